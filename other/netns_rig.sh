@@ -0,0 +1,179 @@
+#!/bin/bash
+# Network namespace rig for end-to-end runs without real game servers: xdpa2scache-emulator and the loader of the
+# build tree run in a namespace behind a veth pair, clients on the host side (xdpa2scache-loadgen, ...) are answered
+# by the XDP program attached to the namespace end. The rig loader gets its own bpffs, run and snapshot directories
+# (under RIG_DIR), an installed instance is not touched. Run as root.
+#
+#   other/netns_rig.sh up                                   Namespace and veth pair only
+#   other/netns_rig.sh start [servers] [emulator options]   Emulator and loader (default 100 servers)
+#   other/netns_rig.sh check                                Cache fill time, freshness and XDP replies (exit code 1 on failure)
+#   other/netns_rig.sh fresh [seconds] [loadgen options]    Freshness benchmark, the emulator started with -c <ms> (default 60 s)
+#   other/netns_rig.sh ctl <command>                        xdpa2scache-ctl against the rig loader (e.g. "stats" for fetcher benchmarks)
+#   other/netns_rig.sh stop                                 Stop the emulator and the loader
+#   other/netns_rig.sh down                                 Stop, then remove the namespace
+#
+# Environment: BUILD (build directory), XDP_MODE (auto, native or skb), FETCH_THREADS (fetcher threads, default 1),
+# MAX_AGE (seconds a cached response may be old in the freshness check, default two query intervals).
+
+set -euo pipefail
+
+NS=${NS:-a2s-rig}
+BUILD=${BUILD:-$(cd "$(dirname "$0")/.." && pwd)/build}
+RIG_DIR=${RIG_DIR:-/tmp/xdpa2scache-rig}
+HOST_IF=veth-gen
+NS_IF=veth-a2s
+HOST_IP=10.200.0.1
+NS_IP=10.200.0.2
+BASE_PORT=27015
+MAX_AGE=${MAX_AGE:-10}
+
+die()
+{
+  echo "ERROR: $*" >&2
+  exit 1
+}
+
+now_ms()
+{
+  echo $(( $(date +%s%N) / 1000000 ))
+}
+
+rig_up()
+{
+  if ip netns list | grep -qw "$NS"; then
+    return 0
+  fi
+
+  ip netns add "$NS"
+  ip link add "$HOST_IF" type veth peer name "$NS_IF" netns "$NS"
+  ip addr add "$HOST_IP/24" dev "$HOST_IF"
+  ip link set "$HOST_IF" up
+  ip -n "$NS" addr add "$NS_IP/24" dev "$NS_IF"
+  ip -n "$NS" link set "$NS_IF" up
+  ip -n "$NS" link set lo up
+
+  # XDP_TX on veth needs NAPI on the peer that receives the replies
+  ethtool -K "$HOST_IF" gro on > /dev/null
+}
+
+rig_start()
+{
+  local servers=${1:-100}
+  shift || true
+
+  [ -x "$BUILD/xdpa2scache" ] && [ -x "$BUILD/xdpa2scache-emulator" ] && [ -f "$BUILD/xdp/xdp.o" ] || die "Build first (make)."
+  [ -f "$RIG_DIR/loader.pid" ] && die "The rig is running, stop it first."
+
+  rig_up
+  mkdir -p "$RIG_DIR/run" "$RIG_DIR/state"
+
+  cat > "$RIG_DIR/config" << EOF
+interface = "$NS_IF";
+xdp_mode = "${XDP_MODE:-auto}";
+server_stats = true;
+servers = ( { ip = "$NS_IP"; ports = "$BASE_PORT-$((BASE_PORT + servers - 1))"; } );
+fetcher = { threads = ${FETCH_THREADS:-1}; };
+EOF
+
+  ip netns exec "$NS" "$BUILD/xdpa2scache-emulator" -b "$NS_IP" -p "$BASE_PORT" -n "$servers" "$@" > "$RIG_DIR/emulator.log" 2>&1 &
+  echo $! > "$RIG_DIR/emulator.pid"
+
+  # Own bpffs (pinned maps), run directory (control and ingestion sockets) and snapshot directory for the rig loader
+  ip netns exec "$NS" sh -c "mount -t bpf bpf /sys/fs/bpf && mkdir -p /run/xdpa2scache /var/lib/xdpa2scache \
+  && mount --bind '$RIG_DIR/run' /run/xdpa2scache && mount --bind '$RIG_DIR/state' /var/lib/xdpa2scache \
+  && exec '$BUILD/xdpa2scache' -c '$RIG_DIR/config' -o '$BUILD/xdp/xdp.o'" > "$RIG_DIR/loader.log" 2>&1 &
+  echo $! > "$RIG_DIR/loader.pid"
+
+  echo "$servers" > "$RIG_DIR/servers"
+  now_ms > "$RIG_DIR/started"
+  echo "Rig started: $servers servers on $NS_IP:$BASE_PORT, logs in $RIG_DIR."
+}
+
+rig_ctl()
+{
+  [ -f "$RIG_DIR/loader.pid" ] || die "The rig is not running."
+  nsenter --target "$(cat "$RIG_DIR/loader.pid")" --mount --net "$BUILD/xdpa2scache-ctl" "$@"
+}
+
+# Servers with their three responses cached
+cached_servers()
+{
+  { rig_ctl list 2> /dev/null || true; } | awk 'NR > 1 && $2 != "-" && $3 != "-" && $4 != "-"' | wc -l
+}
+
+rig_check()
+{
+  local servers filled=0 failed=0
+  servers=$(cat "$RIG_DIR/servers" 2> /dev/null) || die "The rig is not running."
+
+  # Cache fill: every server cached, counted from the start of the loader
+  for _ in $(seq 1 600); do
+    filled=$(cached_servers)
+    [ "$filled" -ge "$servers" ] && break
+    sleep 0.1
+  done
+
+  echo "Cache fill: $filled/$servers servers after $(( $(now_ms) - $(cat "$RIG_DIR/started") )) ms."
+  [ "$filled" -ge "$servers" ] || failed=1
+
+  # Freshness: after a few query cycles, no response older than MAX_AGE
+  sleep $((MAX_AGE + 2))
+  local stale
+  stale=$({ rig_ctl list 2> /dev/null || true; } | awk -v max="$MAX_AGE" 'NR > 1 && ($5 == "-" || $5 + 0 > max)' | wc -l)
+  echo "Freshness: $stale servers with a response older than $MAX_AGE s."
+  [ "$stale" -eq 0 ] || failed=1
+
+  # XDP replies: the challenge flow through the veth pair. The queries of cached servers are answered
+  # or dropped by the XDP program, so every reply comes from it, none may be lost.
+  "$BUILD/xdpa2scache-loadgen" -B "$HOST_IP" -s "$NS_IP:$BASE_PORT" -n "$servers" -c 64 -q info,player,rules -d 3 -w 500 | tee "$RIG_DIR/loadgen.log"
+
+  if ! awk '$1 == "QUERIES" { ok = $3 > 0 && $5 == 0 } END { exit !ok }' "$RIG_DIR/loadgen.log"; then
+    echo "XDP replies: lost queries or no replies."
+    failed=1
+  fi
+
+  [ "$failed" -eq 0 ] && echo "Rig check passed." || echo "Rig check FAILED (logs in $RIG_DIR)."
+  return "$failed"
+}
+
+# Lag from the state changes of the emulator to the XDP replies, each server probed every 100 ms by default
+rig_fresh()
+{
+  local servers duration=${1:-60}
+  shift || true
+  servers=$(cat "$RIG_DIR/servers" 2> /dev/null) || die "The rig is not running."
+  grep -q "state changes every" "$RIG_DIR/emulator.log" || die "Start the emulator with state changes (start <servers> -c <ms>)."
+
+  "$BUILD/xdpa2scache-loadgen" -B "$HOST_IP" -s "$NS_IP:$BASE_PORT" -n "$servers" -c $((servers < 64 ? 64 : servers)) \
+  -r $((servers * 10)) -q info -w 500 -d "$duration" -F "$@" | tee "$RIG_DIR/freshness.log"
+}
+
+rig_stop()
+{
+  for name in loader emulator; do
+    if [ -f "$RIG_DIR/$name.pid" ]; then
+      kill "$(cat "$RIG_DIR/$name.pid")" 2> /dev/null || true
+      rm -f "$RIG_DIR/$name.pid"
+    fi
+  done
+
+  # The loader detaches the program and unpins the maps on exit
+  sleep 1
+}
+
+rig_down()
+{
+  rig_stop
+  ip netns del "$NS" 2> /dev/null || true
+}
+
+case "${1:-}" in
+  up) rig_up ;;
+  start) shift; rig_start "$@" ;;
+  check) rig_check ;;
+  fresh) shift; rig_fresh "$@" ;;
+  ctl) shift; rig_ctl "$@" ;;
+  stop) rig_stop ;;
+  down) rig_down ;;
+  *) sed -n '2,16p' "$0" | cut -c 3-; exit 1 ;;
+esac
\ No newline at end of file
@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "ingest.h"
+#include "a2s_ingest.h"
+
+/**
+* Connect to the ingestion socket of the loader
+*
+* @param path Socket path, or NULL for the default (A2S_INGEST_SOCKET).
+* @return Socket FD on success, or a negative error code on failure.
+*/
+int a2s_ingest_open(const char *path)
+{
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+  if (snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path ? path : A2S_INGEST_SOCKET) >= (int)sizeof(addr.sun_path))
+  {
+    return -ENAMETOOLONG;
+  }
+
+  int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+
+  if (fd < 0)
+  {
+    return -errno;
+  }
+
+  // Connected datagram socket: pushes fail with ECONNREFUSED while the loader is down, reconnect then
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+  {
+    int err = -errno;
+    close(fd);
+    return err;
+  }
+
+  return fd;
+}
+
+/**
+* Push an A2S response of a server to the cache
+*
+* @param fd Socket FD from a2s_ingest_open().
+* @param ip Server IP address (as queried by clients, or the private address for servers behind DNAT).
+* @param port Server port.
+* @param type Query type (A2S_INGEST_INFO, A2S_INGEST_PLAYER or A2S_INGEST_RULES).
+* @param response Full response, starting with the FFFFFFFF connectionless header.
+* @param size Response size (at most A2S_MAX_SIZE, split responses can't be cached).
+* @return 0 on success, or a negative error code on failure.
+*/
+int a2s_ingest_push(int fd, const char *ip, uint16_t port, int type, const void *response, size_t size)
+{
+  struct a2s_ingest_hdr hdr = { .magic = A2S_INGEST_MAGIC, .version = A2S_INGEST_VERSION, .qidx = (__u8)type, .port = htons(port) };
+
+  if (type < 0 || type >= A2S_QUERY_TYPES || size < A2S_MIN_SIZE || size > A2S_MAX_SIZE)
+  {
+    return -EINVAL;
+  }
+
+  if (inet_pton(AF_INET, ip, &hdr.ip) <= 0)
+  {
+    return -EINVAL;
+  }
+
+  struct iovec iov[2] = { { &hdr, sizeof(hdr) }, { (void *)response, size } };
+  struct msghdr msg = { .msg_iov = iov, .msg_iovlen = 2 };
+
+  if (sendmsg(fd, &msg, MSG_NOSIGNAL) < 0)
+  {
+    return -errno;
+  }
+
+  return 0;
+}
+
+/**
+* Close the ingestion socket
+*
+* @param fd Socket FD from a2s_ingest_open().
+*/
+void a2s_ingest_close(int fd)
+{
+  if (fd >= 0)
+  {
+    close(fd);
+  }
+}
\ No newline at end of file
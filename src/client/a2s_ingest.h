@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Client library for the xdpa2scache ingestion socket.
+ * Game server plugins/sidecars push their A2S responses whenever their state changes (map change, player join/leave, ...),
+ * so the cache is fresh right away and the fetcher doesn't need to poll them.
+ *
+ * Example:
+ *   int fd = a2s_ingest_open(NULL);
+ *   a2s_ingest_push(fd, "192.168.0.1", 27015, A2S_INGEST_INFO, info_response, info_size);
+ *   a2s_ingest_close(fd);
+*/
+
+// Query types (same order as the A2S_IDX_* indexes of the loader)
+enum
+{
+  A2S_INGEST_INFO = 0,
+  A2S_INGEST_PLAYER = 1,
+  A2S_INGEST_RULES = 2
+};
+
+int a2s_ingest_open(const char *path);
+int a2s_ingest_push(int fd, const char *ip, uint16_t port, int type, const void *response, size_t size);
+void a2s_ingest_close(int fd);
\ No newline at end of file
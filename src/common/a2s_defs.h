@@ -1,11 +1,13 @@
 #pragma once
 
 #define CONNECTIONLESS_HEADER   0xFFFFFFFF
+#define SPLIT_HEADER            0xFFFFFFFE
 #define A2S_MIN_SIZE            5
 #define A2S_MAX_SIZE            1400
 
 #define A2S_INFO                0x54
 #define S2A_INFO_SRC            0x49
+#define S2A_INFO_DETAILED       0x6D
 #define A2S_PLAYER              0x55
 #define S2A_PLAYER              0x44
 #define A2S_RULES               0x56
@@ -21,14 +23,167 @@
 #define A2S_RULES_REQ           "\xFF\xFF\xFF\xFF\x56\xFF\xFF\xFF\xFF"
 #define A2S_RULES_REQ_SIZE      (sizeof(A2S_RULES_REQ) - 1)
 
-struct a2s_val
+// Indexes of the query types in per query type arrays (rate limits, fetcher queries)
+#define A2S_IDX_INFO            0
+#define A2S_IDX_PLAYER          1
+#define A2S_IDX_RULES           2
+#define A2S_QUERY_TYPES         3
+
+// Size classes of the response store (a2s_store_256/512/1024/1400 array maps): 256, 512, 1024 and A2S_MAX_SIZE bytes
+#define A2S_STORE_CLASSES       4
+#define A2S_STORE_CLASS_SIZE(c) ((c) < A2S_STORE_CLASSES - 1 ? 256U << (c) : A2S_MAX_SIZE)
+
+// Cached response in the response store, value of the per server maps (a2s_info/a2s_player/a2s_rules)
+struct a2s_ref
 {
-  __u64 size;
-  unsigned char data[A2S_MAX_SIZE];
+  __u32 slot;
+  __u16 size;
+  __u8 cls;
+  __u8 reserved;
 };
 
 struct a2s_server_key
 {
   __be32 ip;
   __be16 port;
+};
+
+struct a2s_alias
+{
+  struct a2s_server_key pub;
+  struct a2s_server_key priv;
+};
+
+// Token bucket state, credit is kept in nanoseconds of accumulated time (zeroed state = full bucket)
+struct a2s_bucket
+{
+  __u64 credit;
+  __u64 last;
+};
+
+/*
+ * Shared token bucket (one for all CPUs), kept as the theoretical arrival time of the next token (GCRA):
+ * the bucket is empty when it is more than cap nanoseconds ahead of now (zeroed state = full bucket)
+*/
+struct a2s_shared_bucket
+{
+  __u64 tat;
+};
+
+struct a2s_src_limit
+{
+  struct a2s_bucket bucket[A2S_QUERY_TYPES];
+};
+
+// Token bucket parameters: cost = nanoseconds per token (1e9 / rate), cap = burst * cost, cost 0 = unlimited
+struct a2s_limit
+{
+  __u64 cost;
+  __u64 cap;
+};
+
+// Runtime settings written by the loader into the single entry a2s_settings array map
+struct a2s_settings
+{
+  struct a2s_limit src_limit[A2S_QUERY_TYPES];
+  struct a2s_limit srv_limit;
+  __be32 src_mask;
+  __u8 src_limit_enabled;
+  __u8 srv_limit_enabled;
+  __u8 deny_enabled;
+  __u8 allow_enabled;
+  __u8 trace_enabled;
+  __u8 trace_sources;
+  __u8 trace_servers;
+  __u8 latency_enabled;
+  __u8 srv_stats_enabled;
+  __u32 trace_sample;
+};
+
+// Per server query counters (a2s_srv_stats, per CPU): answered from the cache, dropped as not cached, challenges sent
+#define A2S_SRV_HIT             0
+#define A2S_SRV_MISS            1
+#define A2S_SRV_CHALLENGE       2
+#define A2S_SRV_COUNTERS        3
+
+struct a2s_srv_stats
+{
+  __u64 count[A2S_SRV_COUNTERS][A2S_QUERY_TYPES];
+};
+
+/*
+ * Cookie key rotation state (single entry a2s_cookie_state array map, memory mapped by the loader).
+ * Written field by field with atomic stores, in this order: the new key into the unused slot, the grace deadline
+ * of the previous slot, then the current slot. The XDP program reads the slot first, so a new slot always comes
+ * with its key and deadline.
+*/
+struct a2s_cookie_state
+{
+  __u64 prev_until;
+  __u32 slot;
+  __u32 pad;
+};
+
+// 128-bit SipHash key for cookies (challenges), two slots in a2s_cookie_keys (current and previous)
+struct a2s_cookie_key
+{
+  __u64 k0;
+  __u64 k1;
+};
+
+// LPM trie key for source prefix allow/deny lists
+struct a2s_lpm_key
+{
+  __u32 prefixlen;
+  __be32 ip;
+};
+
+// Decisions of the XDP program reported by the trace events (also the IP ID of the queries in a trace pcap)
+#define A2S_TRACE_DENIED        1
+#define A2S_TRACE_UNKNOWN       2
+#define A2S_TRACE_INVALID       3
+#define A2S_TRACE_RATELIMITED   4
+#define A2S_TRACE_NOT_CACHED    5
+#define A2S_TRACE_CHALLENGE     6
+#define A2S_TRACE_BAD_COOKIE    7
+#define A2S_TRACE_DATA          8
+#define A2S_TRACE_ERROR         9
+
+// Bytes of the query payload kept in a trace event (the A2S queries are at most 29 bytes)
+#define A2S_TRACE_PAYLOAD       32
+
+// Trace event of a query handled by the XDP program, sent through the a2s_trace ring buffer
+struct a2s_trace_event
+{
+  __u64 ts;
+  struct a2s_server_key key;
+  __be32 saddr;
+  __be32 daddr;
+  __be16 sport;
+  __be16 dport;
+  __u16 payload_len;
+  __u16 resp_size;
+  __u32 cookie;
+  __u8 query_type;
+  __u8 decision;
+  __u8 trusted;
+  __u8 captured;
+  __u8 payload[A2S_TRACE_PAYLOAD];
+};
+
+// Paths of a query through the XDP program, for the latency histograms (a2s_latency, A2S_QUERY_TYPES * A2S_LAT_PATHS entries)
+#define A2S_LAT_CHALLENGE       0
+#define A2S_LAT_DATA            1
+#define A2S_LAT_COOKIE_FAIL     2
+#define A2S_LAT_DROP            3
+#define A2S_LAT_PATHS           4
+
+// Log2 buckets of a latency histogram, bucket b counts the packets handled in [2^b, 2^(b+1)) nanoseconds (the last one is open)
+#define A2S_LAT_BUCKETS         32
+
+// Processing latency histogram of a query type and path (per CPU)
+struct a2s_latency
+{
+  __u64 count[A2S_LAT_BUCKETS];
+  __u64 sum_ns;
 };
\ No newline at end of file
@@ -9,7 +9,8 @@
 // The action that indicates it should go onto the next program (default XDP_PASS).
 #define XDP_MULTIPROG_ACTION XDP_PASS
 
-// Use A2S_DEBUG only for debugging purposes and disable in production, A2S_DEBUG will significantly decrease performance!
+// Use A2S_DEBUG only for debugging purposes and disable in production, it prints every fetcher query and response!
+// The decisions of the XDP program are traced at runtime instead, with the 'trace' group of the configuration (see A2S_TRACE_RINGBUF_SIZE).
 //#define A2S_DEBUG
 
 /*
@@ -79,4 +80,124 @@
 *
 * BEWARE: Long caching data may be flagged as spoofed by some master servers (e.g., Steam master server), as far as I know!
 */
-#define A2S_QUERY_TIME_SEC 5
\ No newline at end of file
+#define A2S_QUERY_TIME_SEC 5
+
+/**
+* A2S_COOKIE_ROTATE_SEC - Interval (in seconds) between cookie (challenge) key rotations.
+* A2S_COOKIE_GRACE_SEC - How long (in seconds) cookies created with the previous key are still accepted after a rotation.
+*
+* The key is a random 128-bit SipHash key generated by the loader. Clients use a cookie right after receiving it,
+* so a few seconds of grace window is enough for queries that were in flight during the rotation.
+*
+* The grace window must be shorter than the rotation interval: a rotation writes the next key into the slot of the previous one
+* (a plain map update), which is only safe once the cookies of that slot are no longer accepted.
+*/
+#define A2S_COOKIE_ROTATE_SEC 300
+#define A2S_COOKIE_GRACE_SEC 5
+
+_Static_assert(A2S_COOKIE_GRACE_SEC < A2S_COOKIE_ROTATE_SEC, "A2S_COOKIE_GRACE_SEC must be shorter than A2S_COOKIE_ROTATE_SEC");
+
+/**
+* A2S_PIN_ROOT - bpffs directory where the BPF maps are pinned by name.
+*
+* With 'persistent = true;' in the configuration, the XDP program and the pinned maps stay attached while the loader is stopped,
+* and the next loader instance reuses them (warm restart), instead of starting with an empty cache.
+*/
+#define A2S_PIN_ROOT "/sys/fs/bpf/xdpa2scache"
+
+/**
+* A2S_SNAPSHOT_FILE - File where the fetcher saves the cached responses (periodically and on shutdown).
+* A2S_SNAPSHOT_INTERVAL_SEC - Interval (in seconds) between periodic snapshots.
+* A2S_SNAPSHOT_MAX_AGE_SEC - Snapshot entries older than this (in seconds) are not loaded.
+*
+* On a cold start (e.g. after a reboot), the loader fills the maps from the snapshot before the first fetch cycle,
+* so the cache answers right away. Entries that the fetcher can't refresh afterwards are purged as usual.
+* Comment out A2S_SNAPSHOT_FILE to disable snapshots.
+*/
+#define A2S_SNAPSHOT_FILE "/var/lib/xdpa2scache/cache.snap"
+#define A2S_SNAPSHOT_INTERVAL_SEC 60
+#define A2S_SNAPSHOT_MAX_AGE_SEC 300
+
+/**
+* A2S_BATCH_SIZE - Maximum number of pending cache changes per map before they are committed to the BPF maps.
+* A2S_BATCH_FLUSH_MS - Maximum time (in milliseconds) a cache change stays pending before it is committed.
+*
+* The fetcher collects the changed responses of a query cycle and commits them with one batch syscall per map,
+* instead of one syscall per response. Pending changes are also committed at the start of every query cycle.
+*/
+#define A2S_BATCH_SIZE 256
+#define A2S_BATCH_FLUSH_MS 50
+
+/**
+* A2S_MAP_MIN_ENTRIES - Minimum max_entries of the per server maps (cache, per server rate limits) and of the alias map.
+* A2S_MAP_HEADROOM_PCT - Extra entries (in percent of the configured servers/aliases) for servers added by a reload.
+*
+* The maps are sized from the configuration when the program is loaded, e.g. a "27000-29999" port range gets 3750 entries.
+* A reload that grows past the map size needs a restart (non persistent) to resize the maps.
+*/
+#define A2S_MAP_MIN_ENTRIES 1024
+#define A2S_MAP_HEADROOM_PCT 25
+
+/**
+* A2S_STORE_CLASS_PCT - Slots of each response store size class (256, 512, 1024 and A2S_MAX_SIZE bytes), in percent of the per server map entries.
+*
+* The per server maps only hold a small reference (struct a2s_ref), the responses are stored in the smallest size class they fit in,
+* and spill into a larger class when theirs is full. The default fits a typical mix (A2S_INFO and small A2S_PLAYER in 256 bytes,
+* most A2S_RULES above 1024 bytes) in about 70% of the memory of full size values. The footprint is printed at startup,
+* responses that don't fit anymore are not cached (a warning tells how many). Identical responses of several servers share one slot,
+* so hosts running many servers with the same configuration can lower these.
+*/
+#define A2S_STORE_CLASS_PCT { 150, 60, 60, 120 }
+
+/**
+* A2S_DISCOVERY_INTERVAL_SEC - Default interval (in seconds) between game server socket discovery scans ('discovery' group of the configuration).
+*
+* Each scan lists the bound UDP sockets with NETLINK_SOCK_DIAG (one dump), the owning processes are only looked up in /proc for sockets not seen before.
+*/
+#define A2S_DISCOVERY_INTERVAL_SEC 5
+
+/**
+* A2S_INGEST_FRESH_SEC - How long (in seconds) pushed responses (ingestion socket, see ingest.h) suppress polling.
+*
+* A server whose INFO, PLAYER and RULES responses were all pushed within this window isn't queried by the fetcher.
+* If the pushes stop, polling (and the timeout purge) resumes on its own.
+*/
+#define A2S_INGEST_FRESH_SEC 15
+
+/**
+* A2S_QUERY_TIMEOUT_MS - Time (in milliseconds) the fetcher waits for a response before retransmitting the query.
+* A2S_QUERY_RETRIES - Retransmissions of a query, the timeout doubles with each one (500, 1000, 2000 ms by default).
+* A2S_QUERY_FAIL_LIMIT - Consecutive failed cycles (1-255) of a query type before its cached response is purged.
+*
+* A server that doesn't answer A2S_INFO counts as a failure of all the query types, the other queries are skipped for that cycle.
+* A cycle still retransmitting at the next A2S_QUERY_TIME_SEC tick isn't interrupted, keep the total wait below it.
+*/
+#define A2S_QUERY_TIMEOUT_MS 500
+#define A2S_QUERY_RETRIES 2
+#define A2S_QUERY_FAIL_LIMIT 2
+
+/**
+* A2S_TRACE_RINGBUF_SIZE - Size (in bytes, power of two) of the a2s_trace ring buffer of the XDP trace events.
+* A2S_TRACE_MAX_SERVERS - Maximum number of servers in the 'trace.servers' filter.
+*
+* Trace events are only sent when enabled in the 'trace' group of the configuration (applied on reload), one event per traced query.
+* When the loader can't keep up, the events that don't fit are dropped by the XDP program, the queries are handled as usual.
+*/
+#define A2S_TRACE_RINGBUF_SIZE (1 << 22)
+#define A2S_TRACE_MAX_SERVERS 1024
+
+/**
+* A2S_LATENCY_INTERVAL_SEC - Default interval (in seconds) between the processing latency reports ('latency' group of the configuration).
+*
+* When enabled, the XDP program times each query from the end of the header parse to its verdict (two bpf_ktime_get_ns calls)
+* into per CPU log2 histograms (a2s_latency), by query type and path. The loader prints the percentiles of each interval.
+*/
+#define A2S_LATENCY_INTERVAL_SEC 60
+
+/**
+* A2S_FETCH_MAX_THREADS - Maximum number of fetcher threads ('fetcher' group of the configuration, 1 by default).
+*
+* Each fetcher thread queries its own shard of the servers (by address hash) with its own socket, epoll and timer.
+* With several threads, each one saves its shard into its own snapshot file (A2S_SNAPSHOT_FILE, then A2S_SNAPSHOT_FILE.1, ...).
+*/
+#define A2S_FETCH_MAX_THREADS 64
\ No newline at end of file
@@ -0,0 +1,23 @@
+#pragma once
+
+// Unix stream socket of the loader for the control tool (xdpa2scache-ctl)
+#define A2S_CONTROL_SOCKET      "/run/xdpa2scache/control.sock"
+
+// Maximum length of a command line
+#define A2S_CONTROL_MAX_LINE    128
+
+/*
+ * One command line per connection, answered with text lines until the loader closes the connection (errors start with "ERROR: "):
+ *   servers            One line per server of the fetch set: "ip:port age_info age_player age_rules fail_info fail_player fail_rules source",
+ *                      ages in seconds since the last fetch or push (-1 if never), failed cycles in a row, source "poll" or "push"
+ *   stats              Fetch telemetry since the server was added, one line per fetcher worker:
+ *                      "fetcher id ticks tick_avg_us tick_max_us servers map_changes syscalls_saved" (ticks start the query cycles
+ *                      of the worker's servers, map changes are the cache entries committed, with syscalls saved by the batching),
+ *                      followed by one line per server and query type of the worker:
+ *                      "ip:port type replies rtt_avg_us rtt_p50_us rtt_p99_us rtt_max_us challenges timeouts updates unchanged split oversized send_errors",
+ *                      RTTs from the last (re)transmission to the reply (challenges included), timeouts per request,
+ *                      updates and unchanged (skipped) responses, split (multi packet) and oversized replies, failed sends
+ *   refetch ip:port    Query the server right away instead of waiting for the next cycle
+ *   add ip:port        Add a server to the fetch set, until the next reload
+ *   remove ip:port     Remove a configured server from the fetch set, until the next reload
+*/
\ No newline at end of file
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <linux/types.h>
+
+#include "a2s_defs.h"
+
+// Unix datagram socket of the loader, where game servers (plugins/sidecars) push their own A2S responses
+#define A2S_INGEST_SOCKET       "/run/xdpa2scache/ingest.sock"
+
+// Message identification ("A2SI" in little endian) and format version
+#define A2S_INGEST_MAGIC        0x49533241
+#define A2S_INGEST_VERSION      1
+
+/*
+ * One datagram per response: the header below, followed by the full A2S response exactly as the server would send it
+ * (starting with the FFFFFFFF connectionless header, S2A_INFO_SRC/S2A_PLAYER/S2A_RULES matching qidx), at most A2S_MAX_SIZE bytes.
+*/
+struct a2s_ingest_hdr
+{
+  __u32 magic;
+  __u8 version;
+  __u8 qidx;
+  __be16 port;
+  __be32 ip;
+};
+
+#define A2S_INGEST_MAX_MSG      (sizeof(struct a2s_ingest_hdr) + A2S_MAX_SIZE)
\ No newline at end of file
@@ -0,0 +1,124 @@
+#pragma once
+
+/*
+ * SipHash-1-3 for the fixed 12 byte cookie input (source/destination IP and port).
+ * Shared by the XDP program and userspace, so both compute the exact same cookies.
+ * siphash13() hashes messages of any length, for userspace only (the response store).
+*/
+
+#define SIPHASH_ROTL(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPHASH_ROUND(v0, v1, v2, v3) \
+  do \
+  { \
+    v0 += v1; v1 = SIPHASH_ROTL(v1, 13); v1 ^= v0; v0 = SIPHASH_ROTL(v0, 32); \
+    v2 += v3; v3 = SIPHASH_ROTL(v3, 16); v3 ^= v2; \
+    v0 += v3; v3 = SIPHASH_ROTL(v3, 21); v3 ^= v0; \
+    v2 += v1; v1 = SIPHASH_ROTL(v1, 17); v1 ^= v2; v2 = SIPHASH_ROTL(v2, 32); \
+  } while (0)
+
+/**
+* SipHash-1-3 of a message of any length (userspace only, the loop is not bounded for the verifier).
+*
+* @param k0 First half of the 128-bit key.
+* @param k1 Second half of the 128-bit key.
+* @param data Message.
+* @param len Message length.
+*
+* @return 64-bit keyed hash.
+**/
+static inline __u64 siphash13(__u64 k0, __u64 k1, const void *data, __u64 len)
+{
+  const unsigned char *p = (const unsigned char *)data;
+  __u64 v0 = k0 ^ 0x736f6d6570736575ULL;
+  __u64 v1 = k1 ^ 0x646f72616e646f6dULL;
+  __u64 v2 = k0 ^ 0x6c7967656e657261ULL;
+  __u64 v3 = k1 ^ 0x7465646279746573ULL;
+  __u64 m;
+  __u64 i;
+
+  // Full 8 byte blocks, little endian
+  for (i = 0; i + 8 <= len; i += 8)
+  {
+    m = 0;
+
+    for (int b = 7; b >= 0; b--)
+    {
+      m = (m << 8) | p[i + b];
+    }
+
+    v3 ^= m;
+    SIPHASH_ROUND(v0, v1, v2, v3);
+    v0 ^= m;
+  }
+
+  // Last block: the remaining bytes and the length in the top byte
+  m = (__u64)len << 56;
+
+  for (__u64 b = 0; i + b < len; b++)
+  {
+    m |= (__u64)p[i + b] << (8 * b);
+  }
+
+  v3 ^= m;
+  SIPHASH_ROUND(v0, v1, v2, v3);
+  v0 ^= m;
+
+  v2 ^= 0xff;
+  SIPHASH_ROUND(v0, v1, v2, v3);
+  SIPHASH_ROUND(v0, v1, v2, v3);
+  SIPHASH_ROUND(v0, v1, v2, v3);
+
+  return v0 ^ v1 ^ v2 ^ v3;
+}
+
+/**
+* SipHash-1-3 of a 12 byte message (one full 8 byte block and a final block with 4 bytes and the length).
+*
+* @param k0 First half of the 128-bit key.
+* @param k1 Second half of the 128-bit key.
+* @param saddr Source IP address (network byte order).
+* @param daddr Destination IP address (network byte order).
+* @param sport Source port (network byte order).
+* @param dport Destination port (network byte order).
+*
+* @return 64-bit keyed hash.
+**/
+static __always_inline __u64 siphash13_cookie(__u64 k0, __u64 k1, __u32 saddr, __u32 daddr, __u16 sport, __u16 dport)
+{
+  __u64 v0 = k0 ^ 0x736f6d6570736575ULL;
+  __u64 v1 = k1 ^ 0x646f72616e646f6dULL;
+  __u64 v2 = k0 ^ 0x6c7967656e657261ULL;
+  __u64 v3 = k1 ^ 0x7465646279746573ULL;
+
+  __u64 m = (__u64)saddr | ((__u64)daddr << 32);
+  __u64 b = ((__u64)12 << 56) | (__u64)sport | ((__u64)dport << 16);
+
+  // One compression round per block
+  v3 ^= m;
+  SIPHASH_ROUND(v0, v1, v2, v3);
+  v0 ^= m;
+
+  v3 ^= b;
+  SIPHASH_ROUND(v0, v1, v2, v3);
+  v0 ^= b;
+
+  // Three finalization rounds
+  v2 ^= 0xff;
+  SIPHASH_ROUND(v0, v1, v2, v3);
+  SIPHASH_ROUND(v0, v1, v2, v3);
+  SIPHASH_ROUND(v0, v1, v2, v3);
+
+  return v0 ^ v1 ^ v2 ^ v3;
+}
+
+/**
+* Builds the 32-bit cookie (challenge): the low bit carries the key slot it was created with,
+* so the check only needs to compute one hash, even during the key rotation grace window.
+*
+* @return 32-bit cookie (challenge).
+**/
+static __always_inline __u32 a2s_cookie(__u64 k0, __u64 k1, __u32 slot, __u32 saddr, __u32 daddr, __u16 sport, __u16 dport)
+{
+  return ((__u32)siphash13_cookie(k0, k1, saddr, daddr, sport, dport) & ~1U) | (slot & 1);
+}
\ No newline at end of file
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <stddef.h>
+#include <string.h>
+#include <linux/types.h>
+
+/*
+ * XXH64 (xxHash 64-bit) for change detection of cached responses.
+ * Not a keyed hash: only compare payloads of the same server and query type with it.
+*/
+
+#define XXH64_P1 0x9E3779B185EBCA87ULL
+#define XXH64_P2 0xC2B2AE3D27D4EB4FULL
+#define XXH64_P3 0x165667B19E3779F9ULL
+#define XXH64_P4 0x85EBCA77C2B2AE63ULL
+#define XXH64_P5 0x27D4EB2F165667C5ULL
+
+#define XXH64_ROTL(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+
+static inline __u64 xxh64_read64(const unsigned char *p)
+{
+  __u64 v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline __u32 xxh64_read32(const unsigned char *p)
+{
+  __u32 v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline __u64 xxh64_round(__u64 acc, __u64 input)
+{
+  acc += input * XXH64_P2;
+  acc = XXH64_ROTL(acc, 31);
+  return acc * XXH64_P1;
+}
+
+static inline __u64 xxh64_merge(__u64 acc, __u64 val)
+{
+  acc ^= xxh64_round(0, val);
+  return acc * XXH64_P1 + XXH64_P4;
+}
+
+/**
+* XXH64 of a buffer (little-endian hosts, the hashes are never stored or exchanged).
+*
+* @param data Buffer.
+* @param len Buffer size.
+* @param seed Seed.
+*
+* @return 64-bit hash.
+**/
+static inline __u64 xxh64(const void *data, size_t len, __u64 seed)
+{
+  const unsigned char *p = (const unsigned char *)data;
+  const unsigned char *end = p + len;
+  __u64 h;
+
+  // Four lanes over the 32 byte stripes
+  if (len >= 32)
+  {
+    __u64 v1 = seed + XXH64_P1 + XXH64_P2;
+    __u64 v2 = seed + XXH64_P2;
+    __u64 v3 = seed;
+    __u64 v4 = seed - XXH64_P1;
+
+    do
+    {
+      v1 = xxh64_round(v1, xxh64_read64(p));
+      v2 = xxh64_round(v2, xxh64_read64(p + 8));
+      v3 = xxh64_round(v3, xxh64_read64(p + 16));
+      v4 = xxh64_round(v4, xxh64_read64(p + 24));
+      p += 32;
+    } while (p + 32 <= end);
+
+    h = XXH64_ROTL(v1, 1) + XXH64_ROTL(v2, 7) + XXH64_ROTL(v3, 12) + XXH64_ROTL(v4, 18);
+    h = xxh64_merge(h, v1);
+    h = xxh64_merge(h, v2);
+    h = xxh64_merge(h, v3);
+    h = xxh64_merge(h, v4);
+  }
+  else
+  {
+    h = seed + XXH64_P5;
+  }
+
+  h += (__u64)len;
+
+  // Remaining 8, 4 and 1 byte blocks
+  for (; p + 8 <= end; p += 8)
+  {
+    h ^= xxh64_round(0, xxh64_read64(p));
+    h = XXH64_ROTL(h, 27) * XXH64_P1 + XXH64_P4;
+  }
+
+  if (p + 4 <= end)
+  {
+    h ^= (__u64)xxh64_read32(p) * XXH64_P1;
+    h = XXH64_ROTL(h, 23) * XXH64_P2 + XXH64_P3;
+    p += 4;
+  }
+
+  for (; p < end; p++)
+  {
+    h ^= (*p) * XXH64_P5;
+    h = XXH64_ROTL(h, 11) * XXH64_P1;
+  }
+
+  // Avalanche
+  h ^= h >> 33;
+  h *= XXH64_P2;
+  h ^= h >> 29;
+  h *= XXH64_P3;
+  h ^= h >> 32;
+
+  return h;
+}
\ No newline at end of file
@@ -1,19 +1,44 @@
 #include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
 #include <signal.h>
+#include <stdbool.h>
 #include <pthread.h>
 
+#include "config.h"
 #include "utils/helpers.h"
+#include "utils/snapshot.h"
 
-int main()
+#define CONFIG_FILE "/etc/xdpa2scache/config"
+#define BPF_OBJECT_FILE "/etc/xdpa2scache/xdpa2scache.o"
+
+int main(int argc, char **argv)
 {
+  // Configuration and XDP object of the installation, or others (e.g. a test rig running the build tree)
+  const char *config_file = CONFIG_FILE, *object_file = BPF_OBJECT_FILE;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "c:o:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'c': config_file = optarg; break;
+      case 'o': object_file = optarg; break;
+      default:
+      fprintf(stderr, "Usage: %s [-c <config>] [-o <XDP object>]\n", argv[0]);
+      return 1;
+    }
+  }
+
   // Initialize the loader context structure
-  loader_ctx_t ctx = { .running = true, .ifname = NULL, .prog = NULL };
+  loader_ctx_t ctx = { .running = true, .ifname = NULL, .prog = NULL, .servers_lock = PTHREAD_MUTEX_INITIALIZER };
 
   // Block signals before creating threads so they inherit the mask
   sigset_t sig_set;
   sigemptyset(&sig_set);
   sigaddset(&sig_set, SIGINT);
   sigaddset(&sig_set, SIGTERM);
+  sigaddset(&sig_set, SIGHUP);
 
   if (pthread_sigmask(SIG_BLOCK, &sig_set, NULL) != 0)
   {
@@ -22,48 +47,190 @@ int main()
   }
 
   // Parse the configuration to get the interface name and servers
-  if (!parse_config_file(&ctx, "/etc/xdpa2scache/config"))
+  if (!parse_config_file(&ctx, config_file))
   {
     fprintf(stderr, "FATAL: Configuration parsing failed. Aborting...\n");
     termination_handler(&ctx, 0);
   }
 
-  // Load the BPF object for XDP program
-  if (!(ctx.prog = load_bpf_object("/etc/xdpa2scache/xdpa2scache.o")))
+  // The maps are sized like a fresh load would (load_bpf_object below), with room for the discovered servers
+  int map_servers = ctx.server_count + (ctx.discovery.enabled ? ctx.discovery.max_servers : 0);
+
+  // Persistent mode: reuse the program and the pinned maps of a previous instance (warm restart)
+  bool reuse = false;
+
+  if (ctx.persistent && find_attached_program(ctx.ifindex, false))
   {
-    fprintf(stderr, "FATAL: BPF object initialization failed. Aborting...\n");
+    if (get_pinned_maps(&ctx.xdp_maps) < 0)
+    {
+      fprintf(stderr, "Warning: Attached XDP program found without its pinned maps. Replacing it...\n");
+    }
+    else if (!maps_fit(&ctx.xdp_maps, map_servers, ctx.alias_count))
+    {
+      fprintf(stderr, "Warning: The pinned maps are too small for %d servers and %d aliases. Replacing them...\n", map_servers, ctx.alias_count);
+      close_maps(&ctx.xdp_maps);
+    }
+    else
+    {
+      printf("Warm restart: reusing the attached XDP program and its pinned maps on %s.\n", ctx.ifname);
+      reuse = true;
+    }
+  }
+
+  if (!reuse)
+  {
+    // Start from scratch: take over a leftover instance and drop its maps, they are re-created with the configured sizes
+    if (find_attached_program(ctx.ifindex, true))
+    {
+      printf("Detached a leftover XDP program instance from %s.\n", ctx.ifname);
+    }
+
+    unpin_maps();
+
+    // Load the BPF object for XDP program
+    if (!(ctx.prog = load_bpf_object(object_file, map_servers, ctx.alias_count)))
+    {
+      fprintf(stderr, "FATAL: BPF object initialization failed. Aborting...\n");
+      termination_handler(&ctx, 0);
+    }
+
+    // Attach XDP program to the network interface
+    if (attach_xdp(ctx.prog, ctx.ifindex, 0, ctx.xdp_mode) != 0)
+    {
+      fprintf(stderr, "FATAL: XDP attachment failed. Aborting...\n");
+      termination_handler(&ctx, 0);
+    }
+
+    // Get maps from the xdp program into userspace program
+    if (get_maps(ctx.prog, &ctx.xdp_maps) < 0)
+    {
+      fprintf(stderr, "FATAL: BPF maps initialization failed. Aborting...\n");
+      termination_handler(&ctx, 0);
+    }
+  }
+
+  // The filters, rate limits and cookie key are in place before any cached response can be served
+  // (snapshot below): until then the maps of a cold start are empty and the queries go to the servers.
+  // Populate public -> private address aliases for NAT'd servers
+  if (sync_alias_map(&ctx.xdp_maps, ctx.aliases, ctx.alias_count) < 0)
+  {
+    fprintf(stderr, "FATAL: Alias map initialization failed. Aborting...\n");
     termination_handler(&ctx, 0);
   }
 
-  // Attach XDP program to the network interface
-  if (attach_xdp(ctx.prog, ctx.ifindex, 0) != 0)
+  // Populate the source prefix deny and allow lists
+  if (sync_prefix_map(ctx.xdp_maps.a2s_deny, ctx.deny_prefixes, ctx.deny_count) < 0
+  || sync_prefix_map(ctx.xdp_maps.a2s_allow, ctx.allow_prefixes, ctx.allow_count) < 0)
   {
-    fprintf(stderr, "FATAL: XDP attachment failed. Aborting...\n");
+    fprintf(stderr, "FATAL: Prefix filter maps initialization failed. Aborting...\n");
     termination_handler(&ctx, 0);
   }
 
-  // Get maps from the xdp program into userspace program
-  if (get_maps(ctx.prog, &ctx.xdp_maps) < 0)
+  // Populate the trace filters (source prefixes and servers)
+  if (sync_prefix_map(ctx.xdp_maps.a2s_trace_src, ctx.trace.sources, ctx.trace.source_count) < 0
+  || sync_server_map(ctx.xdp_maps.a2s_trace_srv, ctx.trace.servers, ctx.trace.server_count) < 0)
   {
-    fprintf(stderr, "FATAL: BPF maps initialization failed. Aborting...\n");
+    fprintf(stderr, "FATAL: Trace filter maps initialization failed. Aborting...\n");
     termination_handler(&ctx, 0);
   }
 
-  // Create a query thread for gathering data from the server(s)
-  if (pthread_create(&ctx.query_tid, NULL, a2s_query_servers, &ctx) != 0)
+  // Generate the cookie (challenge) key, or keep the one from the pinned maps
+  if (!init_cookie_keys(&ctx))
   {
-    fprintf(stderr, "FATAL: Query thread creation failed. Aborting...\n");
+    fprintf(stderr, "FATAL: Cookie key initialization failed. Aborting...\n");
     termination_handler(&ctx, 0);
   }
 
-  // Wait for a termination signal synchronously
-  int sig_received;
-  if (sigwait(&sig_set, &sig_received) != 0)
+  // Write the runtime settings (rate limits, filters, tracing) for the XDP program
+  if (update_settings_map(&ctx.xdp_maps, &ctx.settings) < 0)
+  {
+    fprintf(stderr, "FATAL: Settings map initialization failed. Aborting...\n");
+    termination_handler(&ctx, 0);
+  }
+
+  // Slot allocator of the response store, the slots of the responses already cached (warm restart) stay in use
+  if (!store_init(&ctx.store, &ctx.xdp_maps))
   {
-    fprintf(stderr, "FATAL: sigwait failed. Aborting...\n");
+    fprintf(stderr, "FATAL: Response store initialization failed. Aborting...\n");
     termination_handler(&ctx, 0);
   }
 
+  #ifdef A2S_SNAPSHOT_FILE
+  // Cold start: serve the cache saved by the previous instance until the first fetch cycle refreshes it
+  // Each fetcher thread saves its own shard, the files of all the shards are loaded (missing ones are skipped)
+  for (int i = 0; i < A2S_FETCH_MAX_THREADS && !reuse; i++)
+  {
+    char path[256];
+    snapshot_path(path, sizeof(path), A2S_SNAPSHOT_FILE, i);
+
+    int loaded = snapshot_load(&ctx.xdp_maps, &ctx.store, path, A2S_SNAPSHOT_MAX_AGE_SEC);
+
+    if (loaded < 0)
+    {
+      fprintf(stderr, "Warning: Snapshot %s loading failed (code %d). Skipping...\n", path, loaded);
+    }
+  }
+  #endif
+
+  // Find the game server sockets already running on the host before the first fetch cycle
+  if (ctx.discovery.enabled && !discover_servers(&ctx))
+  {
+    fprintf(stderr, "Warning: Initial server discovery failed, retrying in %d seconds...\n", ctx.discovery.interval);
+  }
+
+  // Read the trace events of the XDP program, tracing can be switched on by a reload
+  if (!start_tracer(&ctx))
+  {
+    fprintf(stderr, "Warning: Trace events of the XDP program are unavailable.\n");
+  }
+
+  // Create the fetcher threads for gathering data from the server(s)
+  if (!start_fetchers(&ctx))
+  {
+    fprintf(stderr, "FATAL: Fetcher thread creation failed. Aborting...\n");
+    termination_handler(&ctx, 0);
+  }
+
+  // Answer the control tool (xdpa2scache-ctl), the service keeps running without it
+  if (!start_control(&ctx))
+  {
+    fprintf(stderr, "Warning: The control socket is unavailable.\n");
+  }
+
+  // Wait for a termination signal synchronously, SIGHUP reloads the configuration
+  // Wake up every second for periodic tasks (cookie key rotation, server discovery, latency reports)
+  int sig_received;
+  const struct timespec timeout = { 1, 0 };
+
+  do
+  {
+    if ((sig_received = sigtimedwait(&sig_set, NULL, &timeout)) < 0)
+    {
+      if (errno != EAGAIN && errno != EINTR)
+      {
+        fprintf(stderr, "FATAL: sigtimedwait failed. Aborting...\n");
+        termination_handler(&ctx, 0);
+      }
+
+      rotate_cookie_keys(&ctx);
+
+      if (ctx.discovery.enabled && monotonic_ns() >= ctx.discover_at)
+      {
+        discover_servers(&ctx);
+      }
+
+      report_latency(&ctx);
+
+      continue;
+    }
+
+    if (sig_received == SIGHUP)
+    {
+      printf("Received SIGHUP. Reloading configuration...\n");
+      reload_config(&ctx, config_file);
+    }
+  } while (sig_received < 0 || sig_received == SIGHUP);
+
   // Clean up resources and shut down
   termination_handler(&ctx, sig_received);
 }
\ No newline at end of file
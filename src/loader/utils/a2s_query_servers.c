@@ -1,7 +1,14 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <libgen.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <sys/epoll.h>
 #include <sys/timerfd.h>
 #include <arpa/inet.h>
@@ -11,53 +18,1429 @@
 #include "config.h"
 #include "a2s_defs.h"
 #include "helpers.h"
+#include "snapshot.h"
+#include "addr_index.h"
+#include "ingest.h"
+#include "control.h"
+#include "fetch_io.h"
 
-void *a2s_query_servers(void *arg)
+// Buckets of the RTT histograms, bucket b counts [2^b, 2^(b+1)) microseconds and the last one is open (above 2 seconds)
+#define FETCH_RTT_BUCKETS 22
+
+// Fetch telemetry of a server and query type, always on and read by the "stats" control command.
+// Counted since the server was added to the worker's shard
+typedef struct
+{
+  __u32 rtt[FETCH_RTT_BUCKETS];
+  __u64 rtt_sum_us;
+  __u32 rtt_max_us;
+  __u32 replies;
+  __u32 challenges;
+  __u32 timeouts;
+  __u32 updates;
+  __u32 unchanged;
+  __u32 split;
+  __u32 oversized;
+  __u32 send_errors;
+} fetch_stats_t;
+
+typedef struct
+{
+  // Store slot (size 0 = none) and hash of the last published response of each query type
+  struct a2s_ref refs[A2S_QUERY_TYPES];
+  __u64 resp_hash[A2S_QUERY_TYPES];
+
+  // Position + 1 of the reference update queued in the change set (0 = none), at most one per query type
+  __u32 queued[A2S_QUERY_TYPES];
+
+  // Whether an A2S_INFO response of the server was committed once (counted in the worker's filled servers)
+  bool filled;
+  time_t refreshed[A2S_QUERY_TYPES];
+  time_t pushed_at[A2S_QUERY_TYPES];
+  struct sockaddr_in addr;
+  unsigned char challenge_buf[32];
+  __u64 deadline_ns;
+  __u64 sent_ns;
+  int current_j;
+  __u8 retries;
+  __u8 failures[A2S_QUERY_TYPES];
+  fetch_stats_t stats[A2S_QUERY_TYPES];
+
+  #ifdef A2S_DEBUG
+  char ip_port[24];
+  #endif
+} srv_state_t;
+
+// Cache changes of the current query cycle, committed to the BPF maps in batches
+typedef struct
+{
+  a2s_store_t *store;
+  store_batch_t blobs;
+  struct a2s_server_key *keys[A2S_QUERY_TYPES];
+  struct a2s_ref *refs[A2S_QUERY_TYPES];
+  __u32 count[A2S_QUERY_TYPES];
+
+  // Server and committed reference of each queued update, restored if the update fails (server NULL = cancelled)
+  srv_state_t **srvs[A2S_QUERY_TYPES];
+  struct a2s_ref *old_refs[A2S_QUERY_TYPES];
+  __u64 *old_hash[A2S_QUERY_TYPES];
+  struct a2s_server_key *del_keys[A2S_QUERY_TYPES];
+  __u32 del_count[A2S_QUERY_TYPES];
+  struct a2s_ref *released;
+  __u32 released_count;
+  __u32 store_full;
+  __u64 first_ns;
+  __u32 entries;
+  __u32 syscalls;
+  __u32 filled;
+} change_set_t;
+
+// Deadline of a request in flight, the heap is ordered by the earliest deadline
+typedef struct
+{
+  __u64 deadline_ns;
+  int s;
+} deadline_t;
+
+typedef struct
+{
+  deadline_t *items;
+  int count;
+  int capacity;
+} deadline_heap_t;
+
+static const struct
+{
+  const uint8_t request_data[32];
+  const char *map_name;
+  uint8_t req_size;
+} queries[] =
+{
+  { A2S_INFO_REQ, "A2S_INFO", A2S_INFO_REQ_SIZE },
+  { A2S_PLAYER_REQ, "A2S_PLAYER", A2S_PLAYER_REQ_SIZE },
+  { A2S_RULES_REQ, "A2S_RULES", A2S_RULES_REQ_SIZE }
+};
+
+enum
+{
+  NUM_QUERIES = sizeof(queries) / sizeof(queries[0]),
+  MAX_EVENTS = 64,
+  CONTROL_REPLY_SIZE = 4096
+};
+
+// Socket of a worker, and its io_uring backend when enabled
+typedef struct
+{
+  fetch_worker_t *worker;
+  int sockfd;
+  #ifdef A2S_IO_URING
+  fetch_uring_t *uring;
+  #endif
+} fetch_io_t;
+
+/**
+* Initialize the fetcher state of a newly added server
+*
+* @param srv Pointer to the server state.
+* @param addr Server address.
+*/
+static void init_server_state(srv_state_t *srv, const struct sockaddr_in *addr)
+{
+  memset(srv, 0, sizeof(*srv));
+  srv->addr = *addr;
+
+  // current_j tracks which query is being sent to the server
+  // Initialized to -1 on start to indicate no query has been sent yet
+  // When we first send a query, it will be set to 0
+  srv->current_j = -1;
+
+  #ifdef A2S_DEBUG
+  char ip_str[INET_ADDRSTRLEN];
+  inet_ntop(AF_INET, &srv->addr.sin_addr, ip_str, sizeof(ip_str));
+  snprintf(srv->ip_port, sizeof(srv->ip_port), "%s:%u", ip_str, ntohs(srv->addr.sin_port));
+  #endif
+}
+
+/**
+* Get the fetcher shard (worker) of a server, by a hash of its address
+*
+* @param ip Server IP (network byte order).
+* @param port Server port (network byte order).
+* @param shards Number of shards.
+* @return Shard index.
+*/
+static int shard_of(__be32 ip, __be16 port, int shards)
+{
+  __u64 h = (((__u64)ip << 16) | port) * 0x9E3779B97F4A7C15ULL;
+  return shards > 1 ? (int)((h >> 32) % (__u64)shards) : 0;
+}
+
+/**
+* Sync the fetcher states with the server lists of the loader context (configured and discovered servers, initial load or reload).
+* Only the servers of the worker's shard are kept. Servers that stayed keep their state (and their cache entries),
+* new servers get a fresh state, and the cache entries of removed servers are purged from the BPF maps.
+*
+* @param worker Pointer to the fetcher worker.
+* @param states Current array of server states (may be NULL).
+* @param state_count Pointer to the number of current server states, updated on success.
+* @param map_fds BPF map FDs for each query type.
+* @param index Address -> state index, rebuilt for the new states.
+* @return New array of server states, or NULL on memory allocation failure (current states stay valid).
+*/
+static srv_state_t *sync_servers(fetch_worker_t *worker, srv_state_t *states, int *state_count, const int *map_fds, addr_index_t *index)
+{
+  loader_ctx_t *ctx = worker->ctx;
+  pthread_mutex_lock(&ctx->servers_lock);
+
+  int total = ctx->server_count + ctx->discovered_count, count = 0;
+  srv_state_t *next = calloc(total > 0 ? total : 1, sizeof(srv_state_t));
+  bool *kept = calloc(*state_count > 0 ? *state_count : 1, sizeof(bool));
+  addr_index_t next_index;
+
+  if (!next || !kept || !addr_index_init(&next_index, total))
+  {
+    pthread_mutex_unlock(&ctx->servers_lock);
+    perror("states calloc failed");
+    free(next);
+    free(kept);
+    return NULL;
+  }
+
+  int added = 0;
+
+  // Configured servers first, then the discovered ones that are not configured as well
+  for (int i = 0; i < total; i++)
+  {
+    const struct sockaddr_in *addr = i < ctx->server_count ? &ctx->servers[i] : &ctx->discovered[i - ctx->server_count];
+
+    if (shard_of(addr->sin_addr.s_addr, addr->sin_port, ctx->worker_count) != worker->id)
+    {
+      continue;
+    }
+
+    int dup = addr_index_insert(&next_index, addr->sin_addr.s_addr, addr->sin_port, count);
+
+    if (dup == -ENOMEM)
+    {
+      pthread_mutex_unlock(&ctx->servers_lock);
+      addr_index_free(&next_index);
+      free(next);
+      free(kept);
+      return NULL;
+    }
+
+    if (dup >= 0)
+    {
+      continue;
+    }
+
+    int found = addr_index_find(index, addr->sin_addr.s_addr, addr->sin_port);
+
+    if (found >= 0)
+    {
+      next[count] = states[found];
+      kept[found] = true;
+    }
+    else
+    {
+      init_server_state(&next[count], addr);
+      added++;
+
+      // Per server query counters of the XDP program, only servers with an entry are counted
+      if (!ctx->fetcher.benchmark)
+      {
+        struct a2s_server_key stats_key = {0};
+
+        stats_key.ip = addr->sin_addr.s_addr;
+        stats_key.port = addr->sin_port;
+        add_server_stats(ctx->xdp_maps.a2s_srv_stats, &stats_key);
+      }
+
+      // On the first sync, take over the responses already cached for the server (warm restart or snapshot),
+      // hashed so that unchanged responses are not written again
+      if (!states)
+      {
+        struct a2s_server_key xdp_key = {0};
+        unsigned char data[A2S_MAX_SIZE];
+        int size;
+
+        xdp_key.ip = addr->sin_addr.s_addr;
+        xdp_key.port = addr->sin_port;
+
+        for (size_t k = 0; k < A2S_QUERY_TYPES; k++)
+        {
+          if (bpf_map_lookup_elem(map_fds[k], &xdp_key, &next[count].refs[k]) < 0)
+          {
+            next[count].refs[k].size = 0;
+          }
+          else if (next[count].refs[k].size && (size = store_read(&ctx->store, &next[count].refs[k], data)) >= 0)
+          {
+            next[count].resp_hash[k] = store_hash(&ctx->store, data, (size_t)size);
+          }
+        }
+      }
+    }
+
+    count++;
+  }
+
+  // On the first sync, purge entries left in the (pinned) maps by a previous instance for servers of this shard that are no longer configured
+  if (!states)
+  {
+    for (size_t k = 0; k < A2S_QUERY_TYPES; k++)
+    {
+      struct a2s_server_key key, next_key;
+      int ret = bpf_map_get_next_key(map_fds[k], NULL, &next_key);
+
+      while (ret == 0)
+      {
+        key = next_key;
+        ret = bpf_map_get_next_key(map_fds[k], &key, &next_key);
+
+        struct a2s_ref ref;
+
+        if (shard_of(key.ip, key.port, ctx->worker_count) == worker->id && addr_index_find(&next_index, key.ip, key.port) < 0
+        && bpf_map_lookup_elem(map_fds[k], &key, &ref) == 0 && bpf_map_delete_elem(map_fds[k], &key) == 0)
+        {
+          store_release(&ctx->store, &ref, 1);
+        }
+      }
+    }
+
+    // Same for the per server counters
+    struct a2s_server_key key, next_key;
+    int ret = ctx->fetcher.benchmark ? -ENOENT : bpf_map_get_next_key(ctx->xdp_maps.a2s_srv_stats, NULL, &next_key);
+
+    while (ret == 0)
+    {
+      key = next_key;
+      ret = bpf_map_get_next_key(ctx->xdp_maps.a2s_srv_stats, &key, &next_key);
+
+      if (shard_of(key.ip, key.port, ctx->worker_count) == worker->id && addr_index_find(&next_index, key.ip, key.port) < 0)
+      {
+        bpf_map_delete_elem(ctx->xdp_maps.a2s_srv_stats, &key);
+      }
+    }
+  }
+
+  pthread_mutex_unlock(&ctx->servers_lock);
+
+  // Purge the cache entries of the removed servers
+  int removed = 0;
+
+  for (int s = 0; s < *state_count; s++)
+  {
+    if (kept[s])
+    {
+      continue;
+    }
+
+    struct a2s_server_key xdp_key = {0};
+    xdp_key.ip = states[s].addr.sin_addr.s_addr;
+    xdp_key.port = states[s].addr.sin_port;
+
+    for (size_t k = 0; k < A2S_QUERY_TYPES; k++)
+    {
+      bpf_map_delete_elem(map_fds[k], &xdp_key);
+    }
+
+    if (!ctx->fetcher.benchmark)
+    {
+      bpf_map_delete_elem(ctx->xdp_maps.a2s_srv_stats, &xdp_key);
+    }
+
+    store_release(&ctx->store, states[s].refs, A2S_QUERY_TYPES);
+    removed++;
+  }
+
+  if (states)
+  {
+    printf("Fetcher %d server list synced: %d added, %d removed, %d total.\n", worker->id, added, removed, count);
+  }
+
+  free(kept);
+  free(states);
+  addr_index_free(index);
+  *index = next_index;
+  *state_count = count;
+  return next;
+}
+
+/**
+* Allocate the buffers of a change set
+*
+* @param cs Pointer to the change set.
+* @param store Pointer to the response store.
+* @return true on success, or false on memory allocation failure.
+*/
+static bool init_change_set(change_set_t *cs, a2s_store_t *store)
+{
+  memset(cs, 0, sizeof(*cs));
+  cs->store = store;
+
+  // Each queued update or delete releases at most one slot
+  if (!store_batch_init(&cs->blobs) || !(cs->released = calloc(2 * A2S_QUERY_TYPES * A2S_BATCH_SIZE, sizeof(*cs->released))))
+  {
+    perror("change set calloc failed");
+    return false;
+  }
+
+  for (size_t k = 0; k < A2S_QUERY_TYPES; k++)
+  {
+    if (!(cs->keys[k] = calloc(A2S_BATCH_SIZE, sizeof(*cs->keys[k])))
+    || !(cs->refs[k] = calloc(A2S_BATCH_SIZE, sizeof(*cs->refs[k])))
+    || !(cs->srvs[k] = calloc(A2S_BATCH_SIZE, sizeof(*cs->srvs[k])))
+    || !(cs->old_refs[k] = calloc(A2S_BATCH_SIZE, sizeof(*cs->old_refs[k])))
+    || !(cs->old_hash[k] = calloc(A2S_BATCH_SIZE, sizeof(*cs->old_hash[k])))
+    || !(cs->del_keys[k] = calloc(A2S_BATCH_SIZE, sizeof(*cs->del_keys[k]))))
+    {
+      perror("change set calloc failed");
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/**
+* Free the buffers of a change set
+*
+* @param cs Pointer to the change set.
+*/
+static void free_change_set(change_set_t *cs)
+{
+  for (size_t k = 0; k < A2S_QUERY_TYPES; k++)
+  {
+    free(cs->keys[k]);
+    free(cs->refs[k]);
+    free(cs->srvs[k]);
+    free(cs->old_refs[k]);
+    free(cs->old_hash[k]);
+    free(cs->del_keys[k]);
+  }
+
+  store_batch_free(&cs->blobs);
+  free(cs->released);
+}
+
+/**
+* Settle a queued reference update once committed: on success the previously committed slot is released,
+* on failure the new slot is released and the server keeps its committed reference, so the next cycle retries the update
+*
+* @param cs Pointer to the change set.
+* @param k Query type index.
+* @param n Position of the update.
+* @param ok Whether the per server map holds the new reference.
+*/
+static void settle_update(change_set_t *cs, size_t k, __u32 n, bool ok)
+{
+  srv_state_t *srv = cs->srvs[k][n];
+
+  srv->queued[k] = 0;
+
+  if (ok)
+  {
+    if (k == A2S_IDX_INFO && !srv->filled)
+    {
+      srv->filled = true;
+      cs->filled++;
+    }
+
+    if (cs->old_refs[k][n].size)
+    {
+      cs->released[cs->released_count++] = cs->old_refs[k][n];
+    }
+
+    return;
+  }
+
+  cs->released[cs->released_count++] = cs->refs[k][n];
+  srv->refs[k] = cs->old_refs[k][n];
+  srv->resp_hash[k] = cs->old_hash[k][n];
+}
+
+/**
+* Commit the pending changes to the BPF maps: the new responses into the store first, then the deletes (failed servers)
+* and the updated references, one batch per map. The slots of the replaced and deleted responses are released last.
+* A reference is only committed if its slot was written, and updates that fail are rolled back (see settle_update).
+*
+* @param cs Pointer to the change set.
+* @param map_fds BPF map FDs for each query type.
+*/
+static void flush_changes(change_set_t *cs, const int *map_fds)
+{
+  if (store_batch_flush(cs->store, &cs->blobs, &cs->syscalls) > 0)
+  {
+    fprintf(stderr, "[STORE] Responses whose write failed are not cached, retried on the next cycle.\n");
+  }
+
+  for (size_t k = 0; k < A2S_QUERY_TYPES; k++)
+  {
+    if (cs->del_count[k] > 0)
+    {
+      delete_map_batch(map_fds[k], cs->del_keys[k], cs->del_count[k], sizeof(*cs->del_keys[k]), &cs->syscalls);
+      cs->entries += cs->del_count[k];
+      cs->del_count[k] = 0;
+    }
+  }
+
+  for (size_t k = 0; k < A2S_QUERY_TYPES; k++)
+  {
+    __u32 count = 0;
+
+    // Drop the cancelled updates, and roll back the ones whose slot was not written (never reference unwritten data)
+    for (__u32 n = 0; n < cs->count[k]; n++)
+    {
+      if (!cs->srvs[k][n])
+      {
+        continue;
+      }
+
+      if (!store_written(cs->store, &cs->refs[k][n]))
+      {
+        settle_update(cs, k, n, false);
+        continue;
+      }
+
+      cs->keys[k][count] = cs->keys[k][n];
+      cs->refs[k][count] = cs->refs[k][n];
+      cs->srvs[k][count] = cs->srvs[k][n];
+      cs->old_refs[k][count] = cs->old_refs[k][n];
+      cs->old_hash[k][count] = cs->old_hash[k][n];
+      count++;
+    }
+
+    cs->count[k] = 0;
+
+    if (count == 0)
+    {
+      continue;
+    }
+
+    int ret = update_map_batch(map_fds[k], cs->keys[k], cs->refs[k], count, sizeof(*cs->keys[k]), sizeof(*cs->refs[k]), &cs->syscalls);
+
+    if (ret < (int)count)
+    {
+      fprintf(stderr, "[A2S] BPF map batch update failed for %u of %u entries: %s\n",
+      ret < 0 ? count : count - ret, count, strerror(ret < 0 ? -ret : errno));
+    }
+
+    for (__u32 n = 0; n < count; n++)
+    {
+      // After a partial failure, the map tells which updates went through
+      struct a2s_ref cur;
+      bool ok = ret == (int)count || (bpf_map_lookup_elem(map_fds[k], &cs->keys[k][n], &cur) == 0
+      && cur.slot == cs->refs[k][n].slot && cur.cls == cs->refs[k][n].cls && cur.size == cs->refs[k][n].size);
+
+      settle_update(cs, k, n, ok);
+    }
+
+    cs->entries += count;
+  }
+
+  store_release(cs->store, cs->released, cs->released_count);
+  cs->released_count = 0;
+
+  if (cs->store_full > 0)
+  {
+    fprintf(stderr, "[STORE] %u changed responses not cached, the response store is full (see A2S_STORE_CLASS_PCT).\n", cs->store_full);
+    cs->store_full = 0;
+  }
+
+  cs->first_ns = 0;
+}
+
+/**
+* Check whether a response differs from the last published one of its server and query type (full payload hash)
+*
+* @param st Pointer to the response store (hash key).
+* @param srv Pointer to the server state.
+* @param k Query type index.
+* @param data Response.
+* @param size Response size (at most A2S_MAX_SIZE).
+* @param hash Output hash of the response.
+* @return true if the response changed, or false if it is the same.
+*/
+static bool response_changed(const a2s_store_t *st, const srv_state_t *srv, size_t k, const void *data, size_t size, __u64 *hash)
+{
+  *hash = store_hash(st, data, size);
+  return size != srv->refs[k].size || *hash != srv->resp_hash[k];
+}
+
+/**
+* Queue a changed response: it is interned in the store (written into a free slot unless an identical response of
+* another server already holds one), then the server's reference is pointed to it.
+* The change set is committed when a map buffer is full.
+*
+* @param cs Pointer to the change set.
+* @param map_fds BPF map FDs for each query type.
+* @param srv Pointer to the server state.
+* @param k Query type index.
+* @param data Response to cache.
+* @param size Response size (at most A2S_MAX_SIZE).
+* @param hash Hash of the response (from response_changed).
+* @return true if queued, or false if the store is full.
+*/
+static bool queue_update(change_set_t *cs, const int *map_fds, srv_state_t *srv, size_t k, const void *data, size_t size, __u64 hash)
+{
+  struct a2s_ref ref;
+  bool write;
+
+  if (cs->count[k] >= A2S_BATCH_SIZE || store_batch_full(&cs->blobs))
+  {
+    flush_changes(cs, map_fds);
+  }
+
+  if (!store_intern(cs->store, size, hash, &ref, &write))
+  {
+    cs->store_full++;
+    return false;
+  }
+
+  if (!cs->first_ns)
+  {
+    cs->first_ns = monotonic_ns();
+  }
+
+  if (write)
+  {
+    store_batch_add(&cs->blobs, &ref, data);
+  }
+
+  // A newer response of a server replaces its update still queued, whose slot was never referenced by the map
+  if (srv->queued[k])
+  {
+    __u32 n = srv->queued[k] - 1;
+
+    store_release(cs->store, &cs->refs[k][n], 1);
+    cs->refs[k][n] = ref;
+  }
+  else
+  {
+    // The committed slot is released once the new reference is committed, or kept if the update fails
+    __u32 n = cs->count[k]++;
+    cs->keys[k][n].ip = srv->addr.sin_addr.s_addr;
+    cs->keys[k][n].port = srv->addr.sin_port;
+    cs->refs[k][n] = ref;
+    cs->srvs[k][n] = srv;
+    cs->old_refs[k][n] = srv->refs[k];
+    cs->old_hash[k][n] = srv->resp_hash[k];
+    srv->queued[k] = n + 1;
+  }
+
+  srv->refs[k] = ref;
+  srv->resp_hash[k] = hash;
+  return true;
+}
+
+/**
+* Queue the removal of a cached response of a server
+*
+* @param cs Pointer to the change set.
+* @param map_fds BPF map FDs for each query type.
+* @param srv Pointer to the server state.
+* @param k Query type index.
+*/
+static void queue_delete(change_set_t *cs, const int *map_fds, srv_state_t *srv, size_t k)
+{
+  if (cs->del_count[k] >= A2S_BATCH_SIZE)
+  {
+    flush_changes(cs, map_fds);
+  }
+
+  if (!cs->first_ns)
+  {
+    cs->first_ns = monotonic_ns();
+  }
+
+  struct a2s_server_key *key = &cs->del_keys[k][cs->del_count[k]++];
+  key->ip = srv->addr.sin_addr.s_addr;
+  key->port = srv->addr.sin_port;
+
+  // Cancel a queued update of the server: its slot was never referenced, the committed one is released with the delete
+  struct a2s_ref committed = srv->refs[k];
+
+  if (srv->queued[k])
+  {
+    __u32 n = srv->queued[k] - 1;
+
+    store_release(cs->store, &cs->refs[k][n], 1);
+    committed = cs->old_refs[k][n];
+    cs->srvs[k][n] = NULL;
+    srv->queued[k] = 0;
+  }
+
+  if (committed.size)
+  {
+    cs->released[cs->released_count++] = committed;
+  }
+
+  srv->refs[k].size = 0;
+}
+
+/**
+* Add a request deadline to the heap
+*
+* @param heap Pointer to the deadline heap.
+* @param deadline_ns Deadline (monotonic time in nanoseconds).
+* @param s Server state index.
+* @return true on success, or false on memory allocation failure.
+*/
+static bool deadline_push(deadline_heap_t *heap, __u64 deadline_ns, int s)
+{
+  if (heap->count == heap->capacity)
+  {
+    int capacity = heap->capacity ? heap->capacity * 2 : 64;
+    deadline_t *items = realloc(heap->items, capacity * sizeof(deadline_t));
+
+    if (!items)
+    {
+      perror("deadline heap realloc failed");
+      return false;
+    }
+
+    heap->items = items;
+    heap->capacity = capacity;
+  }
+
+  // Sift up
+  int i = heap->count++;
+
+  while (i > 0 && heap->items[(i - 1) / 2].deadline_ns > deadline_ns)
+  {
+    heap->items[i] = heap->items[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+
+  heap->items[i].deadline_ns = deadline_ns;
+  heap->items[i].s = s;
+  return true;
+}
+
+/**
+* Remove the earliest deadline from the heap (the heap must not be empty)
+*
+* @param heap Pointer to the deadline heap.
+* @return The removed deadline.
+*/
+static deadline_t deadline_pop(deadline_heap_t *heap)
+{
+  deadline_t top = heap->items[0];
+  deadline_t last = heap->items[--heap->count];
+  int i = 0;
+
+  // Sift down
+  for (;;)
+  {
+    int child = 2 * i + 1;
+
+    if (child >= heap->count)
+    {
+      break;
+    }
+
+    if (child + 1 < heap->count && heap->items[child + 1].deadline_ns < heap->items[child].deadline_ns)
+    {
+      child++;
+    }
+
+    if (last.deadline_ns <= heap->items[child].deadline_ns)
+    {
+      break;
+    }
+
+    heap->items[i] = heap->items[child];
+    i = child;
+  }
+
+  if (heap->count > 0)
+  {
+    heap->items[i] = last;
+  }
+
+  return top;
+}
+
+/**
+* Send a request to a server and arm its deadline, the timeout doubles with each retransmission
+*
+* @param io Pointer to the worker's socket and backend.
+* @param srv Pointer to the server state.
+* @param s Server state index.
+* @param deadlines Pointer to the deadline heap.
+* @param data Request to send.
+* @param size Request size.
+* @param what Request description for error messages.
+*/
+static void send_request(fetch_io_t *io, srv_state_t *srv, int s, deadline_heap_t *deadlines, const void *data, size_t size, const char *what)
+{
+  ssize_t sent;
+
+  #ifdef A2S_IO_URING
+  // With io_uring, the request goes out with the next submission, batched with the other sends of this slice
+  if (io->uring && fetch_uring_send(io->uring, data, size, &srv->addr))
+  {
+    sent = (ssize_t)size;
+  }
+  else
+  #endif
+  {
+    sent = sendto(io->sockfd, data, size, MSG_DONTWAIT | MSG_NOSIGNAL, (struct sockaddr *)&srv->addr, sizeof(struct sockaddr_in));
+    io->worker->syscalls++;
+  }
+
+  if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+  {
+    srv->stats[srv->current_j].send_errors++;
+
+    #ifdef A2S_DEBUG
+    fprintf(stderr, "[A2S] %s sendto failed for %s (%s): %s\n", what, srv->ip_port, queries[srv->current_j].map_name, strerror(errno));
+    #else
+    fprintf(stderr, "[A2S] %s sendto failed: %s\n", what, strerror(errno));
+    #endif
+  }
+
+  // A failed send is handled like a lost packet, the deadline retransmits it
+  srv->sent_ns = monotonic_ns();
+  srv->deadline_ns = srv->sent_ns + ((__u64)A2S_QUERY_TIMEOUT_MS << srv->retries) * 1000000ULL;
+  deadline_push(deadlines, srv->deadline_ns, s);
+}
+
+/**
+* Count the round-trip time of a reply (challenge or response) to the last request sent to a server
+*
+* @param srv Pointer to the server state.
+* @param k Query type index.
+* @param now_ns Time the reply was handled (monotonic).
+*/
+static void count_reply(srv_state_t *srv, size_t k, __u64 now_ns)
+{
+  fetch_stats_t *st = &srv->stats[k];
+  __u64 rtt_us = now_ns > srv->sent_ns ? (now_ns - srv->sent_ns) / 1000ULL : 0;
+  int b = 0;
+
+  // Floor of the base 2 logarithm, capped at the last bucket
+  while (rtt_us >> (b + 1) && b < FETCH_RTT_BUCKETS - 1)
+  {
+    b++;
+  }
+
+  st->rtt[b]++;
+  st->rtt_sum_us += rtt_us;
+  st->rtt_max_us = rtt_us > st->rtt_max_us ? (__u32)rtt_us : st->rtt_max_us;
+  st->replies++;
+}
+
+/**
+* Start a query cycle of a server (A2S_INFO first)
+*
+* @param io Pointer to the worker's socket and backend.
+* @param srv Pointer to the server state.
+* @param s Server state index.
+* @param deadlines Pointer to the deadline heap.
+*/
+static void start_cycle(fetch_io_t *io, srv_state_t *srv, int s, deadline_heap_t *deadlines)
+{
+  // Set things to default
+  srv->current_j = 0;
+  srv->retries = 0;
+
+  // Send first query (A2S_INFO)
+  send_request(io, srv, s, deadlines, queries[0].request_data, queries[0].req_size, "query");
+}
+
+/**
+* Count a failed cycle of a query type, the cached response is purged once A2S_QUERY_FAIL_LIMIT consecutive cycles failed
+*
+* @param srv Pointer to the server state.
+* @param k Query type index.
+* @param cs Pointer to the change set.
+* @param map_fds BPF map FDs for each query type.
+*/
+static void count_failure(srv_state_t *srv, size_t k, change_set_t *cs, const int *map_fds)
+{
+  // Purge only once, when the limit is reached
+  if (srv->failures[k] >= A2S_QUERY_FAIL_LIMIT || ++srv->failures[k] < A2S_QUERY_FAIL_LIMIT)
+  {
+    return;
+  }
+
+  queue_delete(cs, map_fds, srv, k);
+  srv->refreshed[k] = 0;
+
+  #ifdef A2S_DEBUG
+  printf("[A2S] %s purged for %s after %d failed cycles.\n", queries[k].map_name, srv->ip_port, A2S_QUERY_FAIL_LIMIT);
+  #endif
+}
+
+/**
+* Handle an expired request deadline: retransmit the query, or give up on it once the retransmissions are exhausted
+*
+* @param io Pointer to the worker's socket and backend.
+* @param srv Pointer to the server state.
+* @param s Server state index.
+* @param deadlines Pointer to the deadline heap.
+* @param cs Pointer to the change set.
+* @param map_fds BPF map FDs for each query type.
+*/
+static void handle_timeout(fetch_io_t *io, srv_state_t *srv, int s, deadline_heap_t *deadlines, change_set_t *cs, const int *map_fds)
+{
+  int j = srv->current_j;
+
+  srv->stats[j].timeouts++;
+
+  // Retransmit the plain query (a lost challenge response is answered with a new challenge)
+  if (srv->retries < A2S_QUERY_RETRIES)
+  {
+    srv->retries++;
+
+    #ifdef A2S_DEBUG
+    printf("[A2S] Server %s timed out on %s. Retransmitting (%d/%d).\n", srv->ip_port, queries[j].map_name, srv->retries, A2S_QUERY_RETRIES);
+    #endif
+
+    send_request(io, srv, s, deadlines, queries[j].request_data, queries[j].req_size, "retransmit");
+    return;
+  }
+
+  #ifdef A2S_DEBUG
+  printf("[A2S] Server %s timed out on %s after %d retransmissions.%s\n", srv->ip_port, queries[j].map_name, A2S_QUERY_RETRIES,
+  j == 0 ? " Skipping other queries." : "");
+  #endif
+
+  srv->deadline_ns = 0;
+  srv->retries = 0;
+
+  // A server that doesn't answer A2S_INFO is considered down, all the query types failed
+  for (int k = j; k < (j == 0 ? NUM_QUERIES : j + 1); k++)
+  {
+    count_failure(srv, k, cs, map_fds);
+  }
+
+  if (j == 0 || ++srv->current_j >= NUM_QUERIES)
+  {
+    srv->current_j = -1;
+    return;
+  }
+
+  // Only this response is missing, continue with the next query
+  send_request(io, srv, s, deadlines, queries[srv->current_j].request_data, queries[srv->current_j].req_size, "next query");
+}
+
+/**
+* Create the ingestion socket, where game servers push their own responses (see ingest.h)
+*
+* @return Socket FD, or -1 on failure (the fetcher then works without ingestion).
+*/
+static int open_ingest_socket(void)
+{
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  char dir[sizeof(addr.sun_path)];
+
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", A2S_INGEST_SOCKET);
+  snprintf(dir, sizeof(dir), "%s", A2S_INGEST_SOCKET);
+
+  // Create the runtime directory, and remove the socket file of a previous instance
+  mkdir(dirname(dir), 0755);
+  unlink(addr.sun_path);
+
+  int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+  if (fd < 0)
+  {
+    perror("[INGEST] socket creation failed");
+    return -1;
+  }
+
+  // Room for bursts of pushes (e.g., a map change on many servers at once)
+  int rcvbuf = 4 * 1024 * 1024;
+  if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) < 0)
+  {
+    perror("[INGEST] SO_RCVBUF failed");
+  }
+
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+  {
+    fprintf(stderr, "[INGEST] bind to %s failed: %s\n", A2S_INGEST_SOCKET, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  // Only root and the socket group (e.g., add the game server user to it) may push
+  chmod(addr.sun_path, 0660);
+
+  printf("Ingestion socket listening on %s.\n", A2S_INGEST_SOCKET);
+  return fd;
+}
+
+/**
+* Read the responses pushed on the ingestion socket (or forwarded by the first worker) and cache them like fetched ones.
+* Pushes for servers of another shard are forwarded to the inbox of their worker.
+*
+* @param worker Pointer to the fetcher worker.
+* @param ingest_fd Ingestion socket or inbox FD.
+* @param states Array of server states.
+* @param index Address -> state index.
+* @param cs Pointer to the change set.
+* @param map_fds BPF map FDs for each query type.
+*/
+static void handle_ingest(const fetch_worker_t *worker, int ingest_fd, srv_state_t *states, const addr_index_t *index, change_set_t *cs, const int *map_fds)
+{
+  static const uint8_t headers[A2S_QUERY_TYPES] = { S2A_INFO_SRC, S2A_PLAYER, S2A_RULES };
+  unsigned char msg[A2S_INGEST_MAX_MSG + 1];
+  struct a2s_ingest_hdr hdr;
+
+  // Drain the socket, with a budget so the fetcher's own work isn't starved
+  for (int budget = 256; budget > 0; budget--)
+  {
+    ssize_t n = recv(ingest_fd, msg, sizeof(msg), MSG_DONTWAIT);
+
+    if (n < 0)
+    {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+      {
+        perror("[INGEST] recv failed");
+      }
+      return;
+    }
+
+    const unsigned char *data = msg + sizeof(hdr);
+    size_t size = (size_t)n - sizeof(hdr);
+    memcpy(&hdr, msg, (size_t)n < sizeof(hdr) ? (size_t)n : sizeof(hdr));
+
+    // Accept only complete responses of the announced type (a datagram above the limit is truncated to one byte more, and rejected)
+    if ((size_t)n < sizeof(hdr) + A2S_MIN_SIZE || (size_t)n > A2S_INGEST_MAX_MSG
+    || hdr.magic != A2S_INGEST_MAGIC || hdr.version != A2S_INGEST_VERSION || hdr.qidx >= A2S_QUERY_TYPES
+    || memcmp(data, "\xFF\xFF\xFF\xFF", 4) != 0 || data[4] != headers[hdr.qidx])
+    {
+      #ifdef A2S_DEBUG
+      printf("[INGEST] Invalid message (%zd bytes). Skipping...\n", n);
+      #endif
+      continue;
+    }
+
+    // The worker of the server's shard caches it
+    int shard = shard_of(hdr.ip, hdr.port, worker->ctx->worker_count);
+
+    if (shard != worker->id)
+    {
+      if (send(worker->ctx->workers[shard].inbox[1], msg, n, MSG_DONTWAIT) < 0)
+      {
+        #ifdef A2S_DEBUG
+        printf("[INGEST] Forwarding to fetcher %d failed: %s\n", shard, strerror(errno));
+        #endif
+      }
+      continue;
+    }
+
+    // Only servers of the fetch set (configured or discovered) can be pushed
+    int s = addr_index_find(index, hdr.ip, hdr.port);
+
+    if (s < 0)
+    {
+      #ifdef A2S_DEBUG
+      char ip_str[INET_ADDRSTRLEN];
+      inet_ntop(AF_INET, &hdr.ip, ip_str, sizeof(ip_str));
+      printf("[INGEST] Push for unknown server %s:%u. Skipping...\n", ip_str, ntohs(hdr.port));
+      #endif
+      continue;
+    }
+
+    srv_state_t *srv = &states[s];
+    time_t now = time(NULL);
+
+    srv->pushed_at[hdr.qidx] = now;
+    srv->refreshed[hdr.qidx] = now;
+    srv->failures[hdr.qidx] = 0;
+
+    __u64 hash;
+
+    if (!response_changed(cs->store, srv, hdr.qidx, data, size, &hash) || !queue_update(cs, map_fds, srv, hdr.qidx, data, size, hash))
+    {
+      continue;
+    }
+
+    #ifdef A2S_DEBUG
+    printf("[INGEST] Map Update queued: type %u | Server: %s | Size: %zu\n", hdr.qidx, srv->ip_port, size);
+    #endif
+  }
+}
+
+/**
+* Send a part of a control reply to the control thread, the reply ends with an empty message
+*
+* @param fd Control socket of the worker.
+* @param data Reply text.
+* @param len Reply length.
+*/
+static void control_reply(int fd, const char *data, size_t len)
+{
+  // Blocking (with a send timeout), the control thread reads the whole reply
+  if (send(fd, data, len, MSG_NOSIGNAL) < 0)
+  {
+    perror("[CONTROL] reply failed");
+  }
+}
+
+/**
+* Append a line to a control reply, the reply is sent in parts of at most CONTROL_REPLY_SIZE bytes
+*
+* @param fd Control socket of the worker.
+* @param out Reply buffer (CONTROL_REPLY_SIZE bytes).
+* @param len Pointer to the length of the reply buffer.
+* @param line Line to append.
+* @param line_len Line length.
+*/
+static void control_append(int fd, char *out, size_t *len, const char *line, int line_len)
 {
-  loader_ctx_t *ctx = (loader_ctx_t *)arg;
+  if (line_len <= 0)
+  {
+    return;
+  }
+
+  if (*len + line_len > CONTROL_REPLY_SIZE)
+  {
+    control_reply(fd, out, *len);
+    *len = 0;
+  }
+
+  memcpy(out + *len, line, line_len);
+  *len += line_len;
+}
+
+/**
+* Estimate a percentile of an RTT histogram (linear interpolation inside the bucket)
+*
+* @param st Pointer to the fetch telemetry.
+* @param pct Percentile (0 to 1).
+* @return Estimated RTT in microseconds, 0 without replies.
+*/
+static __u64 rtt_percentile(const fetch_stats_t *st, double pct)
+{
+  double rank = pct * st->replies;
+  __u64 seen = 0;
+
+  for (int b = 0; b < FETCH_RTT_BUCKETS; b++)
+  {
+    if (!st->rtt[b] || seen + st->rtt[b] < rank)
+    {
+      seen += st->rtt[b];
+      continue;
+    }
+
+    // The last bucket is open, its estimate is capped by the largest RTT
+    double low = b ? (double)(1ULL << b) : 0;
+    double high = b < FETCH_RTT_BUCKETS - 1 ? (double)(1ULL << (b + 1)) : (double)st->rtt_max_us;
+    double est = low + (high - low) * (rank - seen) / st->rtt[b];
+
+    return est < st->rtt_max_us ? (__u64)est : st->rtt_max_us;
+  }
+
+  return 0;
+}
+
+/**
+* Write the fetch telemetry of the worker and of its servers (see the "stats" command in control.h)
+*
+* @param io Pointer to the worker's socket and backend.
+* @param fd Control socket of the worker.
+* @param states Array of server states.
+* @param server_count Number of server states.
+*/
+static void reply_stats(const fetch_io_t *io, int fd, const srv_state_t *states, int server_count)
+{
+  const fetch_worker_t *worker = io->worker;
+  char out[CONTROL_REPLY_SIZE], line[256];
+  size_t len = 0;
+
+  int line_len = snprintf(line, sizeof(line), "fetcher %d %llu %llu %llu %d %llu %llu\n", worker->id, (unsigned long long)worker->ticks,
+  (unsigned long long)(worker->ticks ? worker->tick_ns / worker->ticks / 1000ULL : 0), (unsigned long long)(worker->tick_max_ns / 1000ULL), server_count,
+  (unsigned long long)worker->map_changes, (unsigned long long)worker->syscalls_saved);
+
+  control_append(fd, out, &len, line, line_len);
+
+  for (int s = 0; s < server_count; s++)
+  {
+    char ip_str[INET_ADDRSTRLEN];
+
+    inet_ntop(AF_INET, &states[s].addr.sin_addr, ip_str, sizeof(ip_str));
+
+    for (size_t k = 0; k < A2S_QUERY_TYPES; k++)
+    {
+      const fetch_stats_t *st = &states[s].stats[k];
+
+      line_len = snprintf(line, sizeof(line), "%s:%u %s %u %llu %llu %llu %u %u %u %u %u %u %u %u\n", ip_str, ntohs(states[s].addr.sin_port),
+      queries[k].map_name, st->replies, (unsigned long long)(st->replies ? st->rtt_sum_us / st->replies : 0),
+      (unsigned long long)rtt_percentile(st, 0.5), (unsigned long long)rtt_percentile(st, 0.99), st->rtt_max_us, st->challenges,
+      st->timeouts, st->updates, st->unchanged, st->split, st->oversized, st->send_errors);
+
+      control_append(fd, out, &len, line, line_len);
+    }
+  }
+
+  if (len > 0)
+  {
+    control_reply(fd, out, len);
+  }
+}
+
+/**
+* Handle a control command forwarded by the control thread (see control.h): list the servers of the worker's shard with
+* their age and failures or their fetch telemetry, or start a query cycle of one of them. Servers of other shards are left to their worker.
+*
+* @param io Pointer to the worker's socket and backend.
+* @param fd Control socket of the worker.
+* @param states Array of server states.
+* @param server_count Number of server states.
+* @param index Address -> state index.
+* @param deadlines Pointer to the deadline heap.
+*/
+static void handle_control(fetch_io_t *io, int fd, srv_state_t *states, int server_count, const addr_index_t *index, deadline_heap_t *deadlines)
+{
+  char cmd[A2S_CONTROL_MAX_LINE + 1], out[CONTROL_REPLY_SIZE];
+  ssize_t n = recv(fd, cmd, sizeof(cmd) - 1, MSG_DONTWAIT);
+  size_t len = 0;
+
+  if (n <= 0)
+  {
+    return;
+  }
+
+  cmd[n] = '\0';
+
+  if (strcmp(cmd, "servers") == 0)
+  {
+    time_t now = time(NULL);
+
+    for (int s = 0; s < server_count; s++)
+    {
+      const srv_state_t *srv = &states[s];
+      char ip_str[INET_ADDRSTRLEN], line[160];
+      long age[A2S_QUERY_TYPES];
+      bool pushed = false;
+
+      inet_ntop(AF_INET, &srv->addr.sin_addr, ip_str, sizeof(ip_str));
+
+      for (size_t k = 0; k < A2S_QUERY_TYPES; k++)
+      {
+        age[k] = srv->refreshed[k] ? (long)(now - srv->refreshed[k]) : -1;
+        pushed |= srv->pushed_at[k] && now - srv->pushed_at[k] < A2S_INGEST_FRESH_SEC;
+      }
+
+      int line_len = snprintf(line, sizeof(line), "%s:%u %ld %ld %ld %u %u %u %s\n", ip_str, ntohs(srv->addr.sin_port), age[0], age[1], age[2],
+      srv->failures[0], srv->failures[1], srv->failures[2], pushed ? "push" : "poll");
+
+      control_append(fd, out, &len, line, line_len);
+    }
+  }
+  else if (strcmp(cmd, "stats") == 0)
+  {
+    reply_stats(io, fd, states, server_count);
+  }
+  else if (strncmp(cmd, "refetch ", 8) == 0)
+  {
+    struct sockaddr_in addr;
+    int s;
+
+    if (parse_server_addr(cmd + 8, &addr) && (s = addr_index_find(index, addr.sin_addr.s_addr, addr.sin_port)) >= 0)
+    {
+      // Don't interrupt a cycle in flight, its response is as fresh
+      if (states[s].deadline_ns)
+      {
+        len = snprintf(out, sizeof(out), "OK: %s is being queried (%s).\n", cmd + 8, queries[states[s].current_j].map_name);
+      }
+      else
+      {
+        start_cycle(io, &states[s], s, deadlines);
+        len = snprintf(out, sizeof(out), "OK: %s queried.\n", cmd + 8);
+      }
+    }
+  }
+
+  if (len > 0)
+  {
+    control_reply(fd, out, len);
+  }
+
+  control_reply(fd, "", 0);
+}
+
+#ifdef A2S_SNAPSHOT_FILE
+/**
+* Copy the references of the worker's cached responses into a snapshot job, with the time they were last fetched.
+* Only the references are copied on the fetcher loop: the writer reads the responses back from the response store
+* (so the snapshot holds exactly what is served) and checks them against the copied hashes.
+*
+* @param worker Pointer to the fetcher worker.
+* @param states Array of server states.
+* @param server_count Number of server states.
+* @param job Pointer to the snapshot job (not running).
+* @return true if there is something to save, or false otherwise.
+*/
+static bool collect_snapshot(const fetch_worker_t *worker, const srv_state_t *states, int server_count, snapshot_job_t *job)
+{
+  __u32 needed = (__u32)server_count * A2S_QUERY_TYPES;
+
+  if (needed > job->capacity)
+  {
+    struct a2s_snapshot_entry *entries = realloc(job->entries, needed * sizeof(*entries));
+
+    if (!entries)
+    {
+      perror("snapshot entries realloc failed");
+      return false;
+    }
 
-  const struct
-  {
-    const uint8_t request_data[32];
-    const char *map_name;
-    int map_fd;
-    uint8_t req_size;
-  } queries[] =
+    job->entries = entries;
+    job->capacity = needed;
+  }
+
+  job->count = 0;
+
+  for (int s = 0; s < server_count; s++)
   {
-    { A2S_INFO_REQ, "A2S_INFO", ctx->xdp_maps.a2s_info, A2S_INFO_REQ_SIZE },
-    { A2S_PLAYER_REQ, "A2S_PLAYER", ctx->xdp_maps.a2s_player, A2S_PLAYER_REQ_SIZE },
-    { A2S_RULES_REQ, "A2S_RULES", ctx->xdp_maps.a2s_rules, A2S_RULES_REQ_SIZE }
-  };
+    for (__u32 k = 0; k < A2S_QUERY_TYPES; k++)
+    {
+      // Skip responses that were never fetched by this instance (e.g. entries of a previous snapshot not refreshed yet)
+      if (!states[s].refreshed[k] || !states[s].refs[k].size)
+      {
+        continue;
+      }
+
+      struct a2s_snapshot_entry *e = &job->entries[job->count++];
+      e->key.ip = states[s].addr.sin_addr.s_addr;
+      e->key.port = states[s].addr.sin_port;
+      e->ref = states[s].refs[k];
+      e->hash = states[s].resp_hash[k];
+      e->updated = (__u64)states[s].refreshed[k];
+      e->qidx = k;
+    }
+  }
+
+  job->store = &worker->ctx->store;
+  snapshot_path(job->path, sizeof(job->path), A2S_SNAPSHOT_FILE, worker->id);
+
+  // Keep the previous snapshot if nothing was fetched yet (e.g. stopped right after a cold start)
+  return job->count > 0;
+}
+#endif
+
+/**
+* Wait for the events of the epoll backend: cycle ticks (timerfd), received datagrams (one per socket readiness) and readable watched FDs
+*
+* @param epfd Epoll FD.
+* @param tfd Timer FD.
+* @param sockfd Fetcher socket FD.
+* @param timeout_ms Maximum wait in milliseconds.
+* @param events Output events.
+* @param buffers Receive buffers, one per event.
+* @param syscalls Syscall counter of the worker.
+* @return Number of events, or a negative error code on failure.
+*/
+static int epoll_collect(int epfd, int tfd, int sockfd, int timeout_ms, fetch_event_t *events, unsigned char (*buffers)[A2S_MAX_SIZE], _Atomic __u64 *syscalls)
+{
+  struct epoll_event ready[MAX_EVENTS];
+  int nfds = epoll_wait(epfd, ready, MAX_EVENTS, timeout_ms), count = 0;
 
-  enum
+  (*syscalls)++;
+
+  if (nfds < 0)
   {
-    NUM_QUERIES = sizeof(queries) / sizeof(queries[0]),
-    MAX_EVENTS = 64
-  };
+    return errno == EINTR ? 0 : -errno;
+  }
 
-  typedef struct
+  for (int i = 0; i < nfds; i++)
   {
-    struct a2s_val last_responses[NUM_QUERIES];
-    struct sockaddr_in addr;
-    unsigned char challenge_buf[32];
-    int current_j;
-    bool received_any;
-    bool maps_cleaned_already;
+    fetch_event_t *ev = &events[count];
+    int fd = ready[i].data.fd;
 
-    #ifdef A2S_DEBUG
-    char ip_port[24];
-    #endif
-  } srv_state_t;
+    if (fd == tfd)
+    {
+      uint64_t exp;
+
+      (*syscalls)++;
+
+      if (read(tfd, &exp, sizeof(exp)) < 0)
+      {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+          perror("[TFD] timerfd read failed");
+        }
+        continue;
+      }
+
+      ev->kind = FETCH_EV_TICK;
+    }
+    else if (fd == sockfd)
+    {
+      socklen_t addrlen = sizeof(ev->src);
+      // MSG_TRUNC returns the full length of a datagram above A2S_MAX_SIZE, so it is rejected (and counted) as oversized
+      ssize_t n = recvfrom(sockfd, buffers[count], A2S_MAX_SIZE, MSG_DONTWAIT | MSG_TRUNC, (struct sockaddr *)&ev->src, &addrlen);
+
+      (*syscalls)++;
 
-  int sockfd = -1, epfd = -1, tfd = -1;
+      if (n <= 0)
+      {
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+          perror("[SOCKFD] recvfrom failed");
+        }
+        continue;
+      }
+
+      ev->kind = FETCH_EV_DATAGRAM;
+      ev->data = buffers[count];
+      ev->len = n;
+    }
+    else
+    {
+      ev->kind = FETCH_EV_READABLE;
+    }
+
+    ev->fd = fd;
+    count++;
+  }
+
+  return count;
+}
+
+void *a2s_query_servers(void *arg)
+{
+  fetch_worker_t *worker = (fetch_worker_t *)arg;
+  loader_ctx_t *ctx = worker->ctx;
+
+  const int map_fds[NUM_QUERIES] = { ctx->xdp_maps.a2s_info, ctx->xdp_maps.a2s_player, ctx->xdp_maps.a2s_rules };
+
+  int sockfd = -1, epfd = -1, tfd = -1, ingest_fd = -1;
   srv_state_t *states = NULL;
-  unsigned char recv_buffer[A2S_MAX_SIZE];
-  struct epoll_event events[MAX_EVENTS];
+  addr_index_t index = {0};
+  int server_count = 0;
+  unsigned int servers_gen = ctx->servers_gen;
+  #ifdef A2S_SNAPSHOT_FILE
+  time_t next_snapshot = time(NULL) + A2S_SNAPSHOT_INTERVAL_SEC;
+  snapshot_job_t snapshot = {0};
+  #endif
+  unsigned char (*recv_buffers)[A2S_MAX_SIZE] = NULL;
+  fetch_event_t events[MAX_EVENTS];
+  fetch_io_t io = { .worker = worker, .sockfd = -1 };
+  #ifdef A2S_IO_URING
+  fetch_uring_t uring = {0};
+  #endif
+  change_set_t changes;
+  deadline_heap_t deadlines = {0};
 
-  states = calloc(ctx->server_count, sizeof(srv_state_t));
-  if (!states)
+  if (!init_change_set(&changes, &ctx->store))
+  {
+    goto cleanup;
+  }
+
+  if (!(recv_buffers = calloc(MAX_EVENTS, A2S_MAX_SIZE)))
+  {
+    perror("receive buffers calloc failed");
+    goto cleanup;
+  }
+
+  if (!(states = sync_servers(worker, NULL, &server_count, map_fds, &index)))
   {
-    perror("states calloc failed");
     goto cleanup;
   }
 
@@ -74,156 +1457,264 @@ void *a2s_query_servers(void *arg)
     perror("SO_RCVBUF failed");
   }
 
-  if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0
-  || (tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
-  {
-    perror(epfd < 0 ? "epoll_create1 failed" : "timerfd_create failed");
-    goto cleanup;
-  }
+  io.sockfd = sockfd;
+
+  // Spread the cycle starts of the workers over the interval
+  __u64 offset_ns = (__u64)ctx->fetcher.interval_ms * 1000000ULL * worker->id / ctx->worker_count + 1;
 
-  struct itimerspec ts = {{A2S_QUERY_TIME_SEC, 0}, {0, 1}};
-  if (timerfd_settime(tfd, 0, &ts, NULL) < 0)
+  // Game servers can push their own responses, ingestion is optional (the fetcher keeps polling without it)
+  // The first worker owns the ingestion socket and forwards the pushes of other shards to the inbox of their worker
+  if (worker->id == 0 && !ctx->fetcher.benchmark)
   {
-    perror("timerfd_settime failed");
-    goto cleanup;
+    ingest_fd = open_ingest_socket();
   }
 
-  struct epoll_event ev = {0};
-  ev.events = EPOLLIN;
-
-  if ((ev.data.fd = tfd, epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev) < 0)
-  || (ev.data.fd = sockfd, epoll_ctl(epfd, EPOLL_CTL_ADD, sockfd, &ev) < 0))
+  #ifdef A2S_IO_URING
+  // io_uring backend, the epoll backend stays the fallback (e.g. a kernel without multishot recvmsg)
+  if (ctx->fetcher.io_uring)
   {
-    perror(ev.data.fd == tfd ? "epoll_ctl tfd failed" : "epoll_ctl sockfd failed");
-    goto cleanup;
+    if (fetch_uring_init(&uring, sockfd, (__u64)ctx->fetcher.interval_ms * 1000000ULL, monotonic_ns() + offset_ns))
+    {
+      io.uring = &uring;
+
+      if ((ingest_fd >= 0 && !fetch_uring_watch(&uring, ingest_fd)) || (worker->inbox[0] >= 0 && !fetch_uring_watch(&uring, worker->inbox[0]))
+      || (worker->control[0] >= 0 && !fetch_uring_watch(&uring, worker->control[0])))
+      {
+        fprintf(stderr, "[URING] Watching the ingestion socket, the inbox or the control socket failed.\n");
+      }
+    }
+    else
+    {
+      fprintf(stderr, "Warning: Fetcher %d falls back to epoll.\n", worker->id);
+    }
   }
 
-  for (int i = 0; i < ctx->server_count; i++)
+  if (!io.uring)
+  #endif
   {
-    srv_state_t *srv = &states[i];
-    srv->addr = ctx->servers[i];
+    if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0
+    || (tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+    {
+      perror(epfd < 0 ? "epoll_create1 failed" : "timerfd_create failed");
+      goto cleanup;
+    }
 
-    // current_j tracks which query is being sent to the server
-    // Initialized to -1 on start to indicate no query has been sent yet
-    // When we first send a query, it will be set to 0
-    srv->current_j = -1;
+    struct itimerspec ts =
+    {
+      { ctx->fetcher.interval_ms / 1000, (ctx->fetcher.interval_ms % 1000) * 1000000L },
+      { offset_ns / 1000000000ULL, offset_ns % 1000000000ULL }
+    };
 
-    #ifdef A2S_DEBUG
-    char ip_str[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &srv->addr.sin_addr, ip_str, sizeof(ip_str));
-    snprintf(srv->ip_port, sizeof(srv->ip_port), "%s:%u", ip_str, ntohs(srv->addr.sin_port));
-    #endif
+    if (timerfd_settime(tfd, 0, &ts, NULL) < 0)
+    {
+      perror("timerfd_settime failed");
+      goto cleanup;
+    }
+
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN;
+
+    if ((ev.data.fd = tfd, epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev) < 0)
+    || (ev.data.fd = sockfd, epoll_ctl(epfd, EPOLL_CTL_ADD, sockfd, &ev) < 0))
+    {
+      perror(ev.data.fd == tfd ? "epoll_ctl tfd failed" : "epoll_ctl sockfd failed");
+      goto cleanup;
+    }
+
+    if (ingest_fd >= 0 && (ev.data.fd = ingest_fd, epoll_ctl(epfd, EPOLL_CTL_ADD, ingest_fd, &ev) < 0))
+    {
+      perror("epoll_ctl ingest_fd failed");
+      close(ingest_fd);
+      unlink(A2S_INGEST_SOCKET);
+      ingest_fd = -1;
+    }
+
+    if (worker->inbox[0] >= 0 && (ev.data.fd = worker->inbox[0], epoll_ctl(epfd, EPOLL_CTL_ADD, worker->inbox[0], &ev) < 0))
+    {
+      perror("epoll_ctl inbox failed");
+    }
+
+    if (worker->control[0] >= 0 && (ev.data.fd = worker->control[0], epoll_ctl(epfd, EPOLL_CTL_ADD, worker->control[0], &ev) < 0))
+    {
+      perror("epoll_ctl control failed");
+    }
   }
 
   while (ctx->running)
   {
-    int nfds = epoll_wait(epfd, events, MAX_EVENTS, 1000);
+    // Apply a reloaded server list (SIGHUP), keeping the state and the cache of the servers that stayed
+    // Pending changes are committed first, so no entry of a removed server is written back afterwards
+    if (servers_gen != ctx->servers_gen)
+    {
+      flush_changes(&changes, map_fds);
+      srv_state_t *next = sync_servers(worker, states, &server_count, map_fds, &index);
+
+      if (next)
+      {
+        states = next;
+        servers_gen = ctx->servers_gen;
+
+        // The state indexes changed, re-add the deadlines of the requests in flight
+        deadlines.count = 0;
+
+        for (int s = 0; s < server_count; s++)
+        {
+          if (states[s].deadline_ns)
+          {
+            deadline_push(&deadlines, states[s].deadline_ns, s);
+          }
+        }
+      }
+    }
+
+    // Wake up in time to commit the pending changes within A2S_BATCH_FLUSH_MS, and for the earliest request deadline
+    int wait_ms = 1000;
+    __u64 now_ns = monotonic_ns();
+
+    if (changes.first_ns)
+    {
+      __u64 age_ms = (now_ns - changes.first_ns) / 1000000ULL;
+      wait_ms = age_ms >= A2S_BATCH_FLUSH_MS ? 0 : (int)(A2S_BATCH_FLUSH_MS - age_ms);
+    }
+
+    if (deadlines.count > 0)
+    {
+      __u64 next_ns = deadlines.items[0].deadline_ns;
+      __u64 until_ms = next_ns > now_ns ? (next_ns - now_ns + 999999ULL) / 1000000ULL : 0;
+      wait_ms = until_ms < (__u64)wait_ms ? (int)until_ms : wait_ms;
+    }
 
-    if (nfds < 0 && errno != EINTR)
+    int nev;
+
+    #ifdef A2S_IO_URING
+    if (io.uring)
+    {
+      nev = fetch_uring_wait(io.uring, wait_ms, events, MAX_EVENTS);
+      worker->syscalls += uring.syscalls;
+      uring.syscalls = 0;
+    }
+    else
+    #endif
     {
-      perror("epoll_wait failed");
+      nev = epoll_collect(epfd, tfd, sockfd, wait_ms, events, recv_buffers, &worker->syscalls);
+    }
+
+    if (nev < 0)
+    {
+      fprintf(stderr, "Fetcher %d wait failed: %s\n", worker->id, strerror(-nev));
       break;
     }
 
-    for (int i = 0; i < nfds && ctx->running; i++)
+    for (int i = 0; i < nev && ctx->running; i++)
     {
-      if (events[i].data.fd == tfd)
+      if (events[i].kind == FETCH_EV_TICK)
       {
-        uint64_t exp;
+        __u64 tick_ns = monotonic_ns();
+
+        // A new query cycle starts: commit the changes of the previous one
+        flush_changes(&changes, map_fds);
 
-        if (read(tfd, &exp, sizeof(exp)) < 0)
+        // The store writes of the responses count as syscalls too, so a cycle of few changes can save none
+        worker->syscalls += changes.syscalls;
+        worker->map_changes += changes.entries;
+        worker->filled += changes.filled;
+        changes.filled = 0;
+
+        if (changes.entries > changes.syscalls)
         {
-          if (errno != EAGAIN && errno != EWOULDBLOCK)
-          {
-            perror("[TFD] timerfd read failed");
-          }
-          continue;
+          worker->syscalls_saved += changes.entries - changes.syscalls;
         }
 
-        // Loop over all servers to send queries or handle timeouts
-        for (int s = 0; s < ctx->server_count; s++)
+        changes.entries = 0;
+        changes.syscalls = 0;
+
+        // Loop over all servers to start a new query cycle, timeouts are handled by the request deadlines
+        for (int s = 0; s < server_count; s++)
         {
           srv_state_t *srv = &states[s];
 
-          // If server never responded to the first query (A2S_INFO), then by logic it is timed out
-          if (!srv->received_any && srv->current_j == 0)
-          {
-            #ifdef A2S_DEBUG
-            printf("[A2S] Server %s timed out on %s. Skipping other queries.\n", srv->ip_port, queries[srv->current_j].map_name);
-            #endif
+          // Don't poll servers that push all their responses themselves, polling resumes once a pushed type gets stale
+          time_t oldest_push = srv->pushed_at[0];
 
-            // If maps are not cleaned already we clean
-            if (!srv->maps_cleaned_already)
-            {
-              // Initialize server key and store server IP and port
-              struct a2s_server_key xdp_key = {0};
-              xdp_key.ip = srv->addr.sin_addr.s_addr;
-              xdp_key.port = srv->addr.sin_port;
-
-              for (size_t k = 0; k < NUM_QUERIES; k++)
-              {
-                bpf_map_delete_elem(queries[k].map_fd, &xdp_key);
-                srv->last_responses[k].size = 0;
-              }
-
-              // Set maps as cleaned
-              srv->maps_cleaned_already = true;
-
-              #ifdef A2S_DEBUG
-              printf("[A2S] BPF maps purged for %s due to timeout (performing once).\n", srv->ip_port);
-              #endif
-            }
+          for (size_t k = 1; k < NUM_QUERIES; k++)
+          {
+            oldest_push = srv->pushed_at[k] < oldest_push ? srv->pushed_at[k] : oldest_push;
           }
 
-          // Set things to default
-          srv->current_j = 0;
-          srv->received_any = false;
-
-          // Send first query (A2S_INFO)
-          ssize_t sent = sendto(sockfd, queries[srv->current_j].request_data, queries[srv->current_j].req_size,
-            MSG_DONTWAIT | MSG_NOSIGNAL, (struct sockaddr *)&srv->addr, sizeof(struct sockaddr_in));
+          if (oldest_push && time(NULL) - oldest_push < A2S_INGEST_FRESH_SEC)
+          {
+            continue;
+          }
 
-          if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+          // Don't interrupt a cycle that is still retransmitting
+          if (srv->deadline_ns)
           {
             #ifdef A2S_DEBUG
-            fprintf(stderr, "[A2S] sendto failed for %s (%s): %s\n",
-            srv->ip_port, queries[srv->current_j].map_name, strerror(errno));
-            #else
-            perror("[A2S] sendto failed");
+            printf("[A2S] Server %s is still waiting for %s. Skipping this cycle.\n", srv->ip_port, queries[srv->current_j].map_name);
             #endif
+            continue;
           }
+
+          start_cycle(&io, srv, s, &deadlines);
         }
-      }
-      else if (events[i].data.fd == sockfd)
-      {
-        struct sockaddr_in src_addr;
-        socklen_t addrlen = sizeof(src_addr);
-        ssize_t n = recvfrom(sockfd, recv_buffer, A2S_MAX_SIZE, MSG_DONTWAIT, (struct sockaddr *)&src_addr, &addrlen);
 
-        if (n <= 0)
+        // Commit the changes of the cycle start
+        flush_changes(&changes, map_fds);
+
+        #ifdef A2S_SNAPSHOT_FILE
+        // Periodically save the cache, so a cold start (e.g. after a reboot) can serve it right away.
+        // The file is written by a background thread; a round is skipped while the previous one is still being written.
+        if (!ctx->fetcher.benchmark && time(NULL) >= next_snapshot)
         {
-          if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+          if (!snapshot_job_busy(&snapshot) && collect_snapshot(worker, states, server_count, &snapshot))
           {
-            perror("[SOCKFD] recvfrom failed");
+            snapshot_job_start(&snapshot);
           }
-          continue;
+
+          next_snapshot = time(NULL) + A2S_SNAPSHOT_INTERVAL_SEC;
         }
+        #endif
+
+        // Time spent on the tick (commits, cycle starts and the snapshot copy), the other servers wait for it
+        tick_ns = monotonic_ns() - tick_ns;
+        worker->ticks++;
+        worker->tick_ns += tick_ns;
+        worker->tick_max_ns = tick_ns > worker->tick_max_ns ? tick_ns : worker->tick_max_ns;
+      }
+      else if (events[i].kind == FETCH_EV_READABLE && events[i].fd == worker->control[0])
+      {
+        handle_control(&io, events[i].fd, states, server_count, &index, &deadlines);
+      }
+      else if (events[i].kind == FETCH_EV_READABLE)
+      {
+        handle_ingest(worker, events[i].fd, states, &index, &changes, map_fds);
+      }
+      else if (events[i].data)
+      {
+        const unsigned char *recv_buffer = events[i].data;
+        const struct sockaddr_in src_addr = events[i].src;
+        ssize_t n = events[i].len;
 
         // Find which server this incoming packet belongs to (match by Port and IP)
-        srv_state_t *srv = NULL;
+        int s = addr_index_find(&index, src_addr.sin_addr.s_addr, src_addr.sin_port);
+        srv_state_t *srv = s >= 0 ? &states[s] : NULL;
 
-        for (int s = 0; s < ctx->server_count; s++)
+        // Ignore invalid packets
+        if (!srv || n < A2S_MIN_SIZE || n > A2S_MAX_SIZE || *(uint32_t *)recv_buffer != CONNECTIONLESS_HEADER)
         {
-          if (states[s].addr.sin_port == src_addr.sin_port && states[s].addr.sin_addr.s_addr == src_addr.sin_addr.s_addr)
+          // Split (multi packet) and oversized replies are not supported, count them for the query in flight
+          if (srv && srv->current_j >= 0)
           {
-            srv = &states[s];
-            break;
+            if (n > A2S_MAX_SIZE)
+            {
+              srv->stats[srv->current_j].oversized++;
+            }
+            else if (n >= A2S_MIN_SIZE && *(uint32_t *)recv_buffer == SPLIT_HEADER)
+            {
+              srv->stats[srv->current_j].split++;
+            }
           }
-        }
 
-        // Ignore invalid packets
-        if (!srv || n < A2S_MIN_SIZE || n > A2S_MAX_SIZE || *(uint32_t *)recv_buffer != CONNECTIONLESS_HEADER)
-        {
           #ifdef A2S_DEBUG
           if (!srv)
           {
@@ -234,7 +1725,7 @@ void *a2s_query_servers(void *arg)
             printf("[A2S] %s from %s (%s): Value size: %zd\n", n < A2S_MIN_SIZE ? "Invalid/Short A2S packet" : "A2S packet is above A2S_MAX_SIZE",
             srv->ip_port, queries[srv->current_j].map_name, n);
           }
-          else if (recv_buffer[0] == 0xFE)
+          else if (*(uint32_t *)recv_buffer == SPLIT_HEADER)
           {
             printf("[A2S] Multi Packet/Split Packet from %s (%s). Skipping as we do not support this.\n",
             srv->ip_port, queries[srv->current_j].map_name);
@@ -281,10 +1772,6 @@ void *a2s_query_servers(void *arg)
           continue;
         }
 
-        // Set that we received anything and maps are not cleaned
-        srv->received_any = true;
-        srv->maps_cleaned_already = false;
-
         // Handle challenge if present
         if (header == S2C_CHALLENGE)
         {
@@ -296,6 +1783,9 @@ void *a2s_query_servers(void *arg)
             continue;
           }
 
+          count_reply(srv, step, monotonic_ns());
+          srv->stats[step].challenges++;
+
           #ifdef A2S_DEBUG
           printf("[A2S] Received challenge response from %s (%s) | Hex: %02X %02X %02X %02X\n",
           srv->ip_port, queries[step].map_name, recv_buffer[5], recv_buffer[6], recv_buffer[7], recv_buffer[8]);
@@ -317,93 +1807,250 @@ void *a2s_query_servers(void *arg)
           memcpy(srv->challenge_buf + (is_a2s_info ? 25 : 5), recv_buffer + 5, 4);
 
           // Send the challenge response back to the server
-          ssize_t sent = sendto(sockfd, srv->challenge_buf, is_a2s_info ? 29 : 9,
-            MSG_DONTWAIT | MSG_NOSIGNAL, (struct sockaddr *)&srv->addr, sizeof(struct sockaddr_in));
+          // The retransmission count is kept, so a server that only ever answers with challenges still fails the query
+          send_request(&io, srv, s, &deadlines, srv->challenge_buf, is_a2s_info ? 29 : 9, "challenge");
 
-          if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
-          {
-            #ifdef A2S_DEBUG
-            fprintf(stderr, "[A2S] challenge sendto failed for %s (%s): %s\n",
-            srv->ip_port, queries[step].map_name, strerror(errno));
-            #else
-            perror("[A2S] challenge sendto failed");
-            #endif
-          }
           #ifdef A2S_DEBUG
-          else
-          {
-            printf("[A2S] Sent Challenge response to %s (%s)\n", srv->ip_port, queries[step].map_name);
-          }
+          printf("[A2S] Sent Challenge response to %s (%s)\n", srv->ip_port, queries[step].map_name);
           #endif
           continue;
         }
         // If it is not challenge, continue handling the response
         else
         {
-          // Check if there is data change:
-          // INFO: Small, full compare (n) should be fast enough
-          // PLAYERS: Compare the first 60 bytes. This covers the player count and the first player's score/time, which is enough to trigger update
-          // RULES: Dynamic CVARs like e.g., mp_timeleft, which can point to a data change can be deep (600+ bytes), so we must perform a full compare (n)
-          if (n == srv->last_responses[step].size && memcmp(srv->last_responses[step].data, recv_buffer, step == 1 && n > 60 ? 60 : n) == 0)
+          // The cached response is confirmed as current, whether it changed or not
+          srv->refreshed[step] = time(NULL);
+          srv->failures[step] = 0;
+          srv->retries = 0;
+          worker->responses++;
+          count_reply(srv, step, monotonic_ns());
+
+          // Check if there is data change: hash of the full payload, so a change anywhere (e.g. the score of the last player,
+          // or a deep RULES CVAR like mp_timeleft) is published, without keeping a copy of every response
+          __u64 hash;
+
+          if (!response_changed(&ctx->store, srv, step, recv_buffer, n, &hash))
           {
+            srv->stats[step].unchanged++;
+
             #ifdef A2S_DEBUG
             printf("[A2S] No data change for %s (%s). Skipping BPF update.\n", srv->ip_port, queries[step].map_name);
             #endif
           }
-          else
+          else if (queue_update(&changes, map_fds, srv, step, recv_buffer, n, hash))
           {
-            // Initialize server key and store server IP and port
-            struct a2s_server_key xdp_key = {0};
-            xdp_key.ip = src_addr.sin_addr.s_addr;
-            xdp_key.port = src_addr.sin_port;
+            srv->stats[step].updates++;
 
-            srv->last_responses[step].size = n;
-            memcpy(srv->last_responses[step].data, recv_buffer, n);
-
-            if (bpf_map_update_elem(queries[step].map_fd, &xdp_key, &srv->last_responses[step], BPF_ANY) < 0)
-            {
-              #ifdef A2S_DEBUG
-              fprintf(stderr, "[A2S] BPF map update failed for %s (%s): %s\n", srv->ip_port, queries[step].map_name, strerror(errno));
-              #endif
-            }
             #ifdef A2S_DEBUG
-            else
-            {
-              printf("[A2S] Map Updated: %s | Server: %s | Size: %zd\n", queries[step].map_name, srv->ip_port, n);
-            }
+            printf("[A2S] Map Update queued: %s | Server: %s | Size: %zd\n", queries[step].map_name, srv->ip_port, n);
             #endif
           }
 
-          // Continue to next query
+          // Continue to next query, or end the cycle
           if (++srv->current_j < NUM_QUERIES)
           {
             // Send next A2S query to the server in the sequence
-            ssize_t sent = sendto(sockfd, queries[srv->current_j].request_data, queries[srv->current_j].req_size,
-              MSG_DONTWAIT | MSG_NOSIGNAL, (struct sockaddr *)&srv->addr, sizeof(struct sockaddr_in));
-
-            if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
-            {
-              #ifdef A2S_DEBUG
-              fprintf(stderr, "[A2S] next query sendto failed for %s (%s): %s\n",
-              srv->ip_port, queries[srv->current_j].map_name, strerror(errno));
-              #else
-              perror("[A2S] next query sendto failed");
-              #endif
-            }
+            send_request(&io, srv, s, &deadlines, queries[srv->current_j].request_data, queries[srv->current_j].req_size, "next query");
+          }
+          else
+          {
+            srv->current_j = -1;
+            srv->deadline_ns = 0;
+            worker->cycles++;
           }
         }
       }
     }
+
+    #ifdef A2S_IO_URING
+    // Give the receive buffers of the handled datagrams back to the kernel
+    if (io.uring)
+    {
+      fetch_uring_release(io.uring, events, nev);
+    }
+    #endif
+
+    // Retransmit or give up the requests whose deadline passed
+    now_ns = monotonic_ns();
+
+    while (deadlines.count > 0 && deadlines.items[0].deadline_ns <= now_ns)
+    {
+      deadline_t d = deadline_pop(&deadlines);
+
+      // Skip the deadlines of requests that were answered or sent again since
+      if (d.s < server_count && states[d.s].deadline_ns == d.deadline_ns)
+      {
+        handle_timeout(&io, &states[d.s], d.s, &deadlines, &changes, map_fds);
+      }
+    }
+
+    // Commit the pending changes once the oldest one reached A2S_BATCH_FLUSH_MS
+    if (changes.first_ns && monotonic_ns() - changes.first_ns >= A2S_BATCH_FLUSH_MS * 1000000ULL)
+    {
+      flush_changes(&changes, map_fds);
+    }
   }
 
 cleanup:
+  #ifdef A2S_IO_URING
+  fetch_uring_free(&uring);
+  #endif
+
   if (tfd >= 0) close(tfd);
   if (epfd >= 0) close(epfd);
   if (sockfd >= 0) close(sockfd);
 
+  if (ingest_fd >= 0)
+  {
+    close(ingest_fd);
+    unlink(A2S_INGEST_SOCKET);
+  }
+
+  // Commit what is still pending
+  flush_changes(&changes, map_fds);
+
+  #ifdef A2S_SNAPSHOT_FILE
+  // Save the cache on shutdown for the next start, once the periodic snapshot in progress (if any) is written
+  snapshot_job_free(&snapshot);
+
+  if (states && !ctx->fetcher.benchmark && collect_snapshot(worker, states, server_count, &snapshot))
+  {
+    snapshot_write(snapshot.store, snapshot.path, snapshot.entries, snapshot.count);
+  }
+
+  snapshot_job_free(&snapshot);
+  #endif
+
+  free_change_set(&changes);
+  free(deadlines.items);
+  free(recv_buffers);
+  addr_index_free(&index);
   free(states);
-  printf("Background query thread resources released.\n");
+  printf("Fetcher %d resources released.\n", worker->id);
 
   if (ctx->running) termination_handler(ctx, 0);
   return NULL;
+}
+
+/**
+* Start the fetcher threads (ctx->fetcher.threads), each one pinned to a CPU of ctx->fetcher.cpus (round robin) if set.
+* Each worker has its own unconnected UDP socket rather than a SO_REUSEPORT group: responses return to the socket that sent the query,
+* while SO_REUSEPORT would spread them over the group by address hash, away from the worker that holds the server state.
+*
+* @param ctx Pointer to the loader context.
+* @return true on success, or false on failure (the started workers are stopped by stop_fetchers()).
+*/
+bool start_fetchers(loader_ctx_t *ctx)
+{
+  int count = ctx->fetcher.threads > 0 ? ctx->fetcher.threads : 1;
+
+  if (!(ctx->workers = calloc(count, sizeof(fetch_worker_t))))
+  {
+    perror("fetcher workers calloc failed");
+    return false;
+  }
+
+  ctx->worker_count = count;
+
+  for (int i = 0; i < count; i++)
+  {
+    fetch_worker_t *worker = &ctx->workers[i];
+
+    worker->ctx = ctx;
+    worker->id = i;
+    worker->inbox[0] = worker->inbox[1] = -1;
+    worker->control[0] = worker->control[1] = -1;
+
+    // Inbox for the pushes forwarded by the first worker (ingestion socket owner)
+    if (count > 1 && socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, worker->inbox) < 0)
+    {
+      perror("fetcher inbox socketpair failed");
+      worker->inbox[0] = worker->inbox[1] = -1;
+    }
+
+    // Commands of the control thread (control socket), answered in parts ending with an empty message
+    // The timeouts keep a stuck worker or control thread from blocking the other one
+    struct timeval timeout = { 2, 0 };
+
+    if (!ctx->fetcher.benchmark && (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, worker->control) < 0
+    || setsockopt(worker->control[0], SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0
+    || setsockopt(worker->control[1], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0))
+    {
+      perror("fetcher control socketpair failed");
+
+      if (worker->control[0] >= 0) close(worker->control[0]);
+      if (worker->control[1] >= 0) close(worker->control[1]);
+      worker->control[0] = worker->control[1] = -1;
+    }
+  }
+
+  for (int i = 0; i < count; i++)
+  {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+
+    if (ctx->fetcher.cpu_count > 0)
+    {
+      int cpu = ctx->fetcher.cpus[i % ctx->fetcher.cpu_count];
+      cpu_set_t cpus;
+
+      CPU_ZERO(&cpus);
+
+      if (cpu < CPU_SETSIZE)
+      {
+        CPU_SET(cpu, &cpus);
+
+        if ((errno = pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus)) != 0)
+        {
+          fprintf(stderr, "Warning: Fetcher %d can't be pinned to CPU %d: %s\n", i, cpu, strerror(errno));
+        }
+      }
+    }
+
+    int ret = pthread_create(&ctx->workers[i].tid, &attr, a2s_query_servers, &ctx->workers[i]);
+    pthread_attr_destroy(&attr);
+
+    if (ret != 0)
+    {
+      fprintf(stderr, "ERROR: Fetcher %d thread creation failed: %s\n", i, strerror(ret));
+      return false;
+    }
+  }
+
+  printf("Started %d fetcher thread%s.\n", count, count == 1 ? "" : "s");
+  return true;
+}
+
+/**
+* Stop the fetcher threads: ctx->running must be false. A fetcher that stops the loader on an internal error doesn't wait for itself.
+*
+* @param ctx Pointer to the loader context.
+*/
+void stop_fetchers(loader_ctx_t *ctx)
+{
+  for (int i = 0; i < ctx->worker_count; i++)
+  {
+    fetch_worker_t *worker = &ctx->workers[i];
+
+    if (worker->tid && !pthread_equal(pthread_self(), worker->tid))
+    {
+      pthread_join(worker->tid, NULL);
+    }
+    else if (worker->tid)
+    {
+      printf("Internal shutdown from fetcher %d.\n", i);
+    }
+  }
+
+  for (int i = 0; i < ctx->worker_count; i++)
+  {
+    if (ctx->workers[i].inbox[0] >= 0) close(ctx->workers[i].inbox[0]);
+    if (ctx->workers[i].inbox[1] >= 0) close(ctx->workers[i].inbox[1]);
+    if (ctx->workers[i].control[0] >= 0) close(ctx->workers[i].control[0]);
+    if (ctx->workers[i].control[1] >= 0) close(ctx->workers[i].control[1]);
+  }
+
+  free(ctx->workers);
+  ctx->workers = NULL;
+  ctx->worker_count = 0;
 }
\ No newline at end of file
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "addr_index.h"
+
+/**
+* Build the slot key of an address, the marker bit keeps it nonzero (0 means an empty slot)
+*/
+static inline __u64 addr_key(__be32 ip, __be16 port)
+{
+  return (1ULL << 48) | ((__u64)ip << 16) | port;
+}
+
+/**
+* Fibonacci hashing of a slot key
+*/
+static inline __u32 addr_hash(__u64 key)
+{
+  return (__u32)((key * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+/**
+* Allocate the slots of an index
+*
+* @param idx Pointer to the index.
+* @param slots Number of slots (power of two).
+* @return true on success, or false on memory allocation failure.
+*/
+static bool alloc_slots(addr_index_t *idx, __u32 slots)
+{
+  idx->keys = calloc(slots, sizeof(*idx->keys));
+  idx->values = calloc(slots, sizeof(*idx->values));
+
+  if (!idx->keys || !idx->values)
+  {
+    free(idx->keys);
+    free(idx->values);
+    idx->keys = NULL;
+    idx->values = NULL;
+    return false;
+  }
+
+  idx->mask = slots - 1;
+  idx->count = 0;
+  return true;
+}
+
+/**
+* Place a slot key into an index that has free slots
+*/
+static void place(addr_index_t *idx, __u64 key, int value)
+{
+  __u32 i = addr_hash(key) & idx->mask;
+
+  while (idx->keys[i])
+  {
+    i = (i + 1) & idx->mask;
+  }
+
+  idx->keys[i] = key;
+  idx->values[i] = value;
+  idx->count++;
+}
+
+/**
+* Initialize an index sized for the expected number of addresses (it grows when needed)
+*
+* @param idx Pointer to the index.
+* @param expected Expected number of addresses.
+* @return true on success, or false on memory allocation failure.
+*/
+bool addr_index_init(addr_index_t *idx, __u32 expected)
+{
+  __u32 slots = 16;
+
+  // Keep the load factor at or below 50%
+  while (slots < expected * 2)
+  {
+    slots <<= 1;
+  }
+
+  if (!alloc_slots(idx, slots))
+  {
+    fprintf(stderr, "Memory allocation failed for address index.\n");
+    return false;
+  }
+
+  return true;
+}
+
+/**
+* Free the memory of an index
+*
+* @param idx Pointer to the index.
+*/
+void addr_index_free(addr_index_t *idx)
+{
+  free(idx->keys);
+  free(idx->values);
+  idx->keys = NULL;
+  idx->values = NULL;
+  idx->mask = idx->count = 0;
+}
+
+/**
+* Find the value of an address
+*
+* @param idx Pointer to the index.
+* @param ip IP address (network byte order).
+* @param port Port (network byte order).
+* @return Value of the address, or -1 if it is not in the index.
+*/
+int addr_index_find(const addr_index_t *idx, __be32 ip, __be16 port)
+{
+  if (!idx->keys)
+  {
+    return -1;
+  }
+
+  __u64 key = addr_key(ip, port);
+
+  for (__u32 i = addr_hash(key) & idx->mask; idx->keys[i]; i = (i + 1) & idx->mask)
+  {
+    if (idx->keys[i] == key)
+    {
+      return idx->values[i];
+    }
+  }
+
+  return -1;
+}
+
+/**
+* Insert an address, unless it is already in the index
+*
+* @param idx Pointer to the index.
+* @param ip IP address (network byte order).
+* @param port Port (network byte order).
+* @param value Value to store (>= 0).
+* @return Value of the existing entry for a duplicate, -1 if inserted, or -ENOMEM on memory allocation failure.
+*/
+int addr_index_insert(addr_index_t *idx, __be32 ip, __be16 port, int value)
+{
+  int existing = addr_index_find(idx, ip, port);
+
+  if (existing >= 0)
+  {
+    return existing;
+  }
+
+  // Grow (double) once the load factor would exceed 50% (an index that was never initialized has no slots yet)
+  if (!idx->keys || (idx->count + 1) * 2 > idx->mask + 1)
+  {
+    addr_index_t grown;
+
+    if (!alloc_slots(&grown, (idx->mask + 1) * 2))
+    {
+      fprintf(stderr, "Memory allocation failed for address index.\n");
+      return -ENOMEM;
+    }
+
+    for (__u32 i = 0; idx->keys && i <= idx->mask; i++)
+    {
+      if (idx->keys[i])
+      {
+        place(&grown, idx->keys[i], idx->values[i]);
+      }
+    }
+
+    addr_index_free(idx);
+    *idx = grown;
+  }
+
+  place(idx, addr_key(ip, port), value);
+  return -1;
+}
\ No newline at end of file
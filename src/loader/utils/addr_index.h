@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdbool.h>
+#include <linux/types.h>
+
+// Open addressing hash table mapping a server address (IP and port) to an array index
+typedef struct
+{
+  __u64 *keys;
+  int *values;
+  __u32 mask;
+  __u32 count;
+} addr_index_t;
+
+bool addr_index_init(addr_index_t *idx, __u32 expected);
+void addr_index_free(addr_index_t *idx);
+int addr_index_find(const addr_index_t *idx, __be32 ip, __be16 port);
+int addr_index_insert(addr_index_t *idx, __be32 ip, __be16 port, int value);
\ No newline at end of file
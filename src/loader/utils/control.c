@@ -0,0 +1,407 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <poll.h>
+#include <libgen.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+
+#include "config.h"
+#include "helpers.h"
+#include "control.h"
+
+/**
+* Parse a server address ("ip:port")
+*
+* @param str Server address string.
+* @param addr Pointer to store the address.
+* @return true on success, or false if the string is not a valid server address.
+*/
+bool parse_server_addr(const char *str, struct sockaddr_in *addr)
+{
+  const char *colon = strrchr(str, ':');
+  char ip_str[INET_ADDRSTRLEN], *end;
+
+  if (!colon || (size_t)(colon - str) >= sizeof(ip_str))
+  {
+    return false;
+  }
+
+  memcpy(ip_str, str, colon - str);
+  ip_str[colon - str] = '\0';
+
+  long port = strtol(colon + 1, &end, 10);
+
+  memset(addr, 0, sizeof(*addr));
+  addr->sin_family = AF_INET;
+  addr->sin_port = htons((uint16_t)port);
+
+  return *end == '\0' && port >= 1 && port <= 65535 && inet_pton(AF_INET, ip_str, &addr->sin_addr) == 1;
+}
+
+/**
+* Write a formatted reply to a control client
+*
+* @param fd Client socket.
+* @param fmt Format string.
+*/
+static void reply(int fd, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void reply(int fd, const char *fmt, ...)
+{
+  char buf[512];
+  va_list args;
+
+  va_start(args, fmt);
+  int len = vsnprintf(buf, sizeof(buf), fmt, args);
+  va_end(args);
+
+  if (len > 0 && send(fd, buf, (size_t)len < sizeof(buf) ? (size_t)len : sizeof(buf) - 1, MSG_NOSIGNAL) < 0)
+  {
+    perror("[CONTROL] send failed");
+  }
+}
+
+/**
+* Forward a command to every fetcher worker and copy their replies to the client
+*
+* @param ctx Pointer to the loader context.
+* @param cmd Command line.
+* @param client_fd Client socket.
+* @return Number of reply bytes sent by the workers.
+*/
+static size_t ask_workers(loader_ctx_t *ctx, const char *cmd, int client_fd)
+{
+  char buf[4096];
+  size_t total = 0;
+
+  for (int i = 0; i < ctx->worker_count; i++)
+  {
+    int fd = ctx->workers[i].control[1];
+
+    if (fd < 0)
+    {
+      continue;
+    }
+
+    // Drop what is left of a reply that timed out
+    while (recv(fd, buf, sizeof(buf), MSG_DONTWAIT) > 0);
+
+    if (send(fd, cmd, strlen(cmd), MSG_NOSIGNAL) < 0)
+    {
+      fprintf(stderr, "[CONTROL] Forwarding to fetcher %d failed: %s\n", i, strerror(errno));
+      continue;
+    }
+
+    // Parts of the reply until the empty message (or the receive timeout)
+    ssize_t n;
+
+    while ((n = recv(fd, buf, sizeof(buf), 0)) > 0)
+    {
+      if (send(client_fd, buf, n, MSG_NOSIGNAL) < 0)
+      {
+        break;
+      }
+
+      total += n;
+    }
+
+    if (n < 0)
+    {
+      fprintf(stderr, "[CONTROL] No reply from fetcher %d: %s\n", i, strerror(errno));
+    }
+  }
+
+  return total;
+}
+
+/**
+* Find a server in a server list
+*
+* @param list Server list.
+* @param count Number of servers.
+* @param addr Server address.
+* @return Index of the server, or -1 if not listed.
+*/
+static int find_server(const struct sockaddr_in *list, int count, const struct sockaddr_in *addr)
+{
+  for (int i = 0; i < count; i++)
+  {
+    if (list[i].sin_addr.s_addr == addr->sin_addr.s_addr && list[i].sin_port == addr->sin_port)
+    {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+/**
+* Add a server to the configured servers, the fetchers pick it up by the generation change
+*
+* @param ctx Pointer to the loader context.
+* @param addr Server address.
+* @param name Server address string.
+* @param client_fd Client socket.
+*/
+static void add_server(loader_ctx_t *ctx, const struct sockaddr_in *addr, const char *name, int client_fd)
+{
+  __u32 max_entries = map_max_entries(ctx->xdp_maps.a2s_info);
+
+  pthread_mutex_lock(&ctx->servers_lock);
+
+  if (find_server(ctx->servers, ctx->server_count, addr) >= 0 || find_server(ctx->discovered, ctx->discovered_count, addr) >= 0)
+  {
+    pthread_mutex_unlock(&ctx->servers_lock);
+    reply(client_fd, "ERROR: %s is already in the fetch set.\n", name);
+    return;
+  }
+
+  // The maps are sized when the program is loaded
+  if (max_entries && (__u32)(ctx->server_count + ctx->discovered_count) >= max_entries)
+  {
+    pthread_mutex_unlock(&ctx->servers_lock);
+    reply(client_fd, "ERROR: The maps are full (%u servers), restart the service (non persistent) to resize them.\n", max_entries);
+    return;
+  }
+
+  struct sockaddr_in *temp = realloc(ctx->servers, (ctx->server_count + 1) * sizeof(*temp));
+
+  if (!temp)
+  {
+    pthread_mutex_unlock(&ctx->servers_lock);
+    reply(client_fd, "ERROR: Memory allocation failed.\n");
+    return;
+  }
+
+  ctx->servers = temp;
+  ctx->servers[ctx->server_count++] = *addr;
+  ctx->servers_gen++;
+
+  pthread_mutex_unlock(&ctx->servers_lock);
+
+  printf("[CONTROL] Server %s added (until the next reload).\n", name);
+  reply(client_fd, "OK: %s added, until the next reload.\n", name);
+}
+
+/**
+* Remove a server from the configured servers, the fetchers purge its cache entries by the generation change
+*
+* @param ctx Pointer to the loader context.
+* @param addr Server address.
+* @param name Server address string.
+* @param client_fd Client socket.
+*/
+static void remove_server(loader_ctx_t *ctx, const struct sockaddr_in *addr, const char *name, int client_fd)
+{
+  pthread_mutex_lock(&ctx->servers_lock);
+
+  int i = find_server(ctx->servers, ctx->server_count, addr);
+
+  if (i < 0)
+  {
+    bool discovered = find_server(ctx->discovered, ctx->discovered_count, addr) >= 0;
+
+    pthread_mutex_unlock(&ctx->servers_lock);
+    reply(client_fd, discovered ? "ERROR: %s is a discovered server, change the 'discovery' settings instead.\n" : "ERROR: Unknown server %s.\n", name);
+    return;
+  }
+
+  memmove(&ctx->servers[i], &ctx->servers[i + 1], (ctx->server_count - i - 1) * sizeof(*ctx->servers));
+  ctx->server_count--;
+  ctx->servers_gen++;
+
+  pthread_mutex_unlock(&ctx->servers_lock);
+
+  printf("[CONTROL] Server %s removed (until the next reload).\n", name);
+  reply(client_fd, "OK: %s removed, until the next reload.\n", name);
+}
+
+/**
+* Read and run the command of a control client (see control.h)
+*
+* @param ctx Pointer to the loader context.
+* @param client_fd Client socket.
+*/
+static void handle_client(loader_ctx_t *ctx, int client_fd)
+{
+  char cmd[A2S_CONTROL_MAX_LINE + 1];
+  size_t len = 0;
+  ssize_t n;
+
+  // One line, the receive timeout keeps a silent client from blocking the thread
+  while (len < sizeof(cmd) - 1 && (n = recv(client_fd, cmd + len, sizeof(cmd) - 1 - len, 0)) > 0)
+  {
+    len += n;
+
+    if (memchr(cmd, '\n', len))
+    {
+      break;
+    }
+  }
+
+  cmd[len] = '\0';
+  cmd[strcspn(cmd, "\r\n")] = '\0';
+
+  char *arg = strchr(cmd, ' ');
+  struct sockaddr_in addr;
+
+  if (arg)
+  {
+    *arg++ = '\0';
+  }
+
+  if (strcmp(cmd, "servers") == 0 || strcmp(cmd, "stats") == 0)
+  {
+    ask_workers(ctx, cmd, client_fd);
+  }
+  else if ((strcmp(cmd, "refetch") == 0 || strcmp(cmd, "add") == 0 || strcmp(cmd, "remove") == 0) && (!arg || !parse_server_addr(arg, &addr)))
+  {
+    reply(client_fd, "ERROR: Invalid server address, expected ip:port.\n");
+  }
+  else if (strcmp(cmd, "refetch") == 0)
+  {
+    char fwd[A2S_CONTROL_MAX_LINE + 1];
+
+    snprintf(fwd, sizeof(fwd), "refetch %s", arg);
+
+    // Only the worker of the server's shard answers
+    if (ask_workers(ctx, fwd, client_fd) == 0)
+    {
+      reply(client_fd, "ERROR: Unknown server %s.\n", arg);
+    }
+  }
+  else if (strcmp(cmd, "add") == 0)
+  {
+    add_server(ctx, &addr, arg, client_fd);
+  }
+  else if (strcmp(cmd, "remove") == 0)
+  {
+    remove_server(ctx, &addr, arg, client_fd);
+  }
+  else
+  {
+    reply(client_fd, "ERROR: Unknown command '%s' (servers, stats, refetch, add, remove).\n", cmd);
+  }
+}
+
+/**
+* Create the control socket (see control.h)
+*
+* @return Socket FD, or -1 on failure.
+*/
+static int open_control_socket(void)
+{
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  char dir[sizeof(addr.sun_path)];
+
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", A2S_CONTROL_SOCKET);
+  snprintf(dir, sizeof(dir), "%s", A2S_CONTROL_SOCKET);
+
+  // Create the runtime directory, and remove the socket file of a previous instance
+  mkdir(dirname(dir), 0755);
+  unlink(addr.sun_path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+  if (fd < 0)
+  {
+    perror("[CONTROL] socket creation failed");
+    return -1;
+  }
+
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0)
+  {
+    fprintf(stderr, "[CONTROL] bind to %s failed: %s\n", A2S_CONTROL_SOCKET, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  // Only root and the socket group may control the loader
+  chmod(addr.sun_path, 0660);
+
+  printf("Control socket listening on %s.\n", A2S_CONTROL_SOCKET);
+  return fd;
+}
+
+/**
+* Control thread: answers the commands of the control socket one client at a time until the loader stops
+*
+* @param arg Pointer to the loader context.
+* @return NULL.
+*/
+static void *serve_control(void *arg)
+{
+  loader_ctx_t *ctx = arg;
+  int fd = open_control_socket();
+
+  while (fd >= 0 && ctx->running)
+  {
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+    if (poll(&pfd, 1, 200) <= 0)
+    {
+      continue;
+    }
+
+    int client_fd = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+
+    if (client_fd < 0)
+    {
+      continue;
+    }
+
+    struct timeval timeout = { 1, 0 };
+    setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    handle_client(ctx, client_fd);
+    close(client_fd);
+  }
+
+  if (fd >= 0)
+  {
+    close(fd);
+    unlink(A2S_CONTROL_SOCKET);
+  }
+
+  return NULL;
+}
+
+/**
+* Start the control thread (after the fetchers, it forwards commands to them)
+*
+* @param ctx Pointer to the loader context.
+* @return true on success, or false on failure.
+*/
+bool start_control(loader_ctx_t *ctx)
+{
+  if (pthread_create(&ctx->control_tid, NULL, serve_control, ctx) != 0)
+  {
+    fprintf(stderr, "ERROR: Control thread creation failed.\n");
+    return false;
+  }
+
+  ctx->controlling = true;
+  return true;
+}
+
+/**
+* Wait for the control thread to exit (ctx->running must be false), before the fetchers are stopped
+*
+* @param ctx Pointer to the loader context.
+*/
+void stop_control(loader_ctx_t *ctx)
+{
+  if (ctx->controlling)
+  {
+    pthread_join(ctx->control_tid, NULL);
+    ctx->controlling = false;
+  }
+}
\ No newline at end of file
@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <bpf/bpf.h>
+
+#include "config.h"
+#include "helpers.h"
+
+/**
+* Size of the memory mapping of the cookie key state map (whole pages)
+*
+* @return Mapping size in bytes.
+*/
+static size_t cookie_state_size(void)
+{
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  return (sizeof(struct a2s_cookie_state) + page - 1) / page * page;
+}
+
+/**
+* Generate a random cookie (challenge) key and write it into the given key slot
+*
+* @param ctx Pointer to the loader context.
+* @param slot Key slot (0 or 1).
+* @return true on success, or false on failure.
+*/
+static bool write_cookie_key(loader_ctx_t *ctx, __u32 slot)
+{
+  struct a2s_cookie_key key;
+
+  if (getrandom(&key, sizeof(key), 0) != sizeof(key))
+  {
+    perror("getrandom failed for cookie key");
+    return false;
+  }
+
+  if (bpf_map_update_elem(ctx->xdp_maps.a2s_cookie_keys, &slot, &key, BPF_ANY) < 0)
+  {
+    fprintf(stderr, "ERROR: Could not update cookie key map: %s\n", strerror(errno));
+    return false;
+  }
+
+  return true;
+}
+
+/**
+* Generate the initial cookie (challenge) key, or keep the key found in the (pinned) maps of a previous instance,
+* so cookies handed out before a warm restart stay valid. The key rotation state (a2s_cookie_state) is memory mapped,
+* the rotations write it field by field.
+*
+* @param ctx Pointer to the loader context.
+* @return true on success, or false on failure.
+*/
+bool init_cookie_keys(loader_ctx_t *ctx)
+{
+  struct a2s_cookie_key key;
+  __u32 slot;
+
+  void *state = mmap(NULL, cookie_state_size(), PROT_READ | PROT_WRITE, MAP_SHARED, ctx->xdp_maps.a2s_cookie_state, 0);
+
+  if (state == MAP_FAILED)
+  {
+    fprintf(stderr, "ERROR: Could not map the cookie key state: %s\n", strerror(errno));
+    return false;
+  }
+
+  ctx->cookie_state = state;
+  ctx->cookie_rotate_at = monotonic_ns() + A2S_COOKIE_ROTATE_SEC * 1000000000ULL;
+  slot = __atomic_load_n(&ctx->cookie_state->slot, __ATOMIC_ACQUIRE) & 1;
+
+  if (bpf_map_lookup_elem(ctx->xdp_maps.a2s_cookie_keys, &slot, &key) == 0 && (key.k0 | key.k1) != 0)
+  {
+    printf("Reusing the cookie key from the pinned maps.\n");
+    return true;
+  }
+
+  // Key first, then the state that points to it
+  if (!write_cookie_key(ctx, 0))
+  {
+    return false;
+  }
+
+  __atomic_store_n(&ctx->cookie_state->prev_until, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&ctx->cookie_state->slot, 0, __ATOMIC_RELEASE);
+  return true;
+}
+
+/**
+* Rotate the cookie (challenge) key when it is due: the new key goes into the unused slot first,
+* then the grace deadline of the current slot is set, and the current slot switches last.
+* The XDP program may read the state at any time, each step leaves it consistent.
+*
+* @param ctx Pointer to the loader context.
+* @return true if the key was rotated, false if it is not due yet or on failure.
+*/
+bool rotate_cookie_keys(loader_ctx_t *ctx)
+{
+  __u64 now = monotonic_ns();
+
+  if (now < ctx->cookie_rotate_at || !ctx->cookie_state)
+  {
+    return false;
+  }
+
+  // Retry on the next call if the key can't be written
+  __u32 next_slot = (__atomic_load_n(&ctx->cookie_state->slot, __ATOMIC_ACQUIRE) & 1) ^ 1;
+
+  if (!write_cookie_key(ctx, next_slot))
+  {
+    return false;
+  }
+
+  __atomic_store_n(&ctx->cookie_state->prev_until, now + A2S_COOKIE_GRACE_SEC * 1000000000ULL, __ATOMIC_RELEASE);
+  __atomic_store_n(&ctx->cookie_state->slot, next_slot, __ATOMIC_RELEASE);
+
+  ctx->cookie_rotate_at = now + A2S_COOKIE_ROTATE_SEC * 1000000000ULL;
+
+  #ifdef A2S_DEBUG
+  printf("[COOKIE] Rotated cookie key to slot %u.\n", next_slot);
+  #endif
+
+  return true;
+}
+
+/**
+* Unmap the cookie key state
+*
+* @param ctx Pointer to the loader context.
+*/
+void free_cookie_state(loader_ctx_t *ctx)
+{
+  if (ctx->cookie_state)
+  {
+    munmap(ctx->cookie_state, cookie_state_size());
+    ctx->cookie_state = NULL;
+  }
+}
\ No newline at end of file
@@ -0,0 +1,530 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <ifaddrs.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
+
+#include "config.h"
+#include "helpers.h"
+#include "addr_index.h"
+
+// Bound UDP socket found by the netlink dump
+typedef struct
+{
+  struct sockaddr_in addr;
+  __u32 inode;
+} udp_sock_t;
+
+// Owner match result of a socket inode, cached across scans (a socket keeps its owner)
+typedef struct
+{
+  __u32 inode;
+  bool match;
+} inode_match_t;
+
+static inode_match_t *known_inodes;
+static int known_count;
+
+/**
+* Orders socket inodes (qsort/bsearch comparator)
+*/
+static int inode_cmp(const void *a, const void *b)
+{
+  __u32 ia = *(const __u32 *)a, ib = *(const __u32 *)b;
+  return ia < ib ? -1 : ia > ib;
+}
+
+/**
+* List the unconnected (bound) IPv4 UDP sockets of the host with a NETLINK_SOCK_DIAG dump
+*
+* @param socks Pointer to store the array of sockets.
+* @param count Pointer to store the number of sockets.
+* @return true on success, or false on failure.
+*/
+static bool dump_udp_sockets(udp_sock_t **socks, int *count)
+{
+  struct
+  {
+    struct nlmsghdr nlh;
+    struct inet_diag_req_v2 req;
+  } request =
+  {
+    .nlh = { .nlmsg_len = sizeof(request), .nlmsg_type = SOCK_DIAG_BY_FAMILY, .nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP },
+    .req = { .sdiag_family = AF_INET, .sdiag_protocol = IPPROTO_UDP, .idiag_states = ~0U }
+  };
+
+  int capacity = 0;
+  bool done = false, ok = true;
+  static char buf[32768];
+
+  *socks = NULL;
+  *count = 0;
+
+  int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+
+  if (fd < 0)
+  {
+    perror("[DISCOVERY] netlink socket failed");
+    return false;
+  }
+
+  if (send(fd, &request, sizeof(request), 0) < 0)
+  {
+    perror("[DISCOVERY] netlink send failed");
+    close(fd);
+    return false;
+  }
+
+  while (!done && ok)
+  {
+    ssize_t len = recv(fd, buf, sizeof(buf), 0);
+
+    if (len < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+
+      perror("[DISCOVERY] netlink recv failed");
+      ok = false;
+      break;
+    }
+
+    for (struct nlmsghdr *nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, (size_t)len); nlh = NLMSG_NEXT(nlh, len))
+    {
+      if (nlh->nlmsg_type == NLMSG_DONE)
+      {
+        done = true;
+        break;
+      }
+
+      if (nlh->nlmsg_type == NLMSG_ERROR)
+      {
+        struct nlmsgerr *err = NLMSG_DATA(nlh);
+        fprintf(stderr, "[DISCOVERY] sock_diag dump failed: %s\n", strerror(-err->error));
+        ok = false;
+        break;
+      }
+
+      struct inet_diag_msg *diag = NLMSG_DATA(nlh);
+
+      // Game servers use unconnected sockets, connected ones (e.g., DNS lookups) have a peer port
+      if (diag->id.idiag_sport == 0 || diag->id.idiag_dport != 0 || diag->idiag_inode == 0)
+      {
+        continue;
+      }
+
+      if (*count == capacity)
+      {
+        capacity = capacity ? capacity * 2 : 64;
+        udp_sock_t *temp = realloc(*socks, capacity * sizeof(udp_sock_t));
+
+        if (!temp)
+        {
+          fprintf(stderr, "Memory allocation failed for discovered sockets.\n");
+          ok = false;
+          break;
+        }
+
+        *socks = temp;
+      }
+
+      udp_sock_t *sock = &(*socks)[(*count)++];
+      memset(sock, 0, sizeof(*sock));
+      sock->addr.sin_family = AF_INET;
+      sock->addr.sin_addr.s_addr = diag->id.idiag_src[0];
+      sock->addr.sin_port = diag->id.idiag_sport;
+      sock->inode = diag->idiag_inode;
+    }
+  }
+
+  close(fd);
+
+  if (!ok)
+  {
+    free(*socks);
+    *socks = NULL;
+    *count = 0;
+  }
+
+  return ok;
+}
+
+/**
+* Read a small /proc file of a process into a buffer (NUL terminated)
+*
+* @return Number of bytes read, or -1 on failure.
+*/
+static ssize_t read_proc_file(const char *pid, const char *name, char *buf, size_t size)
+{
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%s/%s", pid, name);
+
+  FILE *fp = fopen(path, "r");
+
+  if (!fp)
+  {
+    return -1;
+  }
+
+  size_t n = fread(buf, 1, size - 1, fp);
+  buf[n] = '\0';
+  fclose(fp);
+
+  return (ssize_t)n;
+}
+
+/**
+* Check if a process matches the discovery filters (process name or cgroup path prefix)
+*
+* @param discovery Pointer to the discovery settings.
+* @param pid Process ID (string).
+* @return true if the process matches.
+*/
+static bool process_matches(const discovery_cfg_t *discovery, const char *pid)
+{
+  char buf[4096];
+
+  // The kernel truncates comm to 15 characters
+  if (discovery->process_count > 0 && read_proc_file(pid, "comm", buf, sizeof(buf)) > 0)
+  {
+    buf[strcspn(buf, "\n")] = '\0';
+
+    for (int i = 0; i < discovery->process_count; i++)
+    {
+      if (strncmp(buf, discovery->processes[i], 15) == 0)
+      {
+        return true;
+      }
+    }
+  }
+
+  // cgroup lines are "hierarchy-ID:controllers:path", match the path prefix of any hierarchy
+  if (discovery->cgroup_count > 0 && read_proc_file(pid, "cgroup", buf, sizeof(buf)) > 0)
+  {
+    for (char *line = strtok(buf, "\n"); line; line = strtok(NULL, "\n"))
+    {
+      char *path = strchr(line, ':');
+      path = path ? strchr(path + 1, ':') : NULL;
+
+      if (!path)
+      {
+        continue;
+      }
+
+      path++;
+
+      for (int i = 0; i < discovery->cgroup_count; i++)
+      {
+        if (strncmp(path, discovery->cgroups[i], strlen(discovery->cgroups[i])) == 0)
+        {
+          return true;
+        }
+      }
+    }
+  }
+
+  return false;
+}
+
+/**
+* Resolve the owners of socket inodes not seen before by walking /proc/<pid>/fd, and cache the filter results
+*
+* @param discovery Pointer to the discovery settings.
+* @param inodes Sorted array of unknown inodes.
+* @param count Number of unknown inodes.
+* @param matches Array to store the results (same order as the inodes).
+*/
+static void resolve_inodes(const discovery_cfg_t *discovery, const __u32 *inodes, int count, bool *matches)
+{
+  DIR *proc = opendir("/proc");
+
+  if (!proc)
+  {
+    perror("[DISCOVERY] opendir /proc failed");
+    return;
+  }
+
+  struct dirent *pid_ent;
+
+  while ((pid_ent = readdir(proc)))
+  {
+    if (pid_ent->d_name[0] < '0' || pid_ent->d_name[0] > '9')
+    {
+      continue;
+    }
+
+    char fd_path[64];
+    snprintf(fd_path, sizeof(fd_path), "/proc/%s/fd", pid_ent->d_name);
+
+    DIR *fds = opendir(fd_path);
+
+    if (!fds)
+    {
+      continue;
+    }
+
+    // The filters are checked once per process, and only if it owns one of the inodes
+    int matched = -1;
+    struct dirent *fd_ent;
+
+    while ((fd_ent = readdir(fds)))
+    {
+      char link_path[320], target[64];
+      snprintf(link_path, sizeof(link_path), "%s/%s", fd_path, fd_ent->d_name);
+
+      ssize_t n = readlink(link_path, target, sizeof(target) - 1);
+      __u32 inode;
+
+      if (n <= 0)
+      {
+        continue;
+      }
+
+      target[n] = '\0';
+
+      if (sscanf(target, "socket:[%u]", &inode) != 1)
+      {
+        continue;
+      }
+
+      const __u32 *found = bsearch(&inode, inodes, count, sizeof(*inodes), inode_cmp);
+
+      if (!found)
+      {
+        continue;
+      }
+
+      if (matched < 0)
+      {
+        matched = process_matches(discovery, pid_ent->d_name);
+      }
+
+      matches[found - inodes] = matched;
+    }
+
+    closedir(fds);
+  }
+
+  closedir(proc);
+}
+
+/**
+* Get the IPv4 address of the XDP interface, used for servers bound to 0.0.0.0
+*
+* @param ifname Interface name.
+* @return IPv4 address (network byte order), or 0 if not found.
+*/
+static __be32 interface_address(const char *ifname)
+{
+  struct ifaddrs *ifas, *ifa;
+  __be32 ip = 0;
+
+  if (getifaddrs(&ifas) < 0)
+  {
+    return 0;
+  }
+
+  for (ifa = ifas; ifa && !ip; ifa = ifa->ifa_next)
+  {
+    if (ifa->ifa_addr && ifa->ifa_addr->sa_family == AF_INET && strcmp(ifa->ifa_name, ifname) == 0)
+    {
+      ip = ((struct sockaddr_in *)ifa->ifa_addr)->sin_addr.s_addr;
+    }
+  }
+
+  freeifaddrs(ifas);
+  return ip;
+}
+
+/**
+* Free the discovery settings
+*
+* @param discovery Pointer to the discovery settings.
+*/
+void free_discovery(discovery_cfg_t *discovery)
+{
+  for (int i = 0; i < discovery->process_count; i++)
+  {
+    free(discovery->processes[i]);
+  }
+
+  for (int i = 0; i < discovery->cgroup_count; i++)
+  {
+    free(discovery->cgroups[i]);
+  }
+
+  free(discovery->processes);
+  free(discovery->cgroups);
+  memset(discovery, 0, sizeof(*discovery));
+}
+
+/**
+* Scan the host for game server sockets (NETLINK_SOCK_DIAG) matching the discovery filters,
+* and hand the changes of the discovered server set to the fetcher (no restart, no cache flush of the servers that stayed)
+*
+* @param ctx Pointer to the loader context.
+* @return true on success, or false on failure (the discovered servers stay as they are).
+*/
+bool discover_servers(loader_ctx_t *ctx)
+{
+  const discovery_cfg_t *discovery = &ctx->discovery;
+  udp_sock_t *socks;
+  int sock_count;
+
+  ctx->discover_at = monotonic_ns() + (__u64)discovery->interval * 1000000000ULL;
+
+  if (!dump_udp_sockets(&socks, &sock_count))
+  {
+    return false;
+  }
+
+  // Split the inodes into known (cached result) and new ones, which need a /proc walk
+  __u32 *inodes = calloc(sock_count ? sock_count : 1, sizeof(__u32));
+  bool *matches = calloc(sock_count ? sock_count : 1, sizeof(bool));
+  inode_match_t *next_known = calloc(sock_count ? sock_count : 1, sizeof(inode_match_t));
+  struct sockaddr_in *found = calloc(sock_count ? sock_count : 1, sizeof(struct sockaddr_in));
+  addr_index_t index = {0};
+  int unknown = 0, found_count = 0;
+  bool ok = false;
+
+  if (!inodes || !matches || !next_known || !found)
+  {
+    fprintf(stderr, "Memory allocation failed for discovery scan.\n");
+    goto cleanup;
+  }
+
+  for (int i = 0; i < sock_count; i++)
+  {
+    __u16 port = ntohs(socks[i].addr.sin_port);
+
+    if (port < discovery->port_first || port > discovery->port_last)
+    {
+      continue;
+    }
+
+    if (!bsearch(&socks[i].inode, known_inodes, known_count, sizeof(*known_inodes), inode_cmp))
+    {
+      inodes[unknown++] = socks[i].inode;
+    }
+  }
+
+  if (unknown > 0)
+  {
+    qsort(inodes, unknown, sizeof(*inodes), inode_cmp);
+    resolve_inodes(discovery, inodes, unknown, matches);
+  }
+
+  __be32 if_ip = interface_address(ctx->ifname);
+
+  // Build the discovered server set, and the inode cache of the sockets that still exist
+  int next_known_count = 0;
+
+  for (int i = 0; i < sock_count; i++)
+  {
+    __u16 port = ntohs(socks[i].addr.sin_port);
+
+    if (port < discovery->port_first || port > discovery->port_last)
+    {
+      continue;
+    }
+
+    const inode_match_t *known = bsearch(&socks[i].inode, known_inodes, known_count, sizeof(*known_inodes), inode_cmp);
+    const __u32 *fresh = known ? NULL : bsearch(&socks[i].inode, inodes, unknown, sizeof(*inodes), inode_cmp);
+    bool match = known ? known->match : (fresh && matches[fresh - inodes]);
+
+    next_known[next_known_count].inode = socks[i].inode;
+    next_known[next_known_count++].match = match;
+
+    if (!match)
+    {
+      continue;
+    }
+
+    // Servers bound to any address are queried on the interface address, loopback-only servers can't be reached through XDP
+    struct sockaddr_in addr = socks[i].addr;
+
+    if (addr.sin_addr.s_addr == INADDR_ANY)
+    {
+      addr.sin_addr.s_addr = if_ip;
+    }
+
+    if (addr.sin_addr.s_addr == 0 || (ntohl(addr.sin_addr.s_addr) >> 24) == 127)
+    {
+      continue;
+    }
+
+    // A server can have several sockets on the same port (e.g., one per address), keep it once
+    int dup = addr_index_insert(&index, addr.sin_addr.s_addr, addr.sin_port, found_count);
+
+    if (dup == -ENOMEM)
+    {
+      goto cleanup;
+    }
+
+    if (dup < 0)
+    {
+      found[found_count++] = addr;
+    }
+  }
+
+  if (found_count > discovery->max_servers)
+  {
+    fprintf(stderr, "Warning: Discovered %d servers, only the first %d (discovery.max_servers) are cached.\n", found_count, discovery->max_servers);
+    found_count = discovery->max_servers;
+  }
+
+  qsort(next_known, next_known_count, sizeof(*next_known), inode_cmp);
+  free(known_inodes);
+  known_inodes = next_known;
+  known_count = next_known_count;
+  next_known = NULL;
+
+  // Count the changes against the current set
+  int added = 0, removed = 0;
+
+  for (int i = 0; i < ctx->discovered_count; i++)
+  {
+    int pos = addr_index_find(&index, ctx->discovered[i].sin_addr.s_addr, ctx->discovered[i].sin_port);
+    removed += pos < 0 || pos >= found_count;
+  }
+
+  added = found_count - (ctx->discovered_count - removed);
+  ok = true;
+
+  if (added == 0 && removed == 0)
+  {
+    goto cleanup;
+  }
+
+  // Hand the new set to the fetcher, it keeps the state and the cache of the servers that stayed
+  pthread_mutex_lock(&ctx->servers_lock);
+
+  struct sockaddr_in *old = ctx->discovered;
+  ctx->discovered = found;
+  ctx->discovered_count = found_count;
+  ctx->servers_gen++;
+
+  pthread_mutex_unlock(&ctx->servers_lock);
+
+  found = old;
+  printf("Discovery: %d servers added, %d removed, %d discovered.\n", added, removed, found_count);
+
+cleanup:
+  addr_index_free(&index);
+  free(next_known);
+  free(found);
+  free(matches);
+  free(inodes);
+  free(socks);
+
+  return ok;
+}
\ No newline at end of file
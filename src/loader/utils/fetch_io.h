@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <linux/types.h>
+
+#include "a2s_defs.h"
+
+// Kinds of fetcher events, produced by the epoll backend or by the io_uring backend
+enum
+{
+  FETCH_EV_TICK,
+  FETCH_EV_DATAGRAM,
+  FETCH_EV_READABLE
+};
+
+typedef struct
+{
+  int kind;
+  int fd;
+  const unsigned char *data;
+  ssize_t len;
+  struct sockaddr_in src;
+  __u16 bid;
+} fetch_event_t;
+
+#ifdef A2S_IO_URING
+#include <liburing.h>
+
+// Ring size, provided receive buffers (power of 2) and send slots (requests copied until their completion)
+#define FETCH_URING_ENTRIES 1024
+#define FETCH_URING_BUFS 1024
+#define FETCH_URING_BUF_SIZE (sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in) + A2S_MAX_SIZE)
+#define FETCH_URING_SEND_SLOTS 1024
+#define FETCH_URING_MAX_WATCH 2
+
+typedef struct
+{
+  struct msghdr msg;
+  struct iovec iov;
+  struct sockaddr_in addr;
+  unsigned char data[32];
+} fetch_send_slot_t;
+
+typedef struct
+{
+  struct io_uring ring;
+  struct io_uring_buf_ring *buf_ring;
+  unsigned char *bufs;
+  fetch_send_slot_t *slots;
+  __u16 *free_slots;
+  int free_count;
+  struct msghdr recv_msg;
+  struct __kernel_timespec tick;
+  __u64 interval_ns;
+  int sockfd;
+  int watch_fds[FETCH_URING_MAX_WATCH];
+  int watch_count;
+  __u64 syscalls;
+  bool ready;
+} fetch_uring_t;
+
+bool fetch_uring_init(fetch_uring_t *u, int sockfd, __u64 interval_ns, __u64 first_tick_ns);
+bool fetch_uring_watch(fetch_uring_t *u, int fd);
+bool fetch_uring_send(fetch_uring_t *u, const void *data, size_t size, const struct sockaddr_in *addr);
+int fetch_uring_wait(fetch_uring_t *u, int timeout_ms, fetch_event_t *events, int max_events);
+void fetch_uring_release(fetch_uring_t *u, const fetch_event_t *events, int count);
+void fetch_uring_free(fetch_uring_t *u);
+#endif
\ No newline at end of file
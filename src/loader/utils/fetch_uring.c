@@ -0,0 +1,444 @@
+#ifdef A2S_IO_URING
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+
+#include "fetch_io.h"
+#include "helpers.h"
+
+/*
+ * io_uring backend of the fetcher (make USE_IO_URING=1, liburing 2.4+ and kernel 6.0+):
+ * - one multishot recvmsg stays armed on the fetcher socket, with a ring of provided buffers
+ * - the sends of a scheduling slice (e.g. all the A2S_INFO queries of a cycle) go out with the next submission
+ * - the query cycle tick is an absolute timeout SQE instead of a timerfd, the request deadlines bound the wait
+ * - the ingestion socket and the inbox are watched with multishot polls
+*/
+
+// User data of the SQEs: kind in the upper half, buffer or slot index (or FD) in the lower half
+enum
+{
+  URING_TICK = 1,
+  URING_RECV,
+  URING_POLL,
+  URING_SEND
+};
+
+#define URING_DATA(kind, index) (((__u64)(kind) << 32) | (__u32)(index))
+#define URING_BUF_GROUP 0
+
+/**
+* Get a free SQE, submitting the queued ones when the submission queue is full
+*
+* @param u Pointer to the io_uring backend.
+* @return SQE, or NULL if none is available.
+*/
+static struct io_uring_sqe *get_sqe(fetch_uring_t *u)
+{
+  struct io_uring_sqe *sqe = io_uring_get_sqe(&u->ring);
+
+  if (!sqe)
+  {
+    io_uring_submit(&u->ring);
+    u->syscalls++;
+    sqe = io_uring_get_sqe(&u->ring);
+  }
+
+  return sqe;
+}
+
+/**
+* Arm the multishot recvmsg of the fetcher socket (again, once the kernel ended it, e.g. out of buffers)
+*
+* @param u Pointer to the io_uring backend.
+* @return true on success, or false if no SQE is available.
+*/
+static bool arm_recv(fetch_uring_t *u)
+{
+  struct io_uring_sqe *sqe = get_sqe(u);
+
+  if (!sqe)
+  {
+    return false;
+  }
+
+  io_uring_prep_recvmsg_multishot(sqe, u->sockfd, &u->recv_msg, 0);
+  sqe->flags |= IOSQE_BUFFER_SELECT;
+  sqe->buf_group = URING_BUF_GROUP;
+  io_uring_sqe_set_data64(sqe, URING_DATA(URING_RECV, 0));
+  return true;
+}
+
+/**
+* Arm the query cycle tick (absolute CLOCK_MONOTONIC time in u->tick)
+*
+* @param u Pointer to the io_uring backend.
+* @return true on success, or false if no SQE is available.
+*/
+static bool arm_tick(fetch_uring_t *u)
+{
+  struct io_uring_sqe *sqe = get_sqe(u);
+
+  if (!sqe)
+  {
+    return false;
+  }
+
+  io_uring_prep_timeout(sqe, &u->tick, 0, IORING_TIMEOUT_ABS);
+  io_uring_sqe_set_data64(sqe, URING_DATA(URING_TICK, 0));
+  return true;
+}
+
+/**
+* Arm the multishot poll of a watched FD
+*
+* @param u Pointer to the io_uring backend.
+* @param fd FD to watch.
+* @return true on success, or false if no SQE is available.
+*/
+static bool arm_poll(fetch_uring_t *u, int fd)
+{
+  struct io_uring_sqe *sqe = get_sqe(u);
+
+  if (!sqe)
+  {
+    return false;
+  }
+
+  io_uring_prep_poll_multishot(sqe, fd, POLLIN);
+  io_uring_sqe_set_data64(sqe, URING_DATA(URING_POLL, fd));
+  return true;
+}
+
+/**
+* Set up the ring, the provided receive buffers and the send slots, and arm the receive and the first tick
+*
+* @param u Pointer to the io_uring backend.
+* @param sockfd Fetcher socket FD.
+* @param interval_ns Query cycle interval.
+* @param first_tick_ns Time of the first tick (monotonic time in nanoseconds).
+* @return true on success, or false on failure (e.g. io_uring not supported, the fetcher then uses epoll).
+*/
+bool fetch_uring_init(fetch_uring_t *u, int sockfd, __u64 interval_ns, __u64 first_tick_ns)
+{
+  struct io_uring_params params = {0};
+  int ret;
+
+  memset(u, 0, sizeof(*u));
+
+  // Only the worker thread submits, let the kernel run the completions when the worker waits
+  params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+
+  if ((ret = io_uring_queue_init_params(FETCH_URING_ENTRIES, &u->ring, &params)) < 0)
+  {
+    memset(&params, 0, sizeof(params));
+
+    if ((ret = io_uring_queue_init_params(FETCH_URING_ENTRIES, &u->ring, &params)) < 0)
+    {
+      fprintf(stderr, "[URING] io_uring setup failed: %s\n", strerror(-ret));
+      return false;
+    }
+  }
+
+  u->ready = true;
+  u->sockfd = sockfd;
+  u->interval_ns = interval_ns;
+  u->tick.tv_sec = first_tick_ns / 1000000000ULL;
+  u->tick.tv_nsec = first_tick_ns % 1000000000ULL;
+
+  if (!(u->buf_ring = io_uring_setup_buf_ring(&u->ring, FETCH_URING_BUFS, URING_BUF_GROUP, 0, &ret)))
+  {
+    fprintf(stderr, "[URING] Provided buffer ring setup failed: %s\n", strerror(-ret));
+    fetch_uring_free(u);
+    return false;
+  }
+
+  if (!(u->bufs = calloc(FETCH_URING_BUFS, FETCH_URING_BUF_SIZE))
+  || !(u->slots = calloc(FETCH_URING_SEND_SLOTS, sizeof(fetch_send_slot_t)))
+  || !(u->free_slots = calloc(FETCH_URING_SEND_SLOTS, sizeof(__u16))))
+  {
+    perror("[URING] buffers calloc failed");
+    fetch_uring_free(u);
+    return false;
+  }
+
+  for (int i = 0; i < FETCH_URING_BUFS; i++)
+  {
+    io_uring_buf_ring_add(u->buf_ring, u->bufs + i * FETCH_URING_BUF_SIZE, FETCH_URING_BUF_SIZE, i, io_uring_buf_ring_mask(FETCH_URING_BUFS), i);
+  }
+
+  io_uring_buf_ring_advance(u->buf_ring, FETCH_URING_BUFS);
+
+  for (int i = 0; i < FETCH_URING_SEND_SLOTS; i++)
+  {
+    u->free_slots[u->free_count++] = FETCH_URING_SEND_SLOTS - 1 - i;
+  }
+
+  // Each received datagram lands in a provided buffer as io_uring_recvmsg_out + source address + payload
+  u->recv_msg.msg_namelen = sizeof(struct sockaddr_in);
+
+  if (!arm_recv(u) || !arm_tick(u))
+  {
+    fetch_uring_free(u);
+    return false;
+  }
+
+  return true;
+}
+
+/**
+* Watch an FD for readability (FETCH_EV_READABLE events)
+*
+* @param u Pointer to the io_uring backend.
+* @param fd FD to watch.
+* @return true on success, or false on failure.
+*/
+bool fetch_uring_watch(fetch_uring_t *u, int fd)
+{
+  if (u->watch_count >= FETCH_URING_MAX_WATCH || !arm_poll(u, fd))
+  {
+    return false;
+  }
+
+  u->watch_fds[u->watch_count++] = fd;
+  return true;
+}
+
+/**
+* Queue a datagram, it goes out with the next submission (next wait).
+* The request and the address are copied into a send slot, the caller's buffers can change right away.
+*
+* @param u Pointer to the io_uring backend.
+* @param data Datagram.
+* @param size Datagram size.
+* @param addr Destination address.
+* @return true if queued, or false if no send slot or SQE is free (the caller sends it directly).
+*/
+bool fetch_uring_send(fetch_uring_t *u, const void *data, size_t size, const struct sockaddr_in *addr)
+{
+  if (u->free_count == 0 || size > sizeof(u->slots[0].data))
+  {
+    return false;
+  }
+
+  struct io_uring_sqe *sqe = get_sqe(u);
+
+  if (!sqe)
+  {
+    return false;
+  }
+
+  __u16 idx = u->free_slots[--u->free_count];
+  fetch_send_slot_t *slot = &u->slots[idx];
+
+  memcpy(slot->data, data, size);
+  slot->addr = *addr;
+  slot->iov.iov_base = slot->data;
+  slot->iov.iov_len = size;
+  slot->msg.msg_name = &slot->addr;
+  slot->msg.msg_namelen = sizeof(slot->addr);
+  slot->msg.msg_iov = &slot->iov;
+  slot->msg.msg_iovlen = 1;
+
+  io_uring_prep_sendmsg(sqe, u->sockfd, &slot->msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+  io_uring_sqe_set_data64(sqe, URING_DATA(URING_SEND, idx));
+  return true;
+}
+
+/**
+* Submit the queued SQEs and wait for completions, up to timeout_ms
+*
+* @param u Pointer to the io_uring backend.
+* @param timeout_ms Maximum wait in milliseconds.
+* @param events Output events (datagram events hold a provided buffer until fetch_uring_release()).
+* @param max_events Size of the events array.
+* @return Number of events, or a negative error code on failure.
+*/
+int fetch_uring_wait(fetch_uring_t *u, int timeout_ms, fetch_event_t *events, int max_events)
+{
+  struct __kernel_timespec ts = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000LL };
+  struct io_uring_cqe *cqe;
+  unsigned int head, seen = 0;
+  int count = 0;
+  bool rearm_recv = false, rearm_tick = false;
+
+  int ret = io_uring_submit_and_wait_timeout(&u->ring, &cqe, 1, &ts, NULL);
+  u->syscalls++;
+
+  if (ret < 0 && ret != -ETIME && ret != -EINTR)
+  {
+    return ret;
+  }
+
+  io_uring_for_each_cqe(&u->ring, head, cqe)
+  {
+    if (count >= max_events)
+    {
+      break;
+    }
+
+    __u64 data = io_uring_cqe_get_data64(cqe);
+    __u32 index = (__u32)data;
+    bool more = cqe->flags & IORING_CQE_F_MORE;
+
+    seen++;
+
+    switch (data >> 32)
+    {
+      case URING_TICK:
+      {
+        // Next tick on the interval grid, skipping the missed ones (like a timerfd)
+        __u64 now_ns = monotonic_ns();
+        __u64 next_ns = (__u64)u->tick.tv_sec * 1000000000ULL + u->tick.tv_nsec;
+
+        do
+        {
+          next_ns += u->interval_ns;
+        } while (next_ns <= now_ns);
+
+        u->tick.tv_sec = next_ns / 1000000000ULL;
+        u->tick.tv_nsec = next_ns % 1000000000ULL;
+        rearm_tick = true;
+
+        events[count].kind = FETCH_EV_TICK;
+        events[count].fd = -1;
+        count++;
+        break;
+      }
+
+      case URING_RECV:
+      {
+        rearm_recv |= !more;
+
+        if (cqe->res < 0)
+        {
+          // Out of buffers (a burst larger than the ring): re-armed once the buffers are released
+          if (cqe->res != -ENOBUFS)
+          {
+            fprintf(stderr, "[URING] recvmsg failed: %s\n", strerror(-cqe->res));
+          }
+          break;
+        }
+
+        __u16 bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        unsigned char *buf = u->bufs + (size_t)bid * FETCH_URING_BUF_SIZE;
+        struct io_uring_recvmsg_out *out = io_uring_recvmsg_validate(buf, cqe->res, &u->recv_msg);
+
+        events[count].kind = FETCH_EV_DATAGRAM;
+        events[count].fd = u->sockfd;
+        events[count].bid = bid;
+        events[count].data = NULL;
+        events[count].len = 0;
+
+        // Datagrams without a source address are only recycled, truncated ones (above A2S_MAX_SIZE) get a length
+        // above A2S_MAX_SIZE so the fetcher rejects them as oversized
+        if (out && out->namelen >= sizeof(struct sockaddr_in))
+        {
+          memcpy(&events[count].src, io_uring_recvmsg_name(out), sizeof(struct sockaddr_in));
+          events[count].data = io_uring_recvmsg_payload(out, &u->recv_msg);
+          events[count].len = out->flags & MSG_TRUNC ? A2S_MAX_SIZE + 1 : io_uring_recvmsg_payload_length(out, cqe->res, &u->recv_msg);
+        }
+
+        count++;
+        break;
+      }
+
+      case URING_POLL:
+      {
+        if (!more)
+        {
+          arm_poll(u, (int)index);
+        }
+
+        if (cqe->res >= 0)
+        {
+          events[count].kind = FETCH_EV_READABLE;
+          events[count].fd = (int)index;
+          count++;
+        }
+        break;
+      }
+
+      case URING_SEND:
+      {
+        if (cqe->res < 0 && cqe->res != -EAGAIN)
+        {
+          fprintf(stderr, "[URING] sendmsg failed: %s\n", strerror(-cqe->res));
+        }
+
+        u->free_slots[u->free_count++] = (__u16)index;
+        break;
+      }
+    }
+  }
+
+  io_uring_cq_advance(&u->ring, seen);
+
+  // Re-arm for the next submission (the receive after the buffers of this batch are released)
+  if (rearm_tick)
+  {
+    arm_tick(u);
+  }
+
+  if (rearm_recv)
+  {
+    arm_recv(u);
+  }
+
+  return count;
+}
+
+/**
+* Give the provided buffers of datagram events back to the kernel
+*
+* @param u Pointer to the io_uring backend.
+* @param events Events returned by fetch_uring_wait().
+* @param count Number of events.
+*/
+void fetch_uring_release(fetch_uring_t *u, const fetch_event_t *events, int count)
+{
+  int released = 0;
+
+  for (int i = 0; i < count; i++)
+  {
+    if (events[i].kind != FETCH_EV_DATAGRAM)
+    {
+      continue;
+    }
+
+    io_uring_buf_ring_add(u->buf_ring, u->bufs + (size_t)events[i].bid * FETCH_URING_BUF_SIZE, FETCH_URING_BUF_SIZE,
+    events[i].bid, io_uring_buf_ring_mask(FETCH_URING_BUFS), released++);
+  }
+
+  if (released > 0)
+  {
+    io_uring_buf_ring_advance(u->buf_ring, released);
+  }
+}
+
+/**
+* Tear down the ring and free the buffers
+*
+* @param u Pointer to the io_uring backend.
+*/
+void fetch_uring_free(fetch_uring_t *u)
+{
+  if (!u->ready)
+  {
+    return;
+  }
+
+  if (u->buf_ring)
+  {
+    io_uring_free_buf_ring(&u->ring, u->buf_ring, FETCH_URING_BUFS, URING_BUF_GROUP);
+  }
+
+  io_uring_queue_exit(&u->ring);
+  free(u->bufs);
+  free(u->slots);
+  free(u->free_slots);
+  memset(u, 0, sizeof(*u));
+}
+#endif
\ No newline at end of file
@@ -1,12 +1,16 @@
 #include <stdlib.h>
 #include <errno.h>
+#include <time.h>
+#include <unistd.h>
 #include <arpa/inet.h>
 #include <net/if.h>
 #include <pthread.h>
 #include <libconfig.h>
 #include <xdp/libxdp.h>
 
+#include "config.h"
 #include "helpers.h"
+#include "addr_index.h"
 
 /**
 * Free dynamically allocated memory and reset server configuration (server count and server list)
@@ -40,9 +44,784 @@ void cleanup(loader_ctx_t *ctx)
   }
 
   ctx->server_count = 0;
+
+  // Check if alias list exists and free it
+  if (ctx->aliases)
+  {
+    fprintf(stderr, "Cleaning up %d configured aliases...\n", ctx->alias_count);
+    free(ctx->aliases);
+    ctx->aliases = NULL;
+  }
+
+  ctx->alias_count = 0;
+
+  // Free the slot allocator of the response store
+  store_free(&ctx->store);
+
+  // Free source prefix lists
+  free(ctx->deny_prefixes);
+  free(ctx->allow_prefixes);
+  ctx->deny_prefixes = ctx->allow_prefixes = NULL;
+  ctx->deny_count = ctx->allow_count = 0;
+
+  // Free discovery settings and the discovered servers
+  free_discovery(&ctx->discovery);
+  free(ctx->discovered);
+  ctx->discovered = NULL;
+  ctx->discovered_count = 0;
+
+  // Free fetcher settings
+  free(ctx->fetcher.cpus);
+  ctx->fetcher.cpus = NULL;
+  ctx->fetcher.cpu_count = 0;
+
+  // Free trace and latency settings
+  free_trace(&ctx->trace);
+  free_latency(ctx);
+
   fprintf(stderr, "Cleanup finished successfully.\n");
 }
 
+// Parsing state of a configuration file (duplicate checks and list capacities)
+typedef struct
+{
+  addr_index_t servers;
+  addr_index_t aliases;
+  int server_capacity;
+  int alias_capacity;
+} parse_state_t;
+
+/**
+* Parse a single port ("27015") or an inclusive port range ("27015-27030")
+*
+* @param str Port or port range string.
+* @param first Pointer to store the first port of the range.
+* @param last Pointer to store the last port of the range.
+* @return true on success, or false if the string is not a valid port or port range.
+*/
+static bool parse_port_range(const char *str, int *first, int *last)
+{
+  char *end;
+  long lo = strtol(str, &end, 10), hi = lo;
+
+  if (end == str)
+  {
+    return false;
+  }
+
+  if (*end == '-')
+  {
+    const char *hi_str = end + 1;
+    hi = strtol(hi_str, &end, 10);
+
+    if (end == hi_str)
+    {
+      return false;
+    }
+  }
+
+  if (*end != '\0' || lo < 1 || hi > 65535 || lo > hi)
+  {
+    return false;
+  }
+
+  *first = (int)lo;
+  *last = (int)hi;
+  return true;
+}
+
+/**
+* Look up a port setting that can be given either as an integer or as a port range string
+*
+* @param setting Config setting group to look in.
+* @param int_name Name of the integer setting (e.g., "port").
+* @param range_name Name of the port range string setting (e.g., "ports").
+* @param first Pointer to store the first port.
+* @param last Pointer to store the last port.
+* @return true if a valid port or port range was found, false otherwise.
+*/
+static bool lookup_ports(config_setting_t *setting, const char *int_name, const char *range_name, int *first, int *last)
+{
+  const char *range_str;
+  int port_val;
+
+  if (config_setting_lookup_int(setting, int_name, &port_val))
+  {
+    *first = *last = port_val;
+    return port_val >= 1 && port_val <= 65535;
+  }
+
+  if (config_setting_lookup_string(setting, range_name, &range_str))
+  {
+    return parse_port_range(range_str, first, last);
+  }
+
+  return false;
+}
+
+/**
+* Add a public -> private alias to the loader context, skipping duplicated public addresses
+*
+* @param ctx Pointer to the loader context.
+* @param ps Pointer to the parsing state.
+* @param pub_ip Public IP address (network byte order).
+* @param pub_port Public port (network byte order).
+* @param priv_ip Private IP address (network byte order).
+* @param priv_port Private port (network byte order).
+* @return true on success or skipped duplicate, false on memory allocation failure.
+*/
+static bool add_alias(loader_ctx_t *ctx, parse_state_t *ps, __be32 pub_ip, __be16 pub_port, __be32 priv_ip, __be16 priv_port)
+{
+  // Duplicate check
+  int dup = addr_index_insert(&ps->aliases, pub_ip, pub_port, ctx->alias_count);
+
+  if (dup == -ENOMEM)
+  {
+    return false;
+  }
+
+  if (dup >= 0)
+  {
+    char ip_str[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &pub_ip, ip_str, sizeof(ip_str));
+    fprintf(stderr, "Duplicate alias found for public address %s:%d. Skipping...\n", ip_str, ntohs(pub_port));
+    return true;
+  }
+
+  // Grow the list geometrically, port ranges can add thousands of aliases
+  if (ctx->alias_count == ps->alias_capacity)
+  {
+    int capacity = ps->alias_capacity ? ps->alias_capacity * 2 : 16;
+    struct a2s_alias *temp = realloc(ctx->aliases, capacity * sizeof(struct a2s_alias));
+
+    if (!temp)
+    {
+      fprintf(stderr, "Memory allocation failed for aliases array.\n");
+      return false;
+    }
+
+    ctx->aliases = temp;
+    ps->alias_capacity = capacity;
+  }
+
+  // Zero the whole entry so the key padding matches the keys built by the XDP program
+  struct a2s_alias *alias = &ctx->aliases[ctx->alias_count++];
+  memset(alias, 0, sizeof(*alias));
+
+  alias->pub.ip = pub_ip;
+  alias->pub.port = pub_port;
+  alias->priv.ip = priv_ip;
+  alias->priv.port = priv_port;
+
+  return true;
+}
+
+/**
+* Parse a list of strings (e.g., process names) into a newly allocated array of copies
+*
+* @param list Config setting list (may be NULL).
+* @param name Name of the list for error messages.
+* @param items Pointer to store the array of strings.
+* @param count Pointer to store the number of strings.
+* @return true on success, or false on memory allocation failure.
+*/
+static bool parse_string_list(config_setting_t *list, const char *name, char ***items, int *count)
+{
+  int length = (list) ? config_setting_length(list) : 0;
+
+  *items = NULL;
+  *count = 0;
+
+  if (length <= 0)
+  {
+    return true;
+  }
+
+  if (!(*items = calloc(length, sizeof(char *))))
+  {
+    fprintf(stderr, "Memory allocation failed for '%s' list.\n", name);
+    return false;
+  }
+
+  for (int i = 0; i < length; i++)
+  {
+    const char *str = config_setting_get_string_elem(list, i);
+
+    if (!str || str[0] == '\0')
+    {
+      fprintf(stderr, "Invalid '%s' entry at index %d. Skipping...\n", name, i);
+      continue;
+    }
+
+    if (!((*items)[*count] = strdup(str)))
+    {
+      fprintf(stderr, "Memory allocation failed for '%s' list.\n", name);
+      return false;
+    }
+
+    (*count)++;
+  }
+
+  return true;
+}
+
+/**
+* Parse the optional 'discovery' group (game server sockets found by process name or cgroup)
+*
+* @param ctx Pointer to the loader context.
+* @param config Pointer to the parsed configuration.
+* @return true on success, or false on memory allocation failure.
+*/
+static bool parse_discovery(loader_ctx_t *ctx, config_t *config)
+{
+  discovery_cfg_t *discovery = &ctx->discovery;
+  config_setting_t *group = config_lookup(config, "discovery");
+
+  memset(discovery, 0, sizeof(*discovery));
+
+  if (!group)
+  {
+    return true;
+  }
+
+  if (!parse_string_list(config_setting_get_member(group, "processes"), "discovery.processes", &discovery->processes, &discovery->process_count)
+  || !parse_string_list(config_setting_get_member(group, "cgroups"), "discovery.cgroups", &discovery->cgroups, &discovery->cgroup_count))
+  {
+    return false;
+  }
+
+  // Without a filter every UDP socket of the host (DNS resolvers, etc.) would be queried
+  if (discovery->process_count == 0 && discovery->cgroup_count == 0)
+  {
+    fprintf(stderr, "The 'discovery' group needs at least one 'processes' or 'cgroups' entry. Discovery disabled...\n");
+    return true;
+  }
+
+  discovery->interval = A2S_DISCOVERY_INTERVAL_SEC;
+  discovery->max_servers = A2S_MAP_MIN_ENTRIES;
+  discovery->port_first = 1;
+  discovery->port_last = 65535;
+
+  config_setting_lookup_int(group, "interval", &discovery->interval);
+  config_setting_lookup_int(group, "max_servers", &discovery->max_servers);
+
+  if (discovery->interval < 1)
+  {
+    discovery->interval = 1;
+  }
+
+  if (discovery->max_servers < 0)
+  {
+    discovery->max_servers = 0;
+  }
+
+  const char *ports;
+
+  if (config_setting_lookup_string(group, "ports", &ports) && !parse_port_range(ports, &discovery->port_first, &discovery->port_last))
+  {
+    fprintf(stderr, "Invalid 'discovery.ports' range %s. Discovering on all ports...\n", ports);
+    discovery->port_first = 1;
+    discovery->port_last = 65535;
+  }
+
+  discovery->enabled = true;
+
+  printf("Server discovery enabled: %d process names, %d cgroups, ports %d-%d, every %d seconds.\n",
+  discovery->process_count, discovery->cgroup_count, discovery->port_first, discovery->port_last, discovery->interval);
+
+  return true;
+}
+
+/**
+* Parse the optional 'fetcher' group (number of fetcher threads and the CPUs they are pinned to)
+*
+* @param ctx Pointer to the loader context.
+* @param config Pointer to the parsed configuration.
+* @return true on success, or false on memory allocation failure.
+*/
+static bool parse_fetcher(loader_ctx_t *ctx, config_t *config)
+{
+  fetcher_cfg_t *fetcher = &ctx->fetcher;
+  config_setting_t *group = config_lookup(config, "fetcher");
+
+  memset(fetcher, 0, sizeof(*fetcher));
+  fetcher->threads = 1;
+  fetcher->interval_ms = A2S_QUERY_TIME_SEC * 1000;
+
+  if (!group)
+  {
+    return true;
+  }
+
+  config_setting_lookup_int(group, "threads", &fetcher->threads);
+
+  if (fetcher->threads < 1 || fetcher->threads > A2S_FETCH_MAX_THREADS)
+  {
+    fprintf(stderr, "Invalid 'fetcher.threads' value %d (1-%d). Using %d...\n", fetcher->threads, A2S_FETCH_MAX_THREADS,
+    fetcher->threads < 1 ? 1 : A2S_FETCH_MAX_THREADS);
+    fetcher->threads = fetcher->threads < 1 ? 1 : A2S_FETCH_MAX_THREADS;
+  }
+
+  // io_uring backend of the fetcher, only available when built with USE_IO_URING=1
+  int io_uring = 0;
+  config_setting_lookup_bool(group, "io_uring", &io_uring);
+  fetcher->io_uring = io_uring;
+
+  #ifndef A2S_IO_URING
+  if (fetcher->io_uring)
+  {
+    fprintf(stderr, "Warning: 'fetcher.io_uring' requires a build with USE_IO_URING=1. Using epoll...\n");
+    fetcher->io_uring = false;
+  }
+  #endif
+
+  config_setting_t *cpus = config_setting_get_member(group, "cpus");
+  int count = cpus ? config_setting_length(cpus) : 0;
+
+  if (count > 0)
+  {
+    if (!(fetcher->cpus = calloc(count, sizeof(int))))
+    {
+      fprintf(stderr, "Memory allocation failed for fetcher CPUs.\n");
+      return false;
+    }
+
+    long cpu_max = sysconf(_SC_NPROCESSORS_CONF);
+
+    for (int i = 0; i < count; i++)
+    {
+      int cpu = config_setting_get_int_elem(cpus, i);
+
+      if (cpu < 0 || cpu >= cpu_max)
+      {
+        fprintf(stderr, "Invalid 'fetcher.cpus' entry %d (CPUs 0-%ld). Skipping...\n", cpu, cpu_max - 1);
+        continue;
+      }
+
+      fetcher->cpus[fetcher->cpu_count++] = cpu;
+    }
+  }
+
+  printf("Fetcher: %d threads, %s, %s backend.\n", fetcher->threads, fetcher->cpu_count > 0 ? "pinned to the configured CPUs" : "not pinned",
+  fetcher->io_uring ? "io_uring" : "epoll");
+  return true;
+}
+
+/**
+* Grow the server list of the loader context (doubling its capacity)
+*
+* @param ctx Pointer to the loader context.
+* @param ps Pointer to the parsing state.
+* @return true on success, or false on memory allocation failure.
+*/
+static bool grow_servers(loader_ctx_t *ctx, parse_state_t *ps)
+{
+  int capacity = ps->server_capacity ? ps->server_capacity * 2 : 16;
+  struct sockaddr_in *temp = realloc(ctx->servers, capacity * sizeof(struct sockaddr_in));
+
+  if (!temp)
+  {
+    fprintf(stderr, "Memory allocation failed for servers array.\n");
+    return false;
+  }
+
+  ctx->servers = temp;
+  ps->server_capacity = capacity;
+  return true;
+}
+
+/**
+* Parse the optional 'aliases' list with public -> private port range mappings
+*
+* @param ctx Pointer to the loader context.
+* @param ps Pointer to the parsing state.
+* @param config Pointer to the parsed configuration.
+* @return true on success, or false on memory allocation failure.
+*/
+static bool parse_aliases(loader_ctx_t *ctx, parse_state_t *ps, config_t *config)
+{
+  config_setting_t *aliases = config_lookup(config, "aliases");
+  int count = (aliases) ? config_setting_length(aliases) : 0;
+
+  for (int i = 0; i < count; i++)
+  {
+    config_setting_t *alias_cfg = config_setting_get_elem(aliases, i);
+    const char *pub_ip_str, *priv_ip_str;
+    int pub_first, pub_last, priv_first, priv_last;
+    struct in_addr pub_ip, priv_ip;
+
+    // Each alias must have both public and private IP and port(s)
+    if (!(config_setting_lookup_string(alias_cfg, "public_ip", &pub_ip_str) && config_setting_lookup_string(alias_cfg, "ip", &priv_ip_str)
+    && lookup_ports(alias_cfg, "public_port", "public_ports", &pub_first, &pub_last) && lookup_ports(alias_cfg, "port", "ports", &priv_first, &priv_last)))
+    {
+      fprintf(stderr, "Invalid 'aliases' setting at index %d. Skipping...\n", i);
+      continue;
+    }
+
+    // Validate IP addresses
+    if (inet_pton(AF_INET, pub_ip_str, &pub_ip) <= 0 || inet_pton(AF_INET, priv_ip_str, &priv_ip) <= 0)
+    {
+      fprintf(stderr, "Invalid IP address format in alias at index %d. Skipping...\n", i);
+      continue;
+    }
+
+    // Public and private port ranges must map one to one
+    if (pub_last - pub_first != priv_last - priv_first)
+    {
+      fprintf(stderr, "ERROR: Public and private port ranges differ in length at alias index %d. Skipping...\n", i);
+      continue;
+    }
+
+    for (int p = 0; p <= pub_last - pub_first; p++)
+    {
+      if (!add_alias(ctx, ps, pub_ip.s_addr, htons(pub_first + p), priv_ip.s_addr, htons(priv_first + p)))
+      {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+/**
+* Parse a single { rate; burst; } token bucket setting into token bucket parameters
+*
+* @param group Parent config setting group.
+* @param name Name of the token bucket setting (e.g., "info").
+* @param limit Pointer to the token bucket parameters to fill (left unlimited if the setting is missing).
+* @return true if the token bucket is limited, false if it is unlimited.
+*/
+static bool parse_limit(config_setting_t *group, const char *name, struct a2s_limit *limit)
+{
+  config_setting_t *setting = config_setting_get_member(group, name);
+  int rate = 0, burst = 0;
+
+  memset(limit, 0, sizeof(*limit));
+
+  if (!setting || !config_setting_lookup_int(setting, "rate", &rate) || rate <= 0)
+  {
+    return false;
+  }
+
+  // Burst defaults to one second worth of tokens
+  if (!config_setting_lookup_int(setting, "burst", &burst) || burst <= 0)
+  {
+    burst = rate;
+  }
+
+  limit->cost = 1000000000ULL / (__u64)rate;
+  limit->cap = limit->cost * (__u64)burst;
+
+  printf("Rate limit '%s': %d/s, burst %d.\n", name, rate, burst);
+  return true;
+}
+
+/**
+* Parse the optional 'ratelimit' group into the runtime settings
+*
+* @param ctx Pointer to the loader context.
+* @param config Pointer to the parsed configuration.
+*/
+static void parse_ratelimit(loader_ctx_t *ctx, config_t *config)
+{
+  static const char *names[A2S_QUERY_TYPES] = { "info", "player", "rules" };
+  config_setting_t *ratelimit = config_lookup(config, "ratelimit");
+  struct a2s_settings *settings = &ctx->settings;
+  int prefix = 32;
+
+  settings->src_limit_enabled = 0;
+  settings->srv_limit_enabled = 0;
+
+  if (!ratelimit)
+  {
+    return;
+  }
+
+  // Sources are grouped by their prefix (32 = per IP address)
+  if (config_setting_lookup_int(ratelimit, "prefix", &prefix) && (prefix < 0 || prefix > 32))
+  {
+    fprintf(stderr, "Invalid rate limit prefix /%d (must be 0-32). Using /32...\n", prefix);
+    prefix = 32;
+  }
+
+  settings->src_mask = htonl(prefix == 0 ? 0 : 0xFFFFFFFFU << (32 - prefix));
+
+  for (int i = 0; i < A2S_QUERY_TYPES; i++)
+  {
+    if (parse_limit(ratelimit, names[i], &settings->src_limit[i]))
+    {
+      settings->src_limit_enabled = 1;
+    }
+  }
+
+  settings->srv_limit_enabled = parse_limit(ratelimit, "server", &settings->srv_limit);
+}
+
+/**
+* Parse a list of IPv4 prefixes ("198.51.100.0/24" or "203.0.113.7") into LPM trie keys
+*
+* @param list Config list (array) of prefix strings, may be NULL.
+* @param name Name of the list (for logging).
+* @param prefixes Pointer to store the allocated array of LPM trie keys.
+* @param count Pointer to store the number of parsed prefixes.
+* @return true on success, or false on memory allocation failure.
+*/
+static bool parse_prefix_list(config_setting_t *list, const char *name, struct a2s_lpm_key **prefixes, int *count)
+{
+  int length = (list) ? config_setting_length(list) : 0;
+
+  *prefixes = NULL;
+  *count = 0;
+
+  if (length <= 0)
+  {
+    return true;
+  }
+
+  if (!(*prefixes = calloc(length, sizeof(struct a2s_lpm_key))))
+  {
+    fprintf(stderr, "Memory allocation failed for '%s' prefix list.\n", name);
+    return false;
+  }
+
+  for (int i = 0; i < length; i++)
+  {
+    const char *prefix_str = config_setting_get_string_elem(list, i);
+    char ip_str[INET_ADDRSTRLEN];
+    struct in_addr ip;
+    long prefixlen = 32;
+
+    if (!prefix_str)
+    {
+      fprintf(stderr, "Invalid '%s' prefix at index %d. Skipping...\n", name, i);
+      continue;
+    }
+
+    // Split the address and the optional prefix length
+    const char *slash = strchr(prefix_str, '/');
+    size_t ip_len = slash ? (size_t)(slash - prefix_str) : strlen(prefix_str);
+
+    if (ip_len >= sizeof(ip_str))
+    {
+      fprintf(stderr, "Invalid '%s' prefix %s. Skipping...\n", name, prefix_str);
+      continue;
+    }
+
+    memcpy(ip_str, prefix_str, ip_len);
+    ip_str[ip_len] = '\0';
+
+    if (slash)
+    {
+      char *end;
+      prefixlen = strtol(slash + 1, &end, 10);
+
+      if (end == slash + 1 || *end != '\0')
+      {
+        prefixlen = -1;
+      }
+    }
+
+    if (inet_pton(AF_INET, ip_str, &ip) <= 0 || prefixlen < 0 || prefixlen > 32)
+    {
+      fprintf(stderr, "Invalid '%s' prefix %s. Skipping...\n", name, prefix_str);
+      continue;
+    }
+
+    // Clear the host bits, so equal prefixes always produce equal keys
+    struct a2s_lpm_key *key = &(*prefixes)[(*count)++];
+    key->prefixlen = prefixlen;
+    key->ip = ip.s_addr & htonl(prefixlen == 0 ? 0 : 0xFFFFFFFFU << (32 - prefixlen));
+  }
+
+  return true;
+}
+
+/**
+* Parse the optional 'filter' group with the source prefix deny and allow lists
+*
+* @param ctx Pointer to the loader context.
+* @param config Pointer to the parsed configuration.
+* @return true on success, or false on memory allocation failure.
+*/
+static bool parse_filters(loader_ctx_t *ctx, config_t *config)
+{
+  if (!parse_prefix_list(config_lookup(config, "filter.deny"), "deny", &ctx->deny_prefixes, &ctx->deny_count)
+  || !parse_prefix_list(config_lookup(config, "filter.allow"), "allow", &ctx->allow_prefixes, &ctx->allow_count))
+  {
+    return false;
+  }
+
+  ctx->settings.deny_enabled = ctx->deny_count > 0;
+  ctx->settings.allow_enabled = ctx->allow_count > 0;
+
+  if (ctx->deny_count > 0 || ctx->allow_count > 0)
+  {
+    printf("Loaded %d deny and %d allow source prefixes from configuration.\n", ctx->deny_count, ctx->allow_count);
+  }
+
+  return true;
+}
+
+/**
+* Parse the optional 'trace' group: trace events of the XDP program, sampling, source prefix and server filters, pcap output
+*
+* @param ctx Pointer to the loader context.
+* @param config Pointer to the parsed configuration.
+* @return true on success, or false on memory allocation failure.
+*/
+static bool parse_trace(loader_ctx_t *ctx, config_t *config)
+{
+  trace_cfg_t *trace = &ctx->trace;
+  config_setting_t *group = config_lookup(config, "trace");
+  int enabled = 0, sample = 1;
+
+  memset(trace, 0, sizeof(*trace));
+
+  if (!group)
+  {
+    return true;
+  }
+
+  config_setting_lookup_bool(group, "enabled", &enabled);
+  config_setting_lookup_int(group, "sample", &sample);
+
+  if (sample < 1)
+  {
+    fprintf(stderr, "Invalid 'trace.sample' value %d (1 = every query, N = 1 in N queries). Using 1...\n", sample);
+    sample = 1;
+  }
+
+  if (!parse_prefix_list(config_setting_get_member(group, "sources"), "trace.sources", &trace->sources, &trace->source_count))
+  {
+    return false;
+  }
+
+  // Servers as "ip:port" or "ip:first-last"
+  config_setting_t *servers = config_setting_get_member(group, "servers");
+  int length = servers ? config_setting_length(servers) : 0;
+
+  for (int i = 0; i < length; i++)
+  {
+    const char *server_str = config_setting_get_string_elem(servers, i);
+    const char *colon = server_str ? strrchr(server_str, ':') : NULL;
+    char ip_str[INET_ADDRSTRLEN];
+    struct in_addr ip;
+    int first, last;
+
+    if (!colon || (size_t)(colon - server_str) >= sizeof(ip_str))
+    {
+      fprintf(stderr, "Invalid 'trace.servers' entry at index %d (ip:port or ip:first-last). Skipping...\n", i);
+      continue;
+    }
+
+    memcpy(ip_str, server_str, colon - server_str);
+    ip_str[colon - server_str] = '\0';
+
+    if (inet_pton(AF_INET, ip_str, &ip) <= 0 || !parse_port_range(colon + 1, &first, &last))
+    {
+      fprintf(stderr, "Invalid 'trace.servers' entry %s. Skipping...\n", server_str);
+      continue;
+    }
+
+    if (trace->server_count + last - first + 1 > A2S_TRACE_MAX_SERVERS)
+    {
+      fprintf(stderr, "Warning: More than %d traced servers (A2S_TRACE_MAX_SERVERS), skipping %s...\n", A2S_TRACE_MAX_SERVERS, server_str);
+      continue;
+    }
+
+    struct a2s_server_key *temp = realloc(trace->servers, (trace->server_count + last - first + 1) * sizeof(*temp));
+
+    if (!temp)
+    {
+      fprintf(stderr, "Memory allocation failed for traced servers.\n");
+      return false;
+    }
+
+    trace->servers = temp;
+
+    // Zero the whole key so the padding matches the keys built by the XDP program
+    for (int port = first; port <= last; port++)
+    {
+      struct a2s_server_key *key = &trace->servers[trace->server_count++];
+      memset(key, 0, sizeof(*key));
+      key->ip = ip.s_addr;
+      key->port = htons(port);
+    }
+  }
+
+  // Trace events are written as text on stdout, or into a pcap file
+  const char *pcap_file;
+
+  if (config_setting_lookup_string(group, "pcap", &pcap_file) && pcap_file[0] && !(trace->pcap_file = strdup(pcap_file)))
+  {
+    fprintf(stderr, "Memory allocation failed for trace pcap file.\n");
+    return false;
+  }
+
+  ctx->settings.trace_enabled = enabled;
+  ctx->settings.trace_sample = sample;
+  ctx->settings.trace_sources = trace->source_count > 0;
+  ctx->settings.trace_servers = trace->server_count > 0;
+
+  if (enabled)
+  {
+    printf("Tracing XDP queries: 1 in %d, %d source prefixes and %d servers filters, to %s.\n", sample, trace->source_count, trace->server_count,
+    trace->pcap_file ? trace->pcap_file : "stdout");
+  }
+
+  return true;
+}
+
+/**
+* Parse the optional 'latency' group: processing latency histograms of the XDP program, report interval, Prometheus export file
+*
+* @param ctx Pointer to the loader context.
+* @param config Pointer to the parsed configuration.
+* @return true on success, or false on memory allocation failure.
+*/
+static bool parse_latency(loader_ctx_t *ctx, config_t *config)
+{
+  latency_cfg_t *latency = &ctx->latency;
+  config_setting_t *group = config_lookup(config, "latency");
+  int enabled = 0;
+
+  memset(latency, 0, sizeof(*latency));
+  latency->interval = A2S_LATENCY_INTERVAL_SEC;
+
+  if (!group)
+  {
+    return true;
+  }
+
+  config_setting_lookup_bool(group, "enabled", &enabled);
+  config_setting_lookup_int(group, "interval", &latency->interval);
+
+  if (latency->interval < 1)
+  {
+    latency->interval = 1;
+  }
+
+  // Cumulative histograms in the Prometheus text format (node_exporter textfile collector)
+  const char *prom_file;
+
+  if (config_setting_lookup_string(group, "file", &prom_file) && prom_file[0] && !(latency->prom_file = strdup(prom_file)))
+  {
+    fprintf(stderr, "Memory allocation failed for latency export file.\n");
+    return false;
+  }
+
+  ctx->settings.latency_enabled = enabled;
+
+  if (enabled)
+  {
+    printf("XDP processing latency histograms enabled: report every %d seconds%s%s.\n", latency->interval,
+    latency->prom_file ? ", exported to " : "", latency->prom_file ? latency->prom_file : "");
+  }
+
+  return true;
+}
+
 /**
 * Parse the configuration file to retrieve the network interface and server details (IP and port)
 * Populate the cfg structure with the parsed data
@@ -100,44 +879,75 @@ bool parse_config_file(loader_ctx_t *ctx, const char *filename)
     return false;
   }
 
+  // Persistent mode keeps the program attached and the maps pinned when the loader stops
+  int persistent = 0;
+  config_lookup_bool(&config, "persistent", &persistent);
+  ctx->persistent = persistent;
+
+  // Attach mode: native with SKB fallback by default, or forced (e.g. to compare both)
+  const char *xdp_mode = "auto";
+  config_lookup_string(&config, "xdp_mode", &xdp_mode);
+
+  if (strcmp(xdp_mode, "auto") != 0 && strcmp(xdp_mode, "native") != 0 && strcmp(xdp_mode, "skb") != 0)
+  {
+    fprintf(stderr, "ERROR: Invalid 'xdp_mode' setting '%s' (auto, native or skb).\n", xdp_mode);
+    config_destroy(&config);
+    return false;
+  }
+
+  ctx->xdp_mode = !strcmp(xdp_mode, "native") ? XDP_ATTACH_NATIVE : !strcmp(xdp_mode, "skb") ? XDP_ATTACH_SKB : XDP_ATTACH_AUTO;
+
+  // Per server query counters of the XDP program (hit rate in xdpa2scache-ctl), one more map lookup per query
+  int server_stats = 0;
+  config_lookup_bool(&config, "server_stats", &server_stats);
+  ctx->settings.srv_stats_enabled = server_stats;
+
+  // Parse the game server socket discovery and the fetcher thread settings, with discovery the static server list is optional
+  if (!parse_discovery(ctx, &config) || !parse_fetcher(ctx, &config))
+  {
+    config_destroy(&config);
+    return false;
+  }
+
   // Check if there are any servers defined in the config
   config_setting_t *servers = config_lookup(&config, "servers");
   int count = (servers) ? config_setting_length(servers) : 0;
 
-  if (count <= 0)
+  if (count <= 0 && !ctx->discovery.enabled)
   {
     fprintf(stderr, "No servers configured in the 'servers' setting.\n");
     config_destroy(&config);
     return false;
   }
 
-  // Check if memory allocation for servers failed
-  if (!(ctx->servers = calloc(count, sizeof(struct sockaddr_in))))
+  // Set count to 0 and increment it as we successfully load each server
+  ctx->server_count = 0;
+
+  // Hash indexes for the duplicate checks, so large server lists and port ranges parse in linear time
+  parse_state_t ps = {0};
+
+  if (!addr_index_init(&ps.servers, count))
   {
-    fprintf(stderr, "Memory allocation failed for servers array.\n");
     config_destroy(&config);
     return false;
   }
 
-  // Set count to 0 and increment it as we successfully load each server
-  ctx->server_count = 0;
-
   // Process and validate each server from the configuration
   for (int i = 0; i < count; i++)
   {
     config_setting_t *server_cfg = config_setting_get_elem(servers, i);
     const char *ip_str;
-    int port_val;
+    int first, last;
 
-    // Each server must have both an IP and a port
-    if (!(config_setting_lookup_string(server_cfg, "ip", &ip_str) && config_setting_lookup_int(server_cfg, "port", &port_val)))
+    // Each server must have both an IP and a port (or a port range)
+    if (!(config_setting_lookup_string(server_cfg, "ip", &ip_str) && lookup_ports(server_cfg, "port", "ports", &first, &last)))
     {
-      fprintf(stderr, "Invalid 'server' setting at index %d. Skipping...\n", i);
+      fprintf(stderr, "Invalid 'server' setting at index %d (missing IP, or invalid port/ports, ports must be 1-65535). Skipping...\n", i);
       continue;
     }
 
     // Prepare address structure in network byte order
-    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port_val) };
+    struct sockaddr_in addr = { .sin_family = AF_INET };
 
     // Validate IP address
     if (inet_pton(AF_INET, ip_str, &addr.sin_addr) <= 0)
@@ -146,36 +956,62 @@ bool parse_config_file(loader_ctx_t *ctx, const char *filename)
       continue;
     }
 
-    // Validate Port
-    if (port_val < 1 || port_val > 65535)
-    {
-      fprintf(stderr, "ERROR: Invalid port %d at index %d (must be 1-65535). Skipping...\n", port_val, i);
-      continue;
-    }
-
-    // Duplicate check
-    bool is_duplicate = false;
+    // Optional public address for servers bound to a private address behind DNAT (same port(s) by default)
+    const char *public_ip_str;
+    struct in_addr public_ip = {0};
+    int pub_first = first, pub_last = last;
 
-    for (int j = 0; j < ctx->server_count; j++)
+    if (config_setting_lookup_string(server_cfg, "public_ip", &public_ip_str))
     {
-      if (ctx->servers[j].sin_addr.s_addr == addr.sin_addr.s_addr && ctx->servers[j].sin_port == addr.sin_port)
+      bool has_ports = config_setting_get_member(server_cfg, "public_port") || config_setting_get_member(server_cfg, "public_ports");
+
+      // A public port range must have the same length as the private one
+      if ((has_ports && !lookup_ports(server_cfg, "public_port", "public_ports", &pub_first, &pub_last))
+      || inet_pton(AF_INET, public_ip_str, &public_ip) <= 0 || pub_last - pub_first != last - first)
       {
-        is_duplicate = true;
-        break;
+        fprintf(stderr, "Invalid public address or port(s) %s at index %d. Serving on the private address only...\n", public_ip_str, i);
+        public_ip.s_addr = 0;
       }
     }
 
-    if (is_duplicate)
+    for (int port = first; port <= last; port++)
     {
-      fprintf(stderr, "Duplicate server found: %s:%d. Skipping index %d...\n", ip_str, port_val, i);
-      continue;
-    }
+      addr.sin_port = htons(port);
+
+      // Duplicate check
+      int dup = addr_index_insert(&ps.servers, addr.sin_addr.s_addr, addr.sin_port, ctx->server_count);
+
+      if (dup >= 0)
+      {
+        fprintf(stderr, "Duplicate server found: %s:%d. Skipping index %d...\n", ip_str, port, i);
+        continue;
+      }
+
+      // Grow the list geometrically, port ranges can add thousands of servers
+      if (dup == -ENOMEM || (ctx->server_count == ps.server_capacity && !grow_servers(ctx, &ps)))
+      {
+        addr_index_free(&ps.servers);
+        addr_index_free(&ps.aliases);
+        config_destroy(&config);
+        return false;
+      }
 
-    ctx->servers[ctx->server_count++] = addr;
+      ctx->servers[ctx->server_count++] = addr;
+
+      if (public_ip.s_addr && !add_alias(ctx, &ps, public_ip.s_addr, htons(pub_first + port - first), addr.sin_addr.s_addr, addr.sin_port))
+      {
+        addr_index_free(&ps.servers);
+        addr_index_free(&ps.aliases);
+        config_destroy(&config);
+        return false;
+      }
+    }
   }
 
-  // Memory optimization (shrink) if duplicates were removed
-  if (ctx->server_count < count && ctx->server_count > 0)
+  addr_index_free(&ps.servers);
+
+  // Memory optimization (shrink) if duplicates were removed or the list grew past the final count
+  if (ctx->server_count < ps.server_capacity && ctx->server_count > 0)
   {
     struct sockaddr_in *temp = realloc(ctx->servers, ctx->server_count * sizeof(struct sockaddr_in));
 
@@ -188,9 +1024,30 @@ bool parse_config_file(loader_ctx_t *ctx, const char *filename)
       fprintf(stderr, "Warning: Could not shrink server list memory, using original allocation.\n");
     }
   }
-  else if (ctx->server_count == 0)
+  else if (ctx->server_count == 0 && !ctx->discovery.enabled)
   {
     fprintf(stderr, "No valid servers were loaded from configuration.\n");
+    addr_index_free(&ps.aliases);
+    config_destroy(&config);
+    return false;
+  }
+
+  // Parse public -> private port range mappings
+  bool aliases_ok = parse_aliases(ctx, &ps, &config);
+  addr_index_free(&ps.aliases);
+
+  if (!aliases_ok)
+  {
+    config_destroy(&config);
+    return false;
+  }
+
+  // Parse per source and per server rate limits
+  parse_ratelimit(ctx, &config);
+
+  // Parse source prefix deny and allow lists, the trace and the latency settings
+  if (!parse_filters(ctx, &config) || !parse_trace(ctx, &config) || !parse_latency(ctx, &config))
+  {
     config_destroy(&config);
     return false;
   }
@@ -198,10 +1055,187 @@ bool parse_config_file(loader_ctx_t *ctx, const char *filename)
   // Print how much servers we loaded from the configuration
   printf(ctx->server_count == 1 ? "Loaded 1 server from configuration.\n" : "Loaded %d servers from configuration.\n", ctx->server_count);
 
+  if (ctx->alias_count > 0)
+  {
+    printf(ctx->alias_count == 1 ? "Loaded 1 public address alias from configuration.\n" : "Loaded %d public address aliases from configuration.\n", ctx->alias_count);
+  }
+
   config_destroy(&config);
   return true;
 }
 
+/**
+* Free the configuration lists of a context that was only used for parsing (e.g., a failed or applied reload)
+*
+* @param ctx Pointer to the parsed context.
+*/
+static void free_config_lists(loader_ctx_t *ctx)
+{
+  free(ctx->ifname);
+  free(ctx->servers);
+  free(ctx->aliases);
+  free(ctx->deny_prefixes);
+  free(ctx->allow_prefixes);
+  free(ctx->fetcher.cpus);
+  free_discovery(&ctx->discovery);
+  free_trace(&ctx->trace);
+  free_latency(ctx);
+}
+
+/**
+* Write the aliases, the prefix lists, the trace filters and the runtime settings of a configuration into the BPF maps
+*
+* @param ctx Pointer to the loader context (maps).
+* @param cfg Pointer to the context holding the configuration to apply (may be ctx itself).
+* @return true on success, or false if a map update failed (the maps may be partially updated).
+*/
+static bool apply_config_maps(loader_ctx_t *ctx, loader_ctx_t *cfg)
+{
+  return sync_alias_map(&ctx->xdp_maps, cfg->aliases, cfg->alias_count) == 0
+  && sync_prefix_map(ctx->xdp_maps.a2s_deny, cfg->deny_prefixes, cfg->deny_count) == 0
+  && sync_prefix_map(ctx->xdp_maps.a2s_allow, cfg->allow_prefixes, cfg->allow_count) == 0
+  && sync_prefix_map(ctx->xdp_maps.a2s_trace_src, cfg->trace.sources, cfg->trace.source_count) == 0
+  && sync_server_map(ctx->xdp_maps.a2s_trace_srv, cfg->trace.servers, cfg->trace.server_count) == 0
+  && update_settings_map(&ctx->xdp_maps, &cfg->settings) == 0;
+}
+
+/**
+* Re-read the configuration file (SIGHUP) and apply it without detaching the XDP program:
+* the server list is handed over to the fetcher, which keeps the state and the cache of the servers that stayed,
+* aliases and source prefix filters are synced incrementally, and the rate limits are updated in place.
+*
+* @param ctx Pointer to the loader context.
+* @param filename Path to the configuration file.
+* @return true on success, or false on parsing or map update failure (the previous configuration stays active).
+*/
+bool reload_config(loader_ctx_t *ctx, const char *filename)
+{
+  loader_ctx_t next = {0};
+
+  if (!parse_config_file(&next, filename))
+  {
+    fprintf(stderr, "Reload failed, keeping the previous configuration.\n");
+    free_config_lists(&next);
+    return false;
+  }
+
+  // The interface and the attach mode can't be changed without detaching the program
+  if (next.ifindex != ctx->ifindex)
+  {
+    fprintf(stderr, "Warning: Changing the interface (%s -> %s) requires a restart, keeping %s.\n", ctx->ifname, next.ifname, ctx->ifname);
+  }
+
+  if (next.xdp_mode != ctx->xdp_mode)
+  {
+    fprintf(stderr, "Warning: Changing 'xdp_mode' requires a restart.\n");
+  }
+
+  // The fetcher threads are started once, their settings are kept until a restart
+  if (next.fetcher.threads != ctx->fetcher.threads || next.fetcher.io_uring != ctx->fetcher.io_uring || next.fetcher.cpu_count != ctx->fetcher.cpu_count
+  || (next.fetcher.cpu_count > 0 && memcmp(next.fetcher.cpus, ctx->fetcher.cpus, next.fetcher.cpu_count * sizeof(int)) != 0))
+  {
+    fprintf(stderr, "Warning: Changing the 'fetcher' settings requires a restart, keeping %d threads.\n", ctx->fetcher.threads);
+  }
+
+  // The maps are sized when the program is loaded, servers past their size can't be cached until a restart
+  __u32 max_entries = map_max_entries(ctx->xdp_maps.a2s_info);
+
+  if (max_entries && ((__u32)next.server_count > max_entries || (__u32)next.alias_count > map_max_entries(ctx->xdp_maps.a2s_alias)))
+  {
+    fprintf(stderr, "Warning: %d servers and %d aliases exceed the current map sizes, restart the service (non persistent) to resize the maps.\n",
+    next.server_count, next.alias_count);
+  }
+
+  // The trace output is opened once, the trace filters, sampling and switch are applied right away
+  if ((next.trace.pcap_file || ctx->trace.pcap_file) && (!next.trace.pcap_file || !ctx->trace.pcap_file || strcmp(next.trace.pcap_file, ctx->trace.pcap_file) != 0))
+  {
+    fprintf(stderr, "Warning: Changing 'trace.pcap' requires a restart, keeping %s.\n", ctx->trace.pcap_file ? ctx->trace.pcap_file : "stdout");
+  }
+
+  if (!apply_config_maps(ctx, &next))
+  {
+    // Roll the maps back to the running configuration, which stays in place
+    if (apply_config_maps(ctx, ctx))
+    {
+      fprintf(stderr, "Reload failed while updating BPF maps, keeping the previous configuration.\n");
+    }
+    else
+    {
+      fprintf(stderr, "ERROR: Reload failed while updating BPF maps, and the previous configuration could not be restored in them.\n");
+    }
+
+    free_config_lists(&next);
+    return false;
+  }
+
+  ctx->settings = next.settings;
+  ctx->persistent = next.persistent;
+
+  // Swap the server list, the fetcher picks it up by the generation change
+  pthread_mutex_lock(&ctx->servers_lock);
+
+  struct sockaddr_in *old_servers = ctx->servers;
+  ctx->servers = next.servers;
+  ctx->server_count = next.server_count;
+  ctx->servers_gen++;
+
+  pthread_mutex_unlock(&ctx->servers_lock);
+
+  next.servers = old_servers;
+
+  // Swap the remaining lists, the old ones are freed with the parsing context
+  struct a2s_alias *old_aliases = ctx->aliases;
+  ctx->aliases = next.aliases;
+  ctx->alias_count = next.alias_count;
+  next.aliases = old_aliases;
+
+  struct a2s_lpm_key *old_deny = ctx->deny_prefixes, *old_allow = ctx->allow_prefixes;
+  ctx->deny_prefixes = next.deny_prefixes;
+  ctx->deny_count = next.deny_count;
+  ctx->allow_prefixes = next.allow_prefixes;
+  ctx->allow_count = next.allow_count;
+  next.deny_prefixes = old_deny;
+  next.allow_prefixes = old_allow;
+
+  // Swap the trace filters, the output file stays the one the tracer opened
+  char *pcap_file = next.trace.pcap_file;
+  trace_cfg_t old_trace = ctx->trace;
+  ctx->trace = next.trace;
+  ctx->trace.pcap_file = old_trace.pcap_file;
+  next.trace = old_trace;
+  next.trace.pcap_file = pcap_file;
+
+  // Swap the latency settings, the next report (right away) uses them, the previous histograms are kept
+  latency_cfg_t old_latency = ctx->latency;
+  ctx->latency = next.latency;
+  next.latency = old_latency;
+  ctx->latency_at = 0;
+
+  // Swap the discovery settings, the next scan (right away) applies them
+  discovery_cfg_t old_discovery = ctx->discovery;
+  ctx->discovery = next.discovery;
+  next.discovery = old_discovery;
+  ctx->discover_at = 0;
+
+  // Drop the discovered servers if discovery got disabled
+  if (!ctx->discovery.enabled && ctx->discovered_count > 0)
+  {
+    pthread_mutex_lock(&ctx->servers_lock);
+
+    free(ctx->discovered);
+    ctx->discovered = NULL;
+    ctx->discovered_count = 0;
+    ctx->servers_gen++;
+
+    pthread_mutex_unlock(&ctx->servers_lock);
+  }
+
+  free_config_lists(&next);
+
+  printf("Configuration reloaded.\n");
+  return true;
+}
+
 /**
 * Handle termination signals to gracefully stop the query thread, detach the XDP program, close resources, and clean up before exiting
 *
@@ -223,39 +1257,44 @@ void termination_handler(loader_ctx_t *ctx, int sig)
     printf("\rReceived %s (signal %d). Starting graceful shutdown...\n", strsignal(sig), sig);
   }
 
-  // Stop the background query thread
+  // Stop the fetcher threads
   ctx->running = false;
 
-  // Wait for the background query thread to finish
-  if (ctx->query_tid)
-  {
-    // We can't wait for ourselves (prevent freeze)
-    if (!pthread_equal(pthread_self(), ctx->query_tid))
-    {
-      // When shutdown from main thread (signal)
-      printf("Waiting for background query thread to exit...\n");
-      pthread_join(ctx->query_tid, NULL);
-      printf("Background query thread exited. Cleaning up resources...\n");
-    }
-    else
-    {
-      // When shutdown from background query thread (internal/error)
-      printf("Internal shutdown from background query thread. Cleaning up resources...\n");
-    }
+  // Stop the control thread first, it forwards commands to the fetchers
+  stop_control(ctx);
 
-    // Set query thread ID to 0
-    ctx->query_tid = 0;
+  // Wait for the fetcher threads to finish (a fetcher shutting down on an internal error doesn't wait for itself)
+  if (ctx->workers)
+  {
+    printf("Waiting for the fetcher threads to exit...\n");
+    stop_fetchers(ctx);
+    printf("Fetcher threads exited. Cleaning up resources...\n");
   }
 
-  // Detach XDP program
-  if (ctx->prog)
+  // Stop reading the trace events (the pcap file is flushed and closed)
+  stop_tracer(ctx);
+
+  // Detach XDP program and remove the pinned maps, unless persistent mode keeps serving the cache while the loader is stopped
+  if (ctx->persistent)
+  {
+    printf("Persistent mode: leaving the XDP program attached and the maps pinned in %s.\n", A2S_PIN_ROOT);
+  }
+  else if (ctx->prog)
   {
     if (ctx->ifindex > 0)
     {
       detach_xdp(ctx->prog, ctx->ifindex);
     }
 
-    // Close XDP program and clean up memory
+    unpin_maps();
+  }
+
+  // Unmap the cookie key state before its map is closed
+  free_cookie_state(ctx);
+
+  // Close XDP program and clean up memory
+  if (ctx->prog)
+  {
     xdp_program__close(ctx->prog);
     ctx->prog = NULL;
   }
@@ -268,4 +1307,16 @@ void termination_handler(loader_ctx_t *ctx, int sig)
 
   // Exit program
   exit(sig == 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+/**
+* Get the current CLOCK_MONOTONIC time in nanoseconds (same clock as bpf_ktime_get_ns)
+*
+* @return Current monotonic time in nanoseconds.
+*/
+__u64 monotonic_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (__u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
 }
\ No newline at end of file
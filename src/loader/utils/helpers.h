@@ -1,22 +1,140 @@
 #pragma once
 
 #include <stdbool.h>
+#include <pthread.h>
+#include <linux/types.h>
 
+#include "a2s_defs.h"
 #include "xdp.h"
+#include "store.h"
 
+// Game server socket discovery settings (see the 'discovery' group of the configuration)
 typedef struct
+{
+  char **processes;
+  char **cgroups;
+  int process_count;
+  int cgroup_count;
+  int port_first;
+  int port_last;
+  int interval;
+  int max_servers;
+  bool enabled;
+} discovery_cfg_t;
+
+// Fetcher thread settings (see the 'fetcher' group of the configuration)
+typedef struct
+{
+  int *cpus;
+  int cpu_count;
+  int threads;
+  int interval_ms;
+  bool io_uring;
+  bool benchmark;
+} fetcher_cfg_t;
+
+// XDP trace event settings (see the 'trace' group of the configuration), enabled and sample are in the runtime settings
+typedef struct
+{
+  struct a2s_lpm_key *sources;
+  struct a2s_server_key *servers;
+  char *pcap_file;
+  int source_count;
+  int server_count;
+} trace_cfg_t;
+
+// XDP processing latency settings (see the 'latency' group of the configuration), enabled is in the runtime settings
+typedef struct
+{
+  char *prom_file;
+  int interval;
+} latency_cfg_t;
+
+struct loader_ctx;
+
+// Fetcher worker, each one queries its own shard of the servers with its own socket, epoll and timer
+typedef struct
+{
+  struct loader_ctx *ctx;
+  pthread_t tid;
+  int id;
+  int inbox[2];
+  int control[2];
+  _Atomic __u64 cycles;
+  _Atomic __u64 responses;
+  _Atomic __u64 syscalls;
+
+  // Cache entries committed to the BPF maps, and syscalls saved by committing them in batches rather than one by one
+  _Atomic __u64 map_changes;
+  _Atomic __u64 syscalls_saved;
+
+  // Servers of the worker with an A2S_INFO response committed at least once
+  _Atomic __u32 filled;
+
+  // Time spent handling the cycle ticks, only used by the worker
+  __u64 ticks;
+  __u64 tick_ns;
+  __u64 tick_max_ns;
+} fetch_worker_t;
+
+typedef struct loader_ctx
 {
   struct xdp_program *prog;
   struct sockaddr_in *servers;
+  struct sockaddr_in *discovered;
+  struct a2s_alias *aliases;
+  struct a2s_lpm_key *deny_prefixes;
+  struct a2s_lpm_key *allow_prefixes;
   char *ifname;
-  pthread_t query_tid;
+  fetch_worker_t *workers;
+  pthread_mutex_t servers_lock;
   xdp_maps_t xdp_maps;
+  a2s_store_t store;
+  struct a2s_settings settings;
+  struct a2s_cookie_state *cookie_state;
+  discovery_cfg_t discovery;
+  fetcher_cfg_t fetcher;
+  trace_cfg_t trace;
+  pthread_t trace_tid;
+  latency_cfg_t latency;
+  struct a2s_latency *latency_prev;
+  __u64 latency_at;
+  __u64 discover_at;
+  __u64 cookie_rotate_at;
   unsigned int ifindex;
   int server_count;
+  int discovered_count;
+  int worker_count;
+  _Atomic unsigned int servers_gen;
+  int alias_count;
+  int deny_count;
+  bool persistent;
+  int xdp_mode;
+  int allow_count;
+  bool tracing;
+  pthread_t control_tid;
+  bool controlling;
   _Atomic bool running;
 } loader_ctx_t;
 
 void cleanup(loader_ctx_t *ctx);
 bool parse_config_file(loader_ctx_t *ctx, const char *filename);
+bool reload_config(loader_ctx_t *ctx, const char *filename);
 void termination_handler(loader_ctx_t *ctx, int sig);
-void *a2s_query_servers(void *arg);
\ No newline at end of file
+__u64 monotonic_ns(void);
+bool init_cookie_keys(loader_ctx_t *ctx);
+bool rotate_cookie_keys(loader_ctx_t *ctx);
+void free_cookie_state(loader_ctx_t *ctx);
+void *a2s_query_servers(void *arg);
+bool start_fetchers(loader_ctx_t *ctx);
+void stop_fetchers(loader_ctx_t *ctx);
+bool discover_servers(loader_ctx_t *ctx);
+bool start_tracer(loader_ctx_t *ctx);
+void free_trace(trace_cfg_t *trace);
+void stop_tracer(loader_ctx_t *ctx);
+bool start_control(loader_ctx_t *ctx);
+void stop_control(loader_ctx_t *ctx);
+bool parse_server_addr(const char *str, struct sockaddr_in *addr);
+void report_latency(loader_ctx_t *ctx);
+void free_latency(loader_ctx_t *ctx);
+void free_discovery(discovery_cfg_t *discovery);
\ No newline at end of file
@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "config.h"
+#include "helpers.h"
+
+#define LATENCY_ENTRIES (A2S_QUERY_TYPES * A2S_LAT_PATHS)
+
+static const char *query_names[A2S_QUERY_TYPES] = { "A2S_INFO", "A2S_PLAYER", "A2S_RULES" };
+static const char *query_labels[A2S_QUERY_TYPES] = { "info", "player", "rules" };
+static const char *path_names[A2S_LAT_PATHS] = { "challenge", "data", "cookie_fail", "drop" };
+
+/**
+* Read the latency histograms of the XDP program, summed over the CPUs
+*
+* @param ctx Pointer to the loader context.
+* @param hist Array of LATENCY_ENTRIES histograms to fill.
+* @return true on success, or false on failure.
+*/
+static bool read_latency(loader_ctx_t *ctx, struct a2s_latency *hist)
+{
+  int cpus = libbpf_num_possible_cpus();
+
+  if (cpus <= 0)
+  {
+    fprintf(stderr, "ERROR: Could not get the number of possible CPUs (code %d).\n", cpus);
+    return false;
+  }
+
+  struct a2s_latency *values = malloc(cpus * sizeof(*values));
+
+  if (!values)
+  {
+    fprintf(stderr, "ERROR: Memory allocation failed for the latency histograms.\n");
+    return false;
+  }
+
+  memset(hist, 0, LATENCY_ENTRIES * sizeof(*hist));
+
+  for (__u32 idx = 0; idx < LATENCY_ENTRIES; idx++)
+  {
+    // One value per possible CPU
+    if (bpf_map_lookup_elem(ctx->xdp_maps.a2s_latency, &idx, values) < 0)
+    {
+      fprintf(stderr, "ERROR: Could not read the latency histogram %u: %s\n", idx, strerror(errno));
+      free(values);
+      return false;
+    }
+
+    for (int cpu = 0; cpu < cpus; cpu++)
+    {
+      for (int b = 0; b < A2S_LAT_BUCKETS; b++)
+      {
+        hist[idx].count[b] += values[cpu].count[b];
+      }
+
+      hist[idx].sum_ns += values[cpu].sum_ns;
+    }
+  }
+
+  free(values);
+  return true;
+}
+
+/**
+* Estimate a percentile from a log2 histogram (linear interpolation inside the bucket)
+*
+* @param hist Pointer to the histogram.
+* @param total Number of packets in the histogram.
+* @param pct Percentile (0 to 1).
+* @return Estimated latency in nanoseconds.
+*/
+static __u64 latency_percentile(const struct a2s_latency *hist, __u64 total, double pct)
+{
+  double rank = pct * total;
+  __u64 seen = 0;
+
+  for (int b = 0; b < A2S_LAT_BUCKETS; b++)
+  {
+    if (!hist->count[b] || seen + hist->count[b] < rank)
+    {
+      seen += hist->count[b];
+      continue;
+    }
+
+    // Bucket b holds [2^b, 2^(b+1)) nanoseconds, bucket 0 holds [0, 2)
+    double low = b ? (double)(1ULL << b) : 0;
+    double high = (double)(1ULL << (b + 1));
+
+    return low + (high - low) * (rank - seen) / hist->count[b];
+  }
+
+  return 1ULL << A2S_LAT_BUCKETS;
+}
+
+/**
+* Write the cumulative histograms in the Prometheus text format (written to a temporary file, then renamed)
+*
+* @param path Path to the output file.
+* @param hist Array of LATENCY_ENTRIES cumulative histograms.
+* @return true on success, or false on failure.
+*/
+static bool export_latency(const char *path, const struct a2s_latency *hist)
+{
+  char tmp_path[4096];
+  FILE *file;
+
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+  if (!(file = fopen(tmp_path, "w")))
+  {
+    fprintf(stderr, "ERROR: Could not open the latency export file %s: %s\n", tmp_path, strerror(errno));
+    return false;
+  }
+
+  fprintf(file, "# HELP a2s_xdp_latency_ns Processing time of the queries in the XDP program, by query type and path.\n");
+  fprintf(file, "# TYPE a2s_xdp_latency_ns histogram\n");
+
+  for (int k = 0; k < A2S_QUERY_TYPES; k++)
+  {
+    for (int p = 0; p < A2S_LAT_PATHS; p++)
+    {
+      const struct a2s_latency *h = &hist[k * A2S_LAT_PATHS + p];
+      __u64 total = 0;
+
+      // Buckets are cumulative, the upper bound of bucket b is 2^(b+1) and the last one is open
+      for (int b = 0; b < A2S_LAT_BUCKETS; b++)
+      {
+        total += h->count[b];
+
+        if (b < A2S_LAT_BUCKETS - 1)
+        {
+          fprintf(file, "a2s_xdp_latency_ns_bucket{query=\"%s\",path=\"%s\",le=\"%llu\"} %llu\n", query_labels[k], path_names[p],
+          1ULL << (b + 1), (unsigned long long)total);
+        }
+      }
+
+      fprintf(file, "a2s_xdp_latency_ns_bucket{query=\"%s\",path=\"%s\",le=\"+Inf\"} %llu\n", query_labels[k], path_names[p], (unsigned long long)total);
+      fprintf(file, "a2s_xdp_latency_ns_sum{query=\"%s\",path=\"%s\"} %llu\n", query_labels[k], path_names[p], (unsigned long long)h->sum_ns);
+      fprintf(file, "a2s_xdp_latency_ns_count{query=\"%s\",path=\"%s\"} %llu\n", query_labels[k], path_names[p], (unsigned long long)total);
+    }
+  }
+
+  if (fclose(file) != 0 || rename(tmp_path, path) < 0)
+  {
+    fprintf(stderr, "ERROR: Could not write the latency export file %s: %s\n", path, strerror(errno));
+    unlink(tmp_path);
+    return false;
+  }
+
+  return true;
+}
+
+/**
+* Print the processing latency percentiles of the last interval and export the cumulative histograms, when the interval is due.
+* Called every second by the main loop, does nothing while the latency histograms are disabled.
+*
+* @param ctx Pointer to the loader context.
+*/
+void report_latency(loader_ctx_t *ctx)
+{
+  struct a2s_latency hist[LATENCY_ENTRIES];
+  __u64 now = monotonic_ns();
+
+  if (!ctx->settings.latency_enabled || now < ctx->latency_at)
+  {
+    return;
+  }
+
+  ctx->latency_at = now + (__u64)ctx->latency.interval * 1000000000ULL;
+
+  if (!read_latency(ctx, hist))
+  {
+    return;
+  }
+
+  // The first report covers the time since the program was loaded (or the histograms were enabled)
+  if (!ctx->latency_prev && !(ctx->latency_prev = calloc(LATENCY_ENTRIES, sizeof(*ctx->latency_prev))))
+  {
+    fprintf(stderr, "ERROR: Memory allocation failed for the latency histograms.\n");
+    return;
+  }
+
+  for (int idx = 0; idx < LATENCY_ENTRIES; idx++)
+  {
+    struct a2s_latency delta;
+    __u64 total = 0;
+
+    // Counters only grow while the program is loaded
+    for (int b = 0; b < A2S_LAT_BUCKETS; b++)
+    {
+      delta.count[b] = hist[idx].count[b] - ctx->latency_prev[idx].count[b];
+      total += delta.count[b];
+    }
+
+    delta.sum_ns = hist[idx].sum_ns - ctx->latency_prev[idx].sum_ns;
+
+    if (!total)
+    {
+      continue;
+    }
+
+    printf("[LATENCY] %s %s: %llu packets, avg %llu ns, p50 %llu ns, p99 %llu ns, p99.9 %llu ns\n", query_names[idx / A2S_LAT_PATHS],
+    path_names[idx % A2S_LAT_PATHS], (unsigned long long)total, (unsigned long long)(delta.sum_ns / total),
+    (unsigned long long)latency_percentile(&delta, total, 0.5), (unsigned long long)latency_percentile(&delta, total, 0.99),
+    (unsigned long long)latency_percentile(&delta, total, 0.999));
+  }
+
+  memcpy(ctx->latency_prev, hist, sizeof(hist));
+
+  if (ctx->latency.prom_file)
+  {
+    export_latency(ctx->latency.prom_file, hist);
+  }
+}
+
+/**
+* Free the latency settings and the previous histograms
+*
+* @param ctx Pointer to the loader context.
+*/
+void free_latency(loader_ctx_t *ctx)
+{
+  free(ctx->latency.prom_file);
+  free(ctx->latency_prev);
+  ctx->latency.prom_file = NULL;
+  ctx->latency_prev = NULL;
+}
\ No newline at end of file
@@ -0,0 +1,444 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "snapshot.h"
+
+/**
+* Calculates the checksum of a snapshot record (header fields and the response data)
+*
+* @param rec Pointer to the record header.
+* @param data Response data (rec->size bytes).
+* @return CRC32 of the record, with the crc field taken as 0.
+*/
+static __u32 record_crc(const struct a2s_snapshot_record *rec, const unsigned char *data)
+{
+  struct a2s_snapshot_record head = *rec;
+  head.crc = 0;
+
+  uLong crc = crc32(0, (const Bytef *)&head, sizeof(head));
+  return (__u32)crc32(crc, data, rec->size);
+}
+
+/**
+* Starts writing a new snapshot into a temporary file next to the final one
+*
+* @param w Pointer to the snapshot writer.
+* @param path Path of the snapshot file.
+* @return true on success, or false on failure.
+*/
+bool snapshot_begin(snapshot_writer_t *w, const char *path)
+{
+  memset(w, 0, sizeof(*w));
+
+  if (snprintf(w->tmp_path, sizeof(w->tmp_path), "%s.tmp", path) >= (int)sizeof(w->tmp_path))
+  {
+    fprintf(stderr, "ERROR: Snapshot path is too long: %s\n", path);
+    return false;
+  }
+
+  // Create the state directory if it does not exist yet
+  char dir[sizeof(w->tmp_path)];
+  snprintf(dir, sizeof(dir), "%s", path);
+  mkdir(dirname(dir), 0755);
+
+  if (!(w->fp = fopen(w->tmp_path, "wb")))
+  {
+    fprintf(stderr, "ERROR: Could not create snapshot file %s: %s\n", w->tmp_path, strerror(errno));
+    return false;
+  }
+
+  // Reserve space for the header, written with the final record count on commit
+  struct a2s_snapshot_header header = {0};
+
+  if (fwrite(&header, sizeof(header), 1, w->fp) != 1)
+  {
+    fprintf(stderr, "ERROR: Could not write snapshot header: %s\n", strerror(errno));
+    fclose(w->fp);
+    unlink(w->tmp_path);
+    w->fp = NULL;
+    return false;
+  }
+
+  return true;
+}
+
+/**
+* Appends a cached response to the snapshot
+*
+* @param w Pointer to the snapshot writer.
+* @param key Server key.
+* @param qidx Query type index (A2S_IDX_*).
+* @param updated Unix time (seconds) of the last successful fetch of the response.
+* @param data Response data.
+* @param size Response size.
+* @return true on success, or false on failure.
+*/
+bool snapshot_add(snapshot_writer_t *w, const struct a2s_server_key *key, __u32 qidx, __u64 updated, const unsigned char *data, __u32 size)
+{
+  struct a2s_snapshot_record rec;
+
+  if (!w->fp || !size || size > A2S_MAX_SIZE)
+  {
+    return false;
+  }
+
+  // Zero everything, including the struct padding, so the checksum is deterministic
+  memset(&rec, 0, sizeof(rec));
+  rec.key.ip = key->ip;
+  rec.key.port = key->port;
+  rec.qidx = qidx;
+  rec.size = size;
+  rec.updated = updated;
+  rec.crc = record_crc(&rec, data);
+
+  // Length prefixed: the header, then only the used bytes of the response
+  if (fwrite(&rec, sizeof(rec), 1, w->fp) != 1 || fwrite(data, 1, size, w->fp) != size)
+  {
+    fprintf(stderr, "ERROR: Could not write snapshot record: %s\n", strerror(errno));
+    return false;
+  }
+
+  w->count++;
+  return true;
+}
+
+/**
+* Finishes the snapshot: writes the header, syncs the file and atomically replaces the previous snapshot
+*
+* @param w Pointer to the snapshot writer.
+* @param path Path of the snapshot file.
+* @return true on success, or false on failure (the previous snapshot is kept).
+*/
+bool snapshot_commit(snapshot_writer_t *w, const char *path)
+{
+  struct a2s_snapshot_header header =
+  {
+    .magic = A2S_SNAPSHOT_MAGIC,
+    .version = A2S_SNAPSHOT_VERSION,
+    .record_size = sizeof(struct a2s_snapshot_record),
+    .record_count = w->count,
+    .created = (__u64)time(NULL)
+  };
+
+  if (!w->fp)
+  {
+    return false;
+  }
+
+  bool ok = fseek(w->fp, 0, SEEK_SET) == 0
+  && fwrite(&header, sizeof(header), 1, w->fp) == 1
+  && fflush(w->fp) == 0
+  && fsync(fileno(w->fp)) == 0;
+
+  if (fclose(w->fp) != 0)
+  {
+    ok = false;
+  }
+
+  w->fp = NULL;
+
+  if (!ok || rename(w->tmp_path, path) < 0)
+  {
+    fprintf(stderr, "ERROR: Could not save snapshot file %s: %s\n", path, strerror(errno));
+    unlink(w->tmp_path);
+    return false;
+  }
+
+  return true;
+}
+
+/**
+* Writes a snapshot of the given responses, read back from the response store.
+* Entries whose slot no longer holds the response they were taken with (released and reused since) are skipped.
+*
+* @param store Pointer to the response store.
+* @param path Path of the snapshot file.
+* @param entries Responses to save.
+* @param count Number of entries.
+* @return Number of records written, or -1 on failure (the previous snapshot is kept).
+*/
+int snapshot_write(const a2s_store_t *store, const char *path, const struct a2s_snapshot_entry *entries, __u32 count)
+{
+  snapshot_writer_t w;
+  unsigned char data[A2S_MAX_SIZE];
+
+  if (!snapshot_begin(&w, path))
+  {
+    return -1;
+  }
+
+  for (__u32 i = 0; i < count; i++)
+  {
+    const struct a2s_snapshot_entry *e = &entries[i];
+    int size = store_read(store, &e->ref, data);
+
+    if (size < 0 || store_hash(store, data, (size_t)size) != e->hash)
+    {
+      continue;
+    }
+
+    snapshot_add(&w, &e->key, e->qidx, e->updated, data, (__u32)size);
+  }
+
+  return snapshot_commit(&w, path) ? (int)w.count : -1;
+}
+
+/**
+* Snapshot writer thread
+*
+* @param arg Pointer to the snapshot job.
+* @return NULL
+*/
+static void *snapshot_job_run(void *arg)
+{
+  snapshot_job_t *job = (snapshot_job_t *)arg;
+  int written = snapshot_write(job->store, job->path, job->entries, job->count);
+
+  #ifdef A2S_DEBUG
+  if (written >= 0)
+  {
+    printf("[A2S] Snapshot %s saved: %d entries.\n", job->path, written);
+  }
+  #else
+  (void)written;
+  #endif
+
+  __atomic_store_n(&job->done, true, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+/**
+* Checks whether the previous snapshot of a job is still being written, and reaps its thread once it is done
+*
+* @param job Pointer to the snapshot job.
+* @return true if the writer thread is still running (the entries must not be touched), false otherwise.
+*/
+bool snapshot_job_busy(snapshot_job_t *job)
+{
+  if (!job->started)
+  {
+    return false;
+  }
+
+  if (!__atomic_load_n(&job->done, __ATOMIC_ACQUIRE))
+  {
+    return true;
+  }
+
+  pthread_join(job->thread, NULL);
+  job->started = false;
+  return false;
+}
+
+/**
+* Starts writing the entries of a job (store, path, entries and count set by the caller) on a background thread
+*
+* @param job Pointer to the snapshot job.
+* @return true if the thread was started, false otherwise (nothing is written).
+*/
+bool snapshot_job_start(snapshot_job_t *job)
+{
+  job->done = false;
+
+  int ret = pthread_create(&job->thread, NULL, snapshot_job_run, job);
+
+  if (ret != 0)
+  {
+    fprintf(stderr, "ERROR: Could not start the snapshot writer: %s\n", strerror(ret));
+    return false;
+  }
+
+  job->started = true;
+  return true;
+}
+
+/**
+* Waits for the running snapshot of a job, then frees its entries
+*
+* @param job Pointer to the snapshot job.
+*/
+void snapshot_job_free(snapshot_job_t *job)
+{
+  if (job->started)
+  {
+    pthread_join(job->thread, NULL);
+    job->started = false;
+  }
+
+  free(job->entries);
+  job->entries = NULL;
+  job->count = job->capacity = 0;
+}
+
+/**
+* Build the snapshot file path of a fetcher shard (the first shard uses the base path)
+*
+* @param buf Output buffer.
+* @param size Size of the output buffer.
+* @param base Base path of the snapshot file.
+* @param shard Fetcher shard (worker) index.
+*/
+void snapshot_path(char *buf, size_t size, const char *base, int shard)
+{
+  if (shard == 0)
+  {
+    snprintf(buf, size, "%s", base);
+  }
+  else
+  {
+    snprintf(buf, size, "%s.%d", base, shard);
+  }
+}
+
+/**
+* Loads the cached responses of a snapshot into the response store and the BPF maps (batched per map).
+* Records that are corrupted or older than max_age seconds are skipped.
+*
+* @param xdp_maps Structure holding the BPF map FDs.
+* @param store Pointer to the response store.
+* @param path Path of the snapshot file.
+* @param max_age Maximum age (in seconds) of the loaded entries.
+* @return Number of entries loaded, or a negative error code on failure.
+*/
+int snapshot_load(const xdp_maps_t *xdp_maps, a2s_store_t *store, const char *path, __u64 max_age)
+{
+  const int map_fds[A2S_QUERY_TYPES] = { xdp_maps->a2s_info, xdp_maps->a2s_player, xdp_maps->a2s_rules };
+  struct a2s_server_key *keys[A2S_QUERY_TYPES] = {0};
+  struct a2s_ref *refs[A2S_QUERY_TYPES] = {0};
+  store_batch_t batch = {0};
+  __u32 counts[A2S_QUERY_TYPES] = {0};
+  struct a2s_snapshot_header header;
+  struct a2s_snapshot_record rec;
+  unsigned char data[A2S_MAX_SIZE];
+  int loaded = 0, skipped = 0, err = 0;
+
+  FILE *fp = fopen(path, "rb");
+
+  if (!fp)
+  {
+    // No snapshot yet (first start) is not an error
+    return errno == ENOENT ? 0 : -errno;
+  }
+
+  // Validate the header (a truncated write is detected while reading the records)
+  if (fread(&header, sizeof(header), 1, fp) != 1
+  || header.magic != A2S_SNAPSHOT_MAGIC || header.version != A2S_SNAPSHOT_VERSION
+  || header.record_size != sizeof(rec))
+  {
+    fprintf(stderr, "Warning: Ignoring invalid snapshot file %s.\n", path);
+    fclose(fp);
+    return -EINVAL;
+  }
+
+  for (size_t k = 0; k < A2S_QUERY_TYPES; k++)
+  {
+    keys[k] = calloc(header.record_count ? header.record_count : 1, sizeof(*keys[k]));
+    refs[k] = calloc(header.record_count ? header.record_count : 1, sizeof(*refs[k]));
+
+    if (!keys[k] || !refs[k])
+    {
+      fprintf(stderr, "Memory allocation failed for snapshot entries.\n");
+      err = -ENOMEM;
+      goto cleanup;
+    }
+  }
+
+  if (!store_batch_init(&batch))
+  {
+    err = -ENOMEM;
+    goto cleanup;
+  }
+
+  __u64 now = (__u64)time(NULL);
+
+  for (__u32 i = 0; i < header.record_count; i++)
+  {
+    // A bad length cannot be skipped over, the rest of the file is unreadable
+    if (fread(&rec, sizeof(rec), 1, fp) != 1 || rec.size > A2S_MAX_SIZE || fread(data, 1, rec.size, fp) != rec.size)
+    {
+      fprintf(stderr, "Warning: Snapshot file %s is truncated or corrupted.\n", path);
+      err = -EIO;
+      goto cleanup;
+    }
+
+    if (rec.qidx >= A2S_QUERY_TYPES || rec.size < A2S_MIN_SIZE
+    || rec.crc != record_crc(&rec, data) || rec.updated + max_age < now)
+    {
+      skipped++;
+      continue;
+    }
+
+    // The responses go into the store first, the per server maps reference them once they are all written
+    // (identical responses of several servers share one slot)
+    struct a2s_ref ref;
+    bool write;
+
+    if (store_batch_full(&batch) && store_batch_flush(store, &batch, NULL) > 0)
+    {
+      err = -EIO;
+      goto cleanup;
+    }
+
+    if (!store_intern(store, rec.size, store_hash(store, data, rec.size), &ref, &write))
+    {
+      skipped++;
+      continue;
+    }
+
+    if (write)
+    {
+      store_batch_add(&batch, &ref, data);
+    }
+
+    __u32 n = counts[rec.qidx]++;
+    keys[rec.qidx][n] = rec.key;
+    refs[rec.qidx][n] = ref;
+  }
+
+  if (store_batch_flush(store, &batch, NULL) > 0)
+  {
+    err = -EIO;
+    goto cleanup;
+  }
+
+  for (size_t k = 0; k < A2S_QUERY_TYPES; k++)
+  {
+    int ret = update_map_batch(map_fds[k], keys[k], refs[k], counts[k], sizeof(*keys[k]), sizeof(*refs[k]), NULL);
+
+    if (ret < 0)
+    {
+      fprintf(stderr, "ERROR: Could not load snapshot entries into the maps: %s (code %d)\n", strerror(-ret), ret);
+      continue;
+    }
+
+    loaded += ret;
+  }
+
+  printf("Snapshot %s: %d entries loaded, %d stale or invalid skipped.\n", path, loaded, skipped);
+
+cleanup:
+  for (size_t k = 0; k < A2S_QUERY_TYPES; k++)
+  {
+    // Nothing references the slots of a failed load
+    if (err)
+    {
+      store_release(store, refs[k], counts[k]);
+    }
+
+    free(keys[k]);
+    free(refs[k]);
+  }
+
+  store_batch_free(&batch);
+
+  fclose(fp);
+  return err ? err : loaded;
+}
\ No newline at end of file
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <linux/types.h>
+
+#include "a2s_defs.h"
+#include "xdp.h"
+#include "store.h"
+
+// Snapshot file identification ("A2SS" in little endian) and format version
+#define A2S_SNAPSHOT_MAGIC 0x53533241
+#define A2S_SNAPSHOT_VERSION 2
+
+struct a2s_snapshot_header
+{
+  __u32 magic;
+  __u32 version;
+  __u32 record_size;
+  __u32 record_count;
+  __u64 created;
+};
+
+// Record header, one per cached response, followed by the size bytes of the response
+struct a2s_snapshot_record
+{
+  struct a2s_server_key key;
+  __u32 qidx;
+  __u32 size;
+  __u64 updated;
+  __u32 crc;
+  __u32 reserved;
+};
+
+// Cached response to save, copied from the fetcher state (the data is read back from the store by the writer)
+struct a2s_snapshot_entry
+{
+  struct a2s_server_key key;
+  struct a2s_ref ref;
+  __u64 hash;
+  __u64 updated;
+  __u32 qidx;
+};
+
+typedef struct
+{
+  FILE *fp;
+  char tmp_path[256];
+  __u32 count;
+} snapshot_writer_t;
+
+// Snapshot written by a background thread, so the fetcher loop does not wait for the disk
+typedef struct
+{
+  const a2s_store_t *store;
+  struct a2s_snapshot_entry *entries;
+  __u32 count;
+  __u32 capacity;
+  char path[256];
+  pthread_t thread;
+  bool started;
+  bool done;
+} snapshot_job_t;
+
+bool snapshot_begin(snapshot_writer_t *w, const char *path);
+bool snapshot_add(snapshot_writer_t *w, const struct a2s_server_key *key, __u32 qidx, __u64 updated, const unsigned char *data, __u32 size);
+bool snapshot_commit(snapshot_writer_t *w, const char *path);
+int snapshot_write(const a2s_store_t *store, const char *path, const struct a2s_snapshot_entry *entries, __u32 count);
+bool snapshot_job_busy(snapshot_job_t *job);
+bool snapshot_job_start(snapshot_job_t *job);
+void snapshot_job_free(snapshot_job_t *job);
+void snapshot_path(char *buf, size_t size, const char *base, int shard);
+int snapshot_load(const xdp_maps_t *xdp_maps, a2s_store_t *store, const char *path, __u64 max_age);
\ No newline at end of file
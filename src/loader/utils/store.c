@@ -0,0 +1,616 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/random.h>
+#include <bpf/bpf.h>
+
+#include "config.h"
+#include "siphash.h"
+#include "store.h"
+#include "helpers.h"
+
+// A released slot is reused only after this delay, far longer than an XDP program run that read its old reference
+#define STORE_GRACE_NS (100 * 1000000ULL)
+
+static const unsigned int class_pct[A2S_STORE_CLASSES] = A2S_STORE_CLASS_PCT;
+
+/**
+* Number of slots of a size class for the size of the per server maps
+*
+* @param cls Size class.
+* @param map_entries max_entries of the per server maps.
+* @return Number of slots.
+*/
+__u32 store_slots(int cls, __u32 map_entries)
+{
+  __u64 slots = (__u64)map_entries * class_pct[cls] / 100;
+  return slots > 0 ? (__u32)slots : 1;
+}
+
+/**
+* Smallest size class a response fits in
+*
+* @param size Response size (at most A2S_MAX_SIZE).
+* @return Size class.
+*/
+static int size_class(size_t size)
+{
+  int cls = 0;
+
+  while (cls < A2S_STORE_CLASSES - 1 && size > A2S_STORE_CLASS_SIZE(cls))
+  {
+    cls++;
+  }
+
+  return cls;
+}
+
+/**
+* Content index entry of a hash, Fibonacci hashing of the already mixed hash keeps the probes spread
+*/
+static inline __u32 index_pos(const a2s_store_t *st, __u64 hash)
+{
+  return (__u32)((hash * 0x9E3779B97F4A7C15ULL) >> 32) & st->index_mask;
+}
+
+/**
+* Find the slot holding a response (lock held)
+*
+* @param st Pointer to the store.
+* @param hash Hash of the response.
+* @param size Response size.
+* @return base[cls] + slot + 1 of the slot, or 0 if no slot holds it.
+*/
+static __u32 index_find(const a2s_store_t *st, __u64 hash, size_t size)
+{
+  for (__u32 i = index_pos(st, hash); st->index[i]; i = (i + 1) & st->index_mask)
+  {
+    __u32 g = st->index[i] - 1;
+
+    if (st->hash[g] == hash && st->size[g] == size)
+    {
+      return st->index[i];
+    }
+  }
+
+  return 0;
+}
+
+/**
+* Add a slot to the content index (lock held, the index has twice as many entries as there are slots)
+*
+* @param st Pointer to the store.
+* @param g base[cls] + slot of the slot.
+*/
+static void index_insert(a2s_store_t *st, __u32 g)
+{
+  __u32 i = index_pos(st, st->hash[g]);
+
+  while (st->index[i])
+  {
+    i = (i + 1) & st->index_mask;
+  }
+
+  st->index[i] = g + 1;
+}
+
+/**
+* Remove a slot from the content index (lock held), the following entries of the probe sequence are shifted back
+*
+* @param st Pointer to the store.
+* @param g base[cls] + slot of the slot.
+*/
+static void index_remove(a2s_store_t *st, __u32 g)
+{
+  __u32 i = index_pos(st, st->hash[g]);
+
+  while (st->index[i] && st->index[i] != g + 1)
+  {
+    i = (i + 1) & st->index_mask;
+  }
+
+  if (!st->index[i])
+  {
+    return;
+  }
+
+  // Move back each entry that would not be found past the hole anymore
+  for (__u32 j = (i + 1) & st->index_mask; st->index[j]; j = (j + 1) & st->index_mask)
+  {
+    __u32 home = index_pos(st, st->hash[st->index[j] - 1]);
+
+    if (((j - home) & st->index_mask) >= ((j - i) & st->index_mask))
+    {
+      st->index[i] = st->index[j];
+      i = j;
+    }
+  }
+
+  st->index[i] = 0;
+}
+
+/**
+* Set up the slot allocator of the response store. Slots referenced by the per server maps
+* (warm restart, or a snapshot loaded before) stay in use with their reference counts and content hashes, the others are free.
+*
+* @param st Pointer to the store.
+* @param xdp_maps Structure holding the BPF map FDs.
+* @return true on success, or false on failure.
+*/
+bool store_init(a2s_store_t *st, const xdp_maps_t *xdp_maps)
+{
+  const int map_fds[A2S_QUERY_TYPES] = { xdp_maps->a2s_info, xdp_maps->a2s_player, xdp_maps->a2s_rules };
+  unsigned char data[A2S_MAX_SIZE];
+  __u64 bytes = 0;
+  __u32 total = 0, entries = 16;
+
+  memset(st, 0, sizeof(*st));
+  pthread_mutex_init(&st->lock, NULL);
+
+  if (getrandom(st->hash_key, sizeof(st->hash_key), 0) != sizeof(st->hash_key))
+  {
+    perror("getrandom failed for the response store hash key");
+    return false;
+  }
+
+  for (int c = 0; c < A2S_STORE_CLASSES; c++)
+  {
+    st->map_fds[c] = xdp_maps->a2s_store[c];
+    st->capacity[c] = map_max_entries(st->map_fds[c]);
+    st->base[c] = total;
+
+    if (st->capacity[c] == 0
+    || !(st->free_slots[c] = calloc(st->capacity[c], sizeof(__u32)))
+    || !(st->pending[c] = calloc(st->capacity[c], sizeof(__u32)))
+    || !(st->pending_ns[c] = calloc(st->capacity[c], sizeof(__u64))))
+    {
+      fprintf(stderr, "ERROR: Response store initialization failed for the %u bytes class.\n", A2S_STORE_CLASS_SIZE(c));
+      store_free(st);
+      return false;
+    }
+
+    total += st->capacity[c];
+    bytes += (__u64)st->capacity[c] * A2S_STORE_CLASS_SIZE(c);
+  }
+
+  // Keep the load factor of the content index at or below 50%
+  while (entries < total * 2)
+  {
+    entries <<= 1;
+  }
+
+  if (!(st->refcount = calloc(total, sizeof(__u32))) || !(st->hash = calloc(total, sizeof(__u64)))
+  || !(st->size = calloc(total, sizeof(__u16))) || !(st->written = calloc(total, sizeof(bool)))
+  || !(st->index = calloc(entries, sizeof(__u32))))
+  {
+    fprintf(stderr, "ERROR: Response store initialization failed (content index).\n");
+    store_free(st);
+    return false;
+  }
+
+  st->index_mask = entries - 1;
+
+  // Keep the slots of the responses already cached, hashed back from their content
+  for (size_t k = 0; k < A2S_QUERY_TYPES; k++)
+  {
+    struct a2s_server_key key, next_key;
+    struct a2s_ref ref;
+    int ret = bpf_map_get_next_key(map_fds[k], NULL, &next_key);
+
+    while (ret == 0)
+    {
+      key = next_key;
+      ret = bpf_map_get_next_key(map_fds[k], &key, &next_key);
+
+      if (bpf_map_lookup_elem(map_fds[k], &key, &ref) < 0 || ref.size == 0 || ref.cls >= A2S_STORE_CLASSES || ref.slot >= st->capacity[ref.cls])
+      {
+        continue;
+      }
+
+      __u32 g = st->base[ref.cls] + ref.slot;
+
+      st->references++;
+
+      if (st->refcount[g]++ > 0)
+      {
+        continue;
+      }
+
+      int size = store_read(st, &ref, data);
+
+      st->in_use++;
+      st->size[g] = ref.size;
+      st->written[g] = true;
+
+      // Slots with the same content (cached before the interning) stay as they are, only the first one is indexed
+      if (size >= 0)
+      {
+        st->hash[g] = store_hash(st, data, (size_t)size);
+
+        if (!index_find(st, st->hash[g], ref.size))
+        {
+          index_insert(st, g);
+        }
+      }
+    }
+  }
+
+  // Free slots are taken from the end of the list, lowest slots first
+  for (int c = 0; c < A2S_STORE_CLASSES; c++)
+  {
+    for (__u32 i = st->capacity[c]; i-- > 0;)
+    {
+      if (!st->refcount[st->base[c] + i])
+      {
+        st->free_slots[c][st->free_count[c]++] = i;
+      }
+    }
+  }
+
+  printf("Response store: %u x 256, %u x 512, %u x 1024, %u x %d bytes slots (%.1f MiB), %u in use by %u cached responses.\n",
+  st->capacity[0], st->capacity[1], st->capacity[2], st->capacity[3], A2S_MAX_SIZE, bytes / 1048576.0, st->in_use, st->references);
+
+  return true;
+}
+
+/**
+* Free the slot allocator of the response store
+*
+* @param st Pointer to the store.
+*/
+void store_free(a2s_store_t *st)
+{
+  for (int c = 0; c < A2S_STORE_CLASSES; c++)
+  {
+    free(st->free_slots[c]);
+    free(st->pending[c]);
+    free(st->pending_ns[c]);
+    st->free_slots[c] = NULL;
+    st->pending[c] = NULL;
+    st->pending_ns[c] = NULL;
+    st->free_count[c] = 0;
+    st->pending_count[c] = 0;
+  }
+
+  free(st->refcount);
+  free(st->hash);
+  free(st->size);
+  free(st->written);
+  free(st->index);
+  st->refcount = NULL;
+  st->hash = NULL;
+  st->size = NULL;
+  st->written = NULL;
+  st->index = NULL;
+}
+
+/**
+* Content hash of a response for the interning: keyed with the random key of the store, so the responses
+* of a game server cannot be crafted to collide with another server's and be served in its place
+*
+* @param st Pointer to the store.
+* @param data Response.
+* @param size Response size.
+* @return 64-bit hash.
+*/
+__u64 store_hash(const a2s_store_t *st, const void *data, size_t size)
+{
+  return siphash13(st->hash_key[0], st->hash_key[1], data, size);
+}
+
+/**
+* Give the released slots whose grace delay passed back to the free lists (lock held)
+*
+* @param st Pointer to the store.
+* @param now_ns Current monotonic time in nanoseconds.
+*/
+static void reclaim(a2s_store_t *st, __u64 now_ns)
+{
+  for (int c = 0; c < A2S_STORE_CLASSES; c++)
+  {
+    while (st->pending_count[c] > 0 && st->pending_ns[c][st->pending_head[c]] + STORE_GRACE_NS <= now_ns)
+    {
+      st->free_slots[c][st->free_count[c]++] = st->pending[c][st->pending_head[c]];
+      st->pending_head[c] = (st->pending_head[c] + 1) % st->capacity[c];
+      st->pending_count[c]--;
+    }
+  }
+}
+
+/**
+* Take a reference to the slot of a response: the slot already holding the same content (same hash and size),
+* or else a free slot in the smallest size class it fits in with a free slot.
+* When write is set, the caller must write the response into the slot (store_batch_add) before committing the reference;
+* this is also the case for a shared slot whose first write is not committed yet (an identical write is harmless).
+*
+* @param st Pointer to the store.
+* @param size Response size (at most A2S_MAX_SIZE).
+* @param hash Hash of the response (store_hash).
+* @param ref Output reference of the slot.
+* @param write Output, whether the response must be written into the slot.
+* @return true on success, or false if the store is full for this size.
+*/
+bool store_intern(a2s_store_t *st, size_t size, __u64 hash, struct a2s_ref *ref, bool *write)
+{
+  bool found = false;
+
+  pthread_mutex_lock(&st->lock);
+
+  __u32 id = index_find(st, hash, size);
+
+  if (id)
+  {
+    __u32 g = id - 1;
+    int c = A2S_STORE_CLASSES - 1;
+
+    while (c > 0 && g < st->base[c])
+    {
+      c--;
+    }
+
+    ref->slot = g - st->base[c];
+    ref->cls = (__u8)c;
+    st->refcount[g]++;
+    *write = !st->written[g];
+    found = true;
+  }
+  else
+  {
+    reclaim(st, monotonic_ns());
+
+    for (int c = size_class(size); c < A2S_STORE_CLASSES && !found; c++)
+    {
+      if (st->free_count[c] > 0)
+      {
+        __u32 g;
+
+        ref->slot = st->free_slots[c][--st->free_count[c]];
+        ref->cls = (__u8)c;
+
+        g = st->base[c] + ref->slot;
+        st->refcount[g] = 1;
+        st->hash[g] = hash;
+        st->size[g] = (__u16)size;
+        st->written[g] = false;
+        index_insert(st, g);
+
+        st->in_use++;
+        *write = true;
+        found = true;
+      }
+    }
+  }
+
+  if (found)
+  {
+    ref->size = (__u16)size;
+    ref->reserved = 0;
+    st->references++;
+  }
+
+  pthread_mutex_unlock(&st->lock);
+  return found;
+}
+
+/**
+* Drop references to slots that are no longer referenced by the per server maps (references with size 0 are skipped).
+* A slot whose last reference is dropped leaves the content index and is reused after the grace delay.
+*
+* @param st Pointer to the store.
+* @param refs References of the released slots.
+* @param count Number of references.
+*/
+void store_release(a2s_store_t *st, const struct a2s_ref *refs, __u32 count)
+{
+  __u64 now_ns = monotonic_ns();
+
+  pthread_mutex_lock(&st->lock);
+
+  for (__u32 i = 0; i < count; i++)
+  {
+    __u8 c = refs[i].cls;
+
+    if (refs[i].size == 0 || c >= A2S_STORE_CLASSES || refs[i].slot >= st->capacity[c])
+    {
+      continue;
+    }
+
+    __u32 g = st->base[c] + refs[i].slot;
+
+    if (st->refcount[g] == 0)
+    {
+      continue;
+    }
+
+    st->references--;
+
+    // Still shared by other servers
+    if (--st->refcount[g] > 0 || st->pending_count[c] >= st->capacity[c])
+    {
+      continue;
+    }
+
+    index_remove(st, g);
+    st->written[g] = false;
+    st->in_use--;
+
+    __u32 tail = (st->pending_head[c] + st->pending_count[c]++) % st->capacity[c];
+    st->pending[c][tail] = refs[i].slot;
+    st->pending_ns[c][tail] = now_ns;
+  }
+
+  pthread_mutex_unlock(&st->lock);
+}
+
+/**
+* Check whether the response of a reference was written into its slot (store_batch_flush succeeded for it)
+*
+* @param st Pointer to the store.
+* @param ref Reference of the response.
+* @return true if the slot holds the response, or false otherwise.
+*/
+bool store_written(a2s_store_t *st, const struct a2s_ref *ref)
+{
+  if (ref->cls >= A2S_STORE_CLASSES || ref->slot >= st->capacity[ref->cls])
+  {
+    return false;
+  }
+
+  pthread_mutex_lock(&st->lock);
+  bool written = st->written[st->base[ref->cls] + ref->slot];
+  pthread_mutex_unlock(&st->lock);
+
+  return written;
+}
+
+/**
+* Read a response from the response store
+*
+* @param st Pointer to the store.
+* @param ref Reference of the response.
+* @param buf Output buffer (A2S_MAX_SIZE bytes).
+* @return Response size, or a negative error code on failure.
+*/
+int store_read(const a2s_store_t *st, const struct a2s_ref *ref, unsigned char *buf)
+{
+  __u32 slot = ref->slot;
+
+  if (ref->cls >= A2S_STORE_CLASSES || ref->size > A2S_STORE_CLASS_SIZE(ref->cls))
+  {
+    return -EINVAL;
+  }
+
+  if (bpf_map_lookup_elem(st->map_fds[ref->cls], &slot, buf) < 0)
+  {
+    return -errno;
+  }
+
+  return ref->size;
+}
+
+/**
+* Allocate the buffers of a store batch (A2S_BATCH_SIZE writes per size class)
+*
+* @param b Pointer to the batch.
+* @return true on success, or false on memory allocation failure.
+*/
+bool store_batch_init(store_batch_t *b)
+{
+  memset(b, 0, sizeof(*b));
+
+  for (int c = 0; c < A2S_STORE_CLASSES; c++)
+  {
+    if (!(b->slots[c] = calloc(A2S_BATCH_SIZE, sizeof(__u32)))
+    || !(b->data[c] = calloc(A2S_BATCH_SIZE, A2S_STORE_CLASS_SIZE(c))))
+    {
+      perror("store batch calloc failed");
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/**
+* Free the buffers of a store batch
+*
+* @param b Pointer to the batch.
+*/
+void store_batch_free(store_batch_t *b)
+{
+  for (int c = 0; c < A2S_STORE_CLASSES; c++)
+  {
+    free(b->slots[c]);
+    free(b->data[c]);
+  }
+}
+
+/**
+* Check whether a store batch has no room left in one of its size classes
+*
+* @param b Pointer to the batch.
+* @return true if the batch must be flushed before adding a write.
+*/
+bool store_batch_full(const store_batch_t *b)
+{
+  for (int c = 0; c < A2S_STORE_CLASSES; c++)
+  {
+    if (b->count[c] >= A2S_BATCH_SIZE)
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/**
+* Queue the write of a response into its slot (the batch must not be full), unless the batch already writes that slot
+*
+* @param b Pointer to the batch.
+* @param ref Reference of the slot (from store_intern).
+* @param data Response (ref->size bytes).
+*/
+void store_batch_add(store_batch_t *b, const struct a2s_ref *ref, const void *data)
+{
+  for (__u32 i = 0; i < b->count[ref->cls]; i++)
+  {
+    if (b->slots[ref->cls][i] == ref->slot)
+    {
+      return;
+    }
+  }
+
+  __u32 n = b->count[ref->cls]++;
+  unsigned char *dst = b->data[ref->cls] + (size_t)n * A2S_STORE_CLASS_SIZE(ref->cls);
+
+  b->slots[ref->cls][n] = ref->slot;
+  memcpy(dst, data, ref->size);
+  memset(dst + ref->size, 0, A2S_STORE_CLASS_SIZE(ref->cls) - ref->size);
+}
+
+/**
+* Write the queued responses into the store maps, one batch per size class, and mark the slots written for store_intern.
+* Must complete before the per server maps reference the written slots.
+*
+* @param st Pointer to the store.
+* @param b Pointer to the batch.
+* @param syscalls Incremented by the number of syscalls used (may be NULL).
+* @return Number of responses that could not be written.
+*/
+int store_batch_flush(a2s_store_t *st, store_batch_t *b, __u32 *syscalls)
+{
+  int failed = 0;
+
+  for (int c = 0; c < A2S_STORE_CLASSES; c++)
+  {
+    if (b->count[c] == 0)
+    {
+      continue;
+    }
+
+    int ret = update_map_batch(st->map_fds[c], b->slots[c], b->data[c], b->count[c], sizeof(__u32), A2S_STORE_CLASS_SIZE(c), syscalls);
+
+    if (ret < (int)b->count[c])
+    {
+      failed += ret < 0 ? (int)b->count[c] : (int)b->count[c] - ret;
+      fprintf(stderr, "[STORE] Writing %u responses into the %u bytes class failed: %s\n", b->count[c], A2S_STORE_CLASS_SIZE(c), strerror(ret < 0 ? -ret : errno));
+    }
+    else
+    {
+      pthread_mutex_lock(&st->lock);
+
+      for (__u32 i = 0; i < b->count[c]; i++)
+      {
+        st->written[st->base[c] + b->slots[c][i]] = true;
+      }
+
+      pthread_mutex_unlock(&st->lock);
+    }
+
+    b->count[c] = 0;
+  }
+
+  return failed;
+}
\ No newline at end of file
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <linux/types.h>
+
+#include "a2s_defs.h"
+#include "xdp.h"
+
+// Slot allocator of the response store (a2s_store_* array maps), shared by the fetcher threads.
+// Responses are interned by content: identical responses of several servers share one refcounted slot.
+typedef struct
+{
+  int map_fds[A2S_STORE_CLASSES];
+  __u32 capacity[A2S_STORE_CLASSES];
+  __u32 *free_slots[A2S_STORE_CLASSES];
+  __u32 free_count[A2S_STORE_CLASSES];
+  __u32 *pending[A2S_STORE_CLASSES];
+  __u64 *pending_ns[A2S_STORE_CLASSES];
+  __u32 pending_head[A2S_STORE_CLASSES];
+  __u32 pending_count[A2S_STORE_CLASSES];
+
+  // Per slot state, indexed by base[cls] + slot
+  __u32 base[A2S_STORE_CLASSES];
+  __u32 *refcount;
+  __u64 *hash;
+  __u16 *size;
+  bool *written;
+
+  // Content index (open addressing, hash and size -> base[cls] + slot + 1, 0 is an empty entry)
+  __u32 *index;
+  __u32 index_mask;
+
+  // Random key of the content hash (store_hash), so servers cannot craft responses that collide with others'
+  __u64 hash_key[2];
+
+  __u32 in_use;
+  __u32 references;
+  pthread_mutex_t lock;
+} a2s_store_t;
+
+// Response writes into the store, committed with one batch per size class
+typedef struct
+{
+  __u32 *slots[A2S_STORE_CLASSES];
+  unsigned char *data[A2S_STORE_CLASSES];
+  __u32 count[A2S_STORE_CLASSES];
+} store_batch_t;
+
+bool store_init(a2s_store_t *st, const xdp_maps_t *xdp_maps);
+void store_free(a2s_store_t *st);
+__u64 store_hash(const a2s_store_t *st, const void *data, size_t size);
+bool store_intern(a2s_store_t *st, size_t size, __u64 hash, struct a2s_ref *ref, bool *write);
+void store_release(a2s_store_t *st, const struct a2s_ref *refs, __u32 count);
+int store_read(const a2s_store_t *st, const struct a2s_ref *ref, unsigned char *buf);
+bool store_written(a2s_store_t *st, const struct a2s_ref *ref);
+__u32 store_slots(int cls, __u32 map_entries);
+bool store_batch_init(store_batch_t *b);
+void store_batch_free(store_batch_t *b);
+bool store_batch_full(const store_batch_t *b);
+void store_batch_add(store_batch_t *b, const struct a2s_ref *ref, const void *data);
+int store_batch_flush(a2s_store_t *st, store_batch_t *b, __u32 *syscalls);
\ No newline at end of file
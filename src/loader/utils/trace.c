@@ -0,0 +1,332 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <pcap/pcap.h>
+#include <bpf/libbpf.h>
+
+#include "config.h"
+#include "helpers.h"
+
+// Trace event reader state
+typedef struct
+{
+  loader_ctx_t *ctx;
+  pcap_t *pcap;
+  pcap_dumper_t *dumper;
+  __u64 realtime_offset;
+  __u64 events;
+} tracer_t;
+
+static const char *decision_names[] =
+{
+  [A2S_TRACE_DENIED] = "denied",
+  [A2S_TRACE_UNKNOWN] = "unknown query, passed",
+  [A2S_TRACE_INVALID] = "invalid query",
+  [A2S_TRACE_RATELIMITED] = "rate limited",
+  [A2S_TRACE_NOT_CACHED] = "not cached",
+  [A2S_TRACE_CHALLENGE] = "challenge sent",
+  [A2S_TRACE_BAD_COOKIE] = "bad cookie",
+  [A2S_TRACE_DATA] = "response sent",
+  [A2S_TRACE_ERROR] = "reply failed"
+};
+
+/**
+* Name of a query type byte
+*
+* @param query_type Query type byte.
+* @param buf Buffer for unknown types.
+* @param size Buffer size.
+* @return Name of the query type.
+*/
+static const char *query_name(__u8 query_type, char *buf, size_t size)
+{
+  switch (query_type)
+  {
+    case A2S_INFO:
+    return "A2S_INFO";
+
+    case A2S_PLAYER:
+    return "A2S_PLAYER";
+
+    case A2S_RULES:
+    return "A2S_RULES";
+
+    case 0:
+    return "-";
+  }
+
+  snprintf(buf, size, "0x%02x", query_type);
+  return buf;
+}
+
+/**
+* Internet checksum of an IPv4 header
+*
+* @param iph Pointer to the IPv4 header (check field zeroed).
+* @return Checksum.
+*/
+static __u16 ip_checksum(const struct iphdr *iph)
+{
+  const __u16 *words = (const __u16 *)iph;
+  __u32 sum = 0;
+
+  for (size_t i = 0; i < sizeof(*iph) / 2; i++)
+  {
+    sum += words[i];
+  }
+
+  while (sum >> 16)
+  {
+    sum = (sum & 0xFFFF) + (sum >> 16);
+  }
+
+  return ~sum;
+}
+
+/**
+* Write a trace event as an IPv4/UDP query packet (the captured payload, the IP ID is the decision)
+*
+* @param tr Pointer to the tracer.
+* @param ev Pointer to the trace event.
+*/
+static void write_pcap(tracer_t *tr, const struct a2s_trace_event *ev)
+{
+  unsigned char pkt[sizeof(struct iphdr) + sizeof(struct udphdr) + A2S_TRACE_PAYLOAD] = {0};
+  struct iphdr *iph = (struct iphdr *)pkt;
+  struct udphdr *udph = (struct udphdr *)(iph + 1);
+  __u32 captured = ev->captured < A2S_TRACE_PAYLOAD ? ev->captured : A2S_TRACE_PAYLOAD;
+  __u64 ts = ev->ts + tr->realtime_offset;
+
+  iph->version = 4;
+  iph->ihl = 5;
+  iph->tot_len = htons(sizeof(*iph) + sizeof(*udph) + ev->payload_len);
+  iph->id = htons(ev->decision);
+  iph->ttl = 64;
+  iph->protocol = IPPROTO_UDP;
+  iph->saddr = ev->saddr;
+  iph->daddr = ev->daddr;
+  iph->check = ip_checksum(iph);
+
+  // No UDP checksum, the payload may be truncated
+  udph->source = ev->sport;
+  udph->dest = ev->dport;
+  udph->len = htons(sizeof(*udph) + ev->payload_len);
+  memcpy(udph + 1, ev->payload, captured);
+
+  struct pcap_pkthdr hdr =
+  {
+    .ts = { .tv_sec = ts / 1000000000ULL, .tv_usec = (ts % 1000000000ULL) / 1000 },
+    .caplen = sizeof(*iph) + sizeof(*udph) + captured,
+    .len = sizeof(*iph) + sizeof(*udph) + ev->payload_len
+  };
+
+  pcap_dump((u_char *)tr->dumper, &hdr, pkt);
+}
+
+/**
+* Write a trace event as a text line on stdout
+*
+* @param tr Pointer to the tracer.
+* @param ev Pointer to the trace event.
+*/
+static void write_text(tracer_t *tr, const struct a2s_trace_event *ev)
+{
+  char src[INET_ADDRSTRLEN], dst[INET_ADDRSTRLEN], srv[INET_ADDRSTRLEN], type[8], when[32];
+  __u64 ts = ev->ts + tr->realtime_offset;
+  time_t sec = ts / 1000000000ULL;
+  struct tm tm;
+
+  inet_ntop(AF_INET, &ev->saddr, src, sizeof(src));
+  inet_ntop(AF_INET, &ev->daddr, dst, sizeof(dst));
+  inet_ntop(AF_INET, &ev->key.ip, srv, sizeof(srv));
+  strftime(when, sizeof(when), "%H:%M:%S", localtime_r(&sec, &tm));
+
+  printf("[TRACE] %s.%06llu %s:%d -> %s:%d", when, (unsigned long long)(ts % 1000000000ULL) / 1000, src, ntohs(ev->sport), dst, ntohs(ev->dport));
+
+  // Server the query was resolved to (public address alias)
+  if (ev->key.ip != ev->daddr || ev->key.port != ev->dport)
+  {
+    printf(" (%s:%d)", srv, ntohs(ev->key.port));
+  }
+
+  printf(" %s %u bytes%s: %s", query_name(ev->query_type, type, sizeof(type)), ev->payload_len, ev->trusted ? " trusted" : "",
+  ev->decision < sizeof(decision_names) / sizeof(decision_names[0]) && decision_names[ev->decision] ? decision_names[ev->decision] : "?");
+
+  if (ev->resp_size)
+  {
+    printf(", %u bytes", ev->resp_size);
+  }
+
+  // NOTE: Cookie (challenge) is in little endian
+  if (ev->cookie)
+  {
+    printf(", cookie 0x%08x", ev->cookie);
+  }
+
+  // Show what the unexpected queries look like
+  if (ev->decision == A2S_TRACE_UNKNOWN || ev->decision == A2S_TRACE_INVALID)
+  {
+    printf(", payload");
+
+    for (__u32 i = 0; i < ev->captured && i < A2S_TRACE_PAYLOAD; i++)
+    {
+      printf(" %02x", ev->payload[i]);
+    }
+  }
+
+  printf("\n");
+}
+
+/**
+* Ring buffer callback of a trace event
+*
+* @param arg Pointer to the tracer.
+* @param data Trace event.
+* @param size Size of the event.
+* @return 0 to keep reading.
+*/
+static int handle_event(void *arg, void *data, size_t size)
+{
+  tracer_t *tr = arg;
+
+  if (size < sizeof(struct a2s_trace_event))
+  {
+    return 0;
+  }
+
+  if (tr->dumper)
+  {
+    write_pcap(tr, data);
+  }
+  else
+  {
+    write_text(tr, data);
+  }
+
+  tr->events++;
+  return 0;
+}
+
+/**
+* Trace event reader thread: waits on the a2s_trace ring buffer and writes the events out until the loader stops.
+* Idle (blocked in epoll) while tracing is disabled.
+*
+* @param arg Pointer to the loader context.
+* @return NULL.
+*/
+static void *read_trace_events(void *arg)
+{
+  tracer_t tr = { .ctx = arg };
+  struct timespec rt;
+  struct ring_buffer *rb;
+
+  // Event timestamps are CLOCK_MONOTONIC (bpf_ktime_get_ns)
+  clock_gettime(CLOCK_REALTIME, &rt);
+  tr.realtime_offset = (__u64)rt.tv_sec * 1000000000ULL + rt.tv_nsec - monotonic_ns();
+
+  if (tr.ctx->trace.pcap_file)
+  {
+    if (!(tr.pcap = pcap_open_dead(DLT_RAW, 65535)) || !(tr.dumper = pcap_dump_open(tr.pcap, tr.ctx->trace.pcap_file)))
+    {
+      fprintf(stderr, "ERROR: Could not open trace pcap file %s: %s. Tracing to stdout...\n", tr.ctx->trace.pcap_file,
+      tr.pcap ? pcap_geterr(tr.pcap) : "out of memory");
+    }
+  }
+
+  if (!(rb = ring_buffer__new(tr.ctx->xdp_maps.a2s_trace, handle_event, &tr, NULL)))
+  {
+    fprintf(stderr, "ERROR: Could not open the trace ring buffer: %s. Tracing is unavailable.\n", strerror(errno));
+  }
+
+  while (rb && tr.ctx->running)
+  {
+    int ret = ring_buffer__poll(rb, 200);
+
+    if (ret < 0 && ret != -EINTR)
+    {
+      fprintf(stderr, "ERROR: Reading the trace ring buffer failed (code %d). Tracing is unavailable.\n", ret);
+      break;
+    }
+
+    if (ret > 0)
+    {
+      if (tr.dumper)
+      {
+        pcap_dump_flush(tr.dumper);
+      }
+      else
+      {
+        fflush(stdout);
+      }
+    }
+  }
+
+  ring_buffer__free(rb);
+
+  if (tr.dumper)
+  {
+    pcap_dump_close(tr.dumper);
+  }
+
+  if (tr.pcap)
+  {
+    pcap_close(tr.pcap);
+  }
+
+  if (tr.events > 0)
+  {
+    printf("Tracer: %llu trace events written.\n", (unsigned long long)tr.events);
+  }
+
+  return NULL;
+}
+
+/**
+* Start the trace event reader thread (tracing itself is switched on and off with the runtime settings)
+*
+* @param ctx Pointer to the loader context.
+* @return true on success, or false on failure.
+*/
+bool start_tracer(loader_ctx_t *ctx)
+{
+  if (pthread_create(&ctx->trace_tid, NULL, read_trace_events, ctx) != 0)
+  {
+    fprintf(stderr, "ERROR: Trace thread creation failed.\n");
+    return false;
+  }
+
+  ctx->tracing = true;
+  return true;
+}
+
+/**
+* Wait for the trace event reader thread to exit (ctx->running must be false)
+*
+* @param ctx Pointer to the loader context.
+*/
+void stop_tracer(loader_ctx_t *ctx)
+{
+  if (ctx->tracing)
+  {
+    pthread_join(ctx->trace_tid, NULL);
+    ctx->tracing = false;
+  }
+}
+
+/**
+* Free the trace settings
+*
+* @param trace Pointer to the trace settings.
+*/
+void free_trace(trace_cfg_t *trace)
+{
+  free(trace->sources);
+  free(trace->servers);
+  free(trace->pcap_file);
+  memset(trace, 0, sizeof(*trace));
+}
\ No newline at end of file
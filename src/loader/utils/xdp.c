@@ -1,22 +1,175 @@
+#include <stdlib.h>
+#include <stddef.h>
+#include <unistd.h>
 #include <errno.h>
 #include <net/if.h>
+#include <sys/stat.h>
 #include <xdp/libxdp.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
 
 #include "config.h"
+#include "a2s_defs.h"
 #include "xdp.h"
+#include "store.h"
+
+// Name of the XDP program function, used to find an already attached instance
+#define XDP_PROG_NAME "xdpa2scache_program"
+
+// Map names and the offset of their file descriptor in xdp_maps_t (every map pinned by name, so all of them are unpinned)
+static const struct
+{
+  const char *name;
+  size_t offset;
+} map_names[] =
+{
+  { "a2s_info", offsetof(xdp_maps_t, a2s_info) },
+  { "a2s_player", offsetof(xdp_maps_t, a2s_player) },
+  { "a2s_rules", offsetof(xdp_maps_t, a2s_rules) },
+  { "a2s_store_256", offsetof(xdp_maps_t, a2s_store[0]) },
+  { "a2s_store_512", offsetof(xdp_maps_t, a2s_store[1]) },
+  { "a2s_store_1024", offsetof(xdp_maps_t, a2s_store[2]) },
+  { "a2s_store_1400", offsetof(xdp_maps_t, a2s_store[3]) },
+  { "a2s_alias", offsetof(xdp_maps_t, a2s_alias) },
+  { "a2s_settings", offsetof(xdp_maps_t, a2s_settings) },
+  { "a2s_src_limit", offsetof(xdp_maps_t, a2s_src_limit) },
+  { "a2s_srv_limit", offsetof(xdp_maps_t, a2s_srv_limit) },
+  { "a2s_deny", offsetof(xdp_maps_t, a2s_deny) },
+  { "a2s_allow", offsetof(xdp_maps_t, a2s_allow) },
+  { "a2s_cookie_keys", offsetof(xdp_maps_t, a2s_cookie_keys) },
+  { "a2s_cookie_state", offsetof(xdp_maps_t, a2s_cookie_state) },
+  { "a2s_trace", offsetof(xdp_maps_t, a2s_trace) },
+  { "a2s_trace_src", offsetof(xdp_maps_t, a2s_trace_src) },
+  { "a2s_trace_srv", offsetof(xdp_maps_t, a2s_trace_srv) },
+  { "a2s_latency", offsetof(xdp_maps_t, a2s_latency) },
+  { "a2s_srv_stats", offsetof(xdp_maps_t, a2s_srv_stats) }
+};
+
+#define NUM_MAPS (sizeof(map_names) / sizeof(map_names[0]))
+#define MAP_FD(xdp_maps, i) ((int *)((char *)(xdp_maps) + map_names[i].offset))
+
+/**
+* Number of map entries for a number of configured keys, with headroom for servers added by a reload
+*
+* @param count Number of configured keys.
+* @return Number of map entries.
+*/
+static __u32 map_entries(int count)
+{
+  __u32 entries = (__u32)count + (__u32)count * A2S_MAP_HEADROOM_PCT / 100;
+  return entries > A2S_MAP_MIN_ENTRIES ? entries : A2S_MAP_MIN_ENTRIES;
+}
+
+// Maps sized by the number of servers (the store classes in proportion, see store_slots)
+static const char *server_maps[] = { "a2s_info", "a2s_player", "a2s_rules", "a2s_srv_limit", "a2s_srv_stats" };
+static const char *store_maps[A2S_STORE_CLASSES] = { "a2s_store_256", "a2s_store_512", "a2s_store_1024", "a2s_store_1400" };
+
+/**
+* Size the per server maps, the response store and the alias map of a BPF object that is not loaded yet
+*
+* @param obj BPF object.
+* @param server_count Number of configured servers.
+* @param alias_count Number of configured public address aliases.
+* @return true on success, or false on failure.
+*/
+bool size_maps(struct bpf_object *obj, int server_count, int alias_count)
+{
+  for (size_t i = 0; i < sizeof(server_maps) / sizeof(server_maps[0]); i++)
+  {
+    struct bpf_map *map = bpf_object__find_map_by_name(obj, server_maps[i]);
+
+    if (!map || bpf_map__set_max_entries(map, map_entries(server_count)) < 0)
+    {
+      fprintf(stderr, "ERROR: Failed to size map '%s' for %d servers.\n", server_maps[i], server_count);
+      return false;
+    }
+  }
+
+  // Size classes of the response store, in proportion to the per server maps
+  for (int c = 0; c < A2S_STORE_CLASSES; c++)
+  {
+    struct bpf_map *map = bpf_object__find_map_by_name(obj, store_maps[c]);
+
+    if (!map || bpf_map__set_max_entries(map, store_slots(c, map_entries(server_count))) < 0)
+    {
+      fprintf(stderr, "ERROR: Failed to size map '%s' for %d servers.\n", store_maps[c], server_count);
+      return false;
+    }
+  }
+
+  struct bpf_map *alias_map = bpf_object__find_map_by_name(obj, "a2s_alias");
+
+  if (!alias_map || bpf_map__set_max_entries(alias_map, map_entries(alias_count)) < 0)
+  {
+    fprintf(stderr, "ERROR: Failed to size map 'a2s_alias' for %d aliases.\n", alias_count);
+    return false;
+  }
+
+  printf("BPF maps sized for %u servers and %u aliases.\n", map_entries(server_count), map_entries(alias_count));
+  return true;
+}
+
+/**
+* Check that the maps of a previous instance are at least as large as size_maps would make them (warm restart)
+*
+* @param xdp_maps Structure holding the BPF map FDs.
+* @param server_count Number of servers (configured and discovered).
+* @param alias_count Number of configured public address aliases.
+* @return true if all the sized maps are large enough, or false otherwise (the first one too small is reported).
+*/
+bool maps_fit(const xdp_maps_t *xdp_maps, int server_count, int alias_count)
+{
+  const int server_fds[] = { xdp_maps->a2s_info, xdp_maps->a2s_player, xdp_maps->a2s_rules, xdp_maps->a2s_srv_limit, xdp_maps->a2s_srv_stats };
+  __u32 have, want;
+
+  for (size_t i = 0; i < sizeof(server_maps) / sizeof(server_maps[0]); i++)
+  {
+    if ((have = map_max_entries(server_fds[i])) < (want = map_entries(server_count)))
+    {
+      fprintf(stderr, "Warning: Pinned map '%s' has %u entries, %u needed for %d servers.\n", server_maps[i], have, want, server_count);
+      return false;
+    }
+  }
+
+  for (int c = 0; c < A2S_STORE_CLASSES; c++)
+  {
+    if ((have = map_max_entries(xdp_maps->a2s_store[c])) < (want = store_slots(c, map_entries(server_count))))
+    {
+      fprintf(stderr, "Warning: Pinned map '%s' has %u entries, %u needed for %d servers.\n", store_maps[c], have, want, server_count);
+      return false;
+    }
+  }
+
+  if ((have = map_max_entries(xdp_maps->a2s_alias)) < (want = map_entries(alias_count)))
+  {
+    fprintf(stderr, "Warning: Pinned map 'a2s_alias' has %u entries, %u needed for %d aliases.\n", have, want, alias_count);
+    return false;
+  }
+
+  return true;
+}
 
 /**
 * Loads a BPF object file and returns the associated XDP program
 *
 * @param filename Path to the BPF object file.
+* @param server_count Number of configured servers (sizes the per server maps).
+* @param alias_count Number of configured public address aliases (sizes the alias map).
 * @return Pointer to the loaded XDP program, or NULL on failure.
 */
-struct xdp_program *load_bpf_object(const char *filename)
+struct xdp_program *load_bpf_object(const char *filename, int server_count, int alias_count)
 {
   struct xdp_program *prog = NULL;
 
+  // Create the pin directory for the maps (pinned by name)
+  if (mkdir(A2S_PIN_ROOT, 0700) < 0 && errno != EEXIST)
+  {
+    fprintf(stderr, "ERROR: Failed to create pin directory '%s': %s\n", A2S_PIN_ROOT, strerror(errno));
+    return NULL;
+  }
+
   // Define options for opening the BPF object
-  DECLARE_LIBBPF_OPTS(bpf_object_open_opts, opts, .pin_root_path = "/sys/fs/bpf");
+  DECLARE_LIBBPF_OPTS(bpf_object_open_opts, opts, .pin_root_path = A2S_PIN_ROOT);
 
   // Attempt to open the XDP program from the given BPF object file
   prog = xdp_program__open_file(filename, NULL, &opts);
@@ -27,6 +180,13 @@ struct xdp_program *load_bpf_object(const char *filename)
     return NULL;
   }
 
+  // Size the per server maps from the configuration, before libxdp loads the object (on attach)
+  if (!size_maps(xdp_program__bpf_obj(prog), server_count, alias_count))
+  {
+    xdp_program__close(prog);
+    return NULL;
+  }
+
   return prog;
 }
 
@@ -36,9 +196,10 @@ struct xdp_program *load_bpf_object(const char *filename)
 * @param prog XDP program.
 * @param ifindex Interface index.
 * @param detach Whether to detach (non-zero) or attach (zero).
+* @param attach_mode XDP_ATTACH_AUTO (native, then SKB), XDP_ATTACH_NATIVE or XDP_ATTACH_SKB.
 * @return 0 on success, or a negative error code on failure.
 */
-int attach_xdp(struct xdp_program *prog, unsigned int ifindex, int detach)
+int attach_xdp(struct xdp_program *prog, unsigned int ifindex, int detach, int attach_mode)
 {
   int err = -EINVAL;
   static const struct
@@ -58,8 +219,10 @@ int attach_xdp(struct xdp_program *prog, unsigned int ifindex, int detach)
     xdp_program__set_chain_call_enabled(prog, XDP_MULTIPROG_ACTION, XDP_MULTIPROG_ENABLED);
   }
 
-  // Try to attach/detach using available modes (Native then Generic)
-  for (int i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+  // Try to attach/detach using available modes (Native then Generic), or the forced one only
+  int first = attach_mode == XDP_ATTACH_SKB ? 1 : 0, last = attach_mode == XDP_ATTACH_NATIVE ? 1 : 2;
+
+  for (int i = first; i < last; i++)
   {
     err = detach ? xdp_program__detach(prog, ifindex, modes[i].mode, 0) : xdp_program__attach(prog, ifindex, modes[i].mode, 0);
 
@@ -120,20 +283,553 @@ int detach_xdp(struct xdp_program *prog, unsigned int ifindex)
 int get_maps(struct xdp_program *prog, xdp_maps_t *xdp_maps)
 {
   // Get the BPF object from the XDP program
-  struct bpf_object *bpf_obj = xdp_program__bpf_obj(prog);
+  return get_object_maps(xdp_program__bpf_obj(prog), xdp_maps);
+}
+
+/**
+* Retrieves the map FDs of a loaded BPF object
+*
+* @param bpf_obj BPF object.
+* @param xdp_maps Structure where the retrieved map FDs will be stored.
+* @return 0 on success, or a negative error code on failure.
+*/
+int get_object_maps(struct bpf_object *bpf_obj, xdp_maps_t *xdp_maps)
+{
+  // Get map file descriptors by name and check if any map FD is invalid
+  for (size_t i = 0; i < NUM_MAPS; i++)
+  {
+    if ((*MAP_FD(xdp_maps, i) = bpf_object__find_map_fd_by_name(bpf_obj, map_names[i].name)) < 0)
+    {
+      int err = *MAP_FD(xdp_maps, i);
+      fprintf(stderr, "ERROR: Could not find BPF map '%s': %s (code %d)\n", map_names[i].name, strerror(-err), err);
+      return err;
+    }
+  }
+
+  return 0;
+}
+
+/**
+* Opens the maps pinned by a previous (persistent) loader instance
+*
+* @param xdp_maps Structure where the map FDs will be stored.
+* @return 0 on success, or a negative error code on failure (no FDs are left open).
+*/
+int get_pinned_maps(xdp_maps_t *xdp_maps)
+{
+  char path[256];
+
+  for (size_t i = 0; i < NUM_MAPS; i++)
+  {
+    snprintf(path, sizeof(path), "%s/%s", A2S_PIN_ROOT, map_names[i].name);
+
+    if ((*MAP_FD(xdp_maps, i) = bpf_obj_get(path)) < 0)
+    {
+      int err = -errno;
+      fprintf(stderr, "Could not open pinned map '%s': %s (code %d)\n", path, strerror(-err), err);
+
+      while (i-- > 0)
+      {
+        close(*MAP_FD(xdp_maps, i));
+        *MAP_FD(xdp_maps, i) = -1;
+      }
+
+      return err;
+    }
+  }
+
+  return 0;
+}
+
+/**
+* Closes the map FDs opened by get_pinned_maps
+*
+* @param xdp_maps Structure holding the BPF map FDs.
+*/
+void close_maps(xdp_maps_t *xdp_maps)
+{
+  for (size_t i = 0; i < NUM_MAPS; i++)
+  {
+    if (*MAP_FD(xdp_maps, i) >= 0)
+    {
+      close(*MAP_FD(xdp_maps, i));
+    }
+
+    *MAP_FD(xdp_maps, i) = -1;
+  }
+}
+
+/**
+* Removes the pinned maps, so the next loader instance starts with fresh maps
+*/
+void unpin_maps(void)
+{
+  char path[256];
+
+  for (size_t i = 0; i < NUM_MAPS; i++)
+  {
+    snprintf(path, sizeof(path), "%s/%s", A2S_PIN_ROOT, map_names[i].name);
+    unlink(path);
+  }
+
+  rmdir(A2S_PIN_ROOT);
+}
+
+/**
+* Looks for an instance of the XDP program that is already attached to the interface (e.g., by a persistent loader)
+*
+* @param ifindex Interface index.
+* @param detach Whether to detach the found instance.
+* @return 1 if an instance was found, 0 if not.
+*/
+int find_attached_program(unsigned int ifindex, bool detach)
+{
+  struct xdp_multiprog *mp = xdp_multiprog__get_from_ifindex(ifindex);
+  int found = 0;
+
+  if (libxdp_get_error(mp) || !mp)
+  {
+    return 0;
+  }
+
+  // Legacy (single program) attachment has no dispatcher to iterate
+  struct xdp_program *prog = xdp_multiprog__is_legacy(mp) ? xdp_multiprog__main_prog(mp) : xdp_multiprog__next_prog(NULL, mp);
+
+  while (prog)
+  {
+    if (strcmp(xdp_program__name(prog), XDP_PROG_NAME) == 0)
+    {
+      found = 1;
+
+      if (detach)
+      {
+        detach_xdp(prog, ifindex);
+      }
+
+      break;
+    }
+
+    prog = xdp_multiprog__is_legacy(mp) ? NULL : xdp_multiprog__next_prog(prog, mp);
+  }
+
+  xdp_multiprog__close(mp);
+  return found;
+}
+
+/**
+* Orders aliases by their public server key, or server keys (qsort/bsearch comparator)
+*/
+static int alias_cmp(const void *a, const void *b)
+{
+  const struct a2s_server_key *ka = a, *kb = b;
+
+  if (ka->ip != kb->ip)
+  {
+    return ka->ip < kb->ip ? -1 : 1;
+  }
+
+  return ka->port < kb->port ? -1 : ka->port > kb->port;
+}
+
+/**
+* Syncs the alias map with the public -> private server key translations: removes aliases that are no longer configured and adds or updates the others
+*
+* @param xdp_maps Structure holding the BPF map FDs.
+* @param aliases Array of public/private server key pairs (gets sorted in place).
+* @param alias_count Number of entries in the aliases array.
+* @return 0 on success, or a negative error code on failure.
+*/
+int sync_alias_map(const xdp_maps_t *xdp_maps, struct a2s_alias *aliases, int alias_count)
+{
+  struct a2s_server_key key, next_key, *stale = NULL;
+  int stale_count = 0;
+
+  if (alias_count > 0)
+  {
+    qsort(aliases, alias_count, sizeof(*aliases), alias_cmp);
+  }
+
+  // Collect the public keys in the map that are no longer configured
+  for (int ret = bpf_map_get_next_key(xdp_maps->a2s_alias, NULL, &next_key); ret == 0; ret = bpf_map_get_next_key(xdp_maps->a2s_alias, &key, &next_key))
+  {
+    key = next_key;
+
+    if (alias_count > 0 && bsearch(&key, aliases, alias_count, sizeof(*aliases), alias_cmp))
+    {
+      continue;
+    }
+
+    struct a2s_server_key *temp = realloc(stale, (stale_count + 1) * sizeof(*stale));
+
+    if (!temp)
+    {
+      free(stale);
+      fprintf(stderr, "Memory allocation failed for stale aliases.\n");
+      return -ENOMEM;
+    }
+
+    stale = temp;
+    stale[stale_count++] = key;
+  }
+
+  for (int i = 0; i < stale_count; i++)
+  {
+    bpf_map_delete_elem(xdp_maps->a2s_alias, &stale[i]);
+  }
+
+  free(stale);
+
+  for (int i = 0; i < alias_count; i++)
+  {
+    if (bpf_map_update_elem(xdp_maps->a2s_alias, &aliases[i].pub, &aliases[i].priv, BPF_ANY) < 0)
+    {
+      int err = -errno;
+      fprintf(stderr, "ERROR: Could not update alias map: %s (code %d)\n", strerror(-err), err);
+      return err;
+    }
+  }
 
-  // Get map file descriptors by name
-  xdp_maps->a2s_info = bpf_object__find_map_fd_by_name(bpf_obj, "a2s_info");
-  xdp_maps->a2s_player = bpf_object__find_map_fd_by_name(bpf_obj, "a2s_player");
-  xdp_maps->a2s_rules = bpf_object__find_map_fd_by_name(bpf_obj, "a2s_rules");
+  return 0;
+}
 
-  // Check if any map FD is invalid
-  if (xdp_maps->a2s_info < 0 || xdp_maps->a2s_player < 0 || xdp_maps->a2s_rules < 0)
+/**
+* Writes the runtime settings into the single entry settings map
+*
+* @param xdp_maps Structure holding the BPF map FDs.
+* @param settings Pointer to the runtime settings.
+* @return 0 on success, or a negative error code on failure.
+*/
+int update_settings_map(const xdp_maps_t *xdp_maps, const struct a2s_settings *settings)
+{
+  __u32 key = 0;
+
+  if (bpf_map_update_elem(xdp_maps->a2s_settings, &key, settings, BPF_ANY) < 0)
   {
-    int err = xdp_maps->a2s_info < 0 ? xdp_maps->a2s_info: xdp_maps->a2s_player < 0 ? xdp_maps->a2s_player : xdp_maps->a2s_rules;
-    fprintf(stderr, "ERROR: Could not find one or more BPF maps: %s (code %d)\n", strerror(-err), err);
+    int err = -errno;
+    fprintf(stderr, "ERROR: Could not update settings map: %s (code %d)\n", strerror(-err), err);
     return err;
   }
 
   return 0;
+}
+
+/**
+* Orders LPM trie keys by prefix length and address (qsort/bsearch comparator)
+*/
+static int lpm_key_cmp(const void *a, const void *b)
+{
+  const struct a2s_lpm_key *ka = a, *kb = b;
+
+  if (ka->prefixlen != kb->prefixlen)
+  {
+    return ka->prefixlen < kb->prefixlen ? -1 : 1;
+  }
+
+  return ka->ip < kb->ip ? -1 : ka->ip > kb->ip;
+}
+
+/**
+* Syncs an LPM trie map with a list of prefixes: removes prefixes that are no longer listed and adds the new ones
+*
+* @param map_fd File descriptor of the LPM trie map.
+* @param prefixes Array of prefixes (gets sorted in place).
+* @param prefix_count Number of entries in the prefixes array.
+* @return 0 on success, or a negative error code on failure.
+*/
+int sync_prefix_map(int map_fd, struct a2s_lpm_key *prefixes, int prefix_count)
+{
+  struct a2s_lpm_key key, next_key, *stale = NULL;
+  int stale_count = 0, err = 0;
+  __u8 value = 1;
+
+  if (prefix_count > 0)
+  {
+    qsort(prefixes, prefix_count, sizeof(*prefixes), lpm_key_cmp);
+  }
+
+  // Collect the prefixes in the map that are no longer listed (deleting while iterating would restart the iteration)
+  for (int ret = bpf_map_get_next_key(map_fd, NULL, &next_key); ret == 0; ret = bpf_map_get_next_key(map_fd, &key, &next_key))
+  {
+    key = next_key;
+
+    if (prefix_count > 0 && bsearch(&key, prefixes, prefix_count, sizeof(*prefixes), lpm_key_cmp))
+    {
+      continue;
+    }
+
+    struct a2s_lpm_key *temp = realloc(stale, (stale_count + 1) * sizeof(*stale));
+
+    if (!temp)
+    {
+      free(stale);
+      fprintf(stderr, "Memory allocation failed for stale prefixes.\n");
+      return -ENOMEM;
+    }
+
+    stale = temp;
+    stale[stale_count++] = key;
+  }
+
+  for (int i = 0; i < stale_count; i++)
+  {
+    bpf_map_delete_elem(map_fd, &stale[i]);
+  }
+
+  free(stale);
+
+  // Add (or refresh) the listed prefixes
+  for (int i = 0; i < prefix_count; i++)
+  {
+    if (bpf_map_update_elem(map_fd, &prefixes[i], &value, BPF_ANY) < 0)
+    {
+      err = -errno;
+      fprintf(stderr, "ERROR: Could not update prefix map: %s (code %d)\n", strerror(-err), err);
+      return err;
+    }
+  }
+
+  return 0;
+}
+
+/**
+* Syncs a set of server keys (e.g., the traced servers): removes servers that are no longer listed and adds the new ones
+*
+* @param map_fd File descriptor of the BPF map (server key -> __u8).
+* @param servers Array of server keys (gets sorted in place).
+* @param server_count Number of entries in the servers array.
+* @return 0 on success, or a negative error code on failure.
+*/
+int sync_server_map(int map_fd, struct a2s_server_key *servers, int server_count)
+{
+  struct a2s_server_key key, next_key, *stale = NULL;
+  int stale_count = 0;
+  __u8 value = 1;
+
+  if (server_count > 0)
+  {
+    qsort(servers, server_count, sizeof(*servers), alias_cmp);
+  }
+
+  // Collect the servers in the map that are no longer listed
+  for (int ret = bpf_map_get_next_key(map_fd, NULL, &next_key); ret == 0; ret = bpf_map_get_next_key(map_fd, &key, &next_key))
+  {
+    key = next_key;
+
+    if (server_count > 0 && bsearch(&key, servers, server_count, sizeof(*servers), alias_cmp))
+    {
+      continue;
+    }
+
+    struct a2s_server_key *temp = realloc(stale, (stale_count + 1) * sizeof(*stale));
+
+    if (!temp)
+    {
+      free(stale);
+      fprintf(stderr, "Memory allocation failed for stale servers.\n");
+      return -ENOMEM;
+    }
+
+    stale = temp;
+    stale[stale_count++] = key;
+  }
+
+  for (int i = 0; i < stale_count; i++)
+  {
+    bpf_map_delete_elem(map_fd, &stale[i]);
+  }
+
+  free(stale);
+
+  for (int i = 0; i < server_count; i++)
+  {
+    if (bpf_map_update_elem(map_fd, &servers[i], &value, BPF_ANY) < 0)
+    {
+      int err = -errno;
+      fprintf(stderr, "ERROR: Could not update server map: %s (code %d)\n", strerror(-err), err);
+      return err;
+    }
+  }
+
+  return 0;
+}
+
+/**
+* Creates the zeroed per server counters of a server (a2s_srv_stats), the counters of an existing entry are kept (warm restart)
+*
+* @param map_fd File descriptor of the a2s_srv_stats map (per CPU).
+* @param key Pointer to the server key.
+* @return 0 on success (or if the entry exists), or a negative error code on failure.
+*/
+int add_server_stats(int map_fd, const struct a2s_server_key *key)
+{
+  int cpus = libbpf_num_possible_cpus();
+
+  if (cpus <= 0)
+  {
+    return cpus < 0 ? cpus : -EINVAL;
+  }
+
+  // One value per possible CPU
+  struct a2s_srv_stats *values = calloc(cpus, sizeof(*values));
+
+  if (!values)
+  {
+    return -ENOMEM;
+  }
+
+  int err = bpf_map_update_elem(map_fd, key, values, BPF_NOEXIST) < 0 && errno != EEXIST ? -errno : 0;
+
+  free(values);
+  return err;
+}
+
+/**
+* Checks whether a batch operation error means the kernel or the map type has no batch support
+*
+* @param err Positive error code.
+* @return true if batch operations aren't supported.
+*/
+static bool batch_unsupported(int err)
+{
+  // 524 = ENOTSUPP (kernel internal, not in the userspace errno.h)
+  return err == EINVAL || err == EOPNOTSUPP || err == 524;
+}
+
+/**
+* Updates many entries of a BPF map with as few syscalls as possible (BPF_MAP_UPDATE_BATCH),
+* falling back to per-element updates for the remaining entries on kernels without batch support
+*
+* @param map_fd File descriptor of the BPF map.
+* @param keys Array of keys.
+* @param values Array of values (same order as the keys).
+* @param count Number of entries.
+* @param key_size Size of a key.
+* @param value_size Size of a value.
+* @param syscalls Incremented by the number of syscalls used (may be NULL).
+* @return Number of entries updated, or a negative error code if none could be updated.
+*/
+int update_map_batch(int map_fd, const void *keys, const void *values, __u32 count, size_t key_size, size_t value_size, __u32 *syscalls)
+{
+  __u32 done = count, calls = 1;
+
+  if (count == 0)
+  {
+    return 0;
+  }
+
+  // On failure, done holds the number of entries the kernel processed before stopping
+  int ret = bpf_map_update_batch(map_fd, keys, values, &done, NULL);
+  int err = ret < 0 ? -errno : 0;
+
+  if (ret < 0)
+  {
+    // Without batch support the kernel doesn't report a count, update everything per element (idempotent)
+    if (batch_unsupported(-err) || done > count)
+    {
+      done = 0;
+    }
+
+    for (__u32 i = done; i < count; i++, calls++)
+    {
+      if (bpf_map_update_elem(map_fd, (const char *)keys + i * key_size, (const char *)values + i * value_size, BPF_ANY) < 0)
+      {
+        err = -errno;
+        continue;
+      }
+
+      done++;
+    }
+  }
+
+  if (syscalls)
+  {
+    *syscalls += calls;
+  }
+
+  return done > 0 ? (int)done : err;
+}
+
+/**
+* Deletes many entries of a BPF map with as few syscalls as possible (BPF_MAP_DELETE_BATCH).
+* The kernel stops a batch at the first missing key, so the batch is resumed after it.
+* Falls back to per-element deletes on kernels without batch support
+*
+* @param map_fd File descriptor of the BPF map.
+* @param keys Array of keys.
+* @param count Number of entries.
+* @param key_size Size of a key.
+* @param syscalls Incremented by the number of syscalls used (may be NULL).
+* @return Number of entries deleted.
+*/
+int delete_map_batch(int map_fd, const void *keys, __u32 count, size_t key_size, __u32 *syscalls)
+{
+  __u32 pos = 0, deleted = 0, calls = 0;
+  bool batch = true;
+
+  while (pos < count)
+  {
+    const char *key = (const char *)keys + pos * key_size;
+
+    if (!batch)
+    {
+      calls++;
+      deleted += bpf_map_delete_elem(map_fd, key) == 0;
+      pos++;
+      continue;
+    }
+
+    __u32 done = count - pos;
+    calls++;
+
+    if (bpf_map_delete_batch(map_fd, key, &done, NULL) == 0)
+    {
+      deleted += count - pos;
+      break;
+    }
+
+    int err = errno;
+
+    // A missing key stops the batch: count the deleted ones, skip the missing key and resume
+    if (err == ENOENT && done < count - pos)
+    {
+      deleted += done;
+      pos += done + 1;
+      continue;
+    }
+
+    // No batch support (the kernel doesn't report a count then) or another error: finish per element
+    batch = false;
+
+    if (!batch_unsupported(err) && done < count - pos)
+    {
+      deleted += done;
+      pos += done;
+    }
+  }
+
+  if (syscalls)
+  {
+    *syscalls += calls;
+  }
+
+  return deleted;
+}
+
+/**
+* Gets the max_entries of a loaded BPF map
+*
+* @param map_fd File descriptor of the BPF map.
+* @return max_entries of the map, or 0 on failure.
+*/
+__u32 map_max_entries(int map_fd)
+{
+  struct bpf_map_info info = {0};
+  __u32 len = sizeof(info);
+
+  if (bpf_obj_get_info_by_fd(map_fd, &info, &len) < 0)
+  {
+    return 0;
+  }
+
+  return info.max_entries;
 }
\ No newline at end of file
@@ -1,7 +1,21 @@
 #pragma once
 
-struct xdp_program *load_bpf_object(const char *filename);
-int attach_xdp(struct xdp_program *prog, unsigned int ifindex, int detach);
+#include <stdbool.h>
+#include <stddef.h>
+#include <linux/types.h>
+
+#include "a2s_defs.h"
+
+struct bpf_object;
+
+// Attach modes of attach_xdp (the 'xdp_mode' setting): native with a generic (SKB) fallback, or one of them only
+#define XDP_ATTACH_AUTO         0
+#define XDP_ATTACH_NATIVE       1
+#define XDP_ATTACH_SKB          2
+
+bool size_maps(struct bpf_object *obj, int server_count, int alias_count);
+struct xdp_program *load_bpf_object(const char *filename, int server_count, int alias_count);
+int attach_xdp(struct xdp_program *prog, unsigned int ifindex, int detach, int attach_mode);
 int detach_xdp(struct xdp_program *prog, unsigned int ifindex);
 
 typedef struct xdp_maps
@@ -9,6 +23,39 @@ typedef struct xdp_maps
   int a2s_info;
   int a2s_player;
   int a2s_rules;
+  int a2s_store[A2S_STORE_CLASSES];
+  int a2s_alias;
+  int a2s_settings;
+  int a2s_src_limit;
+  int a2s_srv_limit;
+  int a2s_deny;
+  int a2s_allow;
+  int a2s_cookie_keys;
+  int a2s_cookie_state;
+  int a2s_trace;
+  int a2s_trace_src;
+  int a2s_trace_srv;
+  int a2s_latency;
+  int a2s_srv_stats;
 } xdp_maps_t;
 
-int get_maps(struct xdp_program *prog, xdp_maps_t *xdp_maps);
\ No newline at end of file
+struct a2s_alias;
+struct a2s_settings;
+struct a2s_lpm_key;
+struct a2s_server_key;
+
+int get_maps(struct xdp_program *prog, xdp_maps_t *xdp_maps);
+int get_object_maps(struct bpf_object *bpf_obj, xdp_maps_t *xdp_maps);
+int get_pinned_maps(xdp_maps_t *xdp_maps);
+bool maps_fit(const xdp_maps_t *xdp_maps, int server_count, int alias_count);
+void close_maps(xdp_maps_t *xdp_maps);
+void unpin_maps(void);
+int find_attached_program(unsigned int ifindex, bool detach);
+int sync_alias_map(const xdp_maps_t *xdp_maps, struct a2s_alias *aliases, int alias_count);
+int update_settings_map(const xdp_maps_t *xdp_maps, const struct a2s_settings *settings);
+int sync_prefix_map(int map_fd, struct a2s_lpm_key *prefixes, int prefix_count);
+int sync_server_map(int map_fd, struct a2s_server_key *servers, int server_count);
+int add_server_stats(int map_fd, const struct a2s_server_key *key);
+int update_map_batch(int map_fd, const void *keys, const void *values, __u32 count, size_t key_size, size_t value_size, __u32 *syscalls);
+int delete_map_batch(int map_fd, const void *keys, __u32 count, size_t key_size, __u32 *syscalls);
+__u32 map_max_entries(int map_fd);
\ No newline at end of file
@@ -0,0 +1,277 @@
+#include <stdio.h>
+#include <string.h>
+#include <linux/types.h>
+
+#include "a2s_defs.h"
+#include "a2s_payload.h"
+
+// Bounded little endian writer over a response buffer
+typedef struct
+{
+  unsigned char *buf;
+  size_t size;
+  size_t len;
+  int overflow;
+} writer_t;
+
+static void put(writer_t *w, const void *data, size_t len)
+{
+  if (w->overflow || w->len + len > w->size)
+  {
+    w->overflow = 1;
+    return;
+  }
+
+  memcpy(w->buf + w->len, data, len);
+  w->len += len;
+}
+
+static void put_u8(writer_t *w, uint8_t v)
+{
+  put(w, &v, 1);
+}
+
+static void put_u16(writer_t *w, uint16_t v)
+{
+  uint8_t b[2] = { v & 0xFF, v >> 8 };
+  put(w, b, 2);
+}
+
+static void put_u32(writer_t *w, uint32_t v)
+{
+  uint8_t b[4] = { v & 0xFF, (v >> 8) & 0xFF, (v >> 16) & 0xFF, v >> 24 };
+  put(w, b, 4);
+}
+
+static void put_str(writer_t *w, const char *s)
+{
+  put(w, s, strlen(s) + 1);
+}
+
+static size_t finish(writer_t *w)
+{
+  return w->overflow ? 0 : w->len;
+}
+
+/**
+* Build an S2A_INFO_SRC response (Source engine format, without the extra data fields)
+*
+* @param buf Response buffer.
+* @param size Buffer size.
+* @param name Server name.
+* @param map Map name.
+* @param players Number of players.
+* @param max_players Maximum number of players.
+* @return Response size, or 0 if it doesn't fit.
+*/
+size_t a2s_build_info(unsigned char *buf, size_t size, const char *name, const char *map, uint8_t players, uint8_t max_players)
+{
+  writer_t w = { buf, size, 0, 0 };
+
+  put_u32(&w, CONNECTIONLESS_HEADER);
+  put_u8(&w, S2A_INFO_SRC);
+  put_u8(&w, 17);
+  put_str(&w, name);
+  put_str(&w, map);
+  put_str(&w, "cstrike");
+  put_str(&w, "Counter-Strike: Source");
+  put_u16(&w, 240);
+  put_u8(&w, players);
+  put_u8(&w, max_players);
+  put_u8(&w, 0);
+  put_u8(&w, 'd');
+  put_u8(&w, 'l');
+  put_u8(&w, 0);
+  put_u8(&w, 1);
+  put_str(&w, "1.0.0.0");
+  put_u8(&w, 0);
+
+  return finish(&w);
+}
+
+/**
+* Build an obsolete S2A_INFO_DETAILED response (GoldSrc format, sent by older HLDS builds besides or instead of S2A_INFO_SRC)
+*
+* @param buf Response buffer.
+* @param size Buffer size.
+* @param address Server address (ip:port).
+* @param name Server name.
+* @param map Map name.
+* @param players Number of players.
+* @param max_players Maximum number of players.
+* @return Response size, or 0 if it doesn't fit.
+*/
+size_t a2s_build_info_goldsrc(unsigned char *buf, size_t size, const char *address, const char *name, const char *map, uint8_t players, uint8_t max_players)
+{
+  writer_t w = { buf, size, 0, 0 };
+
+  put_u32(&w, CONNECTIONLESS_HEADER);
+  put_u8(&w, S2A_INFO_DETAILED);
+  put_str(&w, address);
+  put_str(&w, name);
+  put_str(&w, map);
+  put_str(&w, "cstrike");
+  put_str(&w, "Counter-Strike");
+  put_u8(&w, players);
+  put_u8(&w, max_players);
+  put_u8(&w, 47);
+  put_u8(&w, 'd');
+  put_u8(&w, 'l');
+  put_u8(&w, 0);
+  put_u8(&w, 0);
+  put_u8(&w, 1);
+  put_u8(&w, 0);
+
+  return finish(&w);
+}
+
+/**
+* Build an S2A_PLAYER response with generated player names, scores and durations
+*
+* @param buf Response buffer.
+* @param size Buffer size.
+* @param players Number of players.
+* @param seed Varies the scores and durations (e.g., a sequence number).
+* @return Response size, or 0 if it doesn't fit.
+*/
+size_t a2s_build_players(unsigned char *buf, size_t size, uint8_t players, uint32_t seed)
+{
+  writer_t w = { buf, size, 0, 0 };
+  char name[32];
+
+  put_u32(&w, CONNECTIONLESS_HEADER);
+  put_u8(&w, S2A_PLAYER);
+  put_u8(&w, players);
+
+  for (uint8_t i = 0; i < players; i++)
+  {
+    float duration = (float)(seed * 5 + i * 60);
+    uint32_t duration_bits;
+    memcpy(&duration_bits, &duration, sizeof(duration_bits));
+
+    snprintf(name, sizeof(name), "Player %u", i + 1);
+    put_u8(&w, i);
+    put_str(&w, name);
+    put_u32(&w, (seed + i * 7) % 100);
+    put_u32(&w, duration_bits);
+  }
+
+  return finish(&w);
+}
+
+/**
+* Build an S2A_RULES response with generated rule names and values
+*
+* @param buf Response buffer.
+* @param size Buffer size.
+* @param rules Number of rules.
+* @param seed Varies the values (e.g., a sequence number).
+* @return Response size, or 0 if it doesn't fit.
+*/
+size_t a2s_build_rules(unsigned char *buf, size_t size, uint16_t rules, uint32_t seed)
+{
+  writer_t w = { buf, size, 0, 0 };
+  char name[32], value[32];
+
+  put_u32(&w, CONNECTIONLESS_HEADER);
+  put_u8(&w, S2A_RULES);
+  put_u16(&w, rules);
+
+  for (uint16_t i = 0; i < rules; i++)
+  {
+    // The first rule changes with the seed, like a dynamic cvar
+    if (i == 0)
+    {
+      snprintf(name, sizeof(name), "mp_timeleft");
+      snprintf(value, sizeof(value), "%u", 1800 - seed % 1800);
+    }
+    else
+    {
+      snprintf(name, sizeof(name), "sv_rule%u", i);
+      snprintf(value, sizeof(value), "%u", i);
+    }
+
+    put_str(&w, name);
+    put_str(&w, value);
+  }
+
+  return finish(&w);
+}
+
+// Bounded reader over a response
+typedef struct
+{
+  const unsigned char *buf;
+  size_t size;
+  size_t pos;
+  int overflow;
+} reader_t;
+
+static uint8_t get_u8(reader_t *r)
+{
+  if (r->overflow || r->pos + 1 > r->size)
+  {
+    r->overflow = 1;
+    return 0;
+  }
+
+  return r->buf[r->pos++];
+}
+
+static void get_str(reader_t *r, char *out, size_t out_size)
+{
+  size_t len = 0;
+
+  while (!r->overflow)
+  {
+    uint8_t c = get_u8(r);
+
+    if (c == '\0')
+    {
+      break;
+    }
+
+    if (len + 1 < out_size)
+    {
+      out[len++] = (char)c;
+    }
+  }
+
+  out[len] = '\0';
+}
+
+/**
+* Decode the main fields of an S2A_INFO_SRC response (Source engine format)
+*
+* @param buf Response.
+* @param size Response size.
+* @param info Pointer to the decoded fields.
+* @return 0 on success, or -1 if the response is not a complete S2A_INFO_SRC.
+*/
+int a2s_parse_info(const unsigned char *buf, size_t size, a2s_info_t *info)
+{
+  reader_t r = { buf, size, 0, 0 };
+
+  memset(info, 0, sizeof(*info));
+
+  if (size < 6 || memcmp(buf, "\xFF\xFF\xFF\xFF", 4) != 0 || buf[4] != S2A_INFO_SRC)
+  {
+    return -1;
+  }
+
+  r.pos = 5;
+  info->protocol = get_u8(&r);
+  get_str(&r, info->name, sizeof(info->name));
+  get_str(&r, info->map, sizeof(info->map));
+  get_str(&r, info->folder, sizeof(info->folder));
+  get_str(&r, info->game, sizeof(info->game));
+
+  // App ID (16 bits, little endian)
+  info->app_id = get_u8(&r);
+  info->app_id |= (uint16_t)get_u8(&r) << 8;
+  info->players = get_u8(&r);
+  info->max_players = get_u8(&r);
+  info->bots = get_u8(&r);
+
+  return r.overflow ? -1 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Synthetic A2S responses (S2A_INFO_SRC, S2A_PLAYER, S2A_RULES) for stand-in servers and publishers.
+ * Every builder returns the response size, or 0 if the response doesn't fit in the buffer.
+*/
+
+// Main fields of an S2A_INFO_SRC response, for display (strings are truncated to fit)
+typedef struct
+{
+  char name[64];
+  char map[64];
+  char folder[32];
+  char game[64];
+  uint16_t app_id;
+  uint8_t protocol;
+  uint8_t players;
+  uint8_t max_players;
+  uint8_t bots;
+} a2s_info_t;
+
+size_t a2s_build_info(unsigned char *buf, size_t size, const char *name, const char *map, uint8_t players, uint8_t max_players);
+size_t a2s_build_info_goldsrc(unsigned char *buf, size_t size, const char *address, const char *name, const char *map, uint8_t players, uint8_t max_players);
+size_t a2s_build_players(unsigned char *buf, size_t size, uint8_t players, uint32_t seed);
+size_t a2s_build_rules(unsigned char *buf, size_t size, uint16_t rules, uint32_t seed);
+int a2s_parse_info(const unsigned char *buf, size_t size, a2s_info_t *info);
\ No newline at end of file
@@ -0,0 +1,112 @@
+#include "latency_hist.h"
+
+/**
+* Bucket of a duration
+*
+* @param ns Duration in nanoseconds.
+* @return Bucket index.
+*/
+static int bucket_of(uint64_t ns)
+{
+  if (ns < 16)
+  {
+    return (int)ns;
+  }
+
+  int msb = 63 - __builtin_clzll(ns);
+
+  return 16 + (msb - 4) * 16 + (int)((ns >> (msb - 4)) & 15);
+}
+
+/**
+* Middle of the range of a bucket
+*
+* @param idx Bucket index.
+* @return Duration in nanoseconds.
+*/
+static uint64_t bucket_value(int idx)
+{
+  if (idx < 16)
+  {
+    return (uint64_t)idx;
+  }
+
+  int shift = (idx - 16) / 16;
+  uint64_t low = (uint64_t)(16 + (idx - 16) % 16) << shift;
+
+  return low + ((1ULL << shift) >> 1);
+}
+
+/**
+* Record a duration
+*
+* @param h Pointer to the histogram.
+* @param ns Duration in nanoseconds.
+*/
+void lat_hist_add(lat_hist_t *h, uint64_t ns)
+{
+  h->buckets[bucket_of(ns)]++;
+  h->count++;
+  h->sum_ns += ns;
+
+  if (ns > h->max_ns)
+  {
+    h->max_ns = ns;
+  }
+}
+
+/**
+* Add the durations of a histogram to another one
+*
+* @param dst Pointer to the histogram to add to.
+* @param src Pointer to the histogram to add.
+*/
+void lat_hist_merge(lat_hist_t *dst, const lat_hist_t *src)
+{
+  for (int i = 0; i < LAT_HIST_BUCKETS; i++)
+  {
+    dst->buckets[i] += src->buckets[i];
+  }
+
+  dst->count += src->count;
+  dst->sum_ns += src->sum_ns;
+
+  if (src->max_ns > dst->max_ns)
+  {
+    dst->max_ns = src->max_ns;
+  }
+}
+
+/**
+* Percentile of the recorded durations (bucket resolution, never above the maximum)
+*
+* @param h Pointer to the histogram.
+* @param p Percentile (0 to 100).
+* @return Duration in nanoseconds, or 0 without durations.
+*/
+uint64_t lat_hist_percentile(const lat_hist_t *h, double p)
+{
+  uint64_t rank = (uint64_t)(h->count * p / 100.0 + 0.5), seen = 0;
+
+  if (h->count == 0)
+  {
+    return 0;
+  }
+
+  if (rank == 0)
+  {
+    rank = 1;
+  }
+
+  for (int i = 0; i < LAT_HIST_BUCKETS; i++)
+  {
+    if ((seen += h->buckets[i]) >= rank)
+    {
+      uint64_t value = bucket_value(i);
+
+      return value < h->max_ns ? value : h->max_ns;
+    }
+  }
+
+  return h->max_ns;
+}
\ No newline at end of file
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Log-linear histogram of durations in nanoseconds for the percentiles of the benchmark tools:
+ * 16 sub-buckets per power of two (about 6% resolution), exact below 16 ns.
+*/
+
+#define LAT_HIST_BUCKETS (16 * 61)
+
+typedef struct
+{
+  uint64_t count;
+  uint64_t sum_ns;
+  uint64_t max_ns;
+  uint64_t buckets[LAT_HIST_BUCKETS];
+} lat_hist_t;
+
+void lat_hist_add(lat_hist_t *h, uint64_t ns);
+void lat_hist_merge(lat_hist_t *dst, const lat_hist_t *src);
+uint64_t lat_hist_percentile(const lat_hist_t *h, double p);
\ No newline at end of file
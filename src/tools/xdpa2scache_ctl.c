@@ -0,0 +1,584 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include <linux/types.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "config.h"
+#include "a2s_defs.h"
+#include "control.h"
+#include "a2s_payload.h"
+
+/*
+ * Live inspection and control of a running xdpa2scache: reads the pinned maps (what XDP serves right now),
+ * and asks the loader over its control socket for the fetch state of the servers, refetches and server list changes.
+*/
+
+static const char *type_names[A2S_QUERY_TYPES] = { "info", "player", "rules" };
+
+// Pinned maps of the XDP program
+typedef struct
+{
+  int resp[A2S_QUERY_TYPES];
+  int store[A2S_STORE_CLASSES];
+  int stats;
+  int cpus;
+} ctl_maps_t;
+
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+  "Usage: %s [options] <command>\n"
+  "Commands:\n"
+  "  list                        Servers with cached sizes, age, hit rate and S2A_INFO fields\n"
+  "  dump <ip:port> <type>       Cached response of a server (info, player or rules), as hex\n"
+  "  stats [ip:port]             Fetch telemetry of the fetcher workers and of the servers (RTT, timeouts, updates)\n"
+  "  refetch <ip:port>           Query the server right away\n"
+  "  add <ip:port>               Add a server to the fetch set (until the next reload)\n"
+  "  remove <ip:port>            Remove a configured server from the fetch set (until the next reload)\n"
+  "Options:\n"
+  "  -r                          dump: write the raw response to stdout\n"
+  "  -S <path>                   Control socket path (default %s)\n", prog, A2S_CONTROL_SOCKET);
+}
+
+/**
+* Open the pinned maps of the XDP program (the per server counters are optional)
+*
+* @param maps Pointer to the map FDs.
+* @return true on success, or false on failure.
+*/
+static bool open_maps(ctl_maps_t *maps)
+{
+  static const char *resp_names[A2S_QUERY_TYPES] = { "a2s_info", "a2s_player", "a2s_rules" };
+  char path[256];
+
+  for (int k = 0; k < A2S_QUERY_TYPES; k++)
+  {
+    snprintf(path, sizeof(path), "%s/%s", A2S_PIN_ROOT, resp_names[k]);
+
+    if ((maps->resp[k] = bpf_obj_get(path)) < 0)
+    {
+      fprintf(stderr, "ERROR: Could not open pinned map %s: %s (is xdpa2scache running? root or CAP_BPF required)\n", path, strerror(errno));
+      return false;
+    }
+  }
+
+  for (int c = 0; c < A2S_STORE_CLASSES; c++)
+  {
+    snprintf(path, sizeof(path), "%s/a2s_store_%u", A2S_PIN_ROOT, A2S_STORE_CLASS_SIZE(c));
+
+    if ((maps->store[c] = bpf_obj_get(path)) < 0)
+    {
+      fprintf(stderr, "ERROR: Could not open pinned map %s: %s\n", path, strerror(errno));
+      return false;
+    }
+  }
+
+  snprintf(path, sizeof(path), "%s/a2s_srv_stats", A2S_PIN_ROOT);
+  maps->stats = bpf_obj_get(path);
+  maps->cpus = libbpf_num_possible_cpus();
+
+  return true;
+}
+
+/**
+* Read the cached response of a server from the response store
+*
+* @param maps Pointer to the map FDs.
+* @param k Query type index.
+* @param key Pointer to the server key.
+* @param buf Output buffer (A2S_MAX_SIZE bytes).
+* @return Response size, or -1 if the server has no cached response of this type.
+*/
+static int read_response(const ctl_maps_t *maps, int k, const struct a2s_server_key *key, unsigned char *buf)
+{
+  struct a2s_ref ref;
+
+  if (bpf_map_lookup_elem(maps->resp[k], key, &ref) < 0 || !ref.size || ref.cls >= A2S_STORE_CLASSES || ref.size > A2S_STORE_CLASS_SIZE(ref.cls))
+  {
+    return -1;
+  }
+
+  return bpf_map_lookup_elem(maps->store[ref.cls], &ref.slot, buf) < 0 ? -1 : ref.size;
+}
+
+/**
+* Sum the per server counters of a server over the CPUs
+*
+* @param maps Pointer to the map FDs.
+* @param key Pointer to the server key.
+* @param stats Pointer to the summed counters.
+* @return true on success, or false if the server has no counters.
+*/
+static bool read_stats(const ctl_maps_t *maps, const struct a2s_server_key *key, struct a2s_srv_stats *stats)
+{
+  memset(stats, 0, sizeof(*stats));
+
+  if (maps->stats < 0 || maps->cpus <= 0)
+  {
+    return false;
+  }
+
+  // One value per possible CPU
+  struct a2s_srv_stats *values = calloc(maps->cpus, sizeof(*values));
+
+  if (!values || bpf_map_lookup_elem(maps->stats, key, values) < 0)
+  {
+    free(values);
+    return false;
+  }
+
+  for (int cpu = 0; cpu < maps->cpus; cpu++)
+  {
+    for (int c = 0; c < A2S_SRV_COUNTERS; c++)
+    {
+      for (int k = 0; k < A2S_QUERY_TYPES; k++)
+      {
+        stats->count[c][k] += values[cpu].count[c][k];
+      }
+    }
+  }
+
+  free(values);
+  return true;
+}
+
+/**
+* Send a command to the loader over the control socket and read the whole reply
+*
+* @param socket_path Control socket path.
+* @param cmd Command line (without the newline).
+* @return Reply (NUL terminated, to free), or NULL on failure.
+*/
+static char *control_command(const char *socket_path, const char *cmd)
+{
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  size_t len = 0, capacity = 4096;
+  char *out = malloc(capacity);
+  ssize_t n;
+
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path);
+
+  if (fd < 0 || !out || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || dprintf(fd, "%s\n", cmd) < 0)
+  {
+    fprintf(stderr, "ERROR: Could not reach the loader on %s: %s\n", socket_path, strerror(errno));
+
+    if (fd >= 0) close(fd);
+    free(out);
+    return NULL;
+  }
+
+  // The loader closes the connection at the end of the reply
+  while ((n = recv(fd, out + len, capacity - len - 1, 0)) > 0)
+  {
+    len += n;
+
+    if (len + 1 == capacity)
+    {
+      char *temp = realloc(out, capacity * 2);
+
+      if (!temp)
+      {
+        break;
+      }
+
+      out = temp;
+      capacity *= 2;
+    }
+  }
+
+  close(fd);
+  out[len] = '\0';
+  return out;
+}
+
+/**
+* Print one row of the server list
+*
+* @param maps Pointer to the map FDs.
+* @param key Pointer to the server key.
+* @param age Oldest age of the fetched responses in seconds, -1 if unknown.
+* @param failures Most failed cycles in a row of a query type.
+* @param source "poll" or "push", "-" if unknown.
+*/
+static void print_server(const ctl_maps_t *maps, const struct a2s_server_key *key, long age, unsigned int failures, const char *source)
+{
+  unsigned char buf[A2S_MAX_SIZE];
+  char server[32], ip_str[INET_ADDRSTRLEN], sizes[A2S_QUERY_TYPES][8], age_str[16], hit_str[40], players[16];
+  struct a2s_srv_stats stats;
+  a2s_info_t info = {0};
+  int info_size = -1;
+
+  inet_ntop(AF_INET, &key->ip, ip_str, sizeof(ip_str));
+  snprintf(server, sizeof(server), "%s:%u", ip_str, ntohs(key->port));
+
+  for (int k = 0; k < A2S_QUERY_TYPES; k++)
+  {
+    int size = read_response(maps, k, key, buf);
+
+    if (size < 0)
+    {
+      strcpy(sizes[k], "-");
+    }
+    else
+    {
+      snprintf(sizes[k], sizeof(sizes[k]), "%d", size);
+    }
+
+    // Decode the cached S2A_INFO (the buffer then holds it)
+    if (k == A2S_IDX_INFO && size >= 0 && a2s_parse_info(buf, size, &info) == 0)
+    {
+      info_size = size;
+    }
+  }
+
+  strcpy(age_str, "-");
+  strcpy(players, "-");
+  strcpy(hit_str, "-");
+
+  if (age >= 0)
+  {
+    snprintf(age_str, sizeof(age_str), "%lds", age);
+  }
+
+  if (info_size >= 0)
+  {
+    snprintf(players, sizeof(players), "%u/%u", info.players, info.max_players);
+  }
+
+  // Hit rate of the data queries: answered from the cache vs dropped as not cached
+  if (read_stats(maps, key, &stats))
+  {
+    __u64 hits = 0, misses = 0;
+
+    for (int k = 0; k < A2S_QUERY_TYPES; k++)
+    {
+      hits += stats.count[A2S_SRV_HIT][k];
+      misses += stats.count[A2S_SRV_MISS][k];
+    }
+
+    if (hits + misses > 0)
+    {
+      snprintf(hit_str, sizeof(hit_str), "%.1f%% (%llu)", 100.0 * hits / (hits + misses), (unsigned long long)(hits + misses));
+    }
+  }
+
+  printf("%-21s %5s %6s %5s %6s %4u %4s %-16s %7s %-16.16s %s\n", server, sizes[0], sizes[1], sizes[2], age_str, failures, source,
+  hit_str, players, info_size < 0 ? "-" : info.map, info_size < 0 ? "-" : info.name);
+}
+
+/**
+* List the servers: the fetch set from the loader, or the cached servers of the maps when the loader isn't running (persistent mode)
+*
+* @param maps Pointer to the map FDs.
+* @param socket_path Control socket path.
+* @return Exit code.
+*/
+static int cmd_list(const ctl_maps_t *maps, const char *socket_path)
+{
+  char *servers = control_command(socket_path, "servers");
+
+  printf("%-21s %5s %6s %5s %6s %4s %4s %-16s %7s %-16s %s\n", "SERVER", "INFO", "PLAYER", "RULES", "AGE", "FAIL", "SRC",
+  "HIT% (QUERIES)", "PLAYERS", "MAP", "NAME");
+
+  if (!servers)
+  {
+    fprintf(stderr, "Listing the cached servers of the maps, without the fetch state.\n");
+
+    struct a2s_server_key key, next_key;
+
+    for (int ret = bpf_map_get_next_key(maps->resp[A2S_IDX_INFO], NULL, &next_key); ret == 0;
+    ret = bpf_map_get_next_key(maps->resp[A2S_IDX_INFO], &key, &next_key))
+    {
+      key = next_key;
+      print_server(maps, &key, -1, 0, "-");
+    }
+
+    return 0;
+  }
+
+  for (char *line = strtok(servers, "\n"); line; line = strtok(NULL, "\n"))
+  {
+    char addr_str[64], source[8];
+    long age[A2S_QUERY_TYPES];
+    unsigned int failures[A2S_QUERY_TYPES];
+    struct sockaddr_in addr;
+
+    if (strncmp(line, "ERROR: ", 7) == 0)
+    {
+      fprintf(stderr, "%s\n", line);
+      continue;
+    }
+
+    if (sscanf(line, "%63s %ld %ld %ld %u %u %u %7s", addr_str, &age[0], &age[1], &age[2], &failures[0], &failures[1], &failures[2], source) != 8)
+    {
+      continue;
+    }
+
+    char *colon = strrchr(addr_str, ':');
+
+    if (!colon)
+    {
+      continue;
+    }
+
+    *colon = '\0';
+
+    if (inet_pton(AF_INET, addr_str, &addr.sin_addr) != 1)
+    {
+      continue;
+    }
+
+    struct a2s_server_key key = {0};
+    long oldest = -1;
+    unsigned int worst = 0;
+
+    key.ip = addr.sin_addr.s_addr;
+    key.port = htons((__u16)atoi(colon + 1));
+
+    for (int k = 0; k < A2S_QUERY_TYPES; k++)
+    {
+      oldest = age[k] > oldest ? age[k] : oldest;
+      worst = failures[k] > worst ? failures[k] : worst;
+    }
+
+    print_server(maps, &key, oldest, worst, source);
+  }
+
+  free(servers);
+  return 0;
+}
+
+/**
+* Print the cached response of a server, as a hex dump or raw
+*
+* @param maps Pointer to the map FDs.
+* @param server Server address ("ip:port").
+* @param type Query type name.
+* @param raw Whether to write the raw response.
+* @return Exit code.
+*/
+static int cmd_dump(const ctl_maps_t *maps, const char *server, const char *type, bool raw)
+{
+  const char *colon = strrchr(server, ':');
+  char ip_str[INET_ADDRSTRLEN];
+  struct a2s_server_key key = {0};
+  unsigned char buf[A2S_MAX_SIZE];
+  int k;
+
+  for (k = 0; k < A2S_QUERY_TYPES && strcmp(type, type_names[k]) != 0; k++);
+
+  if (!colon || (size_t)(colon - server) >= sizeof(ip_str) || k == A2S_QUERY_TYPES)
+  {
+    fprintf(stderr, "ERROR: Expected <ip:port> <info|player|rules>.\n");
+    return 1;
+  }
+
+  memcpy(ip_str, server, colon - server);
+  ip_str[colon - server] = '\0';
+  key.port = htons((__u16)atoi(colon + 1));
+
+  if (inet_pton(AF_INET, ip_str, &key.ip) != 1)
+  {
+    fprintf(stderr, "ERROR: Invalid server address %s.\n", server);
+    return 1;
+  }
+
+  int size = read_response(maps, k, &key, buf);
+
+  if (size < 0)
+  {
+    fprintf(stderr, "ERROR: No cached %s response for %s.\n", type, server);
+    return 1;
+  }
+
+  if (raw)
+  {
+    return fwrite(buf, 1, size, stdout) == (size_t)size ? 0 : 1;
+  }
+
+  printf("%s %s: %d bytes\n", server, type, size);
+
+  // 16 bytes per line: offset, hex, printable characters
+  for (int off = 0; off < size; off += 16)
+  {
+    printf("%04x  ", off);
+
+    for (int i = 0; i < 16; i++)
+    {
+      if (off + i < size)
+      {
+        printf("%02x ", buf[off + i]);
+      }
+      else
+      {
+        printf("   ");
+      }
+    }
+
+    printf(" ");
+
+    for (int i = 0; i < 16 && off + i < size; i++)
+    {
+      putchar(buf[off + i] >= 0x20 && buf[off + i] < 0x7F ? buf[off + i] : '.');
+    }
+
+    printf("\n");
+  }
+
+  return 0;
+}
+
+/**
+* Print the fetch telemetry of the fetcher workers and of the servers (RTTs in milliseconds)
+*
+* @param socket_path Control socket path.
+* @param server Server address ("ip:port") to show, NULL for all the servers.
+* @return Exit code.
+*/
+static int cmd_stats(const char *socket_path, const char *server)
+{
+  char *stats = control_command(socket_path, "stats");
+  bool header = false;
+
+  if (!stats)
+  {
+    return 1;
+  }
+
+  for (char *line = strtok(stats, "\n"); line; line = strtok(NULL, "\n"))
+  {
+    char addr_str[64], type[16];
+    unsigned long long ticks, tick_avg, tick_max, map_changes = 0, saved = 0, rtt_avg, rtt_p50, rtt_p99;
+    unsigned int id, count, replies, rtt_max, challenges, timeouts, updates, unchanged, split, oversized, send_errors;
+
+    if (strncmp(line, "ERROR: ", 7) == 0)
+    {
+      fprintf(stderr, "%s\n", line);
+    }
+    else if (sscanf(line, "fetcher %u %llu %llu %llu %u %llu %llu", &id, &ticks, &tick_avg, &tick_max, &count, &map_changes, &saved) >= 5)
+    {
+      if (!server)
+      {
+        printf("Fetcher %u: %u servers, %llu ticks, %.2f ms avg, %.2f ms max per tick, %llu map changes, %llu syscalls saved by batching\n",
+        id, count, ticks, tick_avg / 1000.0, tick_max / 1000.0, map_changes, saved);
+      }
+    }
+    else if (sscanf(line, "%63s %15s %u %llu %llu %llu %u %u %u %u %u %u %u %u", addr_str, type, &replies, &rtt_avg, &rtt_p50, &rtt_p99,
+    &rtt_max, &challenges, &timeouts, &updates, &unchanged, &split, &oversized, &send_errors) == 14 && (!server || strcmp(server, addr_str) == 0))
+    {
+      if (!header)
+      {
+        printf("%-21s %-10s %8s %8s %8s %8s %8s %6s %7s %7s %9s %5s %5s %7s\n", "SERVER", "TYPE", "REPLIES", "RTT AVG", "P50", "P99", "MAX",
+        "CHALL", "TIMEOUT", "UPDATED", "UNCHANGED", "SPLIT", "LARGE", "SENDERR");
+        header = true;
+      }
+
+      printf("%-21s %-10s %8u %8.2f %8.2f %8.2f %8.2f %6u %7u %7u %9u %5u %5u %7u\n", addr_str, type, replies, rtt_avg / 1000.0, rtt_p50 / 1000.0,
+      rtt_p99 / 1000.0, rtt_max / 1000.0, challenges, timeouts, updates, unchanged, split, oversized, send_errors);
+    }
+  }
+
+  free(stats);
+
+  if (server && !header)
+  {
+    fprintf(stderr, "ERROR: Unknown server %s.\n", server);
+    return 1;
+  }
+
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  const char *socket_path = A2S_CONTROL_SOCKET;
+  bool raw = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "rS:h")) != -1)
+  {
+    switch (opt)
+    {
+      case 'r': raw = true; break;
+      case 'S': socket_path = optarg; break;
+      default: usage(argv[0]); return 1;
+    }
+  }
+
+  const char *cmd = optind < argc ? argv[optind] : NULL;
+  const char *server = optind + 1 < argc ? argv[optind + 1] : NULL;
+
+  if (!cmd)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  // Commands answered by the loader
+  if (strcmp(cmd, "stats") == 0)
+  {
+    return cmd_stats(socket_path, server);
+  }
+
+  if (strcmp(cmd, "refetch") == 0 || strcmp(cmd, "add") == 0 || strcmp(cmd, "remove") == 0)
+  {
+    char line[A2S_CONTROL_MAX_LINE];
+
+    if (!server)
+    {
+      usage(argv[0]);
+      return 1;
+    }
+
+    snprintf(line, sizeof(line), "%s %s", cmd, server);
+
+    char *out = control_command(socket_path, line);
+
+    if (!out)
+    {
+      return 1;
+    }
+
+    int ret = strncmp(out, "ERROR: ", 7) == 0 || !out[0];
+    fputs(out[0] ? out : "ERROR: No reply from the loader.\n", ret ? stderr : stdout);
+    free(out);
+    return ret;
+  }
+
+  // Commands reading the pinned maps
+  ctl_maps_t maps;
+
+  if (strcmp(cmd, "list") != 0 && strcmp(cmd, "dump") != 0)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (!open_maps(&maps))
+  {
+    return 1;
+  }
+
+  if (strcmp(cmd, "list") == 0)
+  {
+    return cmd_list(&maps, socket_path);
+  }
+
+  if (!server || optind + 2 >= argc)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  return cmd_dump(&maps, server, argv[optind + 2], raw);
+}
\ No newline at end of file
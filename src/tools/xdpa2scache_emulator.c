@@ -0,0 +1,768 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <linux/types.h>
+
+#include "a2s_defs.h"
+#include "xxhash64.h"
+#include "a2s_payload.h"
+
+/*
+ * A2S game server emulator: stand-in servers on a range of ports (thousands in one process) for end-to-end tests and
+ * benchmarks without HLDS/SRCDS. Speaks the Source and GoldSrc dialects (challenges, split responses, the obsolete
+ * S2A_INFO_DETAILED), with configurable players and rules, and delayed or lost replies. Runs until SIGINT/SIGTERM.
+ * With state changes (-c), every server changes (a player joins) once per interval, and its name carries the generation
+ * and the time of the change ("<name> #<n> g<generation> t<realtime us>") for the freshness mode of xdpa2scache-loadgen.
+*/
+
+#define EMU_MAX_THREADS 64
+
+// Largest generated response, the ones above A2S_MAX_SIZE are sent split (-S) or as oversized datagrams
+#define EMU_MAX_RESPONSE 16384
+
+// Delayed replies waiting at most per thread, the others are sent right away
+#define EMU_MAX_PENDING (1 << 20)
+
+enum
+{
+  DIALECT_SOURCE,
+  DIALECT_GOLDSRC
+};
+
+typedef struct
+{
+  int fd;
+  int index;
+  __u32 generation;
+  __u64 next_change_ns;
+  unsigned char *resp[A2S_QUERY_TYPES];
+  size_t size[A2S_QUERY_TYPES];
+  unsigned char *detailed;
+  size_t detailed_size;
+  __u32 split_id;
+} emu_server_t;
+
+// Delayed reply (min-heap by due time)
+typedef struct
+{
+  __u64 due_ns;
+  emu_server_t *srv;
+  struct sockaddr_in dst;
+  size_t len;
+  unsigned char *data;
+} pending_t;
+
+typedef struct
+{
+  pthread_t tid;
+  emu_server_t *servers;
+  int count;
+  int next_change;
+  pending_t *pending;
+  int pending_count;
+  int pending_capacity;
+  __u64 rng;
+  __u64 queries;
+  __u64 challenges;
+  __u64 responses;
+  __u64 datagrams;
+  __u64 lost;
+  __u64 delayed;
+  __u64 invalid;
+  __u64 changes;
+} emu_thread_t;
+
+typedef struct
+{
+  int dialect;
+  bool challenges;
+  bool detailed;
+  size_t split_size;
+  __u64 delay_ns;
+  __u64 jitter_ns;
+  double loss;
+  __u64 secret;
+  __u64 change_ns;
+  const char *name;
+  const char *map;
+  const char *bind_ip;
+  int base_port;
+  int players;
+  int max_players;
+  int rules;
+  volatile bool running;
+} emu_cfg_t;
+
+static emu_cfg_t emu;
+
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+  "Usage: %s [options]\n"
+  "  -b <ip>        Address of the servers (default 127.0.0.1)\n"
+  "  -p <port>      First server port (default 27015)\n"
+  "  -n <servers>   Number of servers, one port each (default 1)\n"
+  "  -t <threads>   Threads (default 1)\n"
+  "  -D <dialect>   source or goldsrc (no A2S_INFO challenge, GoldSrc split header) (default source)\n"
+  "  -C             No challenges at all (old servers)\n"
+  "  -m             Also send the obsolete GoldSrc S2A_INFO_DETAILED reply before S2A_INFO_SRC\n"
+  "  -P <players>   Players (default 16)\n"
+  "  -M <max>       Maximum players (default 32)\n"
+  "  -R <rules>     Rules (default 24, around 90 rules exceed %d bytes)\n"
+  "  -N <name>      Server name prefix (default \"Emulated server\")\n"
+  "  -L <map>       Map (default de_dust2)\n"
+  "  -S <bytes>     Split the responses above this size into 0xFE packets of this size (default 0, not split)\n"
+  "  -d <ms>        Reply delay (default 0)\n"
+  "  -j <ms>        Random extra reply delay up to this (default 0)\n"
+  "  -l <percent>   Lost replies (default 0)\n"
+  "  -c <ms>        State change of every server once per interval, spread over it (default 0, static)\n", prog, A2S_MAX_SIZE);
+}
+
+static __u64 now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (__u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static __u64 xorshift64(__u64 *state)
+{
+  __u64 x = *state;
+
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return *state = x;
+}
+
+/**
+* Challenge number of a client, stable for the client address and the server (never 0 or 0xFFFFFFFF, the challenge requests)
+*
+* @param srv Pointer to the server.
+* @param src Pointer to the client address.
+* @return Challenge number.
+*/
+static __u32 client_cookie(const emu_server_t *srv, const struct sockaddr_in *src)
+{
+  struct
+  {
+    __be32 ip;
+    __be16 port;
+    __u16 pad;
+    __s32 index;
+  } tuple = { src->sin_addr.s_addr, src->sin_port, 0, srv->index };
+  __u32 cookie = (__u32)xxh64(&tuple, sizeof(tuple), emu.secret);
+
+  return cookie == 0 || cookie == 0xFFFFFFFF ? 1 : cookie;
+}
+
+static void send_datagram(emu_thread_t *th, const emu_server_t *srv, const void *data, size_t len, const struct sockaddr_in *dst)
+{
+  if (sendto(srv->fd, data, len, 0, (const struct sockaddr *)dst, sizeof(*dst)) >= 0)
+  {
+    th->datagrams++;
+  }
+}
+
+/**
+* Send a response, split into 0xFE packets (Source or GoldSrc header) when it is above the split size
+*
+* @param th Pointer to the thread.
+* @param srv Pointer to the server.
+* @param data Response.
+* @param len Response size.
+* @param dst Pointer to the client address.
+*/
+static void emit(emu_thread_t *th, emu_server_t *srv, const unsigned char *data, size_t len, const struct sockaddr_in *dst)
+{
+  size_t header = emu.dialect == DIALECT_GOLDSRC ? 9 : 12;
+  size_t max_packets = emu.dialect == DIALECT_GOLDSRC ? 15 : 255;
+
+  if (!emu.split_size || len <= emu.split_size || emu.split_size <= header)
+  {
+    send_datagram(th, srv, data, len, dst);
+    return;
+  }
+
+  size_t chunk = emu.split_size - header, total = (len + chunk - 1) / chunk;
+  unsigned char packet[EMU_MAX_RESPONSE + 12];
+  __u32 split = SPLIT_HEADER, id = ++srv->split_id;
+
+  // Too many packets for the header: sent whole
+  if (total > max_packets)
+  {
+    send_datagram(th, srv, data, len, dst);
+    return;
+  }
+
+  for (size_t i = 0; i < total; i++)
+  {
+    size_t part = i + 1 < total ? chunk : len - i * chunk;
+    __u16 size = (__u16)emu.split_size;
+
+    memcpy(packet, &split, 4);
+    memcpy(packet + 4, &id, 4);
+
+    if (emu.dialect == DIALECT_GOLDSRC)
+    {
+      packet[8] = (unsigned char)(i << 4 | total);
+    }
+    else
+    {
+      packet[8] = (unsigned char)total;
+      packet[9] = (unsigned char)i;
+      memcpy(packet + 10, &size, 2);
+    }
+
+    memcpy(packet + header, data + i * chunk, part);
+    send_datagram(th, srv, packet, header + part, dst);
+  }
+}
+
+static void heap_swap(pending_t *a, pending_t *b)
+{
+  pending_t tmp = *a;
+
+  *a = *b;
+  *b = tmp;
+}
+
+/**
+* Queue a delayed reply
+*
+* @param th Pointer to the thread.
+* @param p Pointer to the reply (the data is owned by the queue).
+* @return true on success, or false if the queue is full.
+*/
+static bool pending_push(emu_thread_t *th, const pending_t *p)
+{
+  if (th->pending_count == th->pending_capacity)
+  {
+    int capacity = th->pending_capacity ? th->pending_capacity * 2 : 1024;
+    pending_t *temp;
+
+    if (capacity > EMU_MAX_PENDING || !(temp = realloc(th->pending, capacity * sizeof(*temp))))
+    {
+      return false;
+    }
+
+    th->pending = temp;
+    th->pending_capacity = capacity;
+  }
+
+  int i = th->pending_count++;
+
+  th->pending[i] = *p;
+
+  while (i > 0 && th->pending[(i - 1) / 2].due_ns > th->pending[i].due_ns)
+  {
+    heap_swap(&th->pending[(i - 1) / 2], &th->pending[i]);
+    i = (i - 1) / 2;
+  }
+
+  return true;
+}
+
+static void pending_pop(emu_thread_t *th)
+{
+  int i = 0;
+
+  th->pending[0] = th->pending[--th->pending_count];
+
+  for (;;)
+  {
+    int l = 2 * i + 1, r = l + 1, min = i;
+
+    if (l < th->pending_count && th->pending[l].due_ns < th->pending[min].due_ns)
+    {
+      min = l;
+    }
+
+    if (r < th->pending_count && th->pending[r].due_ns < th->pending[min].due_ns)
+    {
+      min = r;
+    }
+
+    if (min == i)
+    {
+      break;
+    }
+
+    heap_swap(&th->pending[i], &th->pending[min]);
+    i = min;
+  }
+}
+
+/**
+* Send a reply now, later (delay) or never (loss)
+*
+* @param th Pointer to the thread.
+* @param srv Pointer to the server.
+* @param data Reply.
+* @param len Reply size.
+* @param dst Pointer to the client address.
+*/
+static void reply(emu_thread_t *th, emu_server_t *srv, const unsigned char *data, size_t len, const struct sockaddr_in *dst)
+{
+  __u64 r = xorshift64(&th->rng);
+
+  if (emu.loss > 0 && (r % 1000000) < emu.loss * 10000)
+  {
+    th->lost++;
+    return;
+  }
+
+  if (emu.delay_ns || emu.jitter_ns)
+  {
+    pending_t p = { .due_ns = now_ns() + emu.delay_ns + (emu.jitter_ns ? (r >> 20) % emu.jitter_ns : 0), .srv = srv, .dst = *dst, .len = len };
+
+    // The response may be rebuilt before the reply is due, the reply keeps its copy
+    if ((p.data = malloc(len)))
+    {
+      memcpy(p.data, data, len);
+
+      if (pending_push(th, &p))
+      {
+        th->delayed++;
+        return;
+      }
+
+      free(p.data);
+    }
+  }
+
+  emit(th, srv, data, len, dst);
+}
+
+/**
+* Answer a query: a challenge without the right challenge number, the response otherwise
+*
+* @param th Pointer to the thread.
+* @param srv Pointer to the server.
+* @param buf Query.
+* @param n Query size.
+* @param src Pointer to the client address.
+*/
+static void handle_query(emu_thread_t *th, emu_server_t *srv, const unsigned char *buf, ssize_t n, const struct sockaddr_in *src)
+{
+  __u32 header;
+  int qidx;
+
+  if (n < 9 || (memcpy(&header, buf, 4), header != CONNECTIONLESS_HEADER))
+  {
+    th->invalid++;
+    return;
+  }
+
+  switch (buf[4])
+  {
+    case A2S_INFO: qidx = A2S_IDX_INFO; break;
+    case A2S_PLAYER: qidx = A2S_IDX_PLAYER; break;
+    case A2S_RULES: qidx = A2S_IDX_RULES; break;
+
+    default:
+    th->invalid++;
+    return;
+  }
+
+  if (qidx == A2S_IDX_INFO && (n < (ssize_t)A2S_INFO_REQ_SIZE || memcmp(buf, A2S_INFO_REQ, A2S_INFO_REQ_SIZE) != 0))
+  {
+    th->invalid++;
+    return;
+  }
+
+  th->queries++;
+
+  // GoldSrc servers answer A2S_INFO without a challenge
+  if (emu.challenges && !(emu.dialect == DIALECT_GOLDSRC && qidx == A2S_IDX_INFO))
+  {
+    __u32 cookie = client_cookie(srv, src), check;
+    size_t off = qidx == A2S_IDX_INFO ? A2S_INFO_REQ_SIZE : 5;
+
+    if (n < (ssize_t)(off + 4) || (memcpy(&check, buf + off, 4), check != cookie))
+    {
+      unsigned char challenge[9] = { 0xFF, 0xFF, 0xFF, 0xFF, S2C_CHALLENGE };
+
+      memcpy(challenge + 5, &cookie, 4);
+      th->challenges++;
+      reply(th, srv, challenge, sizeof(challenge), src);
+      return;
+    }
+  }
+
+  if (qidx == A2S_IDX_INFO && srv->detailed)
+  {
+    reply(th, srv, srv->detailed, srv->detailed_size, src);
+  }
+
+  th->responses++;
+  reply(th, srv, srv->resp[qidx], srv->size[qidx], src);
+}
+
+/**
+* Build the responses of a server for its current generation (players, scores and rules vary with it),
+* replacing the previous ones
+*
+* @param srv Pointer to the server.
+* @return true on success, or false on failure.
+*/
+static bool build_responses(emu_server_t *srv)
+{
+  static __thread unsigned char buf[EMU_MAX_RESPONSE];
+  char name[128], address[32];
+  int players = emu.change_ns ? (emu.players + (int)srv->generation) % (emu.max_players + 1) : emu.players;
+  __u32 seed = (__u32)srv->index + srv->generation;
+  size_t size;
+
+  // The generation and the time of the change (realtime, us) in the name, for the freshness probes
+  if (emu.change_ns)
+  {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    snprintf(name, sizeof(name), "%s #%d g%u t%llu", emu.name, srv->index + 1, srv->generation,
+    (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000);
+  }
+  else
+  {
+    snprintf(name, sizeof(name), "%s #%d", emu.name, srv->index + 1);
+  }
+
+  for (int k = 0; k < A2S_QUERY_TYPES; k++)
+  {
+    size = k == A2S_IDX_INFO ? a2s_build_info(buf, sizeof(buf), name, emu.map, (uint8_t)players, (uint8_t)emu.max_players)
+    : k == A2S_IDX_PLAYER ? a2s_build_players(buf, sizeof(buf), (uint8_t)players, seed) : a2s_build_rules(buf, sizeof(buf), (uint16_t)emu.rules, seed);
+
+    if (!size)
+    {
+      return false;
+    }
+
+    unsigned char *resp = realloc(srv->resp[k], size);
+
+    if (!resp)
+    {
+      return false;
+    }
+
+    memcpy(resp, buf, size);
+    srv->resp[k] = resp;
+    srv->size[k] = size;
+  }
+
+  if (emu.detailed)
+  {
+    snprintf(address, sizeof(address), "%s:%d", emu.bind_ip, emu.base_port + srv->index);
+
+    if (!(size = a2s_build_info_goldsrc(buf, sizeof(buf), address, name, emu.map, (uint8_t)players, (uint8_t)emu.max_players)))
+    {
+      return false;
+    }
+
+    unsigned char *detailed = realloc(srv->detailed, size);
+
+    if (!detailed)
+    {
+      return false;
+    }
+
+    memcpy(detailed, buf, size);
+    srv->detailed = detailed;
+    srv->detailed_size = size;
+  }
+
+  return true;
+}
+
+/**
+* Apply the due state changes of the servers of a thread (their change times are in server order, one interval apart in total)
+*
+* @param th Pointer to the thread.
+* @param now Current time (monotonic, ns).
+* @return Time of the next change, or UINT64_MAX without changes.
+*/
+static __u64 apply_changes(emu_thread_t *th, __u64 now)
+{
+  if (!emu.change_ns)
+  {
+    return UINT64_MAX;
+  }
+
+  for (int n = 0; n < th->count && th->servers[th->next_change].next_change_ns <= now; n++)
+  {
+    emu_server_t *srv = &th->servers[th->next_change];
+
+    srv->generation++;
+    srv->next_change_ns += emu.change_ns;
+
+    if (build_responses(srv))
+    {
+      th->changes++;
+    }
+
+    th->next_change = (th->next_change + 1) % th->count;
+  }
+
+  return th->servers[th->next_change].next_change_ns;
+}
+
+/**
+* Server thread: answers the queries to its servers and sends the delayed replies when due
+*
+* @param arg Pointer to the thread.
+*/
+static void *server_loop(void *arg)
+{
+  emu_thread_t *th = (emu_thread_t *)arg;
+  struct epoll_event events[256];
+  unsigned char buf[2048];
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+
+  for (int i = 0; i < th->count; i++)
+  {
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &th->servers[i] };
+    epoll_ctl(epfd, EPOLL_CTL_ADD, th->servers[i].fd, &ev);
+  }
+
+  while (emu.running)
+  {
+    __u64 now = now_ns(), due = apply_changes(th, now);
+    int timeout_ms = 100;
+
+    if (th->pending_count > 0 && th->pending[0].due_ns < due)
+    {
+      due = th->pending[0].due_ns;
+    }
+
+    if (due != UINT64_MAX)
+    {
+      timeout_ms = due <= now ? 0 : due - now >= 100000000ULL ? 100 : (int)((due - now + 999999) / 1000000);
+    }
+
+    int nfds = epoll_wait(epfd, events, 256, timeout_ms);
+
+    for (int i = 0; i < nfds; i++)
+    {
+      emu_server_t *srv = (emu_server_t *)events[i].data.ptr;
+      struct sockaddr_in src;
+      socklen_t addrlen = sizeof(src);
+      ssize_t n;
+
+      while ((n = recvfrom(srv->fd, buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr *)&src, &addrlen)) >= 0)
+      {
+        handle_query(th, srv, buf, n, &src);
+        addrlen = sizeof(src);
+      }
+    }
+
+    for (now = now_ns(); th->pending_count > 0 && th->pending[0].due_ns <= now; )
+    {
+      pending_t p = th->pending[0];
+
+      pending_pop(th);
+      emit(th, p.srv, p.data, p.len, &p.dst);
+      free(p.data);
+    }
+  }
+
+  while (th->pending_count > 0)
+  {
+    free(th->pending[--th->pending_count].data);
+  }
+
+  free(th->pending);
+  close(epfd);
+  return NULL;
+}
+
+int main(int argc, char **argv)
+{
+  int server_count = 1, thread_count = 1, opt;
+  const char *dialect = "source";
+  double delay_ms = 0, jitter_ms = 0, change_ms = 0;
+
+  emu.challenges = true;
+  emu.bind_ip = "127.0.0.1";
+  emu.base_port = 27015;
+  emu.name = "Emulated server";
+  emu.map = "de_dust2";
+  emu.players = 16;
+  emu.max_players = 32;
+  emu.rules = 24;
+
+  while ((opt = getopt(argc, argv, "b:p:n:t:D:CmP:M:R:N:L:S:d:j:l:c:h")) != -1)
+  {
+    switch (opt)
+    {
+      case 'b': emu.bind_ip = optarg; break;
+      case 'p': emu.base_port = atoi(optarg); break;
+      case 'n': server_count = atoi(optarg); break;
+      case 't': thread_count = atoi(optarg); break;
+      case 'D': dialect = optarg; break;
+      case 'C': emu.challenges = false; break;
+      case 'm': emu.detailed = true; break;
+      case 'P': emu.players = atoi(optarg); break;
+      case 'M': emu.max_players = atoi(optarg); break;
+      case 'R': emu.rules = atoi(optarg); break;
+      case 'N': emu.name = optarg; break;
+      case 'L': emu.map = optarg; break;
+      case 'S': emu.split_size = (size_t)atoi(optarg); break;
+      case 'd': delay_ms = atof(optarg); break;
+      case 'j': jitter_ms = atof(optarg); break;
+      case 'l': emu.loss = atof(optarg); break;
+      case 'c': change_ms = atof(optarg); break;
+      default: usage(argv[0]); return 1;
+    }
+  }
+
+  if (server_count < 1 || emu.base_port < 1 || emu.base_port + server_count > 65536 || thread_count < 1 || thread_count > EMU_MAX_THREADS
+  || thread_count > server_count || emu.players < 0 || emu.players > 255 || emu.max_players < emu.players || emu.max_players > 255
+  || emu.rules < 0 || emu.rules > 65535 || emu.split_size > EMU_MAX_RESPONSE || delay_ms < 0 || jitter_ms < 0 || emu.loss < 0 || emu.loss > 100 || change_ms < 0
+  || (strcmp(dialect, "source") != 0 && strcmp(dialect, "goldsrc") != 0))
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  struct sockaddr_in addr = { .sin_family = AF_INET };
+
+  if (inet_pton(AF_INET, emu.bind_ip, &addr.sin_addr) != 1)
+  {
+    fprintf(stderr, "ERROR: Invalid address '%s'.\n", emu.bind_ip);
+    return 1;
+  }
+
+  emu.dialect = strcmp(dialect, "goldsrc") == 0 ? DIALECT_GOLDSRC : DIALECT_SOURCE;
+  emu.delay_ns = (__u64)(delay_ms * 1e6);
+  emu.jitter_ns = (__u64)(jitter_ms * 1e6);
+  emu.change_ns = (__u64)(change_ms * 1e6);
+  emu.secret = now_ns() ^ ((__u64)getpid() << 32);
+
+  // One socket per server
+  struct rlimit rl = { server_count + 256, server_count + 256 };
+
+  if (setrlimit(RLIMIT_NOFILE, &rl) < 0)
+  {
+    perror("setrlimit failed");
+  }
+
+  emu_server_t *servers = calloc(server_count, sizeof(emu_server_t));
+  emu_thread_t *threads = calloc(thread_count, sizeof(emu_thread_t));
+
+  if (!servers || !threads)
+  {
+    perror("calloc failed");
+    return 1;
+  }
+
+  __u64 start_ns = now_ns();
+
+  for (int i = 0; i < server_count; i++)
+  {
+    servers[i].index = i;
+    addr.sin_port = htons(emu.base_port + i);
+
+    // The first changes are spread over one interval, in server order
+    servers[i].next_change_ns = start_ns + emu.change_ns + emu.change_ns * i / server_count;
+
+    if (!build_responses(&servers[i]))
+    {
+      fprintf(stderr, "ERROR: Responses of server %d don't fit in %d bytes (fewer players or rules).\n", i + 1, EMU_MAX_RESPONSE);
+      return 1;
+    }
+
+    if ((servers[i].fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0 || bind(servers[i].fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+      fprintf(stderr, "ERROR: Server on %s:%d failed: %s\n", emu.bind_ip, emu.base_port + i, strerror(errno));
+      return 1;
+    }
+  }
+
+  // Block the signals before creating the threads, the main thread waits for them
+  sigset_t sig_set;
+  int sig;
+
+  sigemptyset(&sig_set);
+  sigaddset(&sig_set, SIGINT);
+  sigaddset(&sig_set, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &sig_set, NULL);
+
+  emu.running = true;
+
+  for (int t = 0; t < thread_count; t++)
+  {
+    int first = server_count * t / thread_count, last = server_count * (t + 1) / thread_count;
+
+    threads[t].servers = servers + first;
+    threads[t].count = last - first;
+    threads[t].rng = emu.secret + t + 1;
+
+    if (pthread_create(&threads[t].tid, NULL, server_loop, &threads[t]) != 0)
+    {
+      fprintf(stderr, "ERROR: Server thread creation failed.\n");
+      return 1;
+    }
+  }
+
+  printf("Emulating %d %s servers on %s:%d-%d (%s challenges, %d/%d players, %d rules, %zu/%zu/%zu bytes", server_count, dialect,
+  emu.bind_ip, emu.base_port, emu.base_port + server_count - 1, emu.challenges ? "with" : "without", emu.players, emu.max_players, emu.rules,
+  servers[0].size[A2S_IDX_INFO], servers[0].size[A2S_IDX_PLAYER], servers[0].size[A2S_IDX_RULES]);
+
+  if (emu.change_ns)
+  {
+    printf(", state changes every %.0f ms", change_ms);
+  }
+
+  printf(").\n");
+  fflush(stdout);
+
+  sigwait(&sig_set, &sig);
+  emu.running = false;
+
+  __u64 queries = 0, challenges = 0, responses = 0, datagrams = 0, lost = 0, delayed = 0, invalid = 0, changes = 0;
+
+  for (int t = 0; t < thread_count; t++)
+  {
+    pthread_join(threads[t].tid, NULL);
+    queries += threads[t].queries;
+    challenges += threads[t].challenges;
+    responses += threads[t].responses;
+    datagrams += threads[t].datagrams;
+    lost += threads[t].lost;
+    delayed += threads[t].delayed;
+    invalid += threads[t].invalid;
+    changes += threads[t].changes;
+  }
+
+  printf("Queries %llu, challenges %llu, responses %llu, datagrams sent %llu, lost %llu, delayed %llu, invalid %llu, state changes %llu.\n",
+  (unsigned long long)queries, (unsigned long long)challenges, (unsigned long long)responses, (unsigned long long)datagrams,
+  (unsigned long long)lost, (unsigned long long)delayed, (unsigned long long)invalid, (unsigned long long)changes);
+
+  for (int i = 0; i < server_count; i++)
+  {
+    close(servers[i].fd);
+
+    for (int k = 0; k < A2S_QUERY_TYPES; k++)
+    {
+      free(servers[i].resp[k]);
+    }
+
+    free(servers[i].detailed);
+  }
+
+  free(servers);
+  free(threads);
+  return 0;
+}
\ No newline at end of file
@@ -0,0 +1,397 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <arpa/inet.h>
+#include <bpf/bpf.h>
+
+#include "config.h"
+#include "a2s_defs.h"
+#include "helpers.h"
+#include "a2s_payload.h"
+
+/*
+ * Fetcher scaling benchmark: runs the loader's fetcher workers (1 to N threads) against local UDP stand-in servers,
+ * with anonymous cache maps instead of the XDP program's ones. Requires root (or CAP_BPF) for the maps.
+*/
+
+typedef struct
+{
+  int *fds;
+  int fd_count;
+  volatile bool *running;
+  unsigned char info[A2S_MAX_SIZE];
+  unsigned char players[A2S_MAX_SIZE];
+  unsigned char rules[A2S_MAX_SIZE];
+  size_t info_size;
+  size_t players_size;
+  size_t rules_size;
+  pthread_t tid;
+} responder_t;
+
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+  "Usage: %s [options]\n"
+  "  -n <servers>   Number of stand-in servers on 127.0.0.1 (default 1000)\n"
+  "  -p <port>      First stand-in server port (default 40000)\n"
+  "  -t <threads>   Maximum number of fetcher threads, runs 1, 2, 4, ... up to it (default 4)\n"
+  "  -d <seconds>   Measurement time per run (default 10)\n"
+  "  -i <ms>        Query cycle interval (default 100, short enough to saturate the fetcher)\n"
+  "  -r <threads>   Stand-in responder threads (default 2)\n"
+  "  -b <backend>   Fetcher backend: epoll, io_uring or both (default epoll, io_uring needs a USE_IO_URING=1 build)\n"
+  "  -B <ms>        Time budget of the first run to cache a response of every server (empty cache), exit code 2 when exceeded\n", prog);
+}
+
+/**
+* Stand-in servers: answer every A2S query right away (no challenge), with the same synthetic responses
+*
+* @param arg Pointer to the responder.
+*/
+static void *responder_loop(void *arg)
+{
+  responder_t *r = (responder_t *)arg;
+  struct epoll_event events[64];
+  unsigned char buf[64];
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+
+  for (int i = 0; i < r->fd_count; i++)
+  {
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = r->fds[i] };
+    epoll_ctl(epfd, EPOLL_CTL_ADD, r->fds[i], &ev);
+  }
+
+  while (*r->running)
+  {
+    int nfds = epoll_wait(epfd, events, 64, 100);
+
+    for (int i = 0; i < nfds; i++)
+    {
+      struct sockaddr_in src;
+      socklen_t addrlen = sizeof(src);
+      ssize_t n;
+
+      while ((n = recvfrom(events[i].data.fd, buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr *)&src, &addrlen)) >= 5)
+      {
+        const unsigned char *resp = buf[4] == A2S_INFO ? r->info : buf[4] == A2S_PLAYER ? r->players : r->rules;
+        size_t size = buf[4] == A2S_INFO ? r->info_size : buf[4] == A2S_PLAYER ? r->players_size : r->rules_size;
+
+        sendto(events[i].data.fd, resp, size, MSG_DONTWAIT, (struct sockaddr *)&src, addrlen);
+        addrlen = sizeof(src);
+      }
+    }
+  }
+
+  close(epfd);
+  return NULL;
+}
+
+/**
+* Wait until every server has its first response committed to the cache (A2S_INFO of each server, a full first cycle).
+* Servers answering fast complete several cycles meanwhile, so the cycle count alone would not tell.
+*
+* @param ctx Pointer to the loader context.
+* @param budget_ms Time budget in milliseconds.
+* @return Time taken in milliseconds, or -1 if the budget was exceeded.
+*/
+static double wait_first_cycle(const loader_ctx_t *ctx, int budget_ms)
+{
+  __u64 start_ns = monotonic_ns();
+
+  for (;;)
+  {
+    __u64 filled = 0;
+    double elapsed_ms = (monotonic_ns() - start_ns) / 1e6;
+
+    for (int i = 0; i < ctx->worker_count; i++)
+    {
+      filled += ctx->workers[i].filled;
+    }
+
+    if (filled >= (__u64)ctx->server_count)
+    {
+      return elapsed_ms;
+    }
+
+    if (elapsed_ms > budget_ms)
+    {
+      return -1;
+    }
+
+    usleep(1000);
+  }
+}
+
+/**
+* Get the CPU time of a thread
+*
+* @param tid Thread ID.
+* @return CPU time in seconds.
+*/
+static double thread_cpu_sec(pthread_t tid)
+{
+  clockid_t cid;
+  struct timespec ts;
+
+  if (pthread_getcpuclockid(tid, &cid) != 0 || clock_gettime(cid, &ts) != 0)
+  {
+    return 0;
+  }
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+  int server_count = 1000, base_port = 40000, max_threads = 4, duration = 10, interval_ms = 100, responder_count = 2, budget_ms = 0, opt;
+  bool backends[2] = { true, false };
+  bool over_budget = false, first_run = true;
+
+  while ((opt = getopt(argc, argv, "n:p:t:d:i:r:b:B:h")) != -1)
+  {
+    switch (opt)
+    {
+      case 'n': server_count = atoi(optarg); break;
+      case 'p': base_port = atoi(optarg); break;
+      case 't': max_threads = atoi(optarg); break;
+      case 'd': duration = atoi(optarg); break;
+      case 'i': interval_ms = atoi(optarg); break;
+      case 'r': responder_count = atoi(optarg); break;
+      case 'b':
+        backends[0] = strcmp(optarg, "io_uring") != 0;
+        backends[1] = strcmp(optarg, "epoll") != 0;
+        break;
+      case 'B': budget_ms = atoi(optarg); break;
+      default: usage(argv[0]); return 1;
+    }
+  }
+
+  if (server_count < 1 || base_port < 1 || base_port + server_count > 65536 || max_threads < 1 || max_threads > A2S_FETCH_MAX_THREADS
+  || duration < 1 || interval_ms < 1 || responder_count < 1 || responder_count > server_count || budget_ms < 0)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  #ifndef A2S_IO_URING
+  if (backends[1])
+  {
+    fprintf(stderr, "ERROR: This build has no io_uring backend (make USE_IO_URING=1).\n");
+    return 1;
+  }
+  #endif
+
+  // One socket per stand-in server
+  struct rlimit rl = { server_count + 256, server_count + 256 };
+
+  if (setrlimit(RLIMIT_NOFILE, &rl) < 0)
+  {
+    perror("setrlimit failed");
+  }
+
+  loader_ctx_t ctx = { .servers_lock = PTHREAD_MUTEX_INITIALIZER };
+  volatile bool responders_running = true;
+  responder_t *responders = calloc(responder_count, sizeof(responder_t));
+  int *fds = calloc(server_count, sizeof(int));
+
+  if (!responders || !(ctx.servers = calloc(server_count, sizeof(struct sockaddr_in))) || !fds)
+  {
+    perror("calloc failed");
+    return 1;
+  }
+
+  // Cache maps like the ones of the XDP program
+  int *map_fds[A2S_QUERY_TYPES] = { &ctx.xdp_maps.a2s_info, &ctx.xdp_maps.a2s_player, &ctx.xdp_maps.a2s_rules };
+  const char *map_names[A2S_QUERY_TYPES] = { "a2s_info", "a2s_player", "a2s_rules" };
+
+  for (int k = 0; k < A2S_QUERY_TYPES; k++)
+  {
+    if ((*map_fds[k] = bpf_map_create(BPF_MAP_TYPE_HASH, map_names[k], sizeof(struct a2s_server_key), sizeof(struct a2s_ref), server_count, NULL)) < 0)
+    {
+      fprintf(stderr, "ERROR: Creating the %s map failed: %s (root or CAP_BPF required)\n", map_names[k], strerror(errno));
+      return 1;
+    }
+  }
+
+  // Response store sized like the loader does it
+  for (int c = 0; c < A2S_STORE_CLASSES; c++)
+  {
+    char name[16];
+
+    snprintf(name, sizeof(name), "a2s_store_%u", A2S_STORE_CLASS_SIZE(c));
+
+    if ((ctx.xdp_maps.a2s_store[c] = bpf_map_create(BPF_MAP_TYPE_ARRAY, name, sizeof(__u32), A2S_STORE_CLASS_SIZE(c), store_slots(c, server_count), NULL)) < 0)
+    {
+      fprintf(stderr, "ERROR: Creating the %s map failed: %s (root or CAP_BPF required)\n", name, strerror(errno));
+      return 1;
+    }
+  }
+
+  if (!store_init(&ctx.store, &ctx.xdp_maps))
+  {
+    return 1;
+  }
+
+  for (int i = 0; i < server_count; i++)
+  {
+    struct sockaddr_in *addr = &ctx.servers[i];
+
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr->sin_port = htons(base_port + i);
+
+    if ((fds[i] = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0 || bind(fds[i], (struct sockaddr *)addr, sizeof(*addr)) < 0)
+    {
+      fprintf(stderr, "ERROR: Stand-in server on port %d failed: %s\n", base_port + i, strerror(errno));
+      return 1;
+    }
+  }
+
+  ctx.server_count = server_count;
+
+  // Split the stand-in servers over the responder threads
+  for (int r = 0; r < responder_count; r++)
+  {
+    responder_t *resp = &responders[r];
+    int first = server_count * r / responder_count, last = server_count * (r + 1) / responder_count;
+
+    resp->fds = fds + first;
+    resp->fd_count = last - first;
+    resp->running = &responders_running;
+    resp->info_size = a2s_build_info(resp->info, sizeof(resp->info), "fetchbench", "de_dust2", 16, 32);
+    resp->players_size = a2s_build_players(resp->players, sizeof(resp->players), 16, r);
+    resp->rules_size = a2s_build_rules(resp->rules, sizeof(resp->rules), 24, r);
+
+    if (pthread_create(&resp->tid, NULL, responder_loop, resp) != 0)
+    {
+      fprintf(stderr, "ERROR: Responder thread creation failed.\n");
+      return 1;
+    }
+  }
+
+  printf("%d stand-in servers on 127.0.0.1:%d-%d, %d responder threads, %d ms query cycles, %d s per run.\n\n",
+  server_count, base_port, base_port + server_count - 1, responder_count, interval_ms, duration);
+  printf("%8s %8s %12s %14s %10s %14s %16s %16s\n", "backend", "threads", "cycles/s", "responses/s", "cpu %", "refresh (ms)",
+  "syscalls/cycle", "cpu us/cycle");
+
+  for (int b = 0; b < 2; b++)
+  {
+    if (!backends[b])
+    {
+      continue;
+    }
+
+    for (int threads = 1; ; threads = threads * 2 > max_threads && threads < max_threads ? max_threads : threads * 2)
+    {
+      ctx.fetcher.threads = threads;
+      ctx.fetcher.interval_ms = interval_ms;
+      ctx.fetcher.io_uring = b == 1;
+      ctx.fetcher.benchmark = true;
+      ctx.running = true;
+
+      if (!start_fetchers(&ctx))
+      {
+        ctx.running = false;
+        stop_fetchers(&ctx);
+        return 1;
+      }
+
+      // With a budget, the first run fills the empty maps and is timed (the next runs start with the responses cached)
+      if (budget_ms && first_run)
+      {
+        double fill_ms = wait_first_cycle(&ctx, budget_ms);
+
+        if (fill_ms < 0)
+        {
+          fprintf(stderr, "ERROR: %s, %d threads: the first cycle of %d servers did not complete within %d ms.\n",
+          b ? "io_uring" : "epoll", threads, server_count, budget_ms);
+          over_budget = true;
+        }
+        else
+        {
+          printf("%8s %8d first cycle of %d servers in %.1f ms (budget %d ms)\n", b ? "io_uring" : "epoll", threads, server_count, fill_ms, budget_ms);
+        }
+      }
+
+      first_run = false;
+
+      // Warm up (first cycles fill the maps), then measure
+      sleep(1);
+
+      __u64 cycles = 0, responses = 0, syscalls = 0;
+      double cpu = 0;
+      __u64 start_ns = monotonic_ns();
+
+      for (int i = 0; i < ctx.worker_count; i++)
+      {
+        cycles -= ctx.workers[i].cycles;
+        responses -= ctx.workers[i].responses;
+        syscalls -= ctx.workers[i].syscalls;
+        cpu -= thread_cpu_sec(ctx.workers[i].tid);
+      }
+
+      sleep(duration);
+
+      for (int i = 0; i < ctx.worker_count; i++)
+      {
+        cycles += ctx.workers[i].cycles;
+        responses += ctx.workers[i].responses;
+        syscalls += ctx.workers[i].syscalls;
+        cpu += thread_cpu_sec(ctx.workers[i].tid);
+      }
+
+      double elapsed = (monotonic_ns() - start_ns) / 1e9;
+
+      ctx.running = false;
+      stop_fetchers(&ctx);
+
+      // Refresh = average time between two complete query cycles of a server
+      printf("%8s %8d %12.0f %14.0f %10.1f %14.1f %16.2f %16.2f\n", b ? "io_uring" : "epoll", threads, cycles / elapsed,
+      responses / elapsed, cpu / elapsed * 100, cycles ? server_count * elapsed * 1000 / cycles : 0,
+      cycles ? (double)syscalls / cycles : 0, cycles ? cpu * 1e6 / cycles : 0);
+
+      if (threads >= max_threads)
+      {
+        break;
+      }
+    }
+  }
+
+  // Identical responses of the stand-in servers share their store slots
+  printf("\nResponse store: %u slots in use by %u cached responses.\n", ctx.store.in_use, ctx.store.references);
+
+  responders_running = false;
+
+  for (int r = 0; r < responder_count; r++)
+  {
+    pthread_join(responders[r].tid, NULL);
+  }
+
+  for (int i = 0; i < server_count; i++)
+  {
+    close(fds[i]);
+  }
+
+  for (int k = 0; k < A2S_QUERY_TYPES; k++)
+  {
+    close(*map_fds[k]);
+  }
+
+  for (int c = 0; c < A2S_STORE_CLASSES; c++)
+  {
+    close(ctx.xdp_maps.a2s_store[c]);
+  }
+
+  store_free(&ctx.store);
+
+  free(ctx.servers);
+  free(responders);
+  free(fds);
+  return over_budget ? 2 : 0;
+}
\ No newline at end of file
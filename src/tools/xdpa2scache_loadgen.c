@@ -0,0 +1,996 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <linux/types.h>
+
+#include "a2s_defs.h"
+#include "latency_hist.h"
+#include "a2s_payload.h"
+
+/*
+ * A2S load generator: virtual clients (one UDP socket each) run the challenge flow against one or more servers
+ * (A2S_INFO 25 -> 29 bytes, A2S_PLAYER/A2S_RULES challenge request -> cookie), closed loop or at a fixed rate,
+ * and report the query rates, the lost queries and the reply latency percentiles. A spoofed source flood
+ * (raw socket, root or CAP_NET_RAW) can run alongside, to measure the legitimate clients under attack.
+ * The freshness mode (-F) measures the lag between a state change of a server and the first reply showing it,
+ * from the change times that xdpa2scache-emulator -c puts into the server names.
+*/
+
+#define LG_MAX_THREADS 64
+
+// Statistics rows: one per query type, then the challenge round trips
+#define LG_CHALLENGE A2S_QUERY_TYPES
+#define LG_ROWS (A2S_QUERY_TYPES + 1)
+
+// Timeouts are looked for every 10 ms
+#define LG_SCAN_NS 10000000ULL
+
+// Spoofed source patterns
+enum
+{
+  SPOOF_RANDOM,
+  SPOOF_SWEEP,
+  SPOOF_FIXED
+};
+
+typedef struct
+{
+  __u64 sent;
+  __u64 replies;
+  __u64 timeouts;
+  lat_hist_t hist;
+} lg_row_t;
+
+typedef struct
+{
+  int fd;
+  bool has_cookie;
+  bool busy;
+  int target;
+  int row;
+  int next_type;
+  __u32 cookie;
+  __u64 sent_ns;
+} vclient_t;
+
+typedef struct
+{
+  pthread_t tid;
+  vclient_t *clients;
+  int count;
+  int *idle;
+  int idle_count;
+  double rate;
+  lg_row_t rows[LG_ROWS];
+  __u64 rechallenged;
+  __u64 late;
+  __u64 unexpected;
+  __u64 refused;
+  __u64 send_errors;
+  __u64 stalled;
+  lat_hist_t lag;
+  __u64 superseded;
+  __u64 unstamped;
+} lg_thread_t;
+
+typedef struct
+{
+  pthread_t tid;
+  __be32 base;
+  __u32 host_mask;
+  int pattern;
+  double rate;
+  __u64 sent;
+  __u64 send_errors;
+} flood_t;
+
+typedef struct
+{
+  struct sockaddr_in *targets;
+  int target_count;
+  int types[A2S_QUERY_TYPES];
+  int type_count;
+  __u64 timeout_ns;
+  bool steam_challenge;
+  bool freshness;
+  __u32 *generations;
+  volatile bool running;
+} loadgen_t;
+
+static loadgen_t lg;
+
+static const char *row_names[LG_ROWS] = { "INFO", "PLAYER", "RULES", "CHALLENGE" };
+static const __u8 query_bytes[A2S_QUERY_TYPES] = { A2S_INFO, A2S_PLAYER, A2S_RULES };
+
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+  "Usage: %s [options] -s <ip:port>\n"
+  "  -s <ip:port>   Target server (the XDP served address, or the game server itself for a baseline)\n"
+  "  -n <ports>     Consecutive target ports from the one of -s (default 1)\n"
+  "  -c <clients>   Virtual clients, each with its own source port (default 256)\n"
+  "  -t <threads>   Generator threads (default 1)\n"
+  "  -r <qps>       Query flows started per second over all threads, 0 for closed loop (default 0)\n"
+  "  -q <types>     Query mix, comma separated: info, player, rules (default info)\n"
+  "  -d <seconds>   Duration (default 10)\n"
+  "  -w <ms>        Reply timeout, a query without reply by then is lost (default 1000)\n"
+  "  -x             A2S_PLAYER/A2S_RULES challenge requests with 0xFFFFFFFF (Steam servers) instead of 0x00000000\n"
+  "  -B <ip>        Source address of the virtual clients\n"
+  "  -S <ip/cidr>   Spoofed source flood from this prefix (raw socket, root or CAP_NET_RAW)\n"
+  "  -P <pattern>   Spoofed sources: random, sweep or fixed (default random)\n"
+  "  -f <pps>       Spoofed flood rate (default 100000)\n"
+  "  -F             Freshness: lag from the state changes of xdpa2scache-emulator -c to the replies (the mix must include info)\n", prog);
+}
+
+static __u64 now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (__u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static __u64 xorshift64(__u64 *state)
+{
+  __u64 x = *state;
+
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return *state = x;
+}
+
+/**
+* Build the next request of a virtual client: the challenge request of its query type without a cookie,
+* otherwise the query with the cookie
+*
+* @param c Pointer to the virtual client.
+* @param buf Request buffer (at least 29 bytes).
+* @param row Output of the statistics row of the request.
+* @return Request size.
+*/
+static size_t build_request(const vclient_t *c, unsigned char *buf, int *row)
+{
+  int type = lg.types[c->next_type];
+  __u32 check = lg.steam_challenge ? 0xFFFFFFFF : 0x00000000;
+  size_t len;
+
+  if (type == A2S_IDX_INFO)
+  {
+    memcpy(buf, A2S_INFO_REQ, A2S_INFO_REQ_SIZE);
+    len = A2S_INFO_REQ_SIZE;
+  }
+  else
+  {
+    memset(buf, 0xFF, 4);
+    buf[4] = query_bytes[type];
+    memcpy(buf + 5, &check, sizeof(check));
+    len = 9;
+  }
+
+  *row = LG_CHALLENGE;
+
+  if (c->has_cookie)
+  {
+    memcpy(buf + (type == A2S_IDX_INFO ? len : 5), &c->cookie, sizeof(c->cookie));
+    len = type == A2S_IDX_INFO ? len + 4 : 9;
+    *row = type;
+  }
+
+  return len;
+}
+
+/**
+* Send the next request of a virtual client, or put it back into the idle ones if that fails
+*
+* @param t Pointer to the generator thread.
+* @param idx Virtual client index.
+* @param now Current time (monotonic, ns).
+*/
+static void send_request(lg_thread_t *t, int idx, __u64 now)
+{
+  vclient_t *c = &t->clients[idx];
+  unsigned char buf[32];
+  size_t len = build_request(c, buf, &c->row);
+
+  if (send(c->fd, buf, len, 0) < 0)
+  {
+    t->send_errors++;
+    t->idle[t->idle_count++] = idx;
+    return;
+  }
+
+  c->busy = true;
+  c->sent_ns = now;
+  t->rows[c->row].sent++;
+}
+
+/**
+* A request of a virtual client ended (reply, timeout or error): next request right away in closed loop,
+* otherwise the client waits for the pacing
+*
+* @param t Pointer to the generator thread.
+* @param idx Virtual client index.
+* @param now Current time (monotonic, ns).
+*/
+static void release_client(lg_thread_t *t, int idx, __u64 now)
+{
+  t->clients[idx].busy = false;
+
+  if (t->rate > 0)
+  {
+    t->idle[t->idle_count++] = idx;
+  }
+  else
+  {
+    send_request(t, idx, now);
+  }
+}
+
+/**
+* Freshness of an A2S_INFO response: the first reply with a new generation of its server gives the lag since the change
+* (the first reply per server only sets the starting generation, the cache may hold it for a while)
+*
+* @param t Pointer to the generator thread.
+* @param c Pointer to the virtual client.
+* @param buf Response.
+* @param n Response size.
+*/
+static void check_freshness(lg_thread_t *t, const vclient_t *c, const unsigned char *buf, ssize_t n)
+{
+  unsigned long long changed_us;
+  const char *stamp;
+  a2s_info_t info;
+  __u32 gen;
+
+  if (a2s_parse_info(buf, n, &info) < 0 || !(stamp = strstr(info.name, " g")) || sscanf(stamp, " g%u t%llu", &gen, &changed_us) != 2)
+  {
+    t->unstamped++;
+    return;
+  }
+
+  // Servers are probed by several clients and threads, the one that moves the generation forward records the lag
+  __u32 *seen = &lg.generations[c->target], old = __atomic_load_n(seen, __ATOMIC_RELAXED);
+
+  while (gen > old)
+  {
+    if (!__atomic_compare_exchange_n(seen, &old, gen, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+      continue;
+    }
+
+    if (old)
+    {
+      struct timespec ts;
+      __u64 now_us;
+
+      clock_gettime(CLOCK_REALTIME, &ts);
+      now_us = (__u64)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+
+      // Generations never served: replaced before the cache fetched them
+      t->superseded += gen - old - 1;
+      lat_hist_add(&t->lag, now_us > changed_us ? (now_us - changed_us) * 1000ULL : 0);
+    }
+
+    break;
+  }
+}
+
+/**
+* Handle a reply to a virtual client: a challenge continues the flow with the query, a response ends it
+*
+* @param t Pointer to the generator thread.
+* @param idx Virtual client index.
+* @param buf Reply.
+* @param n Reply size.
+* @param now Current time (monotonic, ns).
+*/
+static void handle_reply(lg_thread_t *t, int idx, const unsigned char *buf, ssize_t n, __u64 now)
+{
+  vclient_t *c = &t->clients[idx];
+  __u32 header;
+
+  if (n < 5)
+  {
+    t->unexpected++;
+    return;
+  }
+
+  memcpy(&header, buf, sizeof(header));
+
+  // Replies after the timeout, and the following packets of split responses
+  if (!c->busy)
+  {
+    t->late++;
+    return;
+  }
+
+  if (header != CONNECTIONLESS_HEADER && header != SPLIT_HEADER)
+  {
+    t->unexpected++;
+    return;
+  }
+
+  lg_row_t *row = &t->rows[c->row];
+
+  if (header == CONNECTIONLESS_HEADER && buf[4] == S2C_CHALLENGE)
+  {
+    if (n < 9)
+    {
+      t->unexpected++;
+      return;
+    }
+
+    // A challenge to a query with a cookie: the cookie expired (key rotation), the query is not counted as answered
+    if (c->row == LG_CHALLENGE)
+    {
+      row->replies++;
+      lat_hist_add(&row->hist, now - c->sent_ns);
+    }
+    else
+    {
+      t->rechallenged++;
+    }
+
+    memcpy(&c->cookie, buf + 5, sizeof(c->cookie));
+    c->has_cookie = true;
+    send_request(t, idx, now);
+    return;
+  }
+
+  // Servers without challenges (older ones) answer the challenge request right away, it counts as a query
+  if (c->row == LG_CHALLENGE)
+  {
+    t->rows[LG_CHALLENGE].sent--;
+    c->row = lg.types[c->next_type];
+    t->rows[c->row].sent++;
+  }
+
+  row = &t->rows[c->row];
+  row->replies++;
+  lat_hist_add(&row->hist, now - c->sent_ns);
+
+  if (lg.freshness && c->row == A2S_IDX_INFO && header == CONNECTIONLESS_HEADER)
+  {
+    check_freshness(t, c, buf, n);
+  }
+
+  c->next_type = (c->next_type + 1) % lg.type_count;
+  release_client(t, idx, now);
+}
+
+/**
+* Generator thread: paces the query flows of its virtual clients (or keeps all of them busy in closed loop),
+* handles the replies and the timeouts
+*
+* @param arg Pointer to the generator thread.
+*/
+static void *generator_loop(void *arg)
+{
+  lg_thread_t *t = (lg_thread_t *)arg;
+  struct epoll_event events[256];
+  unsigned char buf[A2S_MAX_SIZE + 1];
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+
+  for (int i = 0; i < t->count; i++)
+  {
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = (__u32)i };
+    epoll_ctl(epfd, EPOLL_CTL_ADD, t->clients[i].fd, &ev);
+  }
+
+  __u64 now = now_ns(), interval_ns = t->rate > 0 ? (__u64)(1e9 / t->rate) : 0, next_send = now, next_scan = now;
+
+  if (t->rate > 0 && interval_ns == 0)
+  {
+    interval_ns = 1;
+  }
+
+  for (int i = t->count - 1; i >= 0; i--)
+  {
+    t->idle[t->idle_count++] = i;
+  }
+
+  while (lg.running)
+  {
+    now = now_ns();
+
+    if (t->rate > 0)
+    {
+      // More than 10 ms behind: the thread was starved, the missed flows are not made up for
+      if (now > next_send + LG_SCAN_NS)
+      {
+        t->stalled += (now - next_send) / interval_ns;
+        next_send = now;
+      }
+
+      while (next_send <= now)
+      {
+        if (t->idle_count > 0)
+        {
+          send_request(t, t->idle[--t->idle_count], now);
+        }
+        else
+        {
+          t->stalled++;
+        }
+
+        next_send += interval_ns;
+      }
+    }
+
+    if (now >= next_scan)
+    {
+      for (int i = 0; i < t->count; i++)
+      {
+        vclient_t *c = &t->clients[i];
+
+        if (c->busy && now - c->sent_ns > lg.timeout_ns)
+        {
+          t->rows[c->row].timeouts++;
+          release_client(t, i, now);
+        }
+      }
+
+      // Closed loop: the clients start here, and the ones that failed to send retry here
+      for (int n = t->rate > 0 ? 0 : t->idle_count; n > 0; n--)
+      {
+        send_request(t, t->idle[--t->idle_count], now);
+      }
+
+      next_scan = now + LG_SCAN_NS;
+    }
+
+    int timeout_ms = t->rate > 0 ? (next_send > now + 1000000 ? 1 : 0) : 10;
+    int nfds = epoll_wait(epfd, events, 256, timeout_ms);
+
+    now = now_ns();
+
+    for (int i = 0; i < nfds; i++)
+    {
+      int idx = (int)events[i].data.u32;
+      ssize_t n;
+
+      while ((n = recv(t->clients[idx].fd, buf, sizeof(buf), MSG_DONTWAIT)) >= 0 || errno == ECONNREFUSED)
+      {
+        // ICMP port unreachable: nothing listens on the target (no XDP program and no server), retried with the next scan
+        if (n < 0)
+        {
+          t->refused++;
+
+          if (t->clients[idx].busy)
+          {
+            t->clients[idx].busy = false;
+            t->idle[t->idle_count++] = idx;
+          }
+
+          break;
+        }
+
+        handle_reply(t, idx, buf, n, now);
+      }
+    }
+  }
+
+  close(epfd);
+  return NULL;
+}
+
+/**
+* Spoofed source flood: challenge requests and queries with random cookies, from a source prefix, through a raw socket
+*
+* @param arg Pointer to the flood settings.
+*/
+static void *flood_loop(void *arg)
+{
+  flood_t *f = (flood_t *)arg;
+  struct
+  {
+    struct iphdr ip;
+    struct udphdr udp;
+    unsigned char payload[32];
+  } __attribute__((packed)) pkts[32];
+  struct mmsghdr msgs[32];
+  struct iovec iovs[32];
+  struct sockaddr_in dests[32];
+  __u64 rng = now_ns() ^ ((__u64)getpid() << 32), counter = 0, start = now_ns();
+  int fd = socket(AF_INET, SOCK_RAW | SOCK_CLOEXEC, IPPROTO_RAW);
+
+  if (fd < 0)
+  {
+    fprintf(stderr, "ERROR: Raw socket for the spoofed flood failed: %s (root or CAP_NET_RAW required)\n", strerror(errno));
+    return NULL;
+  }
+
+  while (lg.running)
+  {
+    __u64 due = (__u64)((now_ns() - start) / 1e9 * f->rate) - f->sent;
+    int batch = due > 32 ? 32 : (int)due;
+
+    if (batch == 0)
+    {
+      struct timespec ts = { 0, 50000 };
+
+      nanosleep(&ts, NULL);
+      continue;
+    }
+
+    for (int i = 0; i < batch; i++, counter++)
+    {
+      const struct sockaddr_in *target = &lg.targets[counter % lg.target_count];
+      int type = lg.types[counter % lg.type_count];
+      __u32 r = (__u32)xorshift64(&rng), host = f->pattern == SPOOF_RANDOM ? r : f->pattern == SPOOF_SWEEP ? (__u32)counter : 0;
+      bool query = (counter / lg.type_count) % 2;
+      __u32 cookie = query ? (__u32)(r >> 7) | 1 : (lg.steam_challenge ? 0xFFFFFFFF : 0);
+      size_t len;
+
+      // Half challenge requests, half queries with random (invalid) cookies
+      if (type == A2S_IDX_INFO)
+      {
+        memcpy(pkts[i].payload, A2S_INFO_REQ, A2S_INFO_REQ_SIZE);
+        memcpy(pkts[i].payload + A2S_INFO_REQ_SIZE, &cookie, sizeof(cookie));
+        len = A2S_INFO_REQ_SIZE + (query ? 4 : 0);
+      }
+      else
+      {
+        memset(pkts[i].payload, 0xFF, 4);
+        pkts[i].payload[4] = query_bytes[type];
+        memcpy(pkts[i].payload + 5, &cookie, sizeof(cookie));
+        len = 9;
+      }
+
+      // Checksum, total length and ID are filled in by the kernel, no UDP checksum
+      memset(&pkts[i].ip, 0, sizeof(pkts[i].ip));
+      pkts[i].ip.version = 4;
+      pkts[i].ip.ihl = 5;
+      pkts[i].ip.ttl = 64;
+      pkts[i].ip.protocol = IPPROTO_UDP;
+      pkts[i].ip.saddr = f->base | htonl(host & f->host_mask);
+      pkts[i].ip.daddr = target->sin_addr.s_addr;
+      pkts[i].udp.source = htons(1024 + (r >> 16) % 64512);
+      pkts[i].udp.dest = target->sin_port;
+      pkts[i].udp.len = htons(sizeof(struct udphdr) + len);
+      pkts[i].udp.check = 0;
+
+      dests[i] = *target;
+      dests[i].sin_port = 0;
+      iovs[i].iov_base = &pkts[i];
+      iovs[i].iov_len = sizeof(struct iphdr) + sizeof(struct udphdr) + len;
+      memset(&msgs[i], 0, sizeof(msgs[i]));
+      msgs[i].msg_hdr.msg_name = &dests[i];
+      msgs[i].msg_hdr.msg_namelen = sizeof(dests[i]);
+      msgs[i].msg_hdr.msg_iov = &iovs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int ret = sendmmsg(fd, msgs, batch, 0);
+
+    if (ret < batch)
+    {
+      f->send_errors += batch - (ret < 0 ? 0 : ret);
+    }
+
+    // Failed packets count as sent, the pacing must not retry them in a burst
+    f->sent += batch;
+  }
+
+  close(fd);
+  return NULL;
+}
+
+/**
+* Sum the statistics rows of the generator threads
+*
+* @param threads Generator threads.
+* @param count Number of threads.
+* @param rows Output rows.
+*/
+static void sum_rows(const lg_thread_t *threads, int count, lg_row_t *rows)
+{
+  memset(rows, 0, sizeof(lg_row_t) * LG_ROWS);
+
+  for (int i = 0; i < count; i++)
+  {
+    for (int r = 0; r < LG_ROWS; r++)
+    {
+      rows[r].sent += threads[i].rows[r].sent;
+      rows[r].replies += threads[i].rows[r].replies;
+      rows[r].timeouts += threads[i].rows[r].timeouts;
+      lat_hist_merge(&rows[r].hist, &threads[i].rows[r].hist);
+    }
+  }
+}
+
+/**
+* Queries of the query types (the challenge round trips excluded) added up, minus an earlier total
+*
+* @param rows Statistics rows.
+* @param prev Earlier total (may be NULL).
+* @param total Output total.
+*/
+static void query_total(const lg_row_t *rows, const lg_row_t *prev, lg_row_t *total)
+{
+  memset(total, 0, sizeof(*total));
+
+  for (int r = 0; r < A2S_QUERY_TYPES; r++)
+  {
+    total->sent += rows[r].sent;
+    total->replies += rows[r].replies;
+    total->timeouts += rows[r].timeouts;
+    lat_hist_merge(&total->hist, &rows[r].hist);
+  }
+
+  if (!prev)
+  {
+    return;
+  }
+
+  total->sent -= prev->sent;
+  total->replies -= prev->replies;
+  total->timeouts -= prev->timeouts;
+  total->hist.count -= prev->hist.count;
+  total->hist.sum_ns -= prev->hist.sum_ns;
+
+  for (int i = 0; i < LAT_HIST_BUCKETS; i++)
+  {
+    total->hist.buckets[i] -= prev->hist.buckets[i];
+  }
+}
+
+static void print_row(const char *name, const lg_row_t *row, double elapsed)
+{
+  __u64 ended = row->replies + row->timeouts;
+
+  printf("%-10s %12llu %12llu %10.0f %10llu %8.3f %9.1f %9.1f %9.1f %9.1f %9.1f\n", name, (unsigned long long)row->sent,
+  (unsigned long long)row->replies, row->replies / elapsed, (unsigned long long)row->timeouts, ended ? 100.0 * row->timeouts / ended : 0,
+  row->hist.count ? row->hist.sum_ns / 1e3 / row->hist.count : 0, lat_hist_percentile(&row->hist, 50) / 1e3,
+  lat_hist_percentile(&row->hist, 99) / 1e3, lat_hist_percentile(&row->hist, 99.9) / 1e3, row->hist.max_ns / 1e3);
+}
+
+/**
+* Parse a spoofed source prefix (a.b.c.d/len)
+*
+* @param str Prefix string.
+* @param f Pointer to the flood settings.
+* @return true on success, or false on failure.
+*/
+static bool parse_prefix(const char *str, flood_t *f)
+{
+  char ip[INET_ADDRSTRLEN];
+  const char *slash = strchr(str, '/');
+  int len = slash ? atoi(slash + 1) : 32;
+  size_t ip_len = slash ? (size_t)(slash - str) : strlen(str);
+
+  if (ip_len >= sizeof(ip) || len < 0 || len > 32)
+  {
+    return false;
+  }
+
+  memcpy(ip, str, ip_len);
+  ip[ip_len] = '\0';
+
+  if (inet_pton(AF_INET, ip, &f->base) != 1)
+  {
+    return false;
+  }
+
+  f->host_mask = len == 32 ? 0 : 0xFFFFFFFFU >> len;
+  f->base &= htonl(~f->host_mask);
+  return true;
+}
+
+/**
+* Parse the query mix (comma separated query types)
+*
+* @param str Query mix string.
+* @return true on success, or false on failure.
+*/
+static bool parse_types(char *str)
+{
+  lg.type_count = 0;
+
+  for (char *tok = strtok(str, ","); tok; tok = strtok(NULL, ","))
+  {
+    int type = !strcmp(tok, "info") ? A2S_IDX_INFO : !strcmp(tok, "player") ? A2S_IDX_PLAYER : !strcmp(tok, "rules") ? A2S_IDX_RULES : -1;
+
+    if (type < 0 || lg.type_count == A2S_QUERY_TYPES)
+    {
+      return false;
+    }
+
+    lg.types[lg.type_count++] = type;
+  }
+
+  return lg.type_count > 0;
+}
+
+int main(int argc, char **argv)
+{
+  int port_count = 1, client_count = 256, thread_count = 1, duration = 10, timeout_ms = 1000, opt;
+  double rate = 0;
+  const char *target = NULL, *bind_ip = NULL, *spoof = NULL, *pattern = "random";
+  flood_t flood = { .rate = 100000 };
+
+  lg.types[0] = A2S_IDX_INFO;
+  lg.type_count = 1;
+
+  while ((opt = getopt(argc, argv, "s:n:c:t:r:q:d:w:xB:S:P:f:Fh")) != -1)
+  {
+    switch (opt)
+    {
+      case 's': target = optarg; break;
+      case 'n': port_count = atoi(optarg); break;
+      case 'c': client_count = atoi(optarg); break;
+      case 't': thread_count = atoi(optarg); break;
+      case 'r': rate = atof(optarg); break;
+      case 'q':
+        if (!parse_types(optarg))
+        {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'd': duration = atoi(optarg); break;
+      case 'w': timeout_ms = atoi(optarg); break;
+      case 'x': lg.steam_challenge = true; break;
+      case 'B': bind_ip = optarg; break;
+      case 'S': spoof = optarg; break;
+      case 'P': pattern = optarg; break;
+      case 'f': flood.rate = atof(optarg); break;
+      case 'F': lg.freshness = true; break;
+      default: usage(argv[0]); return 1;
+    }
+  }
+
+  struct sockaddr_in base = { .sin_family = AF_INET }, local = { .sin_family = AF_INET };
+  char ip[INET_ADDRSTRLEN];
+  const char *colon = target ? strrchr(target, ':') : NULL;
+
+  if (!colon || (size_t)(colon - target) >= sizeof(ip) || port_count < 1 || client_count < 1 || thread_count < 1 || thread_count > LG_MAX_THREADS
+  || thread_count > client_count || rate < 0 || duration < 1 || timeout_ms < 1 || flood.rate <= 0)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  memcpy(ip, target, colon - target);
+  ip[colon - target] = '\0';
+
+  int port = atoi(colon + 1);
+
+  if (inet_pton(AF_INET, ip, &base.sin_addr) != 1 || port < 1 || port + port_count > 65536 || (bind_ip && inet_pton(AF_INET, bind_ip, &local.sin_addr) != 1))
+  {
+    fprintf(stderr, "ERROR: Invalid target or source address.\n");
+    return 1;
+  }
+
+  flood.pattern = !strcmp(pattern, "sweep") ? SPOOF_SWEEP : !strcmp(pattern, "fixed") ? SPOOF_FIXED : SPOOF_RANDOM;
+
+  if ((spoof && !parse_prefix(spoof, &flood)) || (strcmp(pattern, "random") && strcmp(pattern, "sweep") && strcmp(pattern, "fixed")))
+  {
+    fprintf(stderr, "ERROR: Invalid spoofed source prefix or pattern.\n");
+    return 1;
+  }
+
+  bool info = false;
+
+  for (int i = 0; i < lg.type_count; i++)
+  {
+    info |= lg.types[i] == A2S_IDX_INFO;
+  }
+
+  if (lg.freshness && !info)
+  {
+    fprintf(stderr, "ERROR: The freshness mode needs info in the query mix.\n");
+    return 1;
+  }
+
+  if (!(lg.targets = calloc(port_count, sizeof(*lg.targets))) || !(lg.generations = calloc(port_count, sizeof(*lg.generations))))
+  {
+    perror("calloc failed");
+    return 1;
+  }
+
+  for (int i = 0; i < port_count; i++)
+  {
+    lg.targets[i] = base;
+    lg.targets[i].sin_port = htons(port + i);
+  }
+
+  lg.target_count = port_count;
+  lg.timeout_ns = (__u64)timeout_ms * 1000000ULL;
+
+  // One socket per virtual client
+  struct rlimit rl = { client_count + 256, client_count + 256 };
+
+  if (setrlimit(RLIMIT_NOFILE, &rl) < 0)
+  {
+    perror("setrlimit failed");
+  }
+
+  lg_thread_t *threads = calloc(thread_count, sizeof(lg_thread_t));
+  vclient_t *clients = calloc(client_count, sizeof(vclient_t));
+  int *idle = calloc(client_count, sizeof(int));
+
+  if (!threads || !clients || !idle)
+  {
+    perror("calloc failed");
+    return 1;
+  }
+
+  for (int i = 0; i < client_count; i++)
+  {
+    const struct sockaddr_in *dst = &lg.targets[i % port_count];
+
+    clients[i].next_type = i % lg.type_count;
+    clients[i].target = i % port_count;
+
+    if ((clients[i].fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0
+    || (bind_ip && bind(clients[i].fd, (struct sockaddr *)&local, sizeof(local)) < 0)
+    || connect(clients[i].fd, (const struct sockaddr *)dst, sizeof(*dst)) < 0)
+    {
+      fprintf(stderr, "ERROR: Virtual client %d socket failed: %s\n", i, strerror(errno));
+      return 1;
+    }
+  }
+
+  lg.running = true;
+
+  // Split the virtual clients and the rate over the generator threads
+  for (int i = 0; i < thread_count; i++)
+  {
+    lg_thread_t *t = &threads[i];
+    int first = client_count * i / thread_count, last = client_count * (i + 1) / thread_count;
+
+    t->clients = clients + first;
+    t->idle = idle + first;
+    t->count = last - first;
+    t->rate = rate / thread_count;
+
+    if (pthread_create(&t->tid, NULL, generator_loop, t) != 0)
+    {
+      fprintf(stderr, "ERROR: Generator thread creation failed.\n");
+      return 1;
+    }
+  }
+
+  if (spoof && pthread_create(&flood.tid, NULL, flood_loop, &flood) != 0)
+  {
+    fprintf(stderr, "ERROR: Flood thread creation failed.\n");
+    return 1;
+  }
+
+  printf("%d virtual clients on %d thread%s -> %s (%d port%s), %s, reply timeout %d ms%s%s.\n\n", client_count, thread_count,
+  thread_count == 1 ? "" : "s", target, port_count, port_count == 1 ? "" : "s", rate > 0 ? "fixed rate" : "closed loop", timeout_ms,
+  spoof ? ", spoofed flood" : "", lg.freshness ? ", freshness" : "");
+  printf("%6s %12s %12s %8s %9s %9s %9s %12s\n", "time", "queries/s", "replies/s", "lost %", "p50 us", "p99 us", "p999 us", "spoofed/s");
+
+  lg_row_t rows[LG_ROWS], prev = {0}, delta;
+  __u64 start_ns = now_ns(), prev_spoofed = 0;
+
+  // Per second: the queries of the query types, the challenge round trips are part of the flows
+  for (int s = 1; s <= duration; s++)
+  {
+    sleep(1);
+    sum_rows(threads, thread_count, rows);
+    query_total(rows, &prev, &delta);
+
+    __u64 ended = delta.replies + delta.timeouts, spoofed = flood.sent;
+
+    printf("%5ds %12llu %12llu %8.3f %9.1f %9.1f %9.1f %12llu\n", s, (unsigned long long)delta.sent, (unsigned long long)delta.replies,
+    ended ? 100.0 * delta.timeouts / ended : 0, lat_hist_percentile(&delta.hist, 50) / 1e3, lat_hist_percentile(&delta.hist, 99) / 1e3,
+    lat_hist_percentile(&delta.hist, 99.9) / 1e3, (unsigned long long)(spoofed - prev_spoofed));
+    fflush(stdout);
+
+    query_total(rows, NULL, &prev);
+    prev_spoofed = spoofed;
+  }
+
+  lg.running = false;
+
+  for (int i = 0; i < thread_count; i++)
+  {
+    pthread_join(threads[i].tid, NULL);
+  }
+
+  if (spoof)
+  {
+    pthread_join(flood.tid, NULL);
+  }
+
+  double elapsed = (now_ns() - start_ns) / 1e9;
+  __u64 rechallenged = 0, late = 0, unexpected = 0, refused = 0, send_errors = 0, stalled = 0;
+
+  sum_rows(threads, thread_count, rows);
+  query_total(rows, NULL, &delta);
+
+  printf("\n%-10s %12s %12s %10s %10s %8s %9s %9s %9s %9s %9s\n", "TYPE", "SENT", "REPLIES", "REPLIES/S", "TIMEOUTS", "LOST %",
+  "AVG us", "P50 us", "P99 us", "P999 us", "MAX us");
+
+  for (int r = 0; r < LG_ROWS; r++)
+  {
+    if (rows[r].sent)
+    {
+      print_row(row_names[r], &rows[r], elapsed);
+    }
+  }
+
+  print_row("QUERIES", &delta, elapsed);
+
+  for (int i = 0; i < thread_count; i++)
+  {
+    rechallenged += threads[i].rechallenged;
+    late += threads[i].late;
+    unexpected += threads[i].unexpected;
+    refused += threads[i].refused;
+    send_errors += threads[i].send_errors;
+    stalled += threads[i].stalled;
+  }
+
+  printf("\nRechallenged queries %llu, late replies %llu, unexpected replies %llu, refused %llu, send errors %llu.\n",
+  (unsigned long long)rechallenged, (unsigned long long)late, (unsigned long long)unexpected, (unsigned long long)refused,
+  (unsigned long long)send_errors);
+
+  // Flows that found no idle client: the rate was not reached, more clients are needed (-c)
+  if (stalled)
+  {
+    printf("Warning: %llu query flows not started, all virtual clients were waiting for replies (raise -c).\n", (unsigned long long)stalled);
+  }
+
+  if (lg.freshness)
+  {
+    lat_hist_t lag = {0};
+    __u64 superseded = 0, unstamped = 0;
+    int tracked = 0;
+
+    for (int i = 0; i < thread_count; i++)
+    {
+      lat_hist_merge(&lag, &threads[i].lag);
+      superseded += threads[i].superseded;
+      unstamped += threads[i].unstamped;
+    }
+
+    for (int i = 0; i < port_count; i++)
+    {
+      tracked += lg.generations[i] != 0;
+    }
+
+    // The lag includes the probe interval of a server: its share of the INFO replies
+    printf("\nFreshness: %llu state changes served on %d/%d servers, %llu superseded before being served, %llu replies without change stamp.\n",
+    (unsigned long long)lag.count, tracked, port_count, (unsigned long long)superseded, (unsigned long long)unstamped);
+    printf("%-10s %10s %10s %10s %10s %10s %16s\n", "LAG", "AVG ms", "P50 ms", "P99 ms", "P999 ms", "MAX ms", "PROBE EVERY ms");
+    printf("%-10s %10.1f %10.1f %10.1f %10.1f %10.1f %16.1f\n", "CHANGES", lag.count ? lag.sum_ns / 1e6 / lag.count : 0,
+    lat_hist_percentile(&lag, 50) / 1e6, lat_hist_percentile(&lag, 99) / 1e6, lat_hist_percentile(&lag, 99.9) / 1e6, lag.max_ns / 1e6,
+    rows[A2S_IDX_INFO].replies ? elapsed * 1e3 * port_count / rows[A2S_IDX_INFO].replies : 0);
+  }
+
+  if (spoof)
+  {
+    printf("Spoofed flood: %llu packets (%.0f/s), %llu send errors.\n", (unsigned long long)flood.sent, flood.sent / elapsed,
+    (unsigned long long)flood.send_errors);
+  }
+
+  for (int i = 0; i < client_count; i++)
+  {
+    close(clients[i].fd);
+  }
+
+  free(lg.targets);
+  free(lg.generations);
+  free(threads);
+  free(clients);
+  free(idle);
+  return 0;
+}
\ No newline at end of file
@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "ingest.h"
+#include "a2s_ingest.h"
+#include "a2s_payload.h"
+
+/*
+ * Stand-in publisher for the ingestion socket: pushes synthetic (or file based) responses for a server,
+ * once or periodically, the way a game server plugin would on state changes.
+*/
+
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+  "Usage: %s -s <ip:port> [options]\n"
+  "  -s <ip:port>   Server to publish for (must be configured or discovered in xdpa2scache)\n"
+  "  -t <type>      info, player, rules or all (default all)\n"
+  "  -f <file>      Push the raw response from a file (requires -t info/player/rules)\n"
+  "  -p <players>   Number of synthetic players (default 8)\n"
+  "  -i <ms>        Push interval in milliseconds (default 0, push once)\n"
+  "  -n <count>     Number of pushes with -i (default 0, until stopped)\n"
+  "  -S <path>      Ingestion socket path (default %s)\n", prog, A2S_INGEST_SOCKET);
+}
+
+/**
+* Parse a query type name
+*
+* @return Query type, A2S_QUERY_TYPES for "all", or -1 if invalid.
+*/
+static int parse_type(const char *str)
+{
+  static const char *names[A2S_QUERY_TYPES] = { "info", "player", "rules" };
+
+  for (int k = 0; k < A2S_QUERY_TYPES; k++)
+  {
+    if (strcmp(str, names[k]) == 0)
+    {
+      return k;
+    }
+  }
+
+  return strcmp(str, "all") == 0 ? A2S_QUERY_TYPES : -1;
+}
+
+int main(int argc, char **argv)
+{
+  const char *server = NULL, *file = NULL, *socket_path = NULL;
+  int type = A2S_QUERY_TYPES, players = 8, interval_ms = 0, count = 0, opt;
+
+  while ((opt = getopt(argc, argv, "s:t:f:p:i:n:S:h")) != -1)
+  {
+    switch (opt)
+    {
+      case 's': server = optarg; break;
+      case 't': type = parse_type(optarg); break;
+      case 'f': file = optarg; break;
+      case 'p': players = atoi(optarg); break;
+      case 'i': interval_ms = atoi(optarg); break;
+      case 'n': count = atoi(optarg); break;
+      case 'S': socket_path = optarg; break;
+      default: usage(argv[0]); return 1;
+    }
+  }
+
+  char ip[64];
+  const char *colon = server ? strrchr(server, ':') : NULL;
+  int port = colon ? atoi(colon + 1) : 0;
+
+  if (!colon || (size_t)(colon - server) >= sizeof(ip) || port < 1 || port > 65535 || type < 0 || players < 0 || players > 255
+  || (file && type == A2S_QUERY_TYPES))
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  memcpy(ip, server, colon - server);
+  ip[colon - server] = '\0';
+
+  unsigned char response[A2S_MAX_SIZE];
+  size_t file_size = 0;
+
+  // A raw response from a file is pushed as is, every time
+  if (file)
+  {
+    FILE *fp = fopen(file, "rb");
+
+    if (!fp)
+    {
+      fprintf(stderr, "ERROR: Could not open %s: %s\n", file, strerror(errno));
+      return 1;
+    }
+
+    file_size = fread(response, 1, sizeof(response), fp);
+    fclose(fp);
+  }
+
+  int fd = a2s_ingest_open(socket_path);
+
+  if (fd < 0)
+  {
+    fprintf(stderr, "ERROR: Could not connect to the ingestion socket: %s\n", strerror(-fd));
+    return 1;
+  }
+
+  for (unsigned int seq = 0; count <= 0 || seq < (unsigned int)count; seq++)
+  {
+    for (int k = 0; k < A2S_QUERY_TYPES; k++)
+    {
+      if (type != A2S_QUERY_TYPES && type != k)
+      {
+        continue;
+      }
+
+      // Synthetic responses change on every push (player count, scores, mp_timeleft)
+      uint8_t now_players = (uint8_t)(players > 0 ? (players - seq % 2) : 0);
+      size_t size = file_size;
+
+      if (!file)
+      {
+        switch (k)
+        {
+          case A2S_IDX_INFO: size = a2s_build_info(response, sizeof(response), "xdpa2scache stand-in", "de_dust2", now_players, 32); break;
+          case A2S_IDX_PLAYER: size = a2s_build_players(response, sizeof(response), now_players, seq); break;
+          default: size = a2s_build_rules(response, sizeof(response), 16, seq); break;
+        }
+      }
+
+      int err = a2s_ingest_push(fd, ip, (uint16_t)port, k, response, size);
+
+      if (err < 0)
+      {
+        fprintf(stderr, "ERROR: Push failed (type %d, %zu bytes): %s\n", k, size, strerror(-err));
+      }
+    }
+
+    if (interval_ms <= 0)
+    {
+      break;
+    }
+
+    struct timespec ts = { interval_ms / 1000, (interval_ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+  }
+
+  a2s_ingest_close(fd);
+  return 0;
+}
\ No newline at end of file
@@ -0,0 +1,1224 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <arpa/inet.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <linux/if_ether.h>
+#include <pcap/pcap.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "config.h"
+#include "a2s_defs.h"
+#include "siphash.h"
+#include "helpers.h"
+#include "snapshot.h"
+#include "xxhash64.h"
+#include "a2s_payload.h"
+
+/*
+ * Offline replay of a capture through the XDP program: every frame of a pcap file is run through xdpa2scache_program
+ * with BPF_PROG_TEST_RUN, on private (unpinned) maps preloaded from the configuration, a cache snapshot and synthetic responses.
+ * Reports the verdicts and the processing time per packet, and checks every verdict and reflected frame against a userspace
+ * reference of the program. Requires root (or CAP_BPF and CAP_NET_ADMIN), a running instance is not touched.
+*/
+
+// Largest frame a test run takes (one page without the XDP headroom and tailroom)
+#define REPLAY_MAX_FRAME 3500
+
+// Mismatches printed in detail, the others are only counted
+#define REPLAY_MAX_REPORTS 10
+
+// Best of this many alternating rounds of the cookie cost runs
+#define REPLAY_COOKIE_ROUNDS 5
+
+// Synthetic prefixes of the filter cost runs are taken from 240.0.0.0/4 (reserved), so they match no source of a capture
+#define REPLAY_SYNTHETIC_BASE 0xF0000000U
+
+// Paths of a frame through the XDP program, as predicted by the reference
+enum
+{
+  PATH_NOT_UDP,
+  PATH_MALFORMED,
+  PATH_DENIED,
+  PATH_OTHER,
+  PATH_UNKNOWN,
+  PATH_INVALID,
+  PATH_NOT_CACHED,
+  PATH_CHALLENGE,
+  PATH_BAD_COOKIE,
+  PATH_DATA,
+  PATH_RATELIMITED,
+  PATH_COUNT
+};
+
+static const char *path_names[PATH_COUNT] =
+{
+  [PATH_NOT_UDP] = "not IPv4/UDP",
+  [PATH_MALFORMED] = "malformed",
+  [PATH_DENIED] = "denied",
+  [PATH_OTHER] = "other UDP",
+  [PATH_UNKNOWN] = "unknown A2S",
+  [PATH_INVALID] = "invalid query",
+  [PATH_NOT_CACHED] = "not cached",
+  [PATH_CHALLENGE] = "challenge",
+  [PATH_BAD_COOKIE] = "bad cookie",
+  [PATH_DATA] = "response",
+  [PATH_RATELIMITED] = "rate limited"
+};
+
+static const int path_verdicts[PATH_COUNT] =
+{
+  [PATH_NOT_UDP] = XDP_PASS,
+  [PATH_MALFORMED] = XDP_DROP,
+  [PATH_DENIED] = XDP_DROP,
+  [PATH_OTHER] = XDP_PASS,
+  [PATH_UNKNOWN] = XDP_PASS,
+  [PATH_INVALID] = XDP_DROP,
+  [PATH_NOT_CACHED] = XDP_DROP,
+  [PATH_CHALLENGE] = XDP_TX,
+  [PATH_BAD_COOKIE] = XDP_DROP,
+  [PATH_DATA] = XDP_TX,
+  [PATH_RATELIMITED] = XDP_DROP
+};
+
+static const char *verdict_names[] = { "XDP_ABORTED", "XDP_DROP", "XDP_PASS", "XDP_TX", "XDP_REDIRECT" };
+
+#define NUM_VERDICTS (sizeof(verdict_names) / sizeof(verdict_names[0]))
+
+// Expected result of a frame: the path, and the reply of the XDP_TX paths
+typedef struct
+{
+  int path;
+  __u32 udp_off;
+  __u32 payload_off;
+  __u32 payload_len;
+  __u32 reply_len;
+  bool check_reply;
+  unsigned char reply[A2S_MAX_SIZE];
+} expect_t;
+
+typedef struct
+{
+  loader_ctx_t ctx;
+  struct bpf_object *obj;
+  int prog_fd;
+  struct a2s_cookie_key cookie_key;
+  bool resign;
+  bool synthesize;
+
+  // Destinations of the queries in the capture, for the synthetic responses
+  struct a2s_server_key *dests;
+  int dest_count;
+  int dest_capacity;
+
+  __u64 frames;
+  __u64 skipped;
+  __u64 total_ns;
+  __u64 verdicts[NUM_VERDICTS];
+  __u64 verdict_ns[NUM_VERDICTS];
+  __u64 paths[PATH_COUNT];
+  __u64 path_ns[PATH_COUNT];
+  __u64 replies_checked;
+  __u64 mismatches;
+} replay_t;
+
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+  "Usage: %s [options] <capture.pcap> (optional with -K)\n"
+  "  -o <file>      XDP object (default /etc/xdpa2scache/xdpa2scache.o)\n"
+  "  -c <file>      Loader configuration for the aliases, filters and rate limits (its interface must exist)\n"
+  "  -s <file>      Cache snapshot to preload (as saved by the fetchers)\n"
+  "  -a             Synthetic responses for the queried servers without a cached response\n"
+  "  -k             Re-sign the cookies of the queries, as if the clients completed the challenge of this replay\n"
+  "  -L             Disable the rate limits (the replay runs faster than the capture)\n"
+  "  -n <passes>    Replays of the whole capture (default 1)\n"
+  "  -F <prefixes>  Filter cost: alternate passes without and with deny/allow lists of this many synthetic prefixes each\n"
+  "                 (0 = the lists of the configuration), and compare the time per packet\n"
+  "  -K <runs>      Cookie cost: time per packet of queries dropped with and without the cookie hash (runs per measure)\n", prog);
+}
+
+/**
+* Add the 16-bit words of a buffer to a ones' complement sum (network byte order)
+*
+* @param sum Sum so far.
+* @param data Buffer.
+* @param len Buffer length.
+* @return New sum.
+*/
+static __u32 csum_add(__u32 sum, const void *data, size_t len)
+{
+  const unsigned char *p = data;
+
+  for (size_t i = 0; i + 1 < len; i += 2)
+  {
+    sum += (__u32)p[i] << 8 | p[i + 1];
+  }
+
+  if (len & 1)
+  {
+    sum += (__u32)p[len - 1] << 8;
+  }
+
+  return sum;
+}
+
+/**
+* Fold a ones' complement sum into a checksum
+*
+* @param sum Sum.
+* @return Checksum (host byte order).
+*/
+static __u16 csum_fold(__u32 sum)
+{
+  while (sum >> 16)
+  {
+    sum = (sum & 0xFFFF) + (sum >> 16);
+  }
+
+  return (__u16)~sum;
+}
+
+/**
+* Build an Ethernet frame from a captured packet (Ethernet, Linux cooked or raw IPv4 captures)
+*
+* @param linktype Link type of the capture.
+* @param pkt Captured packet.
+* @param caplen Captured length.
+* @param frame Buffer of REPLAY_MAX_FRAME bytes for the frame.
+* @return Frame length, or 0 if the packet can't be replayed.
+*/
+static size_t build_frame(int linktype, const unsigned char *pkt, size_t caplen, unsigned char *frame)
+{
+  static const unsigned char macs[12] = { 0x02, 0, 0, 0, 0, 0x02, 0x02, 0, 0, 0, 0, 0x01 };
+  __be16 proto = htons(ETH_P_IP);
+  size_t skip = 0;
+
+  switch (linktype)
+  {
+    case DLT_EN10MB:
+    if (caplen < ETH_HLEN || caplen > REPLAY_MAX_FRAME)
+    {
+      return 0;
+    }
+
+    memcpy(frame, pkt, caplen);
+    return caplen;
+
+    // Linux cooked capture (tcpdump -i any), the protocol is the last field of the 16 byte header
+    case DLT_LINUX_SLL:
+    if (caplen < 16)
+    {
+      return 0;
+    }
+
+    memcpy(&proto, pkt + 14, sizeof(proto));
+    skip = 16;
+    break;
+
+    // Raw IPv4, e.g. the trace pcaps of the loader
+    case DLT_RAW:
+    case DLT_IPV4:
+    break;
+
+    default:
+    return 0;
+  }
+
+  if (ETH_HLEN + caplen - skip > REPLAY_MAX_FRAME)
+  {
+    return 0;
+  }
+
+  memcpy(frame, macs, sizeof(macs));
+  memcpy(frame + 12, &proto, sizeof(proto));
+  memcpy(frame + ETH_HLEN, pkt + skip, caplen - skip);
+  return ETH_HLEN + caplen - skip;
+}
+
+/**
+* Find the destination of a query in the configured aliases (public -> private server address)
+*
+* @param ctx Pointer to the loader context.
+* @param key Pointer to the server key, resolved in place.
+*/
+static void resolve_alias(const loader_ctx_t *ctx, struct a2s_server_key *key)
+{
+  for (int i = 0; i < ctx->alias_count; i++)
+  {
+    if (ctx->aliases[i].pub.ip == key->ip && ctx->aliases[i].pub.port == key->port)
+    {
+      *key = ctx->aliases[i].priv;
+      return;
+    }
+  }
+}
+
+/**
+* Look up a source address in a prefix list map
+*
+* @param map_fd LPM trie map FD.
+* @param saddr Source address.
+* @return true if a prefix of the list matches.
+*/
+static bool prefix_match(int map_fd, __be32 saddr)
+{
+  struct a2s_lpm_key key = { .prefixlen = 32, .ip = saddr };
+  __u8 value[64];
+
+  return bpf_map_lookup_elem(map_fd, &key, value) == 0;
+}
+
+/**
+* Predict the path of a frame through the XDP program (the reference), and the reply of the XDP_TX paths.
+* With re-signing, the cookie of a data query is replaced first by the one this replay hands out.
+* The rate limits are not predicted, they depend on the timing of the replay.
+*
+* @param rp Pointer to the replay state.
+* @param frame Frame (the cookie may be rewritten).
+* @param len Frame length.
+* @param exp Pointer to the expected result.
+*/
+static void reference(replay_t *rp, unsigned char *frame, size_t len, expect_t *exp)
+{
+  const struct ethhdr *eth = (const struct ethhdr *)frame;
+  const struct a2s_settings *settings = &rp->ctx.settings;
+
+  memset(exp, 0, offsetof(expect_t, reply));
+
+  if (eth->h_proto != htons(ETH_P_IP))
+  {
+    exp->path = PATH_NOT_UDP;
+    return;
+  }
+
+  const struct iphdr *iph = (const struct iphdr *)(frame + ETH_HLEN);
+
+  if (len < ETH_HLEN + sizeof(*iph))
+  {
+    exp->path = PATH_MALFORMED;
+    return;
+  }
+
+  if (iph->protocol != IPPROTO_UDP)
+  {
+    exp->path = PATH_NOT_UDP;
+    return;
+  }
+
+  exp->udp_off = ETH_HLEN + iph->ihl * 4;
+  exp->payload_off = exp->udp_off + sizeof(struct udphdr);
+
+  if (exp->payload_off > len)
+  {
+    exp->path = PATH_MALFORMED;
+    return;
+  }
+
+  const struct udphdr *udph = (const struct udphdr *)(frame + exp->udp_off);
+  unsigned char *payload = frame + exp->payload_off;
+
+  if (settings->deny_enabled && prefix_match(rp->ctx.xdp_maps.a2s_deny, iph->saddr))
+  {
+    exp->path = PATH_DENIED;
+    return;
+  }
+
+  if (exp->payload_off + 9 > len || *(__u32 *)payload != CONNECTIONLESS_HEADER)
+  {
+    exp->path = PATH_OTHER;
+    return;
+  }
+
+  struct a2s_server_key key = {0}, alias;
+  __u8 query_type = payload[4];
+  int qidx = A2S_QUERY_TYPES;
+  bool is_challenge = false;
+
+  key.ip = iph->daddr;
+  key.port = udph->dest;
+
+  if (bpf_map_lookup_elem(rp->ctx.xdp_maps.a2s_alias, &key, &alias) == 0)
+  {
+    key = alias;
+  }
+
+  // Same wrap around as the program for a UDP length below 8
+  exp->payload_len = (__u16)(ntohs(udph->len) - sizeof(struct udphdr));
+
+  switch (query_type)
+  {
+    case A2S_INFO:
+    #ifdef A2S_NON_STEAM_SUPPORT
+    if (exp->payload_len == 25)
+    #else
+    if (exp->payload_len == 25 || exp->payload_len == 29)
+    #endif
+    {
+      qidx = A2S_IDX_INFO;
+
+      #ifndef A2S_NON_STEAM_SUPPORT
+      is_challenge = exp->payload_len == 25;
+      #endif
+    }
+    break;
+
+    case A2S_PLAYER:
+    case A2S_RULES:
+    if (exp->payload_len == 9)
+    {
+      __u32 check;
+
+      memcpy(&check, payload + 5, sizeof(check));
+      qidx = query_type == A2S_PLAYER ? A2S_IDX_PLAYER : A2S_IDX_RULES;
+
+      #if defined A2S_NON_STEAM_SUPPORT || defined A2S_DUAL_CHALLENGE_SUPPORT
+      is_challenge = check == 0x00000000 || check == 0xFFFFFFFF;
+      #else
+      is_challenge = check == 0x00000000;
+      #endif
+    }
+    break;
+
+    default:
+    exp->path = PATH_UNKNOWN;
+    return;
+  }
+
+  if (qidx >= A2S_QUERY_TYPES)
+  {
+    exp->path = PATH_INVALID;
+    return;
+  }
+
+  const int map_fds[A2S_QUERY_TYPES] = { rp->ctx.xdp_maps.a2s_info, rp->ctx.xdp_maps.a2s_player, rp->ctx.xdp_maps.a2s_rules };
+  struct a2s_ref ref;
+  int size;
+
+  if (bpf_map_lookup_elem(map_fds[qidx], &key, &ref) < 0 || (size = store_read(&rp->ctx.store, &ref, exp->reply)) < 0)
+  {
+    exp->path = PATH_NOT_CACHED;
+    return;
+  }
+
+  __u32 cookie = a2s_cookie(rp->cookie_key.k0, rp->cookie_key.k1, rp->ctx.cookie_state->slot, iph->saddr, iph->daddr, udph->source, udph->dest);
+
+  if (is_challenge)
+  {
+    static const unsigned char challenge[] = { 0xFF, 0xFF, 0xFF, 0xFF, S2C_CHALLENGE };
+
+    memcpy(exp->reply, challenge, sizeof(challenge));
+    memcpy(exp->reply + 5, &cookie, sizeof(cookie));
+    exp->path = PATH_CHALLENGE;
+    exp->reply_len = 9;
+  }
+  else
+  {
+    #ifdef A2S_NON_STEAM_SUPPORT
+    __u32 cookie_off = query_type == A2S_INFO ? 0 : 5;
+    #else
+    __u32 cookie_off = query_type == A2S_INFO ? 25 : 5;
+    #endif
+
+    if (cookie_off && exp->payload_off + cookie_off + 4 > len)
+    {
+      exp->path = PATH_INVALID;
+      return;
+    }
+
+    if (cookie_off && rp->resign)
+    {
+      memcpy(payload + cookie_off, &cookie, sizeof(cookie));
+    }
+
+    if (cookie_off && memcmp(payload + cookie_off, &cookie, sizeof(cookie)) != 0)
+    {
+      exp->path = PATH_BAD_COOKIE;
+      return;
+    }
+
+    exp->path = PATH_DATA;
+    exp->reply_len = (__u32)size;
+  }
+
+  // The reply is only predictable when the UDP length matches the frame (trailing padding is fine)
+  exp->check_reply = exp->payload_off + exp->payload_len <= len;
+}
+
+/**
+* Name of the field at an offset of a reflected frame, for the mismatch reports
+*
+* @param exp Pointer to the expected result.
+* @param off Offset in the frame.
+* @return Field name.
+*/
+static const char *field_at(const expect_t *exp, size_t off)
+{
+  if (off < ETH_HLEN)
+  {
+    return "Ethernet addresses";
+  }
+
+  if (off < exp->udp_off)
+  {
+    switch (off - ETH_HLEN)
+    {
+      case 2: case 3: return "IP total length";
+      case 8: return "IP TTL";
+      case 10: case 11: return "IP checksum";
+    }
+
+    return off - ETH_HLEN >= 12 && off - ETH_HLEN < 20 ? "IP addresses" : "IP header";
+  }
+
+  if (off < exp->payload_off)
+  {
+    return off - exp->udp_off < 4 ? "UDP ports" : off - exp->udp_off < 6 ? "UDP length" : "UDP checksum";
+  }
+
+  return exp->path == PATH_CHALLENGE && off - exp->payload_off >= 5 ? "cookie" : "payload";
+}
+
+/**
+* Check a reflected frame against the reply built from the input frame: swapped addresses and ports, lengths, TTL,
+* checksums and payload (the bytes after the payload are not checked)
+*
+* @param in Input frame.
+* @param out Output frame of the test run.
+* @param out_len Output frame length.
+* @param len Input frame length.
+* @param exp Pointer to the expected result.
+* @param why Output of the first mismatch.
+* @param why_size Size of the mismatch buffer.
+* @return true if the frame is the expected reply.
+*/
+static bool check_reply(const unsigned char *in, const unsigned char *out, size_t out_len, size_t len, const expect_t *exp, char *why, size_t why_size)
+{
+  unsigned char want[REPLAY_MAX_FRAME + A2S_MAX_SIZE];
+  size_t want_len = len - exp->payload_len + exp->reply_len;
+  size_t cmp_len = exp->payload_off + exp->reply_len;
+
+  if (out_len != want_len)
+  {
+    snprintf(why, why_size, "frame length %zu, expected %zu", out_len, want_len);
+    return false;
+  }
+
+  memcpy(want, in, exp->payload_off);
+  memcpy(want + exp->payload_off, exp->reply, exp->reply_len);
+
+  struct ethhdr *eth = (struct ethhdr *)want;
+  struct iphdr *iph = (struct iphdr *)(want + ETH_HLEN);
+  struct udphdr *udph = (struct udphdr *)(want + exp->udp_off);
+  unsigned char mac[ETH_ALEN];
+  __be32 addr = iph->saddr;
+  __be16 port = udph->source;
+
+  memcpy(mac, eth->h_source, ETH_ALEN);
+  memcpy(eth->h_source, eth->h_dest, ETH_ALEN);
+  memcpy(eth->h_dest, mac, ETH_ALEN);
+
+  iph->saddr = iph->daddr;
+  iph->daddr = addr;
+  iph->tot_len = htons(iph->ihl * 4 + sizeof(*udph) + exp->reply_len);
+  iph->ttl = 64;
+  iph->check = 0;
+  iph->check = htons(csum_fold(csum_add(0, iph, iph->ihl * 4)));
+
+  udph->source = udph->dest;
+  udph->dest = port;
+  udph->len = htons(sizeof(*udph) + exp->reply_len);
+  udph->check = 0;
+
+  #ifndef USE_HW_UDP_CSUM_OFFLOAD
+  __u32 sum = csum_add(0, &iph->saddr, 8) + IPPROTO_UDP + sizeof(*udph) + exp->reply_len;
+  udph->check = htons(csum_fold(csum_add(sum, udph, sizeof(*udph) + exp->reply_len)));
+  #endif
+
+  for (size_t i = 0; i < cmp_len; i++)
+  {
+    if (out[i] != want[i])
+    {
+      snprintf(why, why_size, "%s differs at byte %zu (0x%02x, expected 0x%02x)", field_at(exp, i), i, out[i], want[i]);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/**
+* Remember the destination of a valid query, for the synthetic responses
+*
+* @param rp Pointer to the replay state.
+* @param frame Frame.
+* @param len Frame length.
+*/
+static void collect_dest(replay_t *rp, unsigned char *frame, size_t len)
+{
+  const struct iphdr *iph = (const struct iphdr *)(frame + ETH_HLEN);
+
+  if (len < ETH_HLEN + sizeof(*iph) || ((const struct ethhdr *)frame)->h_proto != htons(ETH_P_IP) || iph->protocol != IPPROTO_UDP
+  || ETH_HLEN + iph->ihl * 4 + sizeof(struct udphdr) + 9 > len)
+  {
+    return;
+  }
+
+  const struct udphdr *udph = (const struct udphdr *)(frame + ETH_HLEN + iph->ihl * 4);
+  const unsigned char *payload = (const unsigned char *)(udph + 1);
+
+  if (*(const __u32 *)payload != CONNECTIONLESS_HEADER || (payload[4] != A2S_INFO && payload[4] != A2S_PLAYER && payload[4] != A2S_RULES))
+  {
+    return;
+  }
+
+  struct a2s_server_key key = {0};
+
+  key.ip = iph->daddr;
+  key.port = udph->dest;
+  resolve_alias(&rp->ctx, &key);
+
+  for (int i = 0; i < rp->dest_count; i++)
+  {
+    if (rp->dests[i].ip == key.ip && rp->dests[i].port == key.port)
+    {
+      return;
+    }
+  }
+
+  if (rp->dest_count == rp->dest_capacity)
+  {
+    int capacity = rp->dest_capacity ? rp->dest_capacity * 2 : 64;
+    struct a2s_server_key *temp = realloc(rp->dests, capacity * sizeof(*temp));
+
+    if (!temp)
+    {
+      return;
+    }
+
+    rp->dests = temp;
+    rp->dest_capacity = capacity;
+  }
+
+  rp->dests[rp->dest_count++] = key;
+}
+
+/**
+* Read the frames of a capture and call a handler for each of them
+*
+* @param path Capture file.
+* @param handler Frame handler.
+* @param rp Pointer to the replay state.
+* @return Number of frames, or -1 on failure.
+*/
+static long for_each_frame(const char *path, void (*handler)(replay_t *, unsigned char *, size_t), replay_t *rp)
+{
+  char errbuf[PCAP_ERRBUF_SIZE];
+  pcap_t *pcap = pcap_open_offline(path, errbuf);
+  unsigned char frame[REPLAY_MAX_FRAME];
+  struct pcap_pkthdr *hdr;
+  const unsigned char *pkt;
+  long count = 0;
+  int ret;
+
+  if (!pcap)
+  {
+    fprintf(stderr, "ERROR: Could not open the capture %s: %s\n", path, errbuf);
+    return -1;
+  }
+
+  int linktype = pcap_datalink(pcap);
+
+  if (linktype != DLT_EN10MB && linktype != DLT_LINUX_SLL && linktype != DLT_RAW && linktype != DLT_IPV4)
+  {
+    fprintf(stderr, "ERROR: Unsupported link type %s of %s (Ethernet, Linux cooked or raw IPv4).\n", pcap_datalink_val_to_name(linktype), path);
+    pcap_close(pcap);
+    return -1;
+  }
+
+  while ((ret = pcap_next_ex(pcap, &hdr, &pkt)) == 1)
+  {
+    size_t len = 0;
+
+    // Truncated captures (snaplen) are skipped, the program would see another packet
+    if (hdr->caplen == hdr->len)
+    {
+      len = build_frame(linktype, pkt, hdr->caplen, frame);
+    }
+
+    if (len == 0)
+    {
+      rp->skipped++;
+      continue;
+    }
+
+    handler(rp, frame, len);
+    count++;
+  }
+
+  if (ret == -1)
+  {
+    fprintf(stderr, "ERROR: Reading the capture %s failed: %s\n", path, pcap_geterr(pcap));
+  }
+
+  pcap_close(pcap);
+  return ret == -1 ? -1 : count;
+}
+
+/**
+* Run a frame through the XDP program and compare the verdict and the reflected frame with the reference
+*
+* @param rp Pointer to the replay state.
+* @param frame Frame.
+* @param len Frame length.
+*/
+static void replay_frame(replay_t *rp, unsigned char *frame, size_t len)
+{
+  static unsigned char out[REPLAY_MAX_FRAME + A2S_MAX_SIZE + 4096];
+  static expect_t exp;
+  char why[128] = "";
+
+  reference(rp, frame, len, &exp);
+
+  LIBBPF_OPTS(bpf_test_run_opts, opts, .data_in = frame, .data_size_in = (__u32)len, .data_out = out, .data_size_out = sizeof(out), .repeat = 1);
+
+  rp->frames++;
+
+  if (bpf_prog_test_run_opts(rp->prog_fd, &opts) < 0)
+  {
+    snprintf(why, sizeof(why), "test run failed: %s", strerror(errno));
+  }
+  else
+  {
+    __u32 verdict = opts.retval < NUM_VERDICTS ? opts.retval : XDP_ABORTED;
+    int expected = path_verdicts[exp.path];
+
+    // A dropped reply with the rate limits on is a rate limited query, the reference doesn't follow the token buckets
+    if (expected == XDP_TX && verdict == XDP_DROP && (rp->ctx.settings.src_limit_enabled || rp->ctx.settings.srv_limit_enabled))
+    {
+      exp.path = PATH_RATELIMITED;
+      expected = XDP_DROP;
+    }
+
+    rp->verdicts[verdict]++;
+    rp->verdict_ns[verdict] += opts.duration;
+    rp->paths[exp.path]++;
+    rp->path_ns[exp.path] += opts.duration;
+    rp->total_ns += opts.duration;
+
+    if ((int)verdict != expected)
+    {
+      snprintf(why, sizeof(why), "%s, expected %s (%s)", verdict_names[verdict], verdict_names[expected], path_names[exp.path]);
+    }
+    else if (verdict == XDP_TX && exp.check_reply)
+    {
+      rp->replies_checked++;
+
+      if (check_reply(frame, out, opts.data_size_out, len, &exp, why, sizeof(why)))
+      {
+        return;
+      }
+    }
+    else
+    {
+      return;
+    }
+  }
+
+  if (++rp->mismatches <= REPLAY_MAX_REPORTS)
+  {
+    fprintf(stderr, "MISMATCH frame %llu (%s): %s\n", (unsigned long long)rp->frames, path_names[exp.path], why);
+  }
+}
+
+/**
+* Write a response into the response store and point the per server map of its query type to it
+*
+* @param rp Pointer to the replay state.
+* @param qidx Query type index.
+* @param key Pointer to the server key.
+* @param data Response.
+* @param size Response size.
+* @return true on success, or false on failure.
+*/
+static bool cache_response(replay_t *rp, int qidx, const struct a2s_server_key *key, const unsigned char *data, size_t size)
+{
+  const int map_fds[A2S_QUERY_TYPES] = { rp->ctx.xdp_maps.a2s_info, rp->ctx.xdp_maps.a2s_player, rp->ctx.xdp_maps.a2s_rules };
+  store_batch_t batch;
+  struct a2s_ref ref;
+  bool write, ok = true;
+
+  if (!store_intern(&rp->ctx.store, size, store_hash(&rp->ctx.store, data, size), &ref, &write))
+  {
+    return false;
+  }
+
+  if (write)
+  {
+    if (!store_batch_init(&batch))
+    {
+      return false;
+    }
+
+    store_batch_add(&batch, &ref, data);
+    ok = store_batch_flush(&rp->ctx.store, &batch, NULL) == 0;
+    store_batch_free(&batch);
+  }
+
+  return ok && bpf_map_update_elem(map_fds[qidx], key, &ref, BPF_ANY) == 0;
+}
+
+/**
+* Cache synthetic responses for the queried servers without a cached response (after the snapshot)
+*
+* @param rp Pointer to the replay state.
+* @return Number of servers with synthetic responses.
+*/
+static int synthesize_responses(replay_t *rp)
+{
+  unsigned char buf[A2S_MAX_SIZE];
+  int count = 0;
+
+  for (int i = 0; i < rp->dest_count; i++)
+  {
+    const struct a2s_server_key *key = &rp->dests[i];
+    struct a2s_ref ref;
+    char name[64];
+    size_t size;
+
+    if (bpf_map_lookup_elem(rp->ctx.xdp_maps.a2s_info, key, &ref) == 0)
+    {
+      continue;
+    }
+
+    snprintf(name, sizeof(name), "Replay server %d", i + 1);
+
+    if (!(size = a2s_build_info(buf, sizeof(buf), name, "de_dust2", (uint8_t)(i % 32), 32)) || !cache_response(rp, A2S_IDX_INFO, key, buf, size)
+    || !(size = a2s_build_players(buf, sizeof(buf), (uint8_t)(i % 32), (uint32_t)i)) || !cache_response(rp, A2S_IDX_PLAYER, key, buf, size)
+    || !(size = a2s_build_rules(buf, sizeof(buf), 64, (uint32_t)i)) || !cache_response(rp, A2S_IDX_RULES, key, buf, size))
+    {
+      fprintf(stderr, "Warning: Synthetic responses of server %d not cached (response store full?).\n", i + 1);
+      continue;
+    }
+
+    count++;
+  }
+
+  return count;
+}
+
+/**
+* Open and load the XDP object with private maps (the pinning is dropped, the running instance is not touched)
+*
+* @param rp Pointer to the replay state.
+* @param path Object file.
+* @return true on success, or false on failure.
+*/
+static bool load_object(replay_t *rp, const char *path)
+{
+  struct bpf_program *prog;
+  struct bpf_map *map;
+  int servers = rp->ctx.server_count + rp->dest_count;
+
+  if (!(rp->obj = bpf_object__open_file(path, NULL)))
+  {
+    fprintf(stderr, "ERROR: Failed to open BPF object file '%s': %s\n", path, strerror(errno));
+    return false;
+  }
+
+  bpf_object__for_each_map(map, rp->obj)
+  {
+    bpf_map__set_pin_path(map, NULL);
+  }
+
+  // libxdp sets the type of the program on attach, the section name is not a libbpf one
+  if (!(prog = bpf_object__find_program_by_name(rp->obj, "xdpa2scache_program")) || bpf_program__set_type(prog, BPF_PROG_TYPE_XDP) < 0)
+  {
+    fprintf(stderr, "ERROR: No xdpa2scache_program in '%s'.\n", path);
+    return false;
+  }
+
+  if (!size_maps(rp->obj, servers, rp->ctx.alias_count))
+  {
+    return false;
+  }
+
+  int err = bpf_object__load(rp->obj);
+
+  if (err < 0)
+  {
+    fprintf(stderr, "ERROR: Failed to load BPF object file '%s': %s\n", path, strerror(-err));
+    return false;
+  }
+
+  rp->prog_fd = bpf_program__fd(prog);
+  return get_object_maps(rp->obj, &rp->ctx.xdp_maps) == 0;
+}
+
+/**
+* Print the verdict and path mix with the average processing time
+*
+* @param rp Pointer to the replay state.
+* @param passes Number of passes over the capture.
+*/
+static void report(const replay_t *rp, int passes)
+{
+  printf("\nReplayed %llu frames (%d pass%s), %llu packets skipped (truncated, too large or not IPv4).\n",
+  (unsigned long long)rp->frames, passes, passes == 1 ? "" : "es", (unsigned long long)rp->skipped);
+
+  if (!rp->frames)
+  {
+    return;
+  }
+
+  printf("\n%-14s %12s %8s %10s\n", "VERDICT", "FRAMES", "SHARE", "NS/PACKET");
+
+  for (size_t v = 0; v < NUM_VERDICTS; v++)
+  {
+    if (rp->verdicts[v])
+    {
+      printf("%-14s %12llu %7.2f%% %10.1f\n", verdict_names[v], (unsigned long long)rp->verdicts[v], 100.0 * rp->verdicts[v] / rp->frames,
+      (double)rp->verdict_ns[v] / rp->verdicts[v]);
+    }
+  }
+
+  printf("\n%-14s %12s %8s %10s\n", "PATH", "FRAMES", "SHARE", "NS/PACKET");
+
+  for (int p = 0; p < PATH_COUNT; p++)
+  {
+    if (rp->paths[p])
+    {
+      printf("%-14s %12llu %7.2f%% %10.1f\n", path_names[p], (unsigned long long)rp->paths[p], 100.0 * rp->paths[p] / rp->frames,
+      (double)rp->path_ns[p] / rp->paths[p]);
+    }
+  }
+
+  printf("\nAverage %.1f ns/packet. %llu reflected frames checked, %llu mismatches.\n", (double)rp->total_ns / rp->frames,
+  (unsigned long long)rp->replies_checked, (unsigned long long)rp->mismatches);
+}
+
+/**
+* Fill a prefix list with synthetic prefixes (/16 to /32, in 240.0.0.0/4)
+*
+* @param prefixes Prefix array.
+* @param count Number of prefixes.
+* @param seed Random seed.
+*/
+static void synthetic_prefixes(struct a2s_lpm_key *prefixes, int count, __u64 seed)
+{
+  for (int i = 0; i < count; i++)
+  {
+    __u32 len = 16 + (__u32)(xxh64(&i, sizeof(i), seed) % 17);
+    __u32 ip = REPLAY_SYNTHETIC_BASE | ((__u32)xxh64(&i, sizeof(i), seed + 1) & 0x0FFFFFFFU);
+
+    prefixes[i].prefixlen = len;
+    prefixes[i].ip = htonl(ip & (0xFFFFFFFFU << (32 - len)));
+  }
+}
+
+/**
+* Cost of the deny/allow prefix lists (LPM trie lookups): passes without the lists and with them alternate,
+* so both see the same cache and CPU state, and the time per packet of both is compared.
+*
+* @param rp Pointer to the replay state.
+* @param capture Capture file.
+* @param passes Passes of each kind.
+* @param synthetic Synthetic prefixes per list, or 0 for the lists of the configuration.
+* @return 0 on success, or -1 on failure.
+*/
+static int measure_filters(replay_t *rp, const char *capture, int passes, int synthetic)
+{
+  struct a2s_lpm_key *deny = rp->ctx.deny_prefixes, *allow = rp->ctx.allow_prefixes;
+  int deny_count = rp->ctx.deny_count, allow_count = rp->ctx.allow_count, ret = -1;
+  __u64 ns[2] = {0}, frames[2] = {0};
+
+  if (synthetic > 0)
+  {
+    deny = calloc(synthetic, sizeof(*deny));
+    allow = calloc(synthetic, sizeof(*allow));
+
+    if (!deny || !allow)
+    {
+      perror("calloc failed");
+      goto out;
+    }
+
+    synthetic_prefixes(deny, synthetic, 1);
+    synthetic_prefixes(allow, synthetic, 3);
+    deny_count = allow_count = synthetic;
+  }
+
+  if (!deny_count && !allow_count)
+  {
+    fprintf(stderr, "ERROR: No prefix lists in the configuration, use synthetic ones (-F <prefixes>).\n");
+    goto out;
+  }
+
+  if (sync_prefix_map(rp->ctx.xdp_maps.a2s_deny, deny, deny_count) < 0 || sync_prefix_map(rp->ctx.xdp_maps.a2s_allow, allow, allow_count) < 0)
+  {
+    fprintf(stderr, "ERROR: Prefix lists update failed.\n");
+    goto out;
+  }
+
+  for (int p = 0; p < passes; p++)
+  {
+    for (int on = 0; on < 2; on++)
+    {
+      __u64 total_ns = rp->total_ns, count = rp->frames;
+
+      rp->ctx.settings.deny_enabled = on && deny_count > 0;
+      rp->ctx.settings.allow_enabled = on && allow_count > 0;
+
+      if (update_settings_map(&rp->ctx.xdp_maps, &rp->ctx.settings) < 0 || for_each_frame(capture, replay_frame, rp) < 0)
+      {
+        goto out;
+      }
+
+      ns[on] += rp->total_ns - total_ns;
+      frames[on] += rp->frames - count;
+    }
+  }
+
+  if (frames[0] && frames[1])
+  {
+    double off = (double)ns[0] / frames[0], with = (double)ns[1] / frames[1];
+
+    printf("\nPrefix lists (%d deny, %d allow prefixes%s): %.1f ns/packet without, %.1f ns/packet with, %+.1f ns/packet (%+.1f%%).\n",
+    deny_count, allow_count, synthetic > 0 ? ", synthetic" : "", off, with, with - off, off > 0 ? 100.0 * (with - off) / off : 0);
+  }
+
+  ret = 0;
+
+out:
+  if (synthetic > 0)
+  {
+    free(deny);
+    free(allow);
+  }
+
+  return ret;
+}
+
+/**
+* Cost of one cookie in the XDP program: an A2S_PLAYER query with a wrong cookie of the current key slot (SipHash-1-3
+* computed, then dropped) and one with a cookie of the previous slot after its grace window (dropped before hashing)
+* take the same path otherwise, the difference of their time per packet is the cost of a cookie.
+*
+* @param rp Pointer to the replay state.
+* @param runs Test runs per measure (BPF_PROG_TEST_RUN repeat).
+* @return 0 on success, or -1 on failure.
+*/
+static int measure_cookie(replay_t *rp, int runs)
+{
+  static const char *kinds[2] = { "wrong cookie", "expired slot" };
+  const struct a2s_server_key key = { .ip = htonl(0xC0000201), .port = htons(27015) };
+  unsigned char frame[ETH_HLEN + sizeof(struct iphdr) + sizeof(struct udphdr) + 9] = {0}, buf[A2S_MAX_SIZE];
+  struct ethhdr *eth = (struct ethhdr *)frame;
+  struct iphdr *iph = (struct iphdr *)(frame + ETH_HLEN);
+  struct udphdr *udph = (struct udphdr *)(iph + 1);
+  unsigned char *payload = (unsigned char *)(udph + 1);
+  double best[2] = { 0, 0 };
+  size_t size;
+
+  // A cached server in 192.0.2.0/24 (TEST-NET-1), queried from 198.51.100.7 (TEST-NET-2)
+  if (!(size = a2s_build_players(buf, sizeof(buf), 16, 0)) || !cache_response(rp, A2S_IDX_PLAYER, &key, buf, size))
+  {
+    fprintf(stderr, "ERROR: Response of the cookie cost server not cached.\n");
+    return -1;
+  }
+
+  eth->h_proto = htons(ETH_P_IP);
+  iph->version = 4;
+  iph->ihl = 5;
+  iph->ttl = 64;
+  iph->protocol = IPPROTO_UDP;
+  iph->tot_len = htons(sizeof(frame) - ETH_HLEN);
+  iph->saddr = htonl(0xC6336407);
+  iph->daddr = key.ip;
+  udph->source = htons(40000);
+  udph->dest = key.port;
+  udph->len = htons(sizeof(struct udphdr) + 9);
+  memset(payload, 0xFF, 4);
+  payload[4] = A2S_PLAYER;
+
+  // Same slot bit with a wrong value, and the other slot bit (its grace window is over, no rotation in a replay)
+  __u32 valid = a2s_cookie(rp->cookie_key.k0, rp->cookie_key.k1, rp->ctx.cookie_state->slot, iph->saddr, iph->daddr, udph->source, udph->dest);
+  __u32 cookies[2] = { valid ^ 0x100, valid ^ 1 };
+
+  // Repeated runs must not hit the rate limits (the settings of the replay are restored after)
+  struct a2s_settings settings = rp->ctx.settings;
+
+  settings.src_limit_enabled = 0;
+  settings.srv_limit_enabled = 0;
+
+  if (update_settings_map(&rp->ctx.xdp_maps, &settings) < 0)
+  {
+    return -1;
+  }
+
+  for (int round = 0; round < REPLAY_COOKIE_ROUNDS; round++)
+  {
+    for (int k = 0; k < 2; k++)
+    {
+      LIBBPF_OPTS(bpf_test_run_opts, opts, .data_in = frame, .data_size_in = sizeof(frame), .repeat = (__u32)runs);
+
+      memcpy(payload + 5, &cookies[k], sizeof(cookies[k]));
+
+      if (bpf_prog_test_run_opts(rp->prog_fd, &opts) < 0 || opts.retval != XDP_DROP)
+      {
+        fprintf(stderr, "ERROR: Cookie cost run (%s) failed: %s\n", kinds[k], opts.retval != XDP_DROP ? "not dropped" : strerror(errno));
+        return -1;
+      }
+
+      // Test runs report the average time of a run
+      if (round == 0 || opts.duration < best[k])
+      {
+        best[k] = opts.duration;
+      }
+    }
+  }
+
+  printf("Cookie check (best of %d x %d runs): %.1f ns/packet with the SipHash-1-3 cookie (%s), %.1f ns/packet without (%s), %.1f ns per cookie.\n",
+  REPLAY_COOKIE_ROUNDS, runs, best[0], kinds[0], best[1], kinds[1], best[0] - best[1]);
+  return update_settings_map(&rp->ctx.xdp_maps, &rp->ctx.settings) < 0 ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+  static replay_t rp = { .ctx = { .servers_lock = PTHREAD_MUTEX_INITIALIZER } };
+  const char *object = "/etc/xdpa2scache/xdpa2scache.o", *config = NULL, *snapshot = NULL;
+  bool no_limits = false;
+  int passes = 1, filter_cost = -1, cookie_runs = 0, opt;
+
+  while ((opt = getopt(argc, argv, "o:c:s:akLn:F:K:h")) != -1)
+  {
+    switch (opt)
+    {
+      case 'o': object = optarg; break;
+      case 'c': config = optarg; break;
+      case 's': snapshot = optarg; break;
+      case 'a': rp.synthesize = true; break;
+      case 'k': rp.resign = true; break;
+      case 'L': no_limits = true; break;
+      case 'n': passes = atoi(optarg); break;
+      case 'F': filter_cost = atoi(optarg); break;
+      case 'K': cookie_runs = atoi(optarg); break;
+      default: usage(argv[0]); return 1;
+    }
+  }
+
+  if ((optind >= argc && cookie_runs <= 0) || passes < 1 || cookie_runs < 0)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  const char *capture = optind < argc ? argv[optind] : NULL;
+
+  // Aliases, filters and rate limits of the configuration
+  if (config && !parse_config_file(&rp.ctx, config))
+  {
+    fprintf(stderr, "ERROR: Configuration parsing failed.\n");
+    return 1;
+  }
+
+  // First pass: the queried servers, to size the maps for the synthetic responses
+  if (rp.synthesize && capture && for_each_frame(capture, collect_dest, &rp) < 0)
+  {
+    return 1;
+  }
+
+  rp.skipped = 0;
+
+  if (!load_object(&rp, object) || !store_init(&rp.ctx.store, &rp.ctx.xdp_maps))
+  {
+    return 1;
+  }
+
+  if (snapshot)
+  {
+    int loaded = snapshot_load(&rp.ctx.xdp_maps, &rp.ctx.store, snapshot, (__u64)time(NULL));
+
+    if (loaded < 0)
+    {
+      fprintf(stderr, "ERROR: Snapshot %s loading failed (code %d).\n", snapshot, loaded);
+      return 1;
+    }
+  }
+
+  if (rp.synthesize)
+  {
+    printf("Synthetic responses cached for %d of %d queried servers.\n", synthesize_responses(&rp), rp.dest_count);
+  }
+
+  // Tracing and the latency histograms are off, they would only slow the replay down
+  rp.ctx.settings.trace_enabled = 0;
+  rp.ctx.settings.latency_enabled = 0;
+
+  if (no_limits)
+  {
+    rp.ctx.settings.src_limit_enabled = 0;
+    rp.ctx.settings.srv_limit_enabled = 0;
+  }
+
+  __u32 slot = 0;
+
+  if (sync_alias_map(&rp.ctx.xdp_maps, rp.ctx.aliases, rp.ctx.alias_count) < 0
+  || sync_prefix_map(rp.ctx.xdp_maps.a2s_deny, rp.ctx.deny_prefixes, rp.ctx.deny_count) < 0
+  || sync_prefix_map(rp.ctx.xdp_maps.a2s_allow, rp.ctx.allow_prefixes, rp.ctx.allow_count) < 0
+  || !init_cookie_keys(&rp.ctx) || update_settings_map(&rp.ctx.xdp_maps, &rp.ctx.settings) < 0
+  || (slot = rp.ctx.cookie_state->slot, bpf_map_lookup_elem(rp.ctx.xdp_maps.a2s_cookie_keys, &slot, &rp.cookie_key) < 0))
+  {
+    fprintf(stderr, "ERROR: BPF maps initialization failed.\n");
+    return 1;
+  }
+
+  if (cookie_runs > 0 && measure_cookie(&rp, cookie_runs) < 0)
+  {
+    return 1;
+  }
+
+  // The filter cost runs replace the regular passes (their comparison comes before the report of all of them)
+  if (!capture)
+  {
+    passes = 0;
+  }
+  else if (filter_cost >= 0)
+  {
+    passes *= 2;
+
+    if (measure_filters(&rp, capture, passes / 2, filter_cost) < 0)
+    {
+      return 1;
+    }
+  }
+  else
+  {
+    for (int p = 0; p < passes; p++)
+    {
+      if (for_each_frame(capture, replay_frame, &rp) < 0)
+      {
+        return 1;
+      }
+    }
+  }
+
+  if (passes > 0)
+  {
+    rp.skipped /= passes;
+    report(&rp, passes);
+  }
+
+  store_free(&rp.ctx.store);
+  bpf_object__close(rp.obj);
+  free(rp.dests);
+
+  return rp.mismatches ? 2 : 0;
+}
\ No newline at end of file
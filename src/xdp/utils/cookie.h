@@ -1,76 +1,88 @@
 #pragma once
 
-// The key and the cookie_hash function is not the perfect and the best idea, but I have no better idea for the moment
-// If you have better idea for this, please do a PR (https://github.com/TrifonDinev/xdp-a2s-cache) or contact me (https://trifondinev.com)
-
-static __u8 key[8] = {0};
-static __u8 key_initialized = 0;
-
-static __always_inline __u32 cookie_hash(__u32 saddr, __u32 daddr, __u16 sport, __u16 dport)
+#include "siphash.h"
+
+/*
+ * Cookies (challenges) are a keyed SipHash-1-3 of the query's addresses and ports.
+ * The 128-bit secret is generated and rotated by the loader (a2s_cookie_keys, two slots),
+ * the low bit of the cookie tells which slot it was created with.
+ * Cookies from the previous slot are accepted until prev_until of a2s_cookie_state (grace window after rotation).
+*/
+
+/**
+* Reads the current cookie key slot (before anything else of the rotation state, see struct a2s_cookie_state).
+*
+* @param state Pointer to the cookie key rotation state.
+*
+* @return Current key slot (0 or 1).
+**/
+static __always_inline __u32 cookie_slot(struct a2s_cookie_state *state)
 {
-  // Check if the key is not initialized and initialize it if it is not
-  if (!key_initialized)
-  {
-    // Get current timestamp in nanoseconds and use it as simple seed
-    __u64 timestamp = bpf_ktime_get_ns();
-
-    // XOR the upper and lower 32 bits of the timestamp, then mask to get the lower 32 bits as the seed
-    __u32 seed = (timestamp ^ (timestamp >> 32)) & 0xFFFFFFFF;
-
-    // Mix the seed once before entering the loop for key generation
-    seed ^= (seed << 5);
-    seed ^= (seed >> 7);
-    seed ^= (seed << 11);
+  return *(volatile __u32 *)&state->slot & 1;
+}
 
-    // Store the mixed seed in the key array
-    for (int i = 0; i < 8; i++)
-    {
-      // Scramble the seed and assign the least significant byte to each key[i]
-      key[i] = (seed ^ (seed >> 8)) & 0xFF;
-    }
+/**
+* Creates a cookie (challenge) for the query with the current key slot.
+*
+* @param iph Pointer to IPv4 header.
+* @param udph Pointer to UDP header.
+* @param cookie Pointer to store the cookie.
+*
+* @return true on success, false if the key is not available.
+**/
+static __always_inline bool create_cookie(struct iphdr *iph, struct udphdr *udph, __u32 *cookie)
+{
+  __u32 zero = 0;
+  struct a2s_cookie_state *state = bpf_map_lookup_elem(&a2s_cookie_state, &zero);
 
-    // Flag as initialized
-    key_initialized = 1;
+  if (unlikely(!state))
+  {
+    return false;
   }
 
-  // Use local variables to help compiler with register allocation
-  __u32 hash = saddr ^ daddr ^ sport ^ dport;
-
-  // Fast mixing for fields
-  hash ^= (hash >> 16);
-  hash += (hash << 7);
+  __u32 slot = cookie_slot(state);
+  struct a2s_cookie_key *key = bpf_map_lookup_elem(&a2s_cookie_keys, &slot);
 
-  // Manually unrolled loop: Process 4 pairs of bytes from the key and update the hash
-  hash += (key[0] ^ key[1]);
-  hash ^= (hash >> 11);
-  hash += (hash << 15);
+  if (unlikely(!key))
+  {
+    return false;
+  }
 
-  hash += (key[2] ^ key[3]);
-  hash ^= (hash >> 11);
-  hash += (hash << 15);
+  *cookie = a2s_cookie(key->k0, key->k1, slot, iph->saddr, iph->daddr, udph->source, udph->dest);
+  return true;
+}
 
-  hash += (key[4] ^ key[5]);
-  hash ^= (hash >> 11);
-  hash += (hash << 15);
+/**
+* Checks a cookie (challenge) against the key slot it was created with.
+*
+* @param iph Pointer to IPv4 header.
+* @param udph Pointer to UDP header.
+* @param check Cookie (challenge) received from the client.
+*
+* @return true if the cookie is valid.
+**/
+static __always_inline bool check_cookie(struct iphdr *iph, struct udphdr *udph, __u32 check)
+{
+  __u32 zero = 0, slot = check & 1;
+  struct a2s_cookie_state *state = bpf_map_lookup_elem(&a2s_cookie_state, &zero);
 
-  hash += (key[6] ^ key[7]);
-  hash ^= (hash >> 11);
-  hash += (hash << 15);
+  if (unlikely(!state))
+  {
+    return false;
+  }
 
-  // Final mixing for better distribution
-  hash += (hash << 3);
-  hash ^= (hash >> 11);
-  hash += (hash << 15);
+  // Cookies from the previous key slot are only valid during the grace window (the slot is read before the deadline)
+  if (slot != cookie_slot(state) && bpf_ktime_get_ns() > *(volatile __u64 *)&state->prev_until)
+  {
+    return false;
+  }
 
-  return hash;
-}
+  struct a2s_cookie_key *key = bpf_map_lookup_elem(&a2s_cookie_keys, &slot);
 
-static __always_inline __u32 create_cookie(struct iphdr *iph, struct udphdr *udph)
-{
-  return cookie_hash(iph->saddr, iph->daddr, udph->source, udph->dest);
-}
+  if (unlikely(!key))
+  {
+    return false;
+  }
 
-static __always_inline bool check_cookie(struct iphdr *iph, struct udphdr *udph, __u32 check)
-{
-  return create_cookie(iph, udph) == check;
+  return a2s_cookie(key->k0, key->k1, slot, iph->saddr, iph->daddr, udph->source, udph->dest) == check;
 }
\ No newline at end of file
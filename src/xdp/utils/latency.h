@@ -0,0 +1,51 @@
+#pragma once
+
+/**
+* Floor of the base 2 logarithm, capped at the last latency bucket.
+*
+* @param v Value (0 gives 0).
+*
+* @return Bucket index (0 to A2S_LAT_BUCKETS - 1).
+**/
+static __always_inline __u32 latency_bucket(__u64 v)
+{
+  __u32 r = 0;
+
+  // Bounded by the number of buckets, so the verifier can check the loop
+  while (v > 1 && r < A2S_LAT_BUCKETS - 1)
+  {
+    v >>= 1;
+    r++;
+  }
+
+  return r;
+}
+
+/**
+* Adds the processing time of a query to the latency histogram of its query type and path.
+*
+* @param start Time the processing started (bpf_ktime_get_ns), 0 when the histograms are disabled.
+* @param qidx Query type index (A2S_IDX_*).
+* @param path Path of the query (A2S_LAT_*).
+**/
+static __always_inline void latency_record(__u64 start, __u32 qidx, __u32 path)
+{
+  if (likely(!start) || qidx >= A2S_QUERY_TYPES || path >= A2S_LAT_PATHS)
+  {
+    return;
+  }
+
+  __u64 delta = bpf_ktime_get_ns() - start;
+  __u32 idx = qidx * A2S_LAT_PATHS + path;
+
+  // Per CPU entry, no atomics needed
+  struct a2s_latency *hist = bpf_map_lookup_elem(&a2s_latency, &idx);
+
+  if (!hist)
+  {
+    return;
+  }
+
+  hist->count[latency_bucket(delta)]++;
+  hist->sum_ns += delta;
+}
\ No newline at end of file
@@ -1,33 +1,216 @@
 #pragma once
 
 /*
- * Due to BPF_MAP_TYPE_HASH and the overall working logic of the A2S cache I wanted:
- * If you spawn servers on random ports or you need more keys/ip/ports, please rise the max_entries of the A2S_ things.
- * Currently, my idea is 1024, which we can't run more than 40-100 servers on one machine for example, so 1024 is more than fine.
- * (!) If we use, for example, port range 27000-28000, that's 1000 servers, 1024 should be okay.
- * (!) If we use, for example, port range 27000-30000, that's 3000 servers, 3000 + a bit more, let's say 3024, just to be sure. and so on...
+ * The per server maps (a2s_info/a2s_player/a2s_rules, a2s_srv_limit, a2s_srv_stats), a2s_alias and the response store are resized by the loader before loading,
+ * from the number of configured servers/aliases (see A2S_MAP_MIN_ENTRIES, A2S_MAP_HEADROOM_PCT and A2S_STORE_CLASS_PCT), the 1024 below are only defaults.
+ *
+ * All maps are pinned by name under A2S_PIN_ROOT, so a persistent loader can be restarted or upgraded while XDP keeps serving the cache.
 */
 
 struct
 {
   __uint(type, BPF_MAP_TYPE_HASH);
   __type(key, struct a2s_server_key);
-  __type(value, struct a2s_val);
+  __type(value, struct a2s_ref);
   __uint(max_entries, 1024);
+  __uint(pinning, LIBBPF_PIN_BY_NAME);
 } a2s_info SEC(".maps");
 
 struct
 {
   __uint(type, BPF_MAP_TYPE_HASH);
   __type(key, struct a2s_server_key);
-  __type(value, struct a2s_val);
+  __type(value, struct a2s_ref);
   __uint(max_entries, 1024);
+  __uint(pinning, LIBBPF_PIN_BY_NAME);
 } a2s_player SEC(".maps");
 
 struct
 {
   __uint(type, BPF_MAP_TYPE_HASH);
   __type(key, struct a2s_server_key);
-  __type(value, struct a2s_val);
+  __type(value, struct a2s_ref);
   __uint(max_entries, 1024);
-} a2s_rules SEC(".maps");
\ No newline at end of file
+  __uint(pinning, LIBBPF_PIN_BY_NAME);
+} a2s_rules SEC(".maps");
+
+/*
+ * Response store: one array per size class (A2S_STORE_CLASS_SIZE), the per server maps point to a slot of one of them.
+ * The loader writes a changed response into a free slot before pointing the reference to it, a slot is never rewritten while referenced.
+*/
+struct
+{
+  __uint(type, BPF_MAP_TYPE_ARRAY);
+  __type(key, __u32);
+  __uint(value_size, A2S_STORE_CLASS_SIZE(0));
+  __uint(max_entries, 1024);
+  __uint(pinning, LIBBPF_PIN_BY_NAME);
+} a2s_store_256 SEC(".maps");
+
+struct
+{
+  __uint(type, BPF_MAP_TYPE_ARRAY);
+  __type(key, __u32);
+  __uint(value_size, A2S_STORE_CLASS_SIZE(1));
+  __uint(max_entries, 1024);
+  __uint(pinning, LIBBPF_PIN_BY_NAME);
+} a2s_store_512 SEC(".maps");
+
+struct
+{
+  __uint(type, BPF_MAP_TYPE_ARRAY);
+  __type(key, __u32);
+  __uint(value_size, A2S_STORE_CLASS_SIZE(2));
+  __uint(max_entries, 1024);
+  __uint(pinning, LIBBPF_PIN_BY_NAME);
+} a2s_store_1024 SEC(".maps");
+
+struct
+{
+  __uint(type, BPF_MAP_TYPE_ARRAY);
+  __type(key, __u32);
+  __uint(value_size, A2S_STORE_CLASS_SIZE(3));
+  __uint(max_entries, 1024);
+  __uint(pinning, LIBBPF_PIN_BY_NAME);
+} a2s_store_1400 SEC(".maps");
+
+/*
+ * Public -> private server key translation for servers behind DNAT.
+ * Queries arrive for the public IP:port, while the fetcher stores responses under the private IP:port it queried.
+*/
+struct
+{
+  __uint(type, BPF_MAP_TYPE_HASH);
+  __type(key, struct a2s_server_key);
+  __type(value, struct a2s_server_key);
+  __uint(max_entries, 1024);
+  __uint(pinning, LIBBPF_PIN_BY_NAME);
+} a2s_alias SEC(".maps");
+
+// Runtime settings from the loader (single entry at index 0)
+struct
+{
+  __uint(type, BPF_MAP_TYPE_ARRAY);
+  __type(key, __u32);
+  __type(value, struct a2s_settings);
+  __uint(max_entries, 1);
+  __uint(pinning, LIBBPF_PIN_BY_NAME);
+} a2s_settings SEC(".maps");
+
+/*
+ * Per source (IP or prefix) token buckets for each query type.
+ * LRU, so spoofed floods from random sources only evict the least recently seen sources.
+*/
+struct
+{
+  __uint(type, BPF_MAP_TYPE_LRU_PERCPU_HASH);
+  __type(key, __be32);
+  __type(value, struct a2s_src_limit);
+  __uint(max_entries, 65536);
+  __uint(pinning, LIBBPF_PIN_BY_NAME);
+} a2s_src_limit SEC(".maps");
+
+// Per server token bucket (global cap for all sources and CPUs, updated with atomics)
+struct
+{
+  __uint(type, BPF_MAP_TYPE_LRU_HASH);
+  __type(key, struct a2s_server_key);
+  __type(value, struct a2s_shared_bucket);
+  __uint(max_entries, 1024);
+  __uint(pinning, LIBBPF_PIN_BY_NAME);
+} a2s_srv_limit SEC(".maps");
+
+/*
+ * Per server query counters, only the entries created by the fetcher (one per server it queries) are counted,
+ * so queries to unknown ports don't add entries. Only updated when enabled in a2s_settings.
+*/
+struct
+{
+  __uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+  __type(key, struct a2s_server_key);
+  __type(value, struct a2s_srv_stats);
+  __uint(max_entries, 1024);
+  __uint(pinning, LIBBPF_PIN_BY_NAME);
+} a2s_srv_stats SEC(".maps");
+
+// Source prefixes dropped right after the UDP header parse
+struct
+{
+  __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+  __type(key, struct a2s_lpm_key);
+  __type(value, __u8);
+  __uint(map_flags, BPF_F_NO_PREALLOC);
+  __uint(max_entries, 16384);
+  __uint(pinning, LIBBPF_PIN_BY_NAME);
+} a2s_deny SEC(".maps");
+
+// Trusted source prefixes (e.g., game trackers), which skip the rate limits
+struct
+{
+  __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+  __type(key, struct a2s_lpm_key);
+  __type(value, __u8);
+  __uint(map_flags, BPF_F_NO_PREALLOC);
+  __uint(max_entries, 16384);
+  __uint(pinning, LIBBPF_PIN_BY_NAME);
+} a2s_allow SEC(".maps");
+
+// Cookie (challenge) keys generated and rotated by the loader (slot 0/1, current slot in a2s_cookie_state)
+struct
+{
+  __uint(type, BPF_MAP_TYPE_ARRAY);
+  __type(key, __u32);
+  __type(value, struct a2s_cookie_key);
+  __uint(max_entries, 2);
+  __uint(pinning, LIBBPF_PIN_BY_NAME);
+} a2s_cookie_keys SEC(".maps");
+
+// Current cookie key slot and grace deadline of the previous one (single entry, written field by field by the loader through mmap)
+struct
+{
+  __uint(type, BPF_MAP_TYPE_ARRAY);
+  __type(key, __u32);
+  __type(value, struct a2s_cookie_state);
+  __uint(max_entries, 1);
+  __uint(map_flags, BPF_F_MMAPABLE);
+  __uint(pinning, LIBBPF_PIN_BY_NAME);
+} a2s_cookie_state SEC(".maps");
+
+// Trace events of the handled queries, read by the loader (only sent when tracing is enabled in a2s_settings)
+struct
+{
+  __uint(type, BPF_MAP_TYPE_RINGBUF);
+  __uint(max_entries, A2S_TRACE_RINGBUF_SIZE);
+  __uint(pinning, LIBBPF_PIN_BY_NAME);
+} a2s_trace SEC(".maps");
+
+// Source prefixes to trace (all sources when empty)
+struct
+{
+  __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+  __type(key, struct a2s_lpm_key);
+  __type(value, __u8);
+  __uint(map_flags, BPF_F_NO_PREALLOC);
+  __uint(max_entries, 1024);
+  __uint(pinning, LIBBPF_PIN_BY_NAME);
+} a2s_trace_src SEC(".maps");
+
+// Servers to trace (all servers when empty)
+struct
+{
+  __uint(type, BPF_MAP_TYPE_HASH);
+  __type(key, struct a2s_server_key);
+  __type(value, __u8);
+  __uint(max_entries, A2S_TRACE_MAX_SERVERS);
+  __uint(pinning, LIBBPF_PIN_BY_NAME);
+} a2s_trace_srv SEC(".maps");
+
+// Processing latency histograms per query type and path (index qidx * A2S_LAT_PATHS + path), only filled when enabled in a2s_settings
+struct
+{
+  __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+  __type(key, __u32);
+  __type(value, struct a2s_latency);
+  __uint(max_entries, A2S_QUERY_TYPES * A2S_LAT_PATHS);
+  __uint(pinning, LIBBPF_PIN_BY_NAME);
+} a2s_latency SEC(".maps");
\ No newline at end of file
@@ -0,0 +1,135 @@
+#pragma once
+
+// Compare-and-swap attempts on a shared token bucket before it counts as empty
+#define A2S_BUCKET_RETRIES 4
+
+/**
+* Takes one token from a token bucket.
+*
+* Credit is accumulated time in nanoseconds, capped at burst * cost, one token costs 1e9 / rate nanoseconds.
+* A zeroed bucket (new entry, or another CPU's slot of a per-CPU entry) starts full.
+*
+* @param bucket Pointer to the token bucket state.
+* @param limit Pointer to the token bucket parameters.
+* @param now Current time in nanoseconds.
+*
+* @return true if a token was taken, false if the bucket is empty.
+**/
+static __always_inline bool bucket_take(struct a2s_bucket *bucket, const struct a2s_limit *limit, __u64 now)
+{
+  __u64 credit = bucket->credit + (now - bucket->last);
+
+  if (credit > limit->cap)
+  {
+    credit = limit->cap;
+  }
+
+  bucket->last = now;
+
+  if (credit < limit->cost)
+  {
+    bucket->credit = credit;
+    return false;
+  }
+
+  bucket->credit = credit - limit->cost;
+  return true;
+}
+
+/**
+* Takes one token from a token bucket shared by all CPUs.
+*
+* The arrival time of the next token moves forward by one cost per token, with compare-and-swap: a lost race
+* is retried with the new state, a bucket still contended after that counts as empty.
+*
+* @param bucket Pointer to the shared token bucket state.
+* @param limit Pointer to the token bucket parameters.
+* @param now Current time in nanoseconds.
+*
+* @return true if a token was taken, false if the bucket is empty.
+**/
+static __always_inline bool shared_bucket_take(struct a2s_shared_bucket *bucket, const struct a2s_limit *limit, __u64 now)
+{
+  for (int i = 0; i < A2S_BUCKET_RETRIES; i++)
+  {
+    __u64 tat = *(volatile __u64 *)&bucket->tat;
+    __u64 next = (tat > now ? tat : now) + limit->cost;
+
+    if (next - now > limit->cap)
+    {
+      return false;
+    }
+
+    if (__sync_val_compare_and_swap(&bucket->tat, tat, next) == tat)
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/**
+* Checks the per source (per query type) and per server rate limits.
+*
+* NOTE: The per source buckets are per-CPU, so a source spread over several RX queues gets the configured rate on each of them.
+* The per server buckets are shared by all CPUs.
+*
+* @param settings Pointer to the runtime settings.
+* @param key Pointer to the (resolved) server key.
+* @param saddr Source IP address of the query.
+* @param qidx Query type index (A2S_IDX_*).
+*
+* @return true if the query is within the limits, false if it should be dropped.
+**/
+static __always_inline bool ratelimit_check(struct a2s_settings *settings, struct a2s_server_key *key, __be32 saddr, __u32 qidx)
+{
+  if (qidx >= A2S_QUERY_TYPES)
+  {
+    return false;
+  }
+
+  __u64 now = bpf_ktime_get_ns();
+
+  if (settings->src_limit_enabled && settings->src_limit[qidx].cost)
+  {
+    __be32 src = saddr & settings->src_mask;
+    struct a2s_src_limit *limit = bpf_map_lookup_elem(&a2s_src_limit, &src);
+
+    if (limit)
+    {
+      if (!bucket_take(&limit->bucket[qidx], &settings->src_limit[qidx], now))
+      {
+        return false;
+      }
+    }
+    else
+    {
+      // New source, start from a full bucket
+      struct a2s_src_limit new_limit = {0};
+      bucket_take(&new_limit.bucket[qidx], &settings->src_limit[qidx], now);
+      bpf_map_update_elem(&a2s_src_limit, &src, &new_limit, BPF_ANY);
+    }
+  }
+
+  if (settings->srv_limit_enabled)
+  {
+    struct a2s_shared_bucket *bucket = bpf_map_lookup_elem(&a2s_srv_limit, key);
+
+    if (bucket)
+    {
+      if (!shared_bucket_take(bucket, &settings->srv_limit, now))
+      {
+        return false;
+      }
+    }
+    else
+    {
+      // New server, start from a full bucket (another CPU adding it at the same time keeps its own first token)
+      struct a2s_shared_bucket new_bucket = { now + settings->srv_limit.cost };
+      bpf_map_update_elem(&a2s_srv_limit, key, &new_bucket, BPF_NOEXIST);
+    }
+  }
+
+  return true;
+}
\ No newline at end of file
@@ -0,0 +1,25 @@
+#pragma once
+
+/**
+* Counts a query of a server (per CPU entry, no atomics needed), when the per server counters are enabled.
+* Servers without an entry (not queried by the fetcher) are not counted.
+*
+* @param settings Pointer to the runtime settings.
+* @param key Pointer to the (resolved) server key.
+* @param qidx Query type index (A2S_IDX_*).
+* @param counter Counter to increment (A2S_SRV_*).
+**/
+static __always_inline void srv_stats_count(struct a2s_settings *settings, struct a2s_server_key *key, __u32 qidx, __u32 counter)
+{
+  if (likely(!settings->srv_stats_enabled) || qidx >= A2S_QUERY_TYPES || counter >= A2S_SRV_COUNTERS)
+  {
+    return;
+  }
+
+  struct a2s_srv_stats *stats = bpf_map_lookup_elem(&a2s_srv_stats, key);
+
+  if (stats)
+  {
+    stats->count[counter][qidx]++;
+  }
+}
\ No newline at end of file
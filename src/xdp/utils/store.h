@@ -0,0 +1,55 @@
+#pragma once
+
+// Copies a response from one store class map, bounded by the class size so the verifier can check the reads
+#define STORE_COPY(map, cap, slot, size, payload, data_end) \
+  ({ \
+    __u32 __slot = (slot); \
+    __u8 *__blob = bpf_map_lookup_elem(&(map), &__slot); \
+    __u32 __len = (size) < (cap) ? (size) : (cap); \
+    \
+    if (!__blob) \
+    { \
+      __len = 0; \
+    } \
+    \
+    for (__u32 __i = 0; __i < __len; __i++) \
+    { \
+      if ((payload) + (__i + 1) > (data_end)) \
+      { \
+        break; \
+      } \
+      \
+      ((__u8 *)(payload))[__i] = __blob[__i]; \
+    } \
+    \
+    __len; \
+  })
+
+/**
+* Writes a cached response from the response store into the packet payload.
+*
+* @param ref Reference of the response (copied from the per server map).
+* @param payload Pointer to the start of the UDP payload.
+* @param data_end Pointer to the end of the packet.
+*
+* @return Number of bytes of the response, 0 if the reference is invalid.
+**/
+static __always_inline __u32 store_copy(const struct a2s_ref *ref, void *payload, void *data_end)
+{
+  switch (ref->cls)
+  {
+    case 0:
+    return STORE_COPY(a2s_store_256, A2S_STORE_CLASS_SIZE(0), ref->slot, ref->size, payload, data_end);
+
+    case 1:
+    return STORE_COPY(a2s_store_512, A2S_STORE_CLASS_SIZE(1), ref->slot, ref->size, payload, data_end);
+
+    case 2:
+    return STORE_COPY(a2s_store_1024, A2S_STORE_CLASS_SIZE(2), ref->slot, ref->size, payload, data_end);
+
+    case 3:
+    return STORE_COPY(a2s_store_1400, A2S_STORE_CLASS_SIZE(3), ref->slot, ref->size, payload, data_end);
+  }
+
+  return 0;
+}
\ No newline at end of file
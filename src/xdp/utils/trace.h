@@ -0,0 +1,95 @@
+#pragma once
+
+/**
+* Sends the trace event of a query to the loader through the a2s_trace ring buffer, when tracing is enabled
+* and the query passes the sampling and the source/server filters. Costs one load and branch when disabled.
+*
+* NOTE: The event is sent before the packet is rewritten, so it holds the headers and the payload of the query.
+*
+* @param ctx Pointer to the XDP context.
+* @param settings Pointer to the runtime settings.
+* @param iph Pointer to the IP header.
+* @param udph Pointer to the UDP header.
+* @param key Pointer to the (resolved) server key, NULL before it is known (destination address used).
+* @param query_type Query type byte (0 if not read yet).
+* @param decision Decision of the program (A2S_TRACE_*).
+* @param resp_size Size of the reply (0 if none).
+* @param cookie Cookie (challenge) sent or received (0 if none).
+* @param trusted Whether the source is in the allow list.
+**/
+static __always_inline void trace_query(struct xdp_md *ctx, struct a2s_settings *settings, struct iphdr *iph, struct udphdr *udph,
+struct a2s_server_key *key, __u8 query_type, __u8 decision, __u16 resp_size, __u32 cookie, bool trusted)
+{
+  if (likely(!settings->trace_enabled))
+  {
+    return;
+  }
+
+  // Sample 1 in trace_sample queries
+  if (settings->trace_sample > 1 && bpf_get_prandom_u32() % settings->trace_sample != 0)
+  {
+    return;
+  }
+
+  struct a2s_server_key dst = { .ip = iph->daddr, .port = udph->dest };
+
+  if (!key)
+  {
+    key = &dst;
+  }
+
+  // Both filters must match when both are set, an empty filter matches everything
+  if (settings->trace_sources)
+  {
+    struct a2s_lpm_key lpm_key = { .prefixlen = 32, .ip = iph->saddr };
+
+    if (!bpf_map_lookup_elem(&a2s_trace_src, &lpm_key))
+    {
+      return;
+    }
+  }
+
+  if (settings->trace_servers && !bpf_map_lookup_elem(&a2s_trace_srv, key))
+  {
+    return;
+  }
+
+  // Dropped when the loader doesn't keep up, the query is handled as usual
+  struct a2s_trace_event *ev = bpf_ringbuf_reserve(&a2s_trace, sizeof(*ev), 0);
+
+  if (!ev)
+  {
+    return;
+  }
+
+  ev->ts = bpf_ktime_get_ns();
+  ev->key = *key;
+  ev->saddr = iph->saddr;
+  ev->daddr = iph->daddr;
+  ev->sport = udph->source;
+  ev->dport = udph->dest;
+  ev->payload_len = ntohs(udph->len) - sizeof(struct udphdr);
+  ev->resp_size = resp_size;
+  ev->cookie = cookie;
+  ev->query_type = query_type;
+  ev->decision = decision;
+  ev->trusted = trusted;
+
+  // Copy the start of the query payload, bounded so the verifier can check the reads
+  void *data_end = (void *)(long)ctx->data_end;
+  __u8 *payload = (__u8 *)(udph + 1);
+  __u32 i;
+
+  for (i = 0; i < A2S_TRACE_PAYLOAD; i++)
+  {
+    if ((void *)(payload + i + 1) > data_end)
+    {
+      break;
+    }
+
+    ev->payload[i] = payload[i];
+  }
+
+  ev->captured = i;
+  bpf_ringbuf_submit(ev, 0);
+}
\ No newline at end of file
@@ -17,6 +17,11 @@
 #include "utils/swap.h"
 #include "utils/csum.h"
 #include "utils/cookie.h"
+#include "utils/ratelimit.h"
+#include "utils/store.h"
+#include "utils/trace.h"
+#include "utils/latency.h"
+#include "utils/srv_stats.h"
 
 struct
 {
@@ -70,6 +75,35 @@ int xdpa2scache_program(struct xdp_md *ctx)
     return XDP_DROP;
   }
 
+  // Get the runtime settings from the loader
+  __u32 settings_key = 0;
+  struct a2s_settings *settings = bpf_map_lookup_elem(&a2s_settings, &settings_key);
+
+  if (unlikely(!settings))
+  {
+    return XDP_PASS;
+  }
+
+  // Start of the processing time for the latency histograms (the header parse above is not included)
+  __u64 start_ns = settings->latency_enabled ? bpf_ktime_get_ns() : 0;
+
+  // Trusted sources (allow list) skip the rate limits
+  bool trusted = false;
+
+  // Check the source against the deny and allow prefix lists, only when they are not empty
+  if (settings->deny_enabled || settings->allow_enabled)
+  {
+    struct a2s_lpm_key lpm_key = { .prefixlen = 32, .ip = iph->saddr };
+
+    if (settings->deny_enabled && bpf_map_lookup_elem(&a2s_deny, &lpm_key))
+    {
+      trace_query(ctx, settings, iph, udph, NULL, 0, A2S_TRACE_DENIED, 0, 0, false);
+      return XDP_DROP;
+    }
+
+    trusted = settings->allow_enabled && bpf_map_lookup_elem(&a2s_allow, &lpm_key);
+  }
+
   // Pointer to the start of the UDP payload
   void *payload = (void *)(udph + 1);
 
@@ -83,14 +117,25 @@ int xdpa2scache_program(struct xdp_md *ctx)
     key.ip = iph->daddr;
     key.port = udph->dest;
 
+    // If the destination is a public (NAT'd) address, resolve it to the private server address the responses are stored under
+    struct a2s_server_key *alias = bpf_map_lookup_elem(&a2s_alias, &key);
+
+    if (alias)
+    {
+      key = *alias;
+    }
+
     // Read the query type from the 5th byte of the payload
     __u8 query_type = *((__u8 *)(payload + 4));
 
     // Calculate UDP payload length
     __u16 payload_len = ntohs(udph->len) - sizeof(struct udphdr);
 
-    // Pointer to hold the A2S response data retrieved from maps
-    struct a2s_val *val = NULL;
+    // Reference to the A2S response in the response store, retrieved from maps
+    struct a2s_ref *val = NULL;
+
+    // Index of the query type (A2S_IDX_*), stays A2S_QUERY_TYPES if the query is not valid
+    __u32 qidx = A2S_QUERY_TYPES;
 
     // Boolean to indicate whether the incoming A2S query is a challenge request
     bool is_challenge = false;
@@ -104,19 +149,12 @@ int xdpa2scache_program(struct xdp_md *ctx)
       if (payload_len == 25 || payload_len == 29)
       #endif
       {
-        // Lookup the A2S_INFO response in the map using the server key
-        val = bpf_map_lookup_elem(&a2s_info, &key);
+        qidx = A2S_IDX_INFO;
 
         // Determine if this is a challenge request based on payload length
         #ifndef A2S_NON_STEAM_SUPPORT
         is_challenge = (payload_len == 25);
         #endif
-
-        // A2S Debug: Log info query details, payload length, value size, and whether it's a challenge
-        #ifdef A2S_DEBUG
-        bpf_printk("A2S Debug: A2S_INFO: Payload Length: %u, Value Size: %u, Is Challenge: %s\n",
-        payload_len, val ? val->size : 0, is_challenge ? "true" : "false");
-        #endif
       }
       break;
 
@@ -124,10 +162,7 @@ int xdpa2scache_program(struct xdp_md *ctx)
       case A2S_RULES:
       if (payload_len == 9)
       {
-        // Lookup the A2S_PLAYER or A2S_RULES response in the map using the server key
-        val = (query_type == A2S_PLAYER)
-        ? bpf_map_lookup_elem(&a2s_player, &key)
-        : bpf_map_lookup_elem(&a2s_rules, &key);
+        qidx = (query_type == A2S_PLAYER) ? A2S_IDX_PLAYER : A2S_IDX_RULES;
 
         // Determine if this is a challenge request by checking 4 bytes (00000000) starting at the 6th byte of the payload
         #if defined A2S_NON_STEAM_SUPPORT || defined A2S_DUAL_CHALLENGE_SUPPORT
@@ -135,45 +170,63 @@ int xdpa2scache_program(struct xdp_md *ctx)
         #else
         is_challenge = (*(__u32 *)(payload + 5) == 0x00000000);
         #endif
-
-        // A2S Debug: Log player/rules query details, payload length, value size, and whether it's a challenge
-        #ifdef A2S_DEBUG
-        bpf_printk("A2S Debug: A2S_%s: Payload Length: %u, Value Size: %u, Is Challenge: %s\n",
-        (query_type == A2S_PLAYER) ? "PLAYER" : "RULES", payload_len, val ? val->size : 0, is_challenge ? "true" : "false");
-        #endif
       }
       break;
 
       // Return XDP_PASS by default, since we need to allow some other things for certain games starting with the same payload!
       // You can DROP here if there is nothing expected than the above A2S queries, starting with the same payload (FF FF FF FF)
       default:
-      // A2S Debug: Log unknown query type, so you can understand more easily what else is being used
-      #ifdef A2S_DEBUG
-      bpf_printk("A2S Debug: Unknown Query Type: 0x%02x, passing packet.\n", query_type);
-      #endif
+      // Traced, so you can understand more easily what else is being used
+      trace_query(ctx, settings, iph, udph, &key, query_type, A2S_TRACE_UNKNOWN, 0, 0, trusted);
       return XDP_PASS;
     }
 
+    // Invalid A2S query (unexpected payload length), drop the packet
+    if (qidx >= A2S_QUERY_TYPES)
+    {
+      trace_query(ctx, settings, iph, udph, &key, query_type, A2S_TRACE_INVALID, 0, 0, trusted);
+      return XDP_DROP;
+    }
+
+    // Rate limit per source and per server (except trusted sources) before doing any work for the query
+    if (!trusted && !ratelimit_check(settings, &key, iph->saddr, qidx))
+    {
+      trace_query(ctx, settings, iph, udph, &key, query_type, A2S_TRACE_RATELIMITED, 0, 0, trusted);
+      latency_record(start_ns, qidx, A2S_LAT_DROP);
+      return XDP_DROP;
+    }
+
+    // Lookup the response in the map of the query type using the server key
+    val = (qidx == A2S_IDX_INFO) ? bpf_map_lookup_elem(&a2s_info, &key)
+    : (qidx == A2S_IDX_PLAYER) ? bpf_map_lookup_elem(&a2s_player, &key)
+    : bpf_map_lookup_elem(&a2s_rules, &key);
+
     // If val is not found in the map, drop the packet
     if (!val)
     {
-      // A2S Debug: Log that no matching response was found for this key
-      #ifdef A2S_DEBUG
-      bpf_printk("A2S Debug: Value not found for key (IP: %pI4, Port: %d), dropping packet.\n", &key.ip, ntohs(key.port));
-      #endif
+      trace_query(ctx, settings, iph, udph, &key, query_type, A2S_TRACE_NOT_CACHED, 0, 0, trusted);
+      srv_stats_count(settings, &key, qidx, A2S_SRV_MISS);
+      latency_record(start_ns, qidx, A2S_LAT_DROP);
       return XDP_DROP;
     }
 
-    // A2S Debug: Log whether we are preparing a challenge or data response
-    #ifdef A2S_DEBUG
-    bpf_printk("A2S Debug: Preparing %s response.\n", is_challenge ? "cookie (challenge)" : "data");
-    #endif
+    // Copy the reference, the loader may replace the map entry while this packet is handled
+    struct a2s_ref ref = *val;
 
     // Check if it is challenge
     if (is_challenge)
     {
       // Create a cookie (challenge) based on the IP and UDP header
-      __u32 challenge = create_cookie(iph, udph);
+      __u32 challenge;
+
+      if (unlikely(!create_cookie(iph, udph, &challenge)))
+      {
+        trace_query(ctx, settings, iph, udph, &key, query_type, A2S_TRACE_ERROR, 0, 0, trusted);
+        return XDP_DROP;
+      }
+
+      // NOTE: Cookie (challenge) is in little endian
+      trace_query(ctx, settings, iph, udph, &key, query_type, A2S_TRACE_CHALLENGE, 9, challenge, trusted);
 
       // Prepare the response to send back
       __u8 response[] = {0xFF, 0xFF, 0xFF, 0xFF, 0x41, 0xFF, 0xFF, 0xFF, 0xFF};
@@ -183,13 +236,9 @@ int xdpa2scache_program(struct xdp_md *ctx)
       #ifndef A2S_NON_STEAM_SUPPORT
       if (query_type == A2S_INFO)
       {
+        // NOTE: The packet pointers are invalid after the tail adjustment, the failure is not traced
         if (bpf_xdp_adjust_tail(ctx, sizeof(response) - payload_len) != 0)
         {
-          // A2S Debug: Log a failure message when adjusting tail size fails
-          #ifdef A2S_DEBUG
-          bpf_printk("A2S Challenge: Failed to adjust tail size for response. Response size: %d bytes, Payload length: %d bytes, Adjustment required: %d bytes, dropping packet.\n",
-          sizeof(response), payload_len, sizeof(response) - payload_len);
-          #endif
           return XDP_DROP;
         }
 
@@ -218,10 +267,7 @@ int xdpa2scache_program(struct xdp_md *ctx)
         payload = (void *)(udph + 1);
         if (payload + 9 > data_end)
         {
-          // A2S Debug: Log insufficient space for payload when writing 9 byte response
-          #ifdef A2S_DEBUG
-          bpf_printk("A2S Challenge: Insufficient space for 9 byte payload (Available space: %ld bytes), dropping packet.\n", data_end - payload);
-          #endif
+          trace_query(ctx, settings, iph, udph, &key, query_type, A2S_TRACE_ERROR, sizeof(response), challenge, trusted);
           return XDP_DROP;
         }
       }
@@ -230,17 +276,6 @@ int xdpa2scache_program(struct xdp_md *ctx)
       // Write the response to the packet payload
       memcpy(payload, response, sizeof(response));
 
-      // A2S Debug: Log the crafted cookie (challenge) and the full 9 byte response
-      // NOTE: Cookie (challenge) is in little endian
-      #ifdef A2S_DEBUG
-      bpf_printk("A2S Challenge: Crafted cookie (challenge) 0x%x, Full Response: 0x%02x, 0x%02x, 0x%02x, 0x%02x, 0x%02x, 0x%02x, 0x%02x, 0x%02x, 0x%02x\n",
-      challenge, response[0], response[1], response[2], response[3], response[4], response[5], response[6], response[7], response[8]);
-
-      // A2S Debug: Log source and destination IPs and ports for the A2S challenge packet that we are sending
-      bpf_printk("Sending A2S Challenge: Source IP: %pI4, Source Port: %d, Destination IP: %pI4, Destination Port: %d\n",
-      &iph->daddr, ntohs(udph->dest), &iph->saddr, ntohs(udph->source));
-      #endif
-
       // Swap, calculate checksum, set TTL and reinitialize checksums for Ethernet, IP, and UDP headers
       swap_eth(eth);
       swap_ip(iph);
@@ -263,11 +298,16 @@ int xdpa2scache_program(struct xdp_md *ctx)
       iph->check = csum_diff4(old_len, iph->tot_len, iph->check);
       iph->check = csum_diff4(old_ttl, iph->ttl, iph->check);
 
+      srv_stats_count(settings, &key, qidx, A2S_SRV_CHALLENGE);
+      latency_record(start_ns, qidx, A2S_LAT_CHALLENGE);
       return XDP_TX;
     }
     // Else if it is not challenge, proceed with data processing
     else
     {
+      // Cookie (challenge) of the client, for the trace events
+      __u32 client_cookie = 0;
+
       // Get the location of the cookie (challenge)
       #ifdef A2S_NON_STEAM_SUPPORT
       if (query_type != A2S_INFO)
@@ -277,29 +317,19 @@ int xdpa2scache_program(struct xdp_md *ctx)
         // Make sure we dont go out of range of the packet
         if (unlikely(cookie + 1 > data_end))
         {
-          // A2S Debug: Log insufficient space for 1 byte cookie (challenge)
-          #ifdef A2S_DEBUG
-          bpf_printk("A2S Data: Insufficient space for 1 byte cookie (challenge) payload (Available space: %ld bytes), dropping packet.\n", data_end - payload);
-          #endif
+          trace_query(ctx, settings, iph, udph, &key, query_type, A2S_TRACE_INVALID, 0, 0, trusted);
           return XDP_DROP;
         }
 
         // Cookie (challenge) check: If the cookie is not valid, we will drop the packet
         if (!check_cookie(iph, udph, *cookie))
         {
-          // A2S Debug: Log that the cookie was invalid and that we are dropping the packet
-          // NOTE: Cookie (challenge) is in little endian
-          #ifdef A2S_DEBUG
-          bpf_printk("A2S Data: Cookie (challenge) is invalid - 0x%x, dropping packet.\n", *cookie);
-          #endif
+          trace_query(ctx, settings, iph, udph, &key, query_type, A2S_TRACE_BAD_COOKIE, 0, *cookie, trusted);
+          latency_record(start_ns, qidx, A2S_LAT_COOKIE_FAIL);
           return XDP_DROP;
         }
 
-        // A2S Debug: Log that the cookie (challenge) received is valid
-        // NOTE: Cookie (challenge) is in little endian
-        #ifdef A2S_DEBUG
-        bpf_printk("A2S Data: Cookie (challenge) is valid - 0x%x, proceeding with next steps.\n", *cookie);
-        #endif
+        client_cookie = *cookie;
       }
       #else
       __u32 *cookie = payload + (query_type == A2S_INFO ? 25 : 5);
@@ -307,39 +337,27 @@ int xdpa2scache_program(struct xdp_md *ctx)
       // Make sure we dont go out of range of the packet
       if (unlikely(cookie + 1 > data_end))
       {
-        // A2S Debug: Log insufficient space for 1 byte cookie (challenge)
-        #ifdef A2S_DEBUG
-        bpf_printk("A2S Data: Insufficient space for 1 byte cookie (challenge) payload (Available space: %ld bytes), dropping packet.\n", data_end - payload);
-        #endif
+        trace_query(ctx, settings, iph, udph, &key, query_type, A2S_TRACE_INVALID, 0, 0, trusted);
         return XDP_DROP;
       }
 
       // Cookie (challenge) check: If the cookie is not valid, we will drop the packet
       if (!check_cookie(iph, udph, *cookie))
       {
-        // A2S Debug: Log that the cookie was invalid and that we are dropping the packet
-        // NOTE: Cookie (challenge) is in little endian
-        #ifdef A2S_DEBUG
-        bpf_printk("A2S Data: Cookie (challenge) is invalid - 0x%x, dropping packet.\n", *cookie);
-        #endif
+        trace_query(ctx, settings, iph, udph, &key, query_type, A2S_TRACE_BAD_COOKIE, 0, *cookie, trusted);
+        latency_record(start_ns, qidx, A2S_LAT_COOKIE_FAIL);
         return XDP_DROP;
       }
 
-      // A2S Debug: Log that the cookie (challenge) received is valid
-      // NOTE: Cookie (challenge) is in little endian
-      #ifdef A2S_DEBUG
-      bpf_printk("A2S Data: Cookie (challenge) is valid - 0x%x, proceeding with next steps.\n", *cookie);
-      #endif
+      client_cookie = *cookie;
       #endif
 
+      // NOTE: Cookie (challenge) is in little endian, an A2S_TRACE_ERROR event follows if the reply can't be written
+      trace_query(ctx, settings, iph, udph, &key, query_type, A2S_TRACE_DATA, ref.size, client_cookie, trusted);
+
       // Resize packet to fit payload
-      if (bpf_xdp_adjust_tail(ctx, val->size - payload_len) != 0)
+      if (bpf_xdp_adjust_tail(ctx, ref.size - payload_len) != 0)
       {
-        // A2S Debug: Log a failure message when adjusting tail size fails
-        #ifdef A2S_DEBUG
-        bpf_printk("A2S Data: Failed to adjust tail size for response. Response size: %d bytes, Payload length: %d bytes, Adjustment required: %d bytes, dropping packet.\n",
-        val->size, payload_len, val->size - payload_len);
-        #endif
         return XDP_DROP;
       }
 
@@ -368,33 +386,19 @@ int xdpa2scache_program(struct xdp_md *ctx)
       payload = (void *)(udph + 1);
       if (unlikely(payload + 1 > data_end))
       {
-        // A2S Debug: Log insufficient space for 1 byte payload after tail adjustment
-        #ifdef A2S_DEBUG
-        bpf_printk("A2S Data: Insufficient space for 1 byte payload (Available space: %ld bytes), dropping packet.\n", data_end - payload);
-        #endif
+        trace_query(ctx, settings, iph, udph, &key, query_type, A2S_TRACE_ERROR, ref.size, client_cookie, trusted);
         return XDP_DROP;
       }
 
-      // Write the data into the payload we will send
-      __u32 val_data_size = val->size < sizeof(val->data) ? val->size : sizeof(val->data);
+      // Write the data from the response store into the payload we will send
+      __u32 val_data_size = store_copy(&ref, payload, data_end);
 
-      for (__u32 i = 0; i < val_data_size; i++)
+      if (unlikely(val_data_size == 0))
       {
-        if (payload + (i + 1) > data_end)
-        {
-          break;
-        }
-
-        ((__u8 *)payload)[i] = val->data[i];
+        trace_query(ctx, settings, iph, udph, &key, query_type, A2S_TRACE_ERROR, ref.size, client_cookie, trusted);
+        return XDP_DROP;
       }
 
-      // A2S Debug: Log the crafted payload size and packet source/destination information
-      #ifdef A2S_DEBUG
-      bpf_printk("A2S Data: Crafted %d bytes of data to send.\n", val_data_size);
-      bpf_printk("Sending A2S Data: Source IP: %pI4, Source Port: %d, Destination IP: %pI4, Destination Port: %d\n",
-      &iph->daddr, ntohs(udph->dest), &iph->saddr, ntohs(udph->source));
-      #endif
-
       // Swap, calculate checksum, set TTL and reinitialize checksums for Ethernet, IP, and UDP headers
       swap_eth(eth);
       swap_ip(iph);
@@ -417,6 +421,8 @@ int xdpa2scache_program(struct xdp_md *ctx)
       iph->check = csum_diff4(old_len, iph->tot_len, iph->check);
       iph->check = csum_diff4(old_ttl, iph->ttl, iph->check);
 
+      srv_stats_count(settings, &key, qidx, A2S_SRV_HIT);
+      latency_record(start_ns, qidx, A2S_LAT_DATA);
       return XDP_TX;
     }
   }